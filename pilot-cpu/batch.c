@@ -0,0 +1,167 @@
+#include "batch.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/*
+ * Workers sleep on work_cond until the generation counter moves, then claim systems one at a time off a shared index
+ * until there are none left. The calling thread claims systems alongside them, so a batch of one thread runs
+ * everything inline.
+ *
+ * Systems never share mutable state, so apart from the claim counter the workers don't touch any common cache lines
+ * while running.
+ */
+struct Pilot_batch
+{
+	pthread_t *threads;
+	int thread_count;
+
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	uint64_t generation;
+	int busy;
+	bool quit;
+
+	// Current job
+	Pilot_system **systems;
+	Pilot_run_status *status;
+	size_t count;
+	uint64_t cycles;
+	size_t next;
+};
+
+static void
+batch_work_ (Pilot_batch *batch)
+{
+	size_t i;
+	Pilot_run_status status;
+
+	while ((i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) < batch->count)
+	{
+		status = Pilot_run_cycles(batch->systems[i], batch->cycles);
+		if (batch->status)
+		{
+			batch->status[i] = status;
+		}
+	}
+}
+
+static void *
+batch_worker_ (void *arg)
+{
+	Pilot_batch *batch = arg;
+	uint64_t seen = 0;
+
+	pthread_mutex_lock(&batch->lock);
+	for (;;)
+	{
+		while (batch->generation == seen && !batch->quit)
+		{
+			pthread_cond_wait(&batch->work_cond, &batch->lock);
+		}
+		if (batch->quit)
+		{
+			break;
+		}
+		seen = batch->generation;
+		pthread_mutex_unlock(&batch->lock);
+
+		batch_work_(batch);
+
+		pthread_mutex_lock(&batch->lock);
+		if (--batch->busy == 0)
+		{
+			pthread_cond_signal(&batch->done_cond);
+		}
+	}
+	pthread_mutex_unlock(&batch->lock);
+	return NULL;
+}
+
+Pilot_batch *
+Pilot_batch_create (int threads)
+{
+	Pilot_batch *batch;
+
+	if (threads <= 0)
+	{
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = (cpus > 0) ? cpus : 1;
+	}
+
+	batch = calloc(1, sizeof(*batch));
+	if (!batch)
+	{
+		return NULL;
+	}
+	pthread_mutex_init(&batch->lock, NULL);
+	pthread_cond_init(&batch->work_cond, NULL);
+	pthread_cond_init(&batch->done_cond, NULL);
+
+	// The calling thread is one of the workers
+	batch->threads = calloc(threads, sizeof(*batch->threads));
+	if (!batch->threads)
+	{
+		Pilot_batch_destroy(batch);
+		return NULL;
+	}
+	for (batch->thread_count = 0; batch->thread_count < threads - 1; batch->thread_count++)
+	{
+		if (pthread_create(&batch->threads[batch->thread_count], NULL, batch_worker_, batch))
+		{
+			Pilot_batch_destroy(batch);
+			return NULL;
+		}
+	}
+	return batch;
+}
+
+void
+Pilot_batch_destroy (Pilot_batch *batch)
+{
+	int i;
+
+	if (!batch)
+	{
+		return;
+	}
+	pthread_mutex_lock(&batch->lock);
+	batch->quit = TRUE;
+	pthread_cond_broadcast(&batch->work_cond);
+	pthread_mutex_unlock(&batch->lock);
+
+	for (i = 0; i < batch->thread_count; i++)
+	{
+		pthread_join(batch->threads[i], NULL);
+	}
+	pthread_cond_destroy(&batch->done_cond);
+	pthread_cond_destroy(&batch->work_cond);
+	pthread_mutex_destroy(&batch->lock);
+	free(batch->threads);
+	free(batch);
+}
+
+void
+Pilot_batch_run_cycles (Pilot_batch *batch, Pilot_system **systems, size_t count, uint64_t n, Pilot_run_status *status)
+{
+	pthread_mutex_lock(&batch->lock);
+	batch->systems = systems;
+	batch->status = status;
+	batch->count = count;
+	batch->cycles = n;
+	batch->next = 0;
+	batch->busy = batch->thread_count;
+	batch->generation++;
+	pthread_cond_broadcast(&batch->work_cond);
+	pthread_mutex_unlock(&batch->lock);
+
+	batch_work_(batch);
+
+	pthread_mutex_lock(&batch->lock);
+	while (batch->busy)
+	{
+		pthread_cond_wait(&batch->done_cond, &batch->lock);
+	}
+	pthread_mutex_unlock(&batch->lock);
+}
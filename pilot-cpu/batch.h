@@ -0,0 +1,21 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "pilot.h"
+#include "system.h"
+
+// A pool of worker threads for stepping many independent systems at once
+typedef struct Pilot_batch Pilot_batch;
+
+// threads counts the calling thread too; 0 picks one per online CPU. Returns NULL if the threads can't be started.
+Pilot_batch *Pilot_batch_create (int threads);
+void Pilot_batch_destroy (Pilot_batch *batch);
+
+// Runs n cycles on each of the count systems, spread across the pool, and blocks until all of them have returned.
+// If status isn't NULL, status[i] gets the result of Pilot_run_cycles for systems[i].
+// A system must not appear twice, and the batch must not be run from more than one thread at a time.
+void Pilot_batch_run_cycles (Pilot_batch *batch, Pilot_system **systems, size_t count, uint64_t n, Pilot_run_status *status);
+
+#endif
@@ -0,0 +1,192 @@
+#include "block_cache.h"
+#include "cpu_decode.h"
+#include "cpu_jit.h"
+#include "memory.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Blocks are decoded straight out of host memory, so only pages with a direct read pointer are cached; anything
+ * behind a handler could have side effects or change under us. A block never crosses a page boundary, which keeps
+ * invalidation down to one generation counter per page.
+ *
+ * The instruction-level engines run from it (the interpreter directly, the JIT and AOT engines by translating it); the
+ * pipeline decodes from the template table every time, since a block would give it the same signals for more work.
+ *
+ * Decoding a block marks its page PILOT_PAGE_CODE. The first write to (or remap of) a marked page bumps its
+ * generation, which makes every block decoded from it stale at once, and clears the mark so further writes go back
+ * to full speed until a block is decoded there again.
+ */
+#define BLOCK_SLOT_(cache, pgc) ((((pgc) >> 1) ^ ((pgc) >> 11)) & (cache)->block_mask)
+
+bool
+Pilot_block_cache_enable (Pilot_system *sys, uint32_t blocks)
+{
+	pilot_block_cache *cache;
+
+	if (!blocks || (blocks & (blocks - 1)))
+	{
+		return FALSE;
+	}
+	Pilot_block_cache_disable(sys);
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache)
+	{
+		return FALSE;
+	}
+	cache->blocks = malloc(blocks * sizeof(*cache->blocks));
+	if (!cache->blocks)
+	{
+		free(cache);
+		return FALSE;
+	}
+	cache->block_mask = blocks - 1;
+	sys->block_cache = cache;
+	Pilot_block_cache_flush(sys);
+	return TRUE;
+}
+
+void
+Pilot_block_cache_disable (Pilot_system *sys)
+{
+	uint32_t page;
+
+	if (!sys->block_cache)
+	{
+		return;
+	}
+	// Writes to code pages stop being reported, so translations can't be trusted once the cache is back
+	Pilot_jit_flush(sys);
+	for (page = 0; page < PILOT_MEM_PAGES; page++)
+	{
+		sys->mem_pages[page].flags &= ~PILOT_PAGE_CODE;
+	}
+	free(sys->block_cache->blocks);
+	free(sys->block_cache);
+	sys->block_cache = NULL;
+	sys->interp.block = NULL;
+}
+
+void
+Pilot_block_cache_flush (Pilot_system *sys)
+{
+	pilot_block_cache *cache = sys->block_cache;
+	uint32_t i;
+
+	if (!cache)
+	{
+		return;
+	}
+	for (i = 0; i <= cache->block_mask; i++)
+	{
+		cache->blocks[i].pgc = PILOT_BLOCK_EMPTY;
+	}
+	sys->interp.block = NULL;
+}
+
+Pilot_block_cache_stats
+Pilot_block_cache_get_stats (const Pilot_system *sys)
+{
+	if (!sys->block_cache)
+	{
+		return (Pilot_block_cache_stats) { 0 };
+	}
+	return sys->block_cache->stats;
+}
+
+void
+pilot_block_cache_page_written (Pilot_system *sys, uint32_t page)
+{
+	sys->mem_pages[page].flags &= ~PILOT_PAGE_CODE;
+	if (sys->block_cache)
+	{
+		sys->block_cache->page_gen[page]++;
+		sys->block_cache->stats.invalidations++;
+	}
+}
+
+// Ends a block after anything that changes the flow of control
+static inline bool
+block_ends_after_ (uint16_t opcode, const decode_template *t)
+{
+	// Branch instructions
+	if ((opcode & 0xf000) >= 0xe000)
+	{
+		return TRUE;
+	}
+	return ECW_GET(t->core_op, DEST) == DATA_REG_PGC;
+}
+
+static bool
+block_decode_ (Pilot_system *sys, pilot_block *block, uint32_t pgc)
+{
+	uint32_t page = pgc >> PILOT_MEM_PAGE_SHIFT;
+	const uint8_t *host = sys->mem_pages[page].read;
+	uint32_t offset = pgc & PILOT_MEM_PAGE_MASK;
+	uint32_t i;
+
+	block->inst_count = 0;
+	while (block->inst_count < PILOT_BLOCK_MAX_INSTS)
+	{
+		inst_decoded_flags *inst = &block->insts[block->inst_count];
+		uint16_t opcode = host[offset] | (host[offset + 1] << 8);
+		const decode_template *t = pilot_decode_template(opcode);
+		uint32_t words = 1 + t->extra_words;
+
+		// Invalid and unimplemented opcodes are left to the pipeline to report, and instructions running past the
+		// end of the page to the pipeline to fetch
+		if (t->status != DECODE_OK || offset + words * 2 > PILOT_MEM_PAGE_SIZE)
+		{
+			break;
+		}
+
+		memset(inst, 0, sizeof(*inst));
+		pilot_decode_latch_template(inst, t);
+		for (i = 0; i < words; i++)
+		{
+			inst->imm_words[i] = host[offset + i * 2] | (host[offset + i * 2 + 1] << 8);
+		}
+		inst->inst_pgc = (page << PILOT_MEM_PAGE_SHIFT) | offset;
+		block->inst_words[block->inst_count++] = words;
+		offset += words * 2;
+
+		if (block_ends_after_(opcode, t) || offset >= PILOT_MEM_PAGE_SIZE)
+		{
+			break;
+		}
+	}
+
+	if (!block->inst_count)
+	{
+		block->pgc = PILOT_BLOCK_EMPTY;
+		return FALSE;
+	}
+	block->pgc = pgc;
+	block->gen = sys->block_cache->page_gen[page];
+	pilot_mem_flag_page(sys, page, PILOT_PAGE_CODE);
+	return TRUE;
+}
+
+const pilot_block *
+pilot_block_lookup (Pilot_system *sys, uint32_t pgc)
+{
+	pilot_block_cache *cache = sys->block_cache;
+	pilot_block *block;
+
+	pgc &= 0xfffffe;
+	block = &cache->blocks[BLOCK_SLOT_(cache, pgc)];
+	if (block->pgc == pgc && pilot_block_valid(sys, block))
+	{
+		cache->stats.hits++;
+		return block;
+	}
+
+	if (!sys->mem_pages[pgc >> PILOT_MEM_PAGE_SHIFT].read || !block_decode_(sys, block, pgc))
+	{
+		cache->stats.uncacheable++;
+		return NULL;
+	}
+	cache->stats.misses++;
+	return block;
+}
@@ -0,0 +1,61 @@
+#ifndef __BLOCK_CACHE_H__
+#define __BLOCK_CACHE_H__
+
+#include <stdint.h>
+#include "types.h"
+#include "pilot.h"
+
+#define PILOT_BLOCK_MAX_INSTS 16
+#define PILOT_BLOCK_EMPTY     UINT32_MAX
+
+// A run of straight-line instructions within one memory page, decoded up front
+typedef struct pilot_block
+{
+	// Address of the first opcode word, or PILOT_BLOCK_EMPTY
+	uint32_t pgc;
+	// Code generation of the page when the block was decoded; the block is stale once they differ
+	uint32_t gen;
+	uint8_t inst_count;
+	// Length of each instruction in words, opcode word included
+	uint8_t inst_words[PILOT_BLOCK_MAX_INSTS];
+	inst_decoded_flags insts[PILOT_BLOCK_MAX_INSTS];
+} pilot_block;
+
+typedef struct
+{
+	uint64_t hits;
+	uint64_t misses;
+	// Lookups at addresses that can't be cached, e.g. pages behind a memory handler
+	uint64_t uncacheable;
+	// Writes to pages holding cached blocks
+	uint64_t invalidations;
+} Pilot_block_cache_stats;
+
+typedef struct pilot_block_cache
+{
+	// Direct mapped by PGC
+	pilot_block *blocks;
+	uint32_t block_mask;
+	uint32_t page_gen[PILOT_MEM_PAGES];
+	Pilot_block_cache_stats stats;
+} pilot_block_cache;
+
+// Allocates a cache of the given number of blocks, which must be a power of two. Returns FALSE if out of memory.
+bool Pilot_block_cache_enable (Pilot_system *sys, uint32_t blocks);
+void Pilot_block_cache_disable (Pilot_system *sys);
+void Pilot_block_cache_flush (Pilot_system *sys);
+Pilot_block_cache_stats Pilot_block_cache_get_stats (const Pilot_system *sys);
+
+// Returns the block starting at pgc, decoding it first if needed, or NULL if pgc isn't cacheable
+const pilot_block *pilot_block_lookup (Pilot_system *sys, uint32_t pgc);
+
+// Called by the bus on writes to, or remaps of, a page marked PILOT_PAGE_CODE
+void pilot_block_cache_page_written (Pilot_system *sys, uint32_t page);
+
+static inline bool
+pilot_block_valid (const Pilot_system *sys, const pilot_block *block)
+{
+	return block->gen == sys->block_cache->page_gen[block->pgc >> PILOT_MEM_PAGE_SHIFT];
+}
+
+#endif
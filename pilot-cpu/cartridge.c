@@ -0,0 +1,96 @@
+#include "cartridge.h"
+#include "memory.h"
+#include "cpu_aot.h"
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * The ROM image is mmap'd read-only and private, and its pages are put straight into the bus page table.
+ * 
+ * - Loading is constant time regardless of image size; nothing is copied.
+ * - Banks that are never touched are never read from disk and don't count towards RSS.
+ * - Processes running the same image share the physical pages through the host's page cache.
+ * 
+ * Bus pages are 1 KiB and host pages are a multiple of that, so a bus page never straddles the end of the mapping;
+ * the tail of the last host page past the end of the file reads as zero.
+ */
+bool
+Pilot_cart_load (Pilot_system *sys, const char *path)
+{
+	struct stat st;
+	void *map;
+	int fd;
+
+	Pilot_cart_unload(sys);
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		return FALSE;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size == 0)
+	{
+		close(fd);
+		return FALSE;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// The mapping holds its own reference to the file
+	close(fd);
+	if (map == MAP_FAILED)
+	{
+		return FALSE;
+	}
+
+	sys->cart.rom = map;
+	sys->cart.rom_size = st.st_size;
+	sys->cart.map_size = st.st_size;
+
+	Pilot_cart_map_bank(sys, CART_ROM_START, CART_ROM_END, 0);
+	return TRUE;
+}
+
+void
+Pilot_cart_unload (Pilot_system *sys)
+{
+	if (!sys->cart.rom)
+	{
+		return;
+	}
+
+	// Precompiled code belongs to the image
+	Pilot_aot_unload(sys);
+	Pilot_mem_map_handler(sys, CART_ROM_START, CART_ROM_END, MEM_HANDLER_CART_ROM, 0);
+	// Clones share the mapping; the last one out unmaps it
+	if (!sys->cart.users || __atomic_sub_fetch(sys->cart.users, 1, __ATOMIC_ACQ_REL) == 0)
+	{
+		munmap(sys->cart.rom, sys->cart.map_size);
+		free(sys->cart.users);
+	}
+	sys->cart.users = NULL;
+	sys->cart.rom = NULL;
+	sys->cart.rom_size = 0;
+	sys->cart.map_size = 0;
+}
+
+void
+Pilot_cart_map_bank (Pilot_system *sys, uint32_t start, uint32_t end, size_t rom_offset)
+{
+	size_t available;
+	Pilot_mem_map_handler(sys, start, end, MEM_HANDLER_CART_ROM, 0);
+	if (rom_offset >= sys->cart.rom_size)
+	{
+		return;
+	}
+
+	// Round what's left of the image up to a whole bus page
+	available = (sys->cart.rom_size - rom_offset + PILOT_MEM_PAGE_MASK) & ~(size_t)PILOT_MEM_PAGE_MASK;
+	if (available < (size_t)end - start + 1)
+	{
+		end = start + available - 1;
+	}
+	Pilot_mem_map_direct(sys, start, end, sys->cart.rom + rom_offset, NULL, 0);
+}
@@ -0,0 +1,18 @@
+#ifndef __CARTRIDGE_H__
+#define __CARTRIDGE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "pilot.h"
+
+// Maps a ROM image file into the cartridge ROM range. Returns FALSE if the file couldn't be opened or mapped.
+bool Pilot_cart_load (Pilot_system *sys, const char *path);
+// Also unloads any precompiled code for the image; see cpu_aot.h
+void Pilot_cart_unload (Pilot_system *sys);
+
+// Points the bus range [start, end] at the ROM image starting at rom_offset, for bank switching mappers.
+// start and rom_offset must be aligned to PILOT_MEM_PAGE_SIZE.
+// Parts of the range past the end of the image are left to the cartridge handlers.
+void Pilot_cart_map_bank (Pilot_system *sys, uint32_t start, uint32_t end, size_t rom_offset);
+
+#endif
@@ -0,0 +1,416 @@
+#include "clone.h"
+#include "memory.h"
+#include "savestate.h"
+#include "rewind.h"
+#include "replay.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define COW_RAM_SIZE_ (sizeof(Pilot_system) - offsetof(Pilot_system, wram))
+
+static void
+cow_block_unref_ (pilot_cow_block *block)
+{
+	if (__atomic_sub_fetch(&block->refs, 1, __ATOMIC_ACQ_REL) == 0)
+	{
+		free(block);
+	}
+}
+
+// Whether [ptr, ptr + size) overlaps the system's RAM
+static bool
+cow_in_ram_ (const Pilot_system *sys, const uint8_t *ptr, size_t size)
+{
+	uintptr_t start = (uintptr_t)sys->wram;
+	return ptr && (uintptr_t)ptr < start + COW_RAM_SIZE_ && (uintptr_t)ptr + size > start;
+}
+
+/*
+ * Finds the pages mapped onto RAM, sorted by where they land in it, and the spans in between. Only done while no page
+ * is shared, which keeps it off the path of cloning the same map over and over.
+ */
+static void
+cow_scan_map_ (Pilot_system *sys, pilot_cow *cow)
+{
+	uint32_t page;
+	uint32_t end = 0;
+	int i, j;
+
+	cow->page_count = 0;
+	cow->shareable = TRUE;
+	for (page = 0; page < PILOT_MEM_PAGES; page++)
+	{
+		const Pilot_mem_page *p = &sys->mem_pages[page];
+		uint32_t offset;
+
+		if (!cow_in_ram_(sys, p->read, PILOT_MEM_PAGE_SIZE) && !cow_in_ram_(sys, p->write, PILOT_MEM_PAGE_SIZE))
+		{
+			continue;
+		}
+		offset = (uint32_t)(p->write - sys->wram);
+		if (p->read != p->write || p->write < sys->wram || offset + PILOT_MEM_PAGE_SIZE > COW_RAM_SIZE_
+			|| cow->page_count == PILOT_COW_PAGES_MAX)
+		{
+			cow->shareable = FALSE;
+			break;
+		}
+		// Insertion sort; there are a few dozen of them
+		for (i = cow->page_count; i > 0 && cow->offsets[i - 1] > offset; i--)
+		{
+			cow->pages[i] = cow->pages[i - 1];
+			cow->offsets[i] = cow->offsets[i - 1];
+		}
+		cow->pages[i] = page;
+		cow->offsets[i] = offset;
+		cow->page_count++;
+	}
+
+	cow->gap_count = 0;
+	for (j = 0; cow->shareable && j <= cow->page_count; j++)
+	{
+		uint32_t next = (j < cow->page_count) ? cow->offsets[j] : COW_RAM_SIZE_;
+		if (next < end)
+		{
+			// Mirrors
+			cow->shareable = FALSE;
+		}
+		else if (next > end)
+		{
+			cow->gap_offsets[cow->gap_count] = end;
+			cow->gap_sizes[cow->gap_count++] = next - end;
+		}
+		end = next + PILOT_MEM_PAGE_SIZE;
+	}
+	if (!cow->shareable)
+	{
+		cow->page_count = 0;
+	}
+	cow->map_scanned = TRUE;
+}
+
+static pilot_cow *
+cow_get_ (Pilot_system *sys)
+{
+	if (!sys->cow)
+	{
+		sys->cow = calloc(1, sizeof(*sys->cow));
+	}
+	return sys->cow;
+}
+
+// Points a shared page back at the system's own RAM
+static void
+cow_unshare_page_ (Pilot_system *sys, pilot_cow *cow, int i, bool copy)
+{
+	pilot_cow_block *block = cow->blocks[i];
+	uint32_t page = cow->pages[i];
+	Pilot_mem_page *p = &sys->mem_pages[page];
+	uint8_t *own = sys->wram + cow->offsets[i];
+
+	if (cow->stale[i] && copy)
+	{
+		memcpy(own, block->data, PILOT_MEM_PAGE_SIZE);
+		cow->pages_copied++;
+	}
+	// A read the memory controller took straight from the block
+	if (sys->memctl.direct_ptr >= block->data && sys->memctl.direct_ptr < block->data + PILOT_MEM_PAGE_SIZE)
+	{
+		sys->memctl.direct_ptr = own + (sys->memctl.direct_ptr - block->data);
+	}
+	p->read = own;
+	p->write = own;
+	p->flags &= ~PILOT_PAGE_COW;
+	// As for any remap
+	sys->dirty_pages[page >> 5] |= 1u << (page & 31);
+
+	cow->blocks[i] = NULL;
+	cow->stale[i] = FALSE;
+	cow_block_unref_(block);
+}
+
+// Moves every page the system doesn't share yet into a block of its own, shared from then on. Returns FALSE if RAM
+// can't be shared, or out of memory.
+static bool
+cow_freeze_ (Pilot_system *sys)
+{
+	pilot_cow *cow = cow_get_(sys);
+	int i;
+
+	if (!cow)
+	{
+		return FALSE;
+	}
+	if (!cow->map_scanned)
+	{
+		cow_scan_map_(sys, cow);
+	}
+	if (!cow->shareable)
+	{
+		return FALSE;
+	}
+	for (i = 0; i < cow->page_count; i++)
+	{
+		Pilot_mem_page *p = &sys->mem_pages[cow->pages[i]];
+		pilot_cow_block *block;
+
+		if (cow->blocks[i])
+		{
+			continue;
+		}
+		block = malloc(sizeof(*block));
+		if (!block)
+		{
+			return FALSE;
+		}
+		block->refs = 1;
+		memcpy(block->data, sys->wram + cow->offsets[i], PILOT_MEM_PAGE_SIZE);
+		cow->blocks[i] = block;
+		// The system's own copy is the one the block was made from
+		cow->stale[i] = FALSE;
+		p->read = block->data;
+		p->write = NULL;
+		pilot_mem_flag_page(sys, cow->pages[i], PILOT_PAGE_COW);
+	}
+	return TRUE;
+}
+
+bool
+Pilot_system_clone_into (Pilot_system *dst, Pilot_system *parent)
+{
+	uint64_t cpu[(pilot_savestate_cpu_size() + 7) / 8];
+	pilot_cow *from;
+	pilot_cow *to;
+	int i;
+
+	if (dst == parent)
+	{
+		return TRUE;
+	}
+	if (!cow_get_(dst))
+	{
+		return FALSE;
+	}
+	if (!cow_freeze_(parent) && (!parent->cow || parent->cow->shareable))
+	{
+		return FALSE;
+	}
+	from = parent->cow;
+	to = dst->cow;
+
+	Pilot_rewind_disable(dst);
+	Pilot_replay_stop(dst);
+	// Everything dst has is about to be replaced
+	pilot_cow_unshare(dst, FALSE);
+	pilot_mem_ram_replaced(dst);
+
+	if (from->shareable)
+	{
+		uint64_t pages_copied = to->pages_copied;
+
+		*to = *from;
+		to->pages_copied = pages_copied;
+		for (i = 0; i < to->page_count; i++)
+		{
+			Pilot_mem_page *p = &dst->mem_pages[to->pages[i]];
+
+			__atomic_add_fetch(&to->blocks[i]->refs, 1, __ATOMIC_RELAXED);
+			to->stale[i] = TRUE;
+			p->read = to->blocks[i]->data;
+			p->write = NULL;
+			pilot_mem_flag_page(dst, to->pages[i], PILOT_PAGE_COW);
+		}
+		for (i = 0; i < to->gap_count; i++)
+		{
+			memcpy(dst->wram + to->gap_offsets[i], parent->wram + to->gap_offsets[i], to->gap_sizes[i]);
+		}
+	}
+	else
+	{
+		// Nothing of the parent's is shared, so its own RAM is up to date
+		memcpy(dst->wram, parent->wram, COW_RAM_SIZE_);
+		to->map_scanned = FALSE;
+	}
+
+	pilot_savestate_save_cpu(parent, cpu);
+	pilot_savestate_load_cpu(dst, cpu);
+	return TRUE;
+}
+
+Pilot_system *
+Pilot_system_clone (Pilot_system *parent)
+{
+	Pilot_system *sys;
+	uint32_t page;
+	int i;
+
+	// Freezing first has the parent's RAM pages found, which the clone's map starts from
+	if (!cow_freeze_(parent) && (!parent->cow || parent->cow->shareable))
+	{
+		return NULL;
+	}
+	sys = malloc(sizeof(*sys));
+	if (!sys)
+	{
+		return NULL;
+	}
+
+	// The memory map, handlers and host settings are the parent's. The run state is copied again, properly, by
+	// Pilot_system_clone_into.
+	memcpy(sys, parent, offsetof(Pilot_system, wram));
+	memset(sys->dirty_pages, 0, sizeof(sys->dirty_pages));
+	sys->block_cache = NULL;
+	sys->jit = NULL;
+	sys->aot = NULL;
+	sys->rewind = NULL;
+	sys->replay = NULL;
+	sys->cow = NULL;
+	sys->memctl.direct_ptr = NULL;
+	if (parent->cow->shareable)
+	{
+		for (i = 0; i < parent->cow->page_count; i++)
+		{
+			Pilot_mem_page *p = &sys->mem_pages[parent->cow->pages[i]];
+			p->read = sys->wram + parent->cow->offsets[i];
+			p->write = p->read;
+			p->flags &= ~PILOT_PAGE_COW;
+		}
+	}
+	else
+	{
+		for (page = 0; page < PILOT_MEM_PAGES; page++)
+		{
+			Pilot_mem_page *p = &sys->mem_pages[page];
+			if (cow_in_ram_(parent, p->read, 1))
+			{
+				p->read = sys->wram + (p->read - parent->wram);
+			}
+			if (cow_in_ram_(parent, p->write, 1))
+			{
+				p->write = sys->wram + (p->write - parent->wram);
+			}
+		}
+	}
+
+	if (!Pilot_system_clone_into(sys, parent))
+	{
+		free(sys->cow);
+		free(sys);
+		return NULL;
+	}
+	if (sys->cart.rom)
+	{
+		if (!parent->cart.users)
+		{
+			parent->cart.users = malloc(sizeof(*parent->cart.users));
+			if (!parent->cart.users)
+			{
+				pilot_cow_release(sys);
+				free(sys);
+				return NULL;
+			}
+			*parent->cart.users = 1;
+		}
+		sys->cart.users = parent->cart.users;
+		__atomic_add_fetch(sys->cart.users, 1, __ATOMIC_RELAXED);
+	}
+	return sys;
+}
+
+uint32_t
+Pilot_system_shared_pages (const Pilot_system *sys)
+{
+	uint32_t count = 0;
+	int i;
+
+	if (!sys->cow)
+	{
+		return 0;
+	}
+	for (i = 0; i < sys->cow->page_count; i++)
+	{
+		count += (sys->cow->blocks[i] != NULL);
+	}
+	return count;
+}
+
+void
+pilot_cow_page_written (Pilot_system *sys, uint32_t page)
+{
+	pilot_cow *cow = sys->cow;
+	int i;
+
+	for (i = 0; cow && i < cow->page_count; i++)
+	{
+		if (cow->pages[i] == page && cow->blocks[i])
+		{
+			cow_unshare_page_(sys, cow, i, TRUE);
+			return;
+		}
+	}
+}
+
+void
+pilot_cow_remapped (Pilot_system *sys, uint32_t start, uint32_t end, const uint8_t *read, const uint8_t *write)
+{
+	pilot_cow *cow = sys->cow;
+	size_t size = (size_t)end - start + 1;
+	int i;
+
+	if (!cow || !cow->map_scanned)
+	{
+		return;
+	}
+	for (i = 0; i < cow->page_count; i++)
+	{
+		uint32_t addr = cow->pages[i] << PILOT_MEM_PAGE_SHIFT;
+		if (addr >= start && addr <= end)
+		{
+			break;
+		}
+	}
+	// Bank switching ROM in and out doesn't touch RAM, and is left alone
+	if (i == cow->page_count && !cow_in_ram_(sys, read, size) && !cow_in_ram_(sys, write, size))
+	{
+		return;
+	}
+	pilot_cow_unshare(sys, TRUE);
+	cow->map_scanned = FALSE;
+}
+
+void
+pilot_cow_unshare (Pilot_system *sys, bool copy)
+{
+	pilot_cow *cow = sys->cow;
+	int i;
+
+	for (i = 0; cow && i < cow->page_count; i++)
+	{
+		if (cow->blocks[i])
+		{
+			cow_unshare_page_(sys, cow, i, copy);
+		}
+	}
+}
+
+void
+pilot_cow_copy_shared (const Pilot_system *sys, uint8_t *ram)
+{
+	const pilot_cow *cow = sys->cow;
+	int i;
+
+	for (i = 0; cow && i < cow->page_count; i++)
+	{
+		if (cow->blocks[i] && cow->stale[i])
+		{
+			memcpy(ram + cow->offsets[i], cow->blocks[i]->data, PILOT_MEM_PAGE_SIZE);
+		}
+	}
+}
+
+void
+pilot_cow_release (Pilot_system *sys)
+{
+	pilot_cow_unshare(sys, FALSE);
+	free(sys->cow);
+	sys->cow = NULL;
+}
@@ -0,0 +1,78 @@
+#ifndef __CLONE_H__
+#define __CLONE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "types.h"
+#include "pilot.h"
+
+/*
+ * Cloning
+ *
+ * A clone starts out in the same state as the system it was cloned from, pipeline mid-instruction phases included,
+ * and from then on runs on its own. RAM isn't copied: cloning freezes each of the parent's RAM pages into a
+ * reference counted block, which the parent and every clone read from until their first write to the page through
+ * the bus copies it back into their own RAM. The cartridge's ROM mapping is shared as it is.
+ *
+ * Cloning a parent that hasn't written to a page since it was last cloned reuses the page's block, so branching one
+ * state into many copies the CPU part of a savestate (about a kilobyte) per clone and no RAM at all.
+ * Pilot_system_clone_into does it into an existing system, which is what makes it cheap; Pilot_system_clone also
+ * has to allocate one and copy the parent's memory map. Blocks are immutable and their counts atomic, so clones can
+ * run on different threads, e.g. in a batch; a parent mustn't run while it's being cloned.
+ *
+ * Clones start without a block cache, JIT, AOT object, rewind buffer or input recording; they're the host's to
+ * enable. Sharing needs every byte of RAM to be mapped by one bus page at most, through a read-write page; with
+ * mirrors or read-only mappings of RAM, cloning copies all of it instead.
+ */
+#define PILOT_COW_PAGES_MAX 96
+
+typedef struct pilot_cow_block
+{
+	uint32_t refs;
+	uint8_t data[PILOT_MEM_PAGE_SIZE];
+} pilot_cow_block;
+
+typedef struct pilot_cow
+{
+	// Whether pages[] is up to date with the memory map; remaps of RAM clear it
+	bool map_scanned;
+	// Whether RAM is mapped in a way that can be shared
+	bool shareable;
+	// The bus pages mapped onto the system's RAM, by the offset of their memory from sys->wram
+	uint16_t page_count;
+	uint32_t pages[PILOT_COW_PAGES_MAX];
+	uint32_t offsets[PILOT_COW_PAGES_MAX];
+	// The block each of those pages reads from while it's shared, or NULL
+	pilot_cow_block *blocks[PILOT_COW_PAGES_MAX];
+	// Whether the system's own copy of a shared page is out of date, as it is for clones
+	bool stale[PILOT_COW_PAGES_MAX];
+	// Spans of RAM no page maps (e.g. OAM and HCIO, behind a handler), which cloning copies
+	uint16_t gap_count;
+	uint32_t gap_offsets[PILOT_COW_PAGES_MAX + 1];
+	uint32_t gap_sizes[PILOT_COW_PAGES_MAX + 1];
+	// Pages copied back on their first write
+	uint64_t pages_copied;
+} pilot_cow;
+
+// Allocates a system in the same state as parent, sharing its RAM and memory map. Returns NULL if out of memory.
+Pilot_system *Pilot_system_clone (Pilot_system *parent);
+// Puts dst in the same state as parent, sharing its RAM. dst has to have the same memory map and cartridge as parent,
+// e.g. by being an earlier clone of it; its rewind buffer and any recording or replay are dropped. Returns FALSE if
+// out of memory, leaving dst alone.
+bool Pilot_system_clone_into (Pilot_system *dst, Pilot_system *parent);
+
+// Number of RAM pages the system reads from shared blocks
+uint32_t Pilot_system_shared_pages (const Pilot_system *sys);
+
+// Called by the bus on writes to, or remaps of, a page marked PILOT_PAGE_COW
+void pilot_cow_page_written (Pilot_system *sys, uint32_t page);
+// Called on remaps of [start, end] onto the given host memory
+void pilot_cow_remapped (Pilot_system *sys, uint32_t start, uint32_t end, const uint8_t *read, const uint8_t *write);
+// Has every shared page go back to the system's own RAM, copying the out of date ones first if copy is set
+void pilot_cow_unshare (Pilot_system *sys, bool copy);
+// Copies the shared pages the system's own RAM has out of date into ram, laid out as sys->wram onwards
+void pilot_cow_copy_shared (const Pilot_system *sys, uint8_t *ram);
+// Lets go of the shared pages without copying, and frees sys->cow
+void pilot_cow_release (Pilot_system *sys);
+
+#endif
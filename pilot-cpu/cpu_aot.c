@@ -0,0 +1,682 @@
+#include "cpu_aot.h"
+#include "cpu_jit.h"
+#include "system.h"
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+
+#define AOT_DEFAULT_BLOCKS 4096
+
+typedef struct
+{
+	uint32_t pgc;
+	uint32_t rom_offset;
+} aot_block_ref;
+
+// Offset of pgc in the ROM image, or -1 if pgc isn't mapped onto it
+static int64_t
+aot_rom_offset_ (const Pilot_system *sys, uint32_t pgc)
+{
+	const uint8_t *host = sys->mem_pages[pgc >> PILOT_MEM_PAGE_SHIFT].read;
+
+	if (!sys->cart.rom || !host || host < sys->cart.rom || host >= sys->cart.rom + sys->cart.map_size)
+	{
+		return -1;
+	}
+	return (host - sys->cart.rom) + (pgc & PILOT_MEM_PAGE_MASK);
+}
+
+uint64_t
+pilot_aot_rom_hash (const Pilot_system *sys)
+{
+	// FNV-1a
+	uint64_t hash = UINT64_C(0xcbf29ce484222325);
+	size_t i;
+
+	for (i = 0; i < sys->cart.rom_size; i++)
+	{
+		hash = (hash ^ sys->cart.rom[i]) * UINT64_C(0x100000001b3);
+	}
+	return hash;
+}
+
+
+/*
+ * Code generation
+ *
+ * Each block function mirrors what the x86-64 backend emits for the same IR (see cpu_jit_x64.c), as C: guest
+ * registers the block uses are held in locals and stored back at each exit, ALU sources go through a and b, and
+ * flags are recorded into core.lazy_flags. Being the compiler's problem, register allocation and constant folding
+ * across control words come for free.
+ */
+static void
+aot_operand_ (char *buf, size_t size, const jit_operand *op)
+{
+	char base[32];
+
+	switch (op->type)
+	{
+		case JIT_LOC_CONST:
+			snprintf(buf, size, "0x%xu", op->value);
+			return;
+		case JIT_LOC_MEM_ADDR:
+			strcpy(base, "ex->mem_addr");
+			break;
+		case JIT_LOC_MEM_DATA:
+			strcpy(base, "ex->mem_data");
+			break;
+		default:
+			if (op->index < 8)
+			{
+				snprintf(base, sizeof(base), "r%d", op->index);
+			}
+			else
+			{
+				snprintf(base, sizeof(base), "core->file[%d]", op->index);
+			}
+			break;
+	}
+	if (op->shift && op->mask != 0xffffffff)
+	{
+		snprintf(buf, size, "((%s >> %d) & 0x%xu)", base, op->shift, op->mask);
+	}
+	else if (op->shift)
+	{
+		snprintf(buf, size, "(%s >> %d)", base, op->shift);
+	}
+	else if (op->mask != 0xffffffff)
+	{
+		snprintf(buf, size, "(%s & 0x%xu)", base, op->mask);
+	}
+	else
+	{
+		snprintf(buf, size, "%s", base);
+	}
+}
+
+// As BUS_WRITE_
+static void
+aot_emit_store_ (FILE *out, const jit_operand *op)
+{
+	uint32_t field = op->mask << op->shift;
+	jit_operand whole = *op;
+	char dest[32];
+
+	if (op->type == JIT_LOC_CONST || !field)
+	{
+		return;
+	}
+	whole.shift = 0;
+	whole.mask = 0xffffffff;
+	aot_operand_(dest, sizeof(dest), &whole);
+	if (field == 0xffffffff)
+	{
+		fprintf(out, "\t%s = out;\n", dest);
+	}
+	else if (op->shift)
+	{
+		fprintf(out, "\t%s = (%s & 0x%xu) | ((out & 0x%xu) << %d);\n", dest, dest, ~field, op->mask, op->shift);
+	}
+	else
+	{
+		fprintf(out, "\t%s = (%s & 0x%xu) | (out & 0x%xu);\n", dest, dest, ~field, op->mask);
+	}
+}
+
+static void
+aot_emit_size_ (FILE *out, char r, data_size_spec size, bool sign_extend)
+{
+	if (size == SIZE_8_BIT || size == SIZE_16_BIT)
+	{
+		const char *type = (size == SIZE_8_BIT) ? "int8_t" : "int16_t";
+		if (sign_extend)
+		{
+			fprintf(out, "\t%c = (uint32_t)(%s)%c;\n", r, type, r);
+		}
+		else
+		{
+			fprintf(out, "\t%c &= 0x%xu;\n", r, (size == SIZE_8_BIT) ? 0xff : 0xffff);
+		}
+	}
+	else
+	{
+		fprintf(out, "\t%c &= 0xffffffu;\n", r);
+	}
+}
+
+static void
+aot_emit_mem_access_ (FILE *out, bool write)
+{
+	if (write)
+	{
+		fprintf(out, "\tbus |= pilot_aot_write(sys, ex->mem_addr, ex->mem_data);\n");
+	}
+	else
+	{
+		fprintf(out, "\tex->mem_data = pilot_aot_read(sys, ex->mem_addr);\n");
+	}
+}
+
+// Mirrors jit_emit_op_
+static void
+aot_emit_op_ (FILE *out, const jit_op *op)
+{
+	execute_control_word ctl = op->control;
+	alu_operation_spec operation = ECW_GET(ctl, OPERATION);
+	mem_latch_spec latch = ECW_GET(ctl, MEM_LATCH_CTL);
+	mem_write_spec write = ECW_GET(ctl, MEM_WRITE_CTL);
+	bool mem_access = !ECW_GET(ctl, MEM_ACCESS_SUPPRESS);
+	uint8_t write_mask = ECW_GET(ctl, FLAG_WRITE_MASK);
+	bool add_carry = !ECW_GET(ctl, SRC2_ADD1) && ECW_GET(ctl, SRC2_ADD_CARRY);
+	char src[2][48];
+
+	aot_operand_(src[0], sizeof(src[0]), &op->src[0]);
+	aot_operand_(src[1], sizeof(src[1]), &op->src[1]);
+	if (operation != ALU_OFF)
+	{
+		fprintf(out, "\ta = %s;\n\tb = %s;\n", src[0], src[1]);
+	}
+
+	// First half memory access
+	if (latch == MEM_LATCH_HALF1)
+	{
+		if (write == MEM_WRITE_FROM_SRC1)
+		{
+			fprintf(out, "\tex->mem_data = %s;\n", src[1]);
+		}
+		if (mem_access)
+		{
+			aot_emit_mem_access_(out, write != MEM_READ);
+		}
+	}
+
+	// Result latch
+	if (operation != ALU_OFF)
+	{
+		data_size_spec src2_size = ECW_SRC_GET(ctl, 1, SIZE);
+
+		aot_emit_size_(out, 'a', ECW_SRC_GET(ctl, 0, SIZE), op->sign_extend[0]);
+		aot_emit_size_(out, 'b', src2_size, op->sign_extend[1]);
+		if (ECW_GET(ctl, SRC2_ADD1))
+		{
+			fprintf(out, "\tb += 1;\n");
+		}
+		else if (add_carry)
+		{
+			fprintf(out, "\tif (core->lazy_flags.pending)\n\t\tpilot_execute_materialize_flags(core);\n");
+			fprintf(out, "\tb += (core->wf & F_CARRY) != 0;\n");
+		}
+		if (ECW_GET(ctl, SRC2_NEGATE))
+		{
+			fprintf(out, "\tb = -b;\n");
+			if (!op->sign_extend[1])
+			{
+				fprintf(out, "\tb &= 0x%xu;\n", src2_size == SIZE_8_BIT ? 0xff : src2_size == SIZE_16_BIT ? 0xffff : 0xffffff);
+			}
+		}
+		// The second source passes through the shifter, which is 16 bits wide
+		fprintf(out, "\tb &= 0xffffu;\n");
+
+		switch (operation)
+		{
+			case ALU_ADD:
+				fprintf(out, "\tout = (a + b) & 0xffffffu;\n");
+				break;
+			case ALU_AND:
+				fprintf(out, "\tout = a & b;\n");
+				break;
+			case ALU_OR:
+				fprintf(out, "\tout = a | b;\n");
+				break;
+			default:
+				fprintf(out, "\tout = a ^ b;\n");
+				break;
+		}
+
+		// F's decimal flag is checked on entry, so there's no decimal adjust
+		if (op->record_flags)
+		{
+			if (0xff & ~write_mask)
+			{
+				fprintf(out, "\tif (core->lazy_flags.pending && (ECW_GET(core->lazy_flags.control, FLAG_WRITE_MASK) & 0x%xu))\n"
+					"\t\tpilot_execute_materialize_flags(core);\n", 0xff & ~write_mask);
+			}
+			fprintf(out, "\tcore->lazy_flags.control = UINT64_C(0x%016llx);\n", (unsigned long long)ctl);
+			fprintf(out, "\tcore->lazy_flags.operands[0] = a;\n\tcore->lazy_flags.operands[1] = b;\n");
+			fprintf(out, "\tcore->lazy_flags.result = out;\n");
+			fprintf(out, "\tcore->lazy_flags.carries = %s;\n", (operation == ALU_ADD) ? "a ^ b ^ out" : "0");
+			fprintf(out, "\tcore->lazy_flags.shifter_carry = FALSE;\n\tcore->lazy_flags.pending = TRUE;\n");
+		}
+		aot_emit_store_(out, &op->dest);
+	}
+
+	// Second half memory access
+	if (latch >= MEM_LATCH_HALF2)
+	{
+		if (latch == MEM_LATCH_HALF2)
+		{
+			fprintf(out, "\tex->mem_addr = out;\n");
+		}
+		if (write == MEM_WRITE_FROM_DEST)
+		{
+			fprintf(out, "\tex->mem_data = out;\n");
+		}
+		if (mem_access)
+		{
+			aot_emit_mem_access_(out, write != MEM_READ);
+		}
+	}
+
+#ifdef PILOT_EAGER_FLAGS
+	if (op->record_flags)
+	{
+		fprintf(out, "\tpilot_execute_materialize_flags(core);\n");
+	}
+#endif
+}
+
+// Leaves the block after its first n instructions
+static void
+aot_emit_exit_ (FILE *out, const jit_ir_block *ir, int n, const char *indent)
+{
+	const jit_inst *last = &ir->insts[n - 1];
+	int g;
+
+	for (g = 0; g < 8; g++)
+	{
+		if (ir->regs_written & (1 << g))
+		{
+			fprintf(out, "%score->regs[%d] = r%d;\n", indent, g, g);
+		}
+	}
+	fprintf(out, "%score->pgc = 0x%06xu;\n", indent, last->next_pgc);
+	fprintf(out, "%ssys->cycles += %d;\n", indent, last->first_op + last->op_count);
+	fprintf(out, "%sex->insts_taken += %d;\n", indent, n);
+	fprintf(out, "%sreturn TRUE;\n", indent);
+}
+
+static void
+aot_emit_block_ (FILE *out, const jit_ir_block *ir)
+{
+	uint8_t regs_used = ir->regs_read | ir->regs_written;
+	bool writes_memory = FALSE;
+	bool uses_alu = FALSE;
+	int g, k, i;
+
+	for (k = 0; k < ir->inst_count; k++)
+	{
+		writes_memory |= ir->insts[k].writes_memory;
+	}
+	for (i = 0; i < ir->op_count; i++)
+	{
+		uses_alu |= (ECW_GET(ir->ops[i].control, OPERATION) != ALU_OFF);
+	}
+
+	fprintf(out, "static bool\naot_%06x (Pilot_system *sys)\n{\n", ir->pgc);
+	fprintf(out, "\tPilot_cpu_regs *core = &sys->core;\n\tpilot_execute_state *ex = &sys->execute;\n");
+	for (g = 0; g < 8; g++)
+	{
+		if (regs_used & (1 << g))
+		{
+			fprintf(out, "\tuint32_t r%d = core->regs[%d];\n", g, g);
+		}
+	}
+	if (uses_alu)
+	{
+		fprintf(out, "\tuint32_t a, b, out;\n");
+	}
+	if (writes_memory)
+	{
+		fprintf(out, "\tbool bus = FALSE;\n");
+	}
+	fprintf(out, "\n");
+
+	if (ir->needs_decimal_clear)
+	{
+		fprintf(out, "\tif ((core->wf & F_DECIMAL) || (core->lazy_flags.pending\n"
+			"\t\t&& (ECW_GET(core->lazy_flags.control, FLAG_WRITE_MASK) & F_DECIMAL)))\n\t{\n\t\treturn FALSE;\n\t}\n");
+	}
+
+	for (k = 0; k < ir->inst_count; k++)
+	{
+		const jit_inst *inst = &ir->insts[k];
+
+		fprintf(out, "\n\t// %06x\n", inst->pgc);
+		for (i = inst->first_op; i < inst->first_op + inst->op_count; i++)
+		{
+			aot_emit_op_(out, &ir->ops[i]);
+		}
+		// Writes through the bus may have switched banks under the rest of the block
+		if (inst->writes_memory && k < ir->inst_count - 1)
+		{
+			fprintf(out, "\tif (bus)\n\t{\n");
+			aot_emit_exit_(out, ir, k + 1, "\t\t");
+			fprintf(out, "\t}\n");
+		}
+	}
+	fprintf(out, "\n");
+	aot_emit_exit_(out, ir, ir->inst_count, "\t");
+	fprintf(out, "}\n\n");
+}
+
+static int
+aot_compare_refs_ (const void *a, const void *b)
+{
+	uint32_t pa = ((const aot_block_ref *)a)->pgc;
+	uint32_t pb = ((const aot_block_ref *)b)->pgc;
+	return (pa > pb) - (pa < pb);
+}
+
+// Whether the instruction can hand over to the one after it
+static inline bool
+aot_falls_through_ (const inst_decoded_flags *inst)
+{
+	if (inst->branch)
+	{
+		return inst->branch_cond < COND_ALWAYS;
+	}
+	return (inst->imm_words[0] & 0xf000) < 0xe000 && ECW_GET(inst->core_op, DEST) != DATA_REG_PGC;
+}
+
+/*
+ * The walk keeps a worklist of addresses to start blocks at, marking each in a bitmap of the address space's words.
+ * A block that stops short of an instruction the translation can't handle leaves it to the interpreter, and carries
+ * on after it if it falls through.
+ */
+int
+Pilot_aot_compile (Pilot_system *sys, FILE *out, const uint32_t *entries, int entry_count)
+{
+	static const uint32_t default_entry = CART_ROM_START;
+	uint8_t *visited;
+	uint32_t *work;
+	aot_block_ref *refs;
+	size_t work_count = 0;
+	size_t work_size;
+	size_t ref_count = 0;
+	size_t ref_size = 256;
+	bool own_cache = FALSE;
+	bool failed = FALSE;
+	jit_ir_block *ir;
+	size_t r;
+	int i;
+
+	if (!sys->cart.rom)
+	{
+		return -1;
+	}
+	if (!sys->block_cache)
+	{
+		if (!Pilot_block_cache_enable(sys, AOT_DEFAULT_BLOCKS))
+		{
+			return -1;
+		}
+		own_cache = TRUE;
+	}
+	if (!entry_count)
+	{
+		entries = &default_entry;
+		entry_count = 1;
+	}
+
+	work_size = entry_count + 256;
+	visited = calloc(0x1000000 >> 4, 1);
+	work = malloc(work_size * sizeof(*work));
+	refs = malloc(ref_size * sizeof(*refs));
+	ir = malloc(sizeof(*ir));
+	if (!visited || !work || !refs || !ir)
+	{
+		failed = TRUE;
+		goto done;
+	}
+
+	fprintf(out, "// Generated by Pilot_aot_compile; see cpu_aot.h\n\n");
+	fprintf(out, "#include \"pilot.h\"\n#include \"cpu_aot.h\"\n\n");
+	fprintf(out, "const uint32_t pilot_aot_version = PILOT_AOT_VERSION;\n");
+	fprintf(out, "const size_t pilot_aot_system_size = sizeof(Pilot_system);\n");
+	fprintf(out, "const uint64_t pilot_aot_rom_hash_value = UINT64_C(0x%016llx);\n\n",
+		(unsigned long long)pilot_aot_rom_hash(sys));
+
+	for (i = entry_count - 1; i >= 0; i--)
+	{
+		work[work_count++] = entries[i] & 0xfffffe;
+	}
+
+	while (work_count)
+	{
+		uint32_t pgc = work[--work_count];
+		uint32_t next = PILOT_BLOCK_EMPTY;
+		const pilot_block *block;
+		int64_t rom_offset = aot_rom_offset_(sys, pgc);
+
+		if (rom_offset < 0 || (visited[pgc >> 4] & (1 << ((pgc >> 1) & 7))))
+		{
+			continue;
+		}
+		visited[pgc >> 4] |= 1 << ((pgc >> 1) & 7);
+		block = pilot_block_lookup(sys, pgc);
+		if (!block)
+		{
+			continue;
+		}
+
+		pilot_jit_build_ir(sys, block, ir);
+		if (ir->inst_count)
+		{
+			if (ref_count == ref_size)
+			{
+				aot_block_ref *grown = realloc(refs, ref_size * 2 * sizeof(*refs));
+				if (!grown)
+				{
+					failed = TRUE;
+					goto done;
+				}
+				refs = grown;
+				ref_size *= 2;
+			}
+			refs[ref_count].pgc = pgc;
+			refs[ref_count].rom_offset = rom_offset & ~(int64_t)PILOT_MEM_PAGE_MASK;
+			ref_count++;
+			aot_emit_block_(out, ir);
+		}
+
+		// Carry on after the last instruction translated, or the one the interpreter will run
+		if (ir->inst_count < block->inst_count)
+		{
+			if (aot_falls_through_(&block->insts[ir->inst_count]))
+			{
+				next = (block->insts[ir->inst_count].inst_pgc + block->inst_words[ir->inst_count] * 2) & 0xfffffe;
+			}
+		}
+		else if (aot_falls_through_(&block->insts[block->inst_count - 1]))
+		{
+			next = ir->insts[ir->inst_count - 1].next_pgc;
+		}
+		if (next != PILOT_BLOCK_EMPTY)
+		{
+			if (work_count == work_size)
+			{
+				uint32_t *grown = realloc(work, work_size * 2 * sizeof(*work));
+				if (!grown)
+				{
+					failed = TRUE;
+					goto done;
+				}
+				work = grown;
+				work_size *= 2;
+			}
+			work[work_count++] = next;
+		}
+	}
+
+	qsort(refs, ref_count, sizeof(*refs), aot_compare_refs_);
+	fprintf(out, "const Pilot_aot_block pilot_aot_blocks[] =\n{\n");
+	for (r = 0; r < ref_count; r++)
+	{
+		fprintf(out, "\t{ 0x%06xu, 0x%xu, aot_%06x },\n", refs[r].pgc, refs[r].rom_offset, refs[r].pgc);
+	}
+	if (!ref_count)
+	{
+		fprintf(out, "\t{ 0 }\n");
+	}
+	fprintf(out, "};\nconst uint32_t pilot_aot_block_count = %u;\n", (unsigned)ref_count);
+
+done:
+	free(visited);
+	free(work);
+	free(refs);
+	free(ir);
+	if (own_cache)
+	{
+		Pilot_block_cache_disable(sys);
+	}
+	return failed ? -1 : (int)ref_count;
+}
+
+
+/*
+ * Loading
+ */
+bool
+Pilot_aot_load (Pilot_system *sys, const char *path)
+{
+	const uint32_t *version, *count;
+	const size_t *system_size;
+	const uint64_t *rom_hash;
+	const Pilot_aot_block *blocks;
+	pilot_aot *aot;
+	void *handle;
+
+	Pilot_aot_unload(sys);
+	if (!sys->cart.rom)
+	{
+		return FALSE;
+	}
+	handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (!handle)
+	{
+		return FALSE;
+	}
+
+	version = dlsym(handle, "pilot_aot_version");
+	system_size = dlsym(handle, "pilot_aot_system_size");
+	rom_hash = dlsym(handle, "pilot_aot_rom_hash_value");
+	blocks = dlsym(handle, "pilot_aot_blocks");
+	count = dlsym(handle, "pilot_aot_block_count");
+	// Objects built against a different layout of Pilot_system, or for another ROM, can't be used
+	if (!version || !system_size || !rom_hash || !blocks || !count || *version != PILOT_AOT_VERSION
+		|| *system_size != sizeof(Pilot_system) || *rom_hash != pilot_aot_rom_hash(sys))
+	{
+		dlclose(handle);
+		return FALSE;
+	}
+
+	aot = calloc(1, sizeof(*aot));
+	if (!aot)
+	{
+		dlclose(handle);
+		return FALSE;
+	}
+	aot->handle = handle;
+	aot->blocks = blocks;
+	aot->block_count = *count;
+	sys->aot = aot;
+	return TRUE;
+}
+
+void
+Pilot_aot_unload (Pilot_system *sys)
+{
+	if (!sys->aot)
+	{
+		return;
+	}
+	dlclose(sys->aot->handle);
+	free(sys->aot);
+	sys->aot = NULL;
+}
+
+Pilot_aot_stats
+Pilot_aot_get_stats (const Pilot_system *sys)
+{
+	if (!sys->aot)
+	{
+		return (Pilot_aot_stats) { 0 };
+	}
+	return sys->aot->stats;
+}
+
+
+/*
+ * Dispatch
+ *
+ * As for the JIT, stop requests and the end of the run are only checked between blocks, and the whole run goes
+ * through the interpreter while any breakpoints are set.
+ */
+static const Pilot_aot_block *
+aot_find_ (const pilot_aot *aot, uint32_t pgc)
+{
+	uint32_t lo = 0;
+	uint32_t hi = aot->block_count;
+
+	while (lo < hi)
+	{
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (aot->blocks[mid].pgc < pgc)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+	return (lo < aot->block_count && aot->blocks[lo].pgc == pgc) ? &aot->blocks[lo] : NULL;
+}
+
+Pilot_run_status
+pilot_aot_run (Pilot_system *sys, uint64_t end)
+{
+	pilot_aot *aot = sys->aot;
+
+	if (!aot || sys->breakpoint_count)
+	{
+		return pilot_interp_run(sys, end);
+	}
+
+	while (sys->cycles < end)
+	{
+		uint32_t pgc = sys->core.pgc & 0xfffffe;
+		const Pilot_aot_block *block = aot_find_(aot, pgc);
+		Pilot_run_status status = PILOT_RUN_DONE;
+
+		if (block && sys->mem_pages[pgc >> PILOT_MEM_PAGE_SHIFT].read == sys->cart.rom + block->rom_offset
+			&& block->run(sys))
+		{
+			aot->stats.blocks_run++;
+		}
+		else
+		{
+			if (block)
+			{
+				aot->stats.bails++;
+			}
+			aot->stats.fallbacks++;
+			status = pilot_interp_run(sys, sys->cycles + 1);
+		}
+		if (status != PILOT_RUN_DONE)
+		{
+			return status;
+		}
+
+		if (sys->stop_requested || sys->execute.execution_phase == EXEC_EXCEPTION)
+		{
+			if (sys->execute.execution_phase == EXEC_EXCEPTION)
+			{
+				return PILOT_RUN_EXCEPTION;
+			}
+			sys->stop_requested = FALSE;
+			return PILOT_RUN_STOPPED;
+		}
+	}
+	return PILOT_RUN_DONE;
+}
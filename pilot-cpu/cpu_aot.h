@@ -0,0 +1,106 @@
+#ifndef __CPU_AOT_H__
+#define __CPU_AOT_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include "types.h"
+#include "pilot.h"
+#include "memory.h"
+
+/*
+ * Static recompiler
+ *
+ * Pilot_aot_compile walks the code reachable from a set of entry points in the cartridge ROM and writes out a C
+ * translation unit with one function per basic block, translated from the same IR the JIT uses (cpu_jit.h). The
+ * unit is compiled into a shared object against these headers:
+ *
+ *     cc -O2 -shared -fPIC -I pilot-cpu rom_aot.c -o rom_aot.so
+ *
+ * and loaded with Pilot_aot_load. The core's symbols have to be visible to it, so link the frontend with -rdynamic
+ * or build the core as a shared library.
+ *
+ * Only direct control flow can be followed ahead of time, and the decoder doesn't implement any branches yet, so
+ * the walk follows straight-line code from each entry point until it reaches an instruction that isn't decoded or
+ * translated. Everything the object doesn't cover (indirect jumps, writes to PGC, code in RAM, banks that aren't
+ * mapped where they were at compile time) is run by the interpreter.
+ */
+#define PILOT_AOT_VERSION 1
+
+// One precompiled block. Returns FALSE without running anything if it can't run with F as it is.
+typedef struct
+{
+	uint32_t pgc;
+	// Offset of the block's page in the ROM image; the block only runs while that bank is mapped at pgc
+	uint32_t rom_offset;
+	bool (*run) (Pilot_system *sys);
+} Pilot_aot_block;
+
+typedef struct
+{
+	// Block functions run, and instructions run by the interpreter instead
+	uint64_t blocks_run;
+	uint64_t fallbacks;
+	// Blocks that didn't run because their bank wasn't mapped, or F's decimal flag was set
+	uint64_t bails;
+} Pilot_aot_stats;
+
+typedef struct pilot_aot
+{
+	void *handle;
+	// Sorted by pgc
+	const Pilot_aot_block *blocks;
+	uint32_t block_count;
+	Pilot_aot_stats stats;
+} pilot_aot;
+
+// Writes the translation of the code reachable from entries (CART_ROM_START if entry_count is 0) to out. The ROM has
+// to be loaded and mapped as it will be at run time. Returns the number of blocks written, or -1 if out of memory or
+// the ROM isn't loaded.
+int Pilot_aot_compile (Pilot_system *sys, FILE *out, const uint32_t *entries, int entry_count);
+
+// Loads a compiled object. Returns FALSE if it can't be loaded, or was built for a different ROM or core.
+// Select the engine with Pilot_set_engine.
+bool Pilot_aot_load (Pilot_system *sys, const char *path);
+void Pilot_aot_unload (Pilot_system *sys);
+Pilot_aot_stats Pilot_aot_get_stats (const Pilot_system *sys);
+
+// Hash of the loaded ROM image, as recorded in compiled objects
+uint64_t pilot_aot_rom_hash (const Pilot_system *sys);
+
+
+/*
+ * Helpers for generated code; the same fast paths as the JIT's inline page lookups
+ */
+static inline uint32_t
+pilot_aot_read (Pilot_system *sys, uint32_t addr)
+{
+	const Pilot_mem_page *page = &sys->mem_pages[(addr & 0xfffffe) >> PILOT_MEM_PAGE_SHIFT];
+	uint16_t data;
+
+	if (page->read && !page->wait_states)
+	{
+		const uint8_t *host = page->read + (addr & PILOT_MEM_PAGE_MASK & ~1);
+		return host[0] | (host[1] << 8);
+	}
+	sys->cycles += Pilot_mem_read_sync(sys, addr, &data) - 1;
+	return data;
+}
+
+// Returns TRUE if the write went through the bus, where a handler may have remapped memory
+static inline bool
+pilot_aot_write (Pilot_system *sys, uint32_t addr, uint32_t data)
+{
+	const Pilot_mem_page *page = &sys->mem_pages[(addr & 0xfffffe) >> PILOT_MEM_PAGE_SHIFT];
+
+	if (page->write && !page->wait_states && !page->flags)
+	{
+		uint8_t *host = page->write + (addr & PILOT_MEM_PAGE_MASK & ~1);
+		host[0] = data & 0xff;
+		host[1] = (data >> 8) & 0xff;
+		return FALSE;
+	}
+	sys->cycles += Pilot_mem_write_sync(sys, addr, data) - 1;
+	return TRUE;
+}
+
+#endif
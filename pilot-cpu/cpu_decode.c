@@ -2,6 +2,10 @@
 #include "cpu_decode.h"
 #include "memory.h"
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 
 /*
  * Pipeline stages:
@@ -82,9 +86,6 @@
  * 
  */
 
-// Placeholder
-void decode_not_implemented_ ();
-
 // Decodes an RM specifier.
 void decode_rm_specifier (pilot_decode_state *state, rm_spec rm, bool is_dest, bool src_is_left, data_size_spec size);
 
@@ -94,13 +95,15 @@ decode_inst_branch_ (pilot_decode_state *state, uint16_t opcode)
 	if ((opcode & 0xff00) == 0xff00)
 	{
 		// RST
-		decode_not_implemented_();
+		state->status = DECODE_NOT_IMPLEMENTED;
 		return;
 	}
 	if ((opcode & 0xffe0) == 0xfe00)
 	{
 		// REPI
-		decode_not_implemented_();
+		// Repeated LDs between post-incremented RM operands can be run as a whole with Pilot_mem_copy_sync and
+		// Pilot_mem_fill_sync
+		state->status = DECODE_NOT_IMPLEMENTED;
 		return;
 	}
 	if ((opcode & 0xf800) == 0xf000)
@@ -108,18 +111,18 @@ decode_inst_branch_ (pilot_decode_state *state, uint16_t opcode)
 		if (!(opcode & 0xff))
 		{
 			// REPR
-			decode_not_implemented_();
+			state->status = DECODE_NOT_IMPLEMENTED;
 			return;
 		}
 		else if (opcode & 0x80)
 		{
 			// DJNZ
-			decode_not_implemented_();
+			state->status = DECODE_NOT_IMPLEMENTED;
 			return;
 		}
 		else
 		{
-			decode_invalid_opcode_(state->sys);
+			state->status = DECODE_INVALID;
 			return;
 		}
 	}
@@ -128,11 +131,11 @@ decode_inst_branch_ (pilot_decode_state *state, uint16_t opcode)
 	{
 		case 0x0000:
 			// JP, JR.L
-			decode_not_implemented_();
+			state->status = DECODE_NOT_IMPLEMENTED;
 			return;
 		case 0x0100:
 			// CALL, CR.L
-			decode_not_implemented_();
+			state->status = DECODE_NOT_IMPLEMENTED;
 			return;
 		case 0x0200:
 		{
@@ -140,19 +143,19 @@ decode_inst_branch_ (pilot_decode_state *state, uint16_t opcode)
 			{
 				case 0x0000:
 					// JP rm24
-					decode_not_implemented_();
+					state->status = DECODE_NOT_IMPLEMENTED;
 					return;
 				case 0x0040:
 					// JEA
-					decode_not_implemented_();
+					state->status = DECODE_NOT_IMPLEMENTED;
 					return;
 				case 0x0100:
 					// CALL rm24
-					decode_not_implemented();
+					state->status = DECODE_NOT_IMPLEMENTED;
 					return;
 				case 0x0140:
 					// CEA
-					decode_not_implemented();
+					state->status = DECODE_NOT_IMPLEMENTED;
 					return;
 				default:
 					break;
@@ -160,49 +163,49 @@ decode_inst_branch_ (pilot_decode_state *state, uint16_t opcode)
 		}
 	}
 	
-	decode_invalid_opcode_(state->sys);
+	state->status = DECODE_INVALID;
 	return;
 }
 
 static void
 decode_inst_bit_ (pilot_decode_state *state, uint16_t opcode)
 {
-	decode_not_implemented_();
+	state->status = DECODE_NOT_IMPLEMENTED;
 	return;
 }
 
 static void
 decode_inst_ld_other_ (pilot_decode_state *state, uint16_t opcode)
 {
-	execute_control_word *core_op = &state->work_regs.core_op;
-	core_op->src2_add1 = FALSE;
-	core_op->src2_add_carry = FALSE;
-	core_op->src2_negate = FALSE;
-	core_op->flag_write_mask = 0;
-	core_op->flag_v_mode = FLAG_V_NORMAL;
+	execute_control_word *core_op = &state->work_regs->core_op;
+	ECW_SET(*core_op, SRC2_ADD1, FALSE);
+	ECW_SET(*core_op, SRC2_ADD_CARRY, FALSE);
+	ECW_SET(*core_op, SRC2_NEGATE, FALSE);
+	ECW_SET(*core_op, FLAG_WRITE_MASK, 0);
+	ECW_SET(*core_op, FLAG_V_MODE, FLAG_V_NORMAL);
 
 	// left operand is never fetched and is always zero
-	core_op->srcs[0].location = DATA_ZERO;
-	core_op->srcs[0].size = SIZE_24_BIT;
-	core_op->operation = ALU_OR;
+	ECW_SRC_SET(*core_op, 0, LOCATION, DATA_ZERO);
+	ECW_SRC_SET(*core_op, 0, SIZE, SIZE_24_BIT);
+	ECW_SET(*core_op, OPERATION, ALU_OR);
 
-	core_op->dest = DATA_REG_IMM_0_8;
-	core_op->shifter_mode = SHIFTER_NONE;
+	ECW_SET(*core_op, DEST, DATA_REG_IMM_0_8);
+	ECW_SET(*core_op, SHIFTER_MODE, SHIFTER_NONE);
 	
 	if ((opcode & 0x0800) == 0x0000)
 	{
 		// LD.P r24, hml
-		core_op->srcs[1].location = DATA_LATCH_IMM_HML;
-		core_op->srcs[1].size = SIZE_24_BIT;
-		core_op->srcs[1].sign_extend = FALSE;
+		ECW_SRC_SET(*core_op, 1, LOCATION, DATA_LATCH_IMM_HML);
+		ECW_SRC_SET(*core_op, 1, SIZE, SIZE_24_BIT);
+		ECW_SRC_SET(*core_op, 1, SIGN_EXTEND, FALSE);
 		return;
 	}
 	else
 	{
 		// LDQ
-		core_op->srcs[1].location = DATA_LATCH_IMM_0;
-		core_op->srcs[1].size = SIZE_8_BIT;
-		core_op->srcs[1].sign_extend = TRUE;
+		ECW_SRC_SET(*core_op, 1, LOCATION, DATA_LATCH_IMM_0);
+		ECW_SRC_SET(*core_op, 1, SIZE, SIZE_8_BIT);
+		ECW_SRC_SET(*core_op, 1, SIGN_EXTEND, TRUE);
 		return;
 	}
 }
@@ -212,51 +215,51 @@ decode_inst_arithlogic_ (pilot_decode_state *state, uint16_t opcode)
 {
 	uint8_t operation = ((opcode & 0x00c0) >> 6) | ((opcode & 0x1800) >> 9);
 	data_size_spec size = ((opcode & 0xc000) >> 14);
-	execute_control_word *core_op = &state->work_regs.core_op;
+	execute_control_word *core_op = &state->work_regs->core_op;
 	
 	bool uses_imm = FALSE;
 	
-	core_op->shifter_mode = SHIFTER_NONE;
-	core_op->src2_add1 = FALSE;
-	core_op->flag_v_mode = FLAG_V_NORMAL;
+	ECW_SET(*core_op, SHIFTER_MODE, SHIFTER_NONE);
+	ECW_SET(*core_op, SRC2_ADD1, FALSE);
+	ECW_SET(*core_op, FLAG_V_MODE, FLAG_V_NORMAL);
 	
 	// Decode core_op operation
 	switch (operation)
 	{
 		case 0: case 1: case 2: case 3: case 8: case 9: case 10: case 11:
 			// ADD, ADX, SUB, SBX
-			core_op->operation = ALU_ADD;
-			core_op->src2_add_carry = (operation & 1) != 0;
-			core_op->src2_negate = (operation & 2) != 0;
-			core_op->flag_write_mask = F_NEG | F_ZERO | F_OVERFLOW | F_CARRY | F_EXTEND;
+			ECW_SET(*core_op, OPERATION, ALU_ADD);
+			ECW_SET(*core_op, SRC2_ADD_CARRY, (operation & 1) != 0);
+			ECW_SET(*core_op, SRC2_NEGATE, (operation & 2) != 0);
+			ECW_SET(*core_op, FLAG_WRITE_MASK, F_NEG | F_ZERO | F_OVERFLOW | F_CARRY | F_EXTEND);
 			break;
 		case 4: case 12:
 			// AND
-			core_op->operation = ALU_AND;
-			core_op->src2_add_carry = FALSE;
-			core_op->src2_negate = FALSE;
-			core_op->flag_write_mask = F_NEG | F_ZERO | F_OVERFLOW | F_CARRY;
+			ECW_SET(*core_op, OPERATION, ALU_AND);
+			ECW_SET(*core_op, SRC2_ADD_CARRY, FALSE);
+			ECW_SET(*core_op, SRC2_NEGATE, FALSE);
+			ECW_SET(*core_op, FLAG_WRITE_MASK, F_NEG | F_ZERO | F_OVERFLOW | F_CARRY);
 			break;
 		case 5: case 13:
 			// XOR
-			core_op->operation = ALU_XOR;
-			core_op->src2_add_carry = FALSE;
-			core_op->src2_negate = FALSE;
-			core_op->flag_write_mask = F_NEG | F_ZERO | F_OVERFLOW | F_CARRY;
+			ECW_SET(*core_op, OPERATION, ALU_XOR);
+			ECW_SET(*core_op, SRC2_ADD_CARRY, FALSE);
+			ECW_SET(*core_op, SRC2_NEGATE, FALSE);
+			ECW_SET(*core_op, FLAG_WRITE_MASK, F_NEG | F_ZERO | F_OVERFLOW | F_CARRY);
 			break;
 		case 6: case 14:
 			// OR
-			core_op->operation = ALU_OR;
-			core_op->src2_add_carry = FALSE;
-			core_op->src2_negate = FALSE;
-			core_op->flag_write_mask = F_NEG | F_ZERO | F_OVERFLOW | F_CARRY;
+			ECW_SET(*core_op, OPERATION, ALU_OR);
+			ECW_SET(*core_op, SRC2_ADD_CARRY, FALSE);
+			ECW_SET(*core_op, SRC2_NEGATE, FALSE);
+			ECW_SET(*core_op, FLAG_WRITE_MASK, F_NEG | F_ZERO | F_OVERFLOW | F_CARRY);
 			break;
 		case 7:
 			// CP
-			core_op->operation = ALU_ADD;
-			core_op->src2_add_carry = FALSE;
-			core_op->src2_negate = TRUE;
-			core_op->flag_write_mask = F_NEG | F_ZERO | F_OVERFLOW | F_CARRY;
+			ECW_SET(*core_op, OPERATION, ALU_ADD);
+			ECW_SET(*core_op, SRC2_ADD_CARRY, FALSE);
+			ECW_SET(*core_op, SRC2_NEGATE, TRUE);
+			ECW_SET(*core_op, FLAG_WRITE_MASK, F_NEG | F_ZERO | F_OVERFLOW | F_CARRY);
 			break;
 		case 15:
 		{
@@ -266,42 +269,43 @@ decode_inst_arithlogic_ (pilot_decode_state *state, uint16_t opcode)
 			{
 				case 0: case 1: case 2: case 3:
 					// ADD, ADX, SUB, SBX
-					core_op->operation = ALU_ADD;
-					core_op->src2_add_carry = operation & 1;
-					core_op->src2_negate = operation & 2;
-					core_op->flag_write_mask = F_NEG | F_ZERO | F_OVERFLOW | F_CARRY | F_EXTEND;
+					ECW_SET(*core_op, OPERATION, ALU_ADD);
+					ECW_SET(*core_op, SRC2_ADD_CARRY, operation & 1);
+					ECW_SET(*core_op, SRC2_NEGATE, (operation & 2) != 0);
+					ECW_SET(*core_op, FLAG_WRITE_MASK, F_NEG | F_ZERO | F_OVERFLOW | F_CARRY | F_EXTEND);
 					break;
 				case 4:
 					// AND
-					core_op->operation = ALU_AND;
-					core_op->src2_add_carry = FALSE;
-					core_op->src2_negate = FALSE;
-					core_op->flag_write_mask = F_NEG | F_ZERO | F_OVERFLOW | F_CARRY;
+					ECW_SET(*core_op, OPERATION, ALU_AND);
+					ECW_SET(*core_op, SRC2_ADD_CARRY, FALSE);
+					ECW_SET(*core_op, SRC2_NEGATE, FALSE);
+					ECW_SET(*core_op, FLAG_WRITE_MASK, F_NEG | F_ZERO | F_OVERFLOW | F_CARRY);
 					break;
 				case 5:
 					// XOR
-					core_op->operation = ALU_XOR;
-					core_op->src2_add_carry = FALSE;
-					core_op->src2_negate = FALSE;
-					core_op->flag_write_mask = F_NEG | F_ZERO | F_OVERFLOW | F_CARRY;
+					ECW_SET(*core_op, OPERATION, ALU_XOR);
+					ECW_SET(*core_op, SRC2_ADD_CARRY, FALSE);
+					ECW_SET(*core_op, SRC2_NEGATE, FALSE);
+					ECW_SET(*core_op, FLAG_WRITE_MASK, F_NEG | F_ZERO | F_OVERFLOW | F_CARRY);
 					break;
 				case 6:
 					// OR
-					core_op->operation = ALU_OR;
-					core_op->src2_add_carry = FALSE;
-					core_op->src2_negate = FALSE;
-					core_op->flag_write_mask = F_NEG | F_ZERO | F_OVERFLOW | F_CARRY;
+					ECW_SET(*core_op, OPERATION, ALU_OR);
+					ECW_SET(*core_op, SRC2_ADD_CARRY, FALSE);
+					ECW_SET(*core_op, SRC2_NEGATE, FALSE);
+					ECW_SET(*core_op, FLAG_WRITE_MASK, F_NEG | F_ZERO | F_OVERFLOW | F_CARRY);
 					break;
 				case 7:
 					// CP
-					core_op->operation = ALU_ADD;
-					core_op->src2_add_carry = FALSE;
-					core_op->src2_negate = TRUE;
-					core_op->flag_write_mask = F_NEG | F_ZERO | F_OVERFLOW | F_CARRY;
+					ECW_SET(*core_op, OPERATION, ALU_ADD);
+					ECW_SET(*core_op, SRC2_ADD_CARRY, FALSE);
+					ECW_SET(*core_op, SRC2_NEGATE, TRUE);
+					ECW_SET(*core_op, FLAG_WRITE_MASK, F_NEG | F_ZERO | F_OVERFLOW | F_CARRY);
 					break;
 			default:
 				decode_unreachable_();
 			}
+			break;
 		}
 		default:
 			decode_unreachable_();
@@ -313,11 +317,11 @@ decode_inst_arithlogic_ (pilot_decode_state *state, uint16_t opcode)
 		// from RM src
 		rm_spec rm = opcode & 0x003f;
 		decode_rm_specifier(state, rm, FALSE, FALSE, size);
-		state->work_regs.core_op.srcs[1].sign_extend = FALSE;
+		ECW_SRC_SET(state->work_regs->core_op, 1, SIGN_EXTEND, FALSE);
 		
-		state->work_regs.core_op.srcs[0].location = DATA_REG_IMM_0_8;
-		state->work_regs.core_op.srcs[0].size = size;
-		state->work_regs.core_op.srcs[0].sign_extend = FALSE;
+		ECW_SRC_SET(state->work_regs->core_op, 0, LOCATION, DATA_REG_IMM_0_8);
+		ECW_SRC_SET(state->work_regs->core_op, 0, SIZE, size);
+		ECW_SRC_SET(state->work_regs->core_op, 0, SIGN_EXTEND, FALSE);
 		return;
 	}
 	else
@@ -325,15 +329,15 @@ decode_inst_arithlogic_ (pilot_decode_state *state, uint16_t opcode)
 		// from immediate src
 		rm_spec rm = opcode & 0x003f;
 		decode_rm_specifier(state, rm, TRUE, TRUE, size);
-		state->work_regs.core_op.srcs[0].sign_extend = FALSE;
+		ECW_SRC_SET(state->work_regs->core_op, 0, SIGN_EXTEND, FALSE);
 		
-		state->work_regs.core_op.srcs[1].location = DATA_LATCH_IMM_1;
-		state->work_regs.core_op.srcs[1].size = size;
-		state->work_regs.core_op.srcs[1].sign_extend = FALSE;
+		ECW_SRC_SET(state->work_regs->core_op, 1, LOCATION, DATA_LATCH_IMM_1);
+		ECW_SRC_SET(state->work_regs->core_op, 1, SIZE, size);
+		ECW_SRC_SET(state->work_regs->core_op, 1, SIGN_EXTEND, FALSE);
 		
 		if (operation == 7)
 		{
-			state->work_regs.core_op.dest = DATA_ZERO;
+			ECW_SET(state->work_regs->core_op, DEST, DATA_ZERO);
 		}
 		return;
 	}
@@ -342,33 +346,33 @@ decode_inst_arithlogic_ (pilot_decode_state *state, uint16_t opcode)
 static void
 decode_inst_ld_group_ (pilot_decode_state *state, uint16_t opcode)
 {
-	execute_control_word *core_op = &state->work_regs.core_op;
+	execute_control_word *core_op = &state->work_regs->core_op;
 	data_size_spec size = ((opcode & 0xc000) >> 14);
-	core_op->src2_add1 = FALSE;
-	core_op->src2_add_carry = FALSE;
-	core_op->src2_negate = FALSE;
-	core_op->flag_write_mask = 0;
-	core_op->flag_v_mode = FLAG_V_NORMAL;
+	ECW_SET(*core_op, SRC2_ADD1, FALSE);
+	ECW_SET(*core_op, SRC2_ADD_CARRY, FALSE);
+	ECW_SET(*core_op, SRC2_NEGATE, FALSE);
+	ECW_SET(*core_op, FLAG_WRITE_MASK, 0);
+	ECW_SET(*core_op, FLAG_V_MODE, FLAG_V_NORMAL);
 
 	// left operand is never fetched and is always zero
-	core_op->srcs[0].location = DATA_ZERO;
-	core_op->srcs[0].size = size;
+	ECW_SRC_SET(*core_op, 0, LOCATION, DATA_ZERO);
+	ECW_SRC_SET(*core_op, 0, SIZE, size);
 	
-	core_op->operation = ALU_OR;
-	core_op->shifter_mode = SHIFTER_NONE;
+	ECW_SET(*core_op, OPERATION, ALU_OR);
+	ECW_SET(*core_op, SHIFTER_MODE, SHIFTER_NONE);
 	
 	if ((opcode & 0x00c0) == 0x00c0)
 	{
 		// one RM specifier
 		rm_spec rm_src = opcode & 0x3f;
 
-		core_op->srcs[0].size = SIZE_24_BIT;
-		core_op->dest = DATA_REG_IMM_0_8;
+		ECW_SRC_SET(*core_op, 0, SIZE, SIZE_24_BIT);
+		ECW_SET(*core_op, DEST, DATA_REG_IMM_0_8);
 
 		if ((opcode & 0x8800) == 0x0800)
 		{
 			// LDSX
-			core_op->srcs[1].sign_extend = TRUE;
+			ECW_SRC_SET(*core_op, 1, SIGN_EXTEND, TRUE);
 		}
 		if ((opcode & 0xf800) == 0x9800)
 		{
@@ -402,7 +406,7 @@ decode_inst_ld_group_ (pilot_decode_state *state, uint16_t opcode)
 static void
 decode_inst_other_ (pilot_decode_state *state, uint16_t opcode)
 {
-	decode_not_implemented_();
+	state->status = DECODE_NOT_IMPLEMENTED;
 	return;
 }
 
@@ -410,7 +414,7 @@ static void
 decode_inst_ (pilot_decode_state *state)
 {
 	state->rm_ops = 0;
-	uint16_t opcode = state->work_regs.imm_words[0];
+	uint16_t opcode = state->work_regs->imm_words[0];
 	
 	if ((opcode & 0xf000) >= 0xe000)
 	{
@@ -444,13 +448,165 @@ decode_inst_ (pilot_decode_state *state)
 	}
 }
 
+// The decoder got into a state its own logic rules out
+void
+decode_unreachable_ ()
+{
+	fprintf(stderr, "pilot: unreachable decoder state\n");
+	abort();
+}
+
+// Exceptions aren't modelled yet, so the instruction runs as whatever its template decoded to
+void
+decode_invalid_opcode_ (Pilot_system *sys)
+{
+	(void)sys;
+}
+
+void
+decode_not_implemented_ ()
+{
+}
+
 void
-decode_queue_read_word (pilot_decode_state *state)
+decode_queue_read_word_ (pilot_decode_state *state)
 {
 	state->inst_length++;
 	state->words_to_read++;
 }
 
+/*
+ * Opcode templates
+ *
+ * Decoding only depends on the opcode word; the immediate words that follow it are only ever looked at by the
+ * execute stage. So every opcode is run through decode_inst_ once, and the results are kept as templates.
+ *
+ * Many opcodes decode identically (e.g. differing only in bits that aren't looked at yet), so templates are
+ * deduplicated into a pool, with a 16-bit index per opcode pointing into it.
+ */
+static uint16_t decode_template_idx_[0x10000];
+static decode_template *decode_template_pool_;
+static size_t decode_template_count_;
+static pthread_once_t decode_templates_once_ = PTHREAD_ONCE_INIT;
+
+static uint32_t
+decode_template_hash_ (const decode_template *t)
+{
+	const uint8_t *bytes = (const uint8_t *)t;
+	uint32_t hash = 2166136261u;
+	size_t i;
+	for (i = 0; i < sizeof(*t); i++)
+	{
+		hash = (hash ^ bytes[i]) * 16777619u;
+	}
+	return hash;
+}
+
+static void
+decode_make_template_ (uint16_t opcode, decode_template *t)
+{
+	pilot_decode_state scratch;
+	inst_decoded_flags regs;
+	memset(&scratch, 0, sizeof(scratch));
+	memset(&regs, 0, sizeof(regs));
+	scratch.work_regs = &regs;
+	regs.imm_words[0] = opcode;
+	// the opcode word itself
+	scratch.inst_length = 1;
+
+	decode_inst_(&scratch);
+
+	memset(t, 0, sizeof(*t));
+	t->override_op = regs.override_op;
+	t->run_before = regs.run_before;
+	t->core_op = regs.core_op;
+	pilot_execute_select_alu_kernel(&t->core_op);
+	t->run_after = regs.run_after;
+	t->auto_incr_amount = regs.auto_incr_amount;
+	t->rm2_offset = regs.rm2_offset;
+	t->extra_words = scratch.words_to_read;
+	t->status = scratch.status;
+}
+
+static void
+decode_build_templates_ (void)
+{
+	// Open addressed set of pool indices, for deduplication
+	const size_t buckets = 0x20000;
+	uint32_t *set;
+	size_t capacity = 1024;
+	uint32_t opcode;
+
+	set = malloc(buckets * sizeof(*set));
+	memset(set, 0xff, buckets * sizeof(*set));
+	decode_template_pool_ = malloc(capacity * sizeof(*decode_template_pool_));
+	decode_template_count_ = 0;
+
+	for (opcode = 0; opcode < 0x10000; opcode++)
+	{
+		decode_template t;
+		size_t bucket;
+
+		decode_make_template_(opcode, &t);
+		bucket = decode_template_hash_(&t) & (buckets - 1);
+		while (set[bucket] != UINT32_MAX && memcmp(&decode_template_pool_[set[bucket]], &t, sizeof(t)))
+		{
+			bucket = (bucket + 1) & (buckets - 1);
+		}
+
+		if (set[bucket] == UINT32_MAX)
+		{
+			if (decode_template_count_ == capacity)
+			{
+				capacity *= 2;
+				decode_template_pool_ = realloc(decode_template_pool_, capacity * sizeof(*decode_template_pool_));
+			}
+			decode_template_pool_[decode_template_count_] = t;
+			set[bucket] = decode_template_count_++;
+		}
+		decode_template_idx_[opcode] = set[bucket];
+	}
+
+	free(set);
+}
+
+void
+pilot_decode_init_templates (void)
+{
+	pthread_once(&decode_templates_once_, decode_build_templates_);
+}
+
+const decode_template *
+pilot_decode_template (uint16_t opcode)
+{
+	return &decode_template_pool_[decode_template_idx_[opcode]];
+}
+
+// Latches the decoded signals for the opcode in imm_words[0], and queues up reads for its immediate words
+static inline void
+decode_apply_template_ (pilot_decode_state *state)
+{
+	const decode_template *t = pilot_decode_template(state->work_regs->imm_words[0]);
+
+	pilot_decode_latch_template(state->work_regs, t);
+
+	state->inst_length += t->extra_words;
+	state->words_to_read += t->extra_words;
+	state->status = t->status;
+
+	switch (t->status)
+	{
+		case DECODE_OK:
+			break;
+		case DECODE_INVALID:
+			decode_invalid_opcode_(state->sys);
+			break;
+		case DECODE_NOT_IMPLEMENTED:
+			decode_not_implemented_();
+			break;
+	}
+}
+
 void
 pilot_decode_half1 (pilot_decode_state *state)
 {
@@ -465,7 +621,15 @@ pilot_decode_half1 (pilot_decode_state *state)
 	
 	if (state->decoding_phase == DECODER_HALF1_READY)
 	{
+		// The execute stage has taken the last instruction, so the other slot is free
+		pilot_interconnect *interconnects = &state->sys->interconnects;
+		interconnects->decoded_inst_slot ^= 1;
+		state->work_regs = &interconnects->decoded_insts[interconnects->decoded_inst_slot];
+
+		state->inst_addr = state->pgc;
 		state->inst_length = 0;
+		// Immediate words past the end of the instruction read as zero, not as the last instruction's
+		memset(state->work_regs->imm_words, 0, sizeof(state->work_regs->imm_words));
 		state->decoding_phase = DECODER_HALF1_READ_INST_WORD;
 	}
 	
@@ -475,7 +639,9 @@ pilot_decode_half1 (pilot_decode_state *state)
 		if (read_ok)
 		{
 			state->inst_length++;
-			decode_inst_(state);
+			// Even with the block cache enabled: a cached instruction's signals are the template's, and copying them
+			// out of a block (after finding it and checking it's still valid) measured no faster than from the table
+			decode_apply_template_(state);
 			state->decoding_phase = DECODER_HALF2_READ_OPERANDS;
 		}
 	}
@@ -504,7 +670,7 @@ pilot_decode_half2 (pilot_decode_state *state)
 	
 	if (state->decoding_phase == DECODER_HALF2_DISPATCH)
 	{
-		state->work_regs.inst_pgc = state->pgc;
+		state->work_regs->inst_pgc = state->inst_addr;
 		bool *decoded_inst_semaph = &state->sys->interconnects.decoded_inst_semaph;
 		*decoded_inst_semaph = TRUE;
 		state->decoding_phase = DECODER_HALF1_DISPATCH_WAIT;
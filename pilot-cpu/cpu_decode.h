@@ -2,13 +2,38 @@
 #define __CPU_DECODE_H__
 
 #include "types.h"
-#include "pilot.h"
+
+typedef enum
+{
+	DECODE_OK = 0,
+	DECODE_INVALID,
+	DECODE_NOT_IMPLEMENTED
+} decode_status;
+
+// Everything the decode stage derives from the opcode word alone. One of these is precomputed for every opcode.
+typedef struct
+{
+	mucode_entry_spec override_op;
+	mucode_entry_spec run_before;
+	execute_control_word core_op;
+	mucode_entry_spec run_after;
+	int8_t auto_incr_amount;
+	uint8_t rm2_offset;
+
+	// Number of immediate words following the opcode word
+	uint8_t extra_words;
+	decode_status status;
+} decode_template;
 
 typedef struct {
 	Pilot_system *sys;
 	
-	inst_decoded_flags work_regs;
+	// The slot of the decode-execute ring being filled
+	inst_decoded_flags *work_regs;
+	// Address of the next word to be read; advanced by the fetch interface
 	uint32_t pgc;
+	// Address of the current instruction's opcode word
+	uint32_t inst_addr;
 	
 	uint8_t inst_length;
 	uint8_t words_to_read;
@@ -24,19 +49,43 @@ typedef struct {
 	
 	// Number of RM operands in current instruction
 	uint8_t rm_ops;
+	decode_status status;
 } pilot_decode_state;
 
-extern pilot_decode_state *decode_state_;
-
 void decode_unreachable_ ();
 
 // Runs the invalid opcode exception reporting.
 void decode_invalid_opcode_ (Pilot_system *sys);
+// Placeholder
+void decode_not_implemented_ ();
 
 // Queues in a word read from the fetch unit
 void decode_queue_read_word_ (pilot_decode_state *state);
 
-// Tries to actually read a word from the fetch unit
+// Tries to actually read a word from the fetch unit. Fetches are untimed for now (see cpu_fetch.c): they don't go through
+// Pilot_memctl, pay no wait states, never contend with the execute stage's accesses and ignore execute_memory_backoff,
+// so the pipeline's cycle counts leave out fetch timing.
 bool decode_try_read_word_ (pilot_decode_state *state);
 
+void pilot_decode_half1 (pilot_decode_state *state);
+void pilot_decode_half2 (pilot_decode_state *state);
+
+// Builds the opcode template table, once per process; safe to call from any thread. Pilot_system_reset calls it.
+void pilot_decode_init_templates (void);
+
+// Looks up the precomputed template for an opcode word
+const decode_template *pilot_decode_template (uint16_t opcode);
+
+// Latches a template's decoded signals into an instruction
+static inline void
+pilot_decode_latch_template (inst_decoded_flags *inst, const decode_template *t)
+{
+	inst->override_op = t->override_op;
+	inst->run_before = t->run_before;
+	inst->core_op = t->core_op;
+	inst->run_after = t->run_after;
+	inst->auto_incr_amount = t->auto_incr_amount;
+	inst->rm2_offset = t->rm2_offset;
+}
+
 #endif
@@ -1,3 +1,4 @@
+#include <stddef.h>
 #include "cpu_decode.h"
 
 static inline bool
@@ -13,64 +14,65 @@ rm_requires_mem_fetch_ (rm_spec rm)
 void
 decode_rm_specifier (pilot_decode_state *state, rm_spec rm, bool is_dest, bool src_is_left, data_size_spec size)
 {
-	execute_control_word *core_op = &state->work_regs.core_op;
-	mucode_entry_spec *run_mucode;
-	alu_src_control *src_affected;
+	execute_control_word *core_op = &state->work_regs->core_op;
+	mucode_entry_spec *run_mucode = NULL;
+	// ALU source fed by this operand, or -1 if it's only a destination
+	int src_affected;
 	
 	state->rm_ops++;
 	
 	if (src_is_left)
 	{
-		src_affected = &state->work_regs.core_op.srcs[0];
+		src_affected = 0;
 	}
 	else if (!is_dest)
 	{
-		src_affected = &state->work_regs.core_op.srcs[1];
+		src_affected = 1;
 	}
 	else
 	{
-		src_affected = 0;
+		src_affected = -1;
 	}
 	
-	if (src_affected)
+	if (src_affected >= 0)
 	{
-		src_affected->size = size;
+		ECW_SRC_SET(*core_op, src_affected, SIZE, size);
 	}
 	if (rm_requires_mem_fetch_(rm))
 	{
-		if (src_affected)
+		if (src_affected >= 0)
 		{
-			src_affected->location = DATA_LATCH_MEM_DATA;
+			ECW_SRC_SET(*core_op, src_affected, LOCATION, DATA_LATCH_MEM_DATA);
 		}
 		if (is_dest && src_is_left)
 		{
 			// left source and destination are the same
 			// fetch and set up writeback
-			run_mucode = &state->work_regs.run_before;
-			core_op->dest = DATA_LATCH_MEM_DATA;
-			core_op->mem_latch_ctl = MEM_LATCH_HALF2_MAR;
-			core_op->mem_write_ctl = MEM_WRITE_FROM_DEST;
-			core_op->mem_size = size;
+			run_mucode = &state->work_regs->run_before;
+			ECW_SET(*core_op, DEST, DATA_LATCH_MEM_DATA);
+			ECW_SET(*core_op, MEM_LATCH_CTL, MEM_LATCH_HALF2_MAR);
+			ECW_SET(*core_op, MEM_WRITE_CTL, MEM_WRITE_FROM_DEST);
+			ECW_SET(*core_op, MEM_SIZE, size);
 		}
 		else if (is_dest)
 		{
 			// destination only, not part of core op; no fetch
-			run_mucode = &state->work_regs.run_after;
+			run_mucode = &state->work_regs->run_after;
 		}
 		else
 		{
 			// source only, fetch
-			run_mucode = &state->work_regs.run_before;
+			run_mucode = &state->work_regs->run_before;
 		}
 		
 		run_mucode->is_write = is_dest;
 	}
 	
-	if (src_affected && ((rm & 0x03) == 0x03))
+	if (src_affected >= 0 && ((rm & 0x03) == 0x03))
 	{
 		// Short form immediate
-		src_affected->sign_extend = FALSE;
-		src_affected->location = !(state->rm_ops == 1) ? DATA_LATCH_SFI_1 : DATA_LATCH_SFI_2;
+		ECW_SRC_SET(*core_op, src_affected, SIGN_EXTEND, FALSE);
+		ECW_SRC_SET(*core_op, src_affected, LOCATION, !(state->rm_ops == 1) ? DATA_LATCH_SFI_1 : DATA_LATCH_SFI_2);
 	}
 	else if ((rm & 0x23) == 0x22)
 	{
@@ -81,7 +83,7 @@ decode_rm_specifier (pilot_decode_state *state, rm_spec rm, bool is_dest, bool s
 	else if ((rm & 0x3b) == 0x39)
 	{
 		// Extra word needed
-		decode_try_read_word_(state);
+		decode_queue_read_word_(state);
 		
 		if (!(rm & 0x4))
 		{
@@ -92,7 +94,7 @@ decode_rm_specifier (pilot_decode_state *state, rm_spec rm, bool is_dest, bool s
 		else
 		{
 			// Absolute indexed
-			decode_try_read_word_(state);
+			decode_queue_read_word_(state);
 			run_mucode->entry_idx = MU_IND_IMM_WITH_BITS;
 			run_mucode->reg_select = 0;
 		}
@@ -100,7 +102,7 @@ decode_rm_specifier (pilot_decode_state *state, rm_spec rm, bool is_dest, bool s
 	else if ((rm & 0x3b) == 0x31)
 	{
 		// PGC relative
-		decode_try_read_word_(state);
+		decode_queue_read_word_(state);
 		run_mucode->entry_idx = MU_IND_PGC_WITH_IMM_RM;
 		run_mucode->reg_select = 0;
 		if (!(rm & 0x04))
@@ -111,7 +113,7 @@ decode_rm_specifier (pilot_decode_state *state, rm_spec rm, bool is_dest, bool s
 		else
 		{
 			// unsigned 24-bit
-			decode_try_read_word_(state);
+			decode_queue_read_word_(state);
 		}
 	}
 	else if ((rm & 0x3b) == 0x29)
@@ -120,12 +122,12 @@ decode_rm_specifier (pilot_decode_state *state, rm_spec rm, bool is_dest, bool s
 		run_mucode->size = !(rm & 0x04) ? SIZE_16_BIT : SIZE_24_BIT;
 		run_mucode->reg_select = !(rm & 0x04) ? 8 : 0;
 	}
-	else if (src_affected && ((rm & 0x3b) == 0x21))
+	else if (src_affected >= 0 && ((rm & 0x3b) == 0x21))
 	{
 		// Immediate
-		src_affected->size = !(rm & 0x04) ? SIZE_16_BIT : SIZE_24_BIT;
-		src_affected->location = !(state->rm_ops == 1) ? DATA_LATCH_IMM_1 : DATA_LATCH_RM_1;
-		src_affected->sign_extend = !(rm & 0x04);
+		ECW_SRC_SET(*core_op, src_affected, SIZE, !(rm & 0x04) ? SIZE_16_BIT : SIZE_24_BIT);
+		ECW_SRC_SET(*core_op, src_affected, LOCATION, !(state->rm_ops == 1) ? DATA_LATCH_IMM_1 : DATA_LATCH_RM_1);
+		ECW_SRC_SET(*core_op, src_affected, SIGN_EXTEND, !(rm & 0x04));
 	}
 	else if ((rm & 0x23) == 0x20)
 	{
@@ -145,14 +147,14 @@ decode_rm_specifier (pilot_decode_state *state, rm_spec rm, bool is_dest, bool s
 		run_mucode->entry_idx = MU_IND_REG_WITH_IMM;
 		run_mucode->reg_select = (rm >> 2) & 0x7;
 	}
-	else if (src_affected && ((rm & 0x23) == 0x00))
+	else if (src_affected >= 0 && ((rm & 0x23) == 0x00))
 	{
 		// Register direct
 		uint8_t reg = (rm >> 2) & 0x7;
-		src_affected->location = (size == SIZE_8_BIT) ? DATA_REG_L0 + reg : DATA_REG_P0 + reg;
+		ECW_SRC_SET(*core_op, src_affected, LOCATION, (size == SIZE_8_BIT) ? DATA_REG_L0 + reg : DATA_REG_P0 + reg);
 	}
 	
-	if (state->rm_ops == 2)
+	if (state->rm_ops == 2 && run_mucode)
 	{
 		run_mucode->reg_select |= 0x10;
 	}
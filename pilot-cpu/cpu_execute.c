@@ -1,3 +1,5 @@
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "cpu_regs.h"
 #include "cpu_decode.h"
@@ -5,347 +7,265 @@
 #include "memory.h"
 #include "types.h"
 
-typedef struct {
-	Pilot_system *sys;
-	
-	inst_decoded_flags decoded_inst;
-	mucode_entry_spec mucode_control;
-	execute_control_word mucode_decoded_buffer;
-	execute_control_word *control;
-	
-	uint32_t alu_input_latches[2];
-	uint32_t alu_output_latch;
-	bool alu_shifter_carry_bit;
-	
-	// Memory address and data registers for requesting memory accesses
-	uint32_t mem_addr;
-	uint16_t mem_data;
-	
-	// When reading memory, this flag will be high until the memory access has been completed.
-	// During this time, any reads from mem_data will block until this flag goes low.
-	bool mem_access_waiting;
-	bool mem_access_was_read;
-	
-	enum
-	{
-		EXEC_HALF1_READY,
-		EXEC_HALF1_MEM_WAIT,
-		EXEC_HALF1_OPERAND_LATCH,
-		EXEC_HALF1_MEM_PREPARE,
-		EXEC_HALF1_MEM_ASSERT,
-		
-		EXEC_HALF2_READY,
-		EXEC_HALF2_RESULT_LATCH,
-		EXEC_HALF2_MEM_PREPARE,
-		EXEC_HALF2_MEM_ASSERT,
-		
-		EXEC_ADVANCE_SEQUENCER,
-		EXEC_EXCEPTION
-	} execution_phase;
-	
-	enum
-	{
-		EXEC_SEQ_WAIT_NEXT_INS,
-		EXEC_SEQ_EVAL_CONTROL,
-		EXEC_SEQ_OVERRIDE_OP,
-		EXEC_SEQ_RUN_BEFORE,
-		EXEC_SEQ_CORE_OP,
-		EXEC_SEQ_CORE_OP_EXECUTED,
-		EXEC_SEQ_RUN_AFTER,
-		EXEC_SEQ_FINAL_STEPS,
-		EXEC_SEQ_SIGNAL_BRANCH,
-	} sequencer_phase;
-} pilot_execute_state;
-
-void execute_unreachable_ ();
-
-#define ACCESS_REG_BITS_(state, r, size) fetch_data_(state, (size == SIZE_8_BIT ? DATA_REG_L0 : DATA_REG_P0) + r)
-#define READ_IMM_LATCH_(state, imm, size) (size == SIZE_24_BIT ? (((state->decoded_inst.imm_words[imm] & 0xff) << 16) | state->decoded_inst.imm_words[imm + 1]) : state->decoded_inst.imm_words[imm])
+#define BUS_READ_(op) ((*(op)->reg >> (op)->shift) & (op)->mask)
+#define BUS_WRITE_(op, value) \
+	(*(op)->reg = (*(op)->reg & ~((op)->mask << (op)->shift)) | (((value) & (op)->mask) << (op)->shift))
+
+// Bus operand slots; the two ALU sources, then the destination
+#define BUS_DEST 2
+
+// The execute stage got into a state its own logic rules out
+void
+execute_unreachable_ ()
+{
+	fprintf(stderr, "pilot: unreachable execute state\n");
+	abort();
+}
+
+#define READ_IMM_LATCH_(state, imm, size) (size == SIZE_24_BIT ? (((state->decoded_inst->imm_words[imm] & 0xff) << 16) | state->decoded_inst->imm_words[imm + 1]) : state->decoded_inst->imm_words[imm])
+
+/*
+ * Data bus routing
+ *
+ * Every data bus specifier in a control word is resolved into an exec_bus_operand once, when the control word is
+ * latched by the sequencer. Operand reads and result writes are then plain masked loads and stores, with no
+ * dispatch on the specifier.
+ *
+ * Most specifiers are a fixed field of a register; those come straight from data_bus_routes_. The rest depend on the
+ * instruction's immediate words and the operation size, and are worked out in execute_resolve_operand_.
+ */
+typedef enum
+{
+	// Field of Pilot_cpu_regs.file
+	ROUTE_CORE,
+	// Field of pilot_execute_state.bus_latches
+	ROUTE_LATCH,
+	// Constant for the duration of the control word (immediates, DATA_SIZE); read only
+	ROUTE_CONST,
+	// Register selected by 3 bits of an immediate word; index is the word, shift is the bit position
+	ROUTE_REG_IMM,
+	// As above, with the word counted from the second RM operand
+	ROUTE_REG_RM,
+	// Register indexed address component; index is the word, counted from the second RM operand if shift is set
+	ROUTE_REG_INDEX
+} data_bus_route_type;
+
+typedef struct
+{
+	uint8_t type;
+	uint8_t index;
+	uint8_t shift;
+	uint32_t mask;
+} data_bus_route;
+
+#define ROUTE_CORE_(reg, shift, mask) { ROUTE_CORE, reg, shift, mask }
+
+static const data_bus_route data_bus_routes_[] =
+{
+	[DATA_ZERO]             = { ROUTE_LATCH, 0, 0, 0 },
+	[DATA_SIZE]             = { ROUTE_CONST },
+
+	[DATA_REG_L0]           = ROUTE_CORE_(0, 0, 0xff),
+	[DATA_REG_L1]           = ROUTE_CORE_(1, 0, 0xff),
+	[DATA_REG_L2]           = ROUTE_CORE_(2, 0, 0xff),
+	[DATA_REG_L3]           = ROUTE_CORE_(3, 0, 0xff),
+	[DATA_REG_M0]           = ROUTE_CORE_(0, 8, 0xff),
+	[DATA_REG_M1]           = ROUTE_CORE_(1, 8, 0xff),
+	[DATA_REG_M2]           = ROUTE_CORE_(2, 8, 0xff),
+	[DATA_REG_M3]           = ROUTE_CORE_(3, 8, 0xff),
+	[DATA_REG__F]           = ROUTE_CORE_(REGFILE_WF, 0, 0xff),
+	[DATA_REG__W]           = ROUTE_CORE_(REGFILE_WF, 8, 0xff),
+
+	[DATA_REG_W0]           = ROUTE_CORE_(0, 0, 0xffff),
+	[DATA_REG_W1]           = ROUTE_CORE_(1, 0, 0xffff),
+	[DATA_REG_W2]           = ROUTE_CORE_(2, 0, 0xffff),
+	[DATA_REG_W3]           = ROUTE_CORE_(3, 0, 0xffff),
+	[DATA_REG_W4]           = ROUTE_CORE_(4, 0, 0xffff),
+	[DATA_REG_W5]           = ROUTE_CORE_(5, 0, 0xffff),
+	[DATA_REG_W6]           = ROUTE_CORE_(6, 0, 0xffff),
+	[DATA_REG_W7]           = ROUTE_CORE_(7, 0, 0xffff),
+	[DATA_REG_WF]           = ROUTE_CORE_(REGFILE_WF, 0, 0xffff),
+
+	[DATA_REG_P0]           = ROUTE_CORE_(0, 0, 0xffffff),
+	[DATA_REG_P1]           = ROUTE_CORE_(1, 0, 0xffffff),
+	[DATA_REG_P2]           = ROUTE_CORE_(2, 0, 0xffffff),
+	[DATA_REG_P3]           = ROUTE_CORE_(3, 0, 0xffffff),
+	[DATA_REG_P4]           = ROUTE_CORE_(4, 0, 0xffffff),
+	[DATA_REG_P5]           = ROUTE_CORE_(5, 0, 0xffffff),
+	[DATA_REG_P6]           = ROUTE_CORE_(6, 0, 0xffffff),
+	[DATA_REG_SP]           = ROUTE_CORE_(7, 0, 0xffffff),
+	// PGC is always even
+	[DATA_REG_PGC]          = ROUTE_CORE_(REGFILE_PGC, 0, 0xfffffe),
+
+	[DATA_LATCH_REPI]       = ROUTE_CORE_(REGFILE_REPI, 0, 0xff),
+	[DATA_LATCH_REPR]       = ROUTE_CORE_(REGFILE_REPR, 0, 0xff),
+	[DATA_LATCH_MEM_ADDR]   = { ROUTE_LATCH, 1, 0, 0xffffffff },
+	[DATA_LATCH_MEM_DATA]   = { ROUTE_LATCH, 2, 0, 0xffff },
+	[DATA_LATCH_IMM_0]      = { ROUTE_CONST },
+	[DATA_LATCH_IMM_1]      = { ROUTE_CONST },
+	[DATA_LATCH_IMM_2]      = { ROUTE_CONST },
+	[DATA_LATCH_IMM_HML]    = { ROUTE_CONST },
+	[DATA_LATCH_IMM_HML_RM] = { ROUTE_CONST },
+	[DATA_LATCH_SFI_1]      = { ROUTE_CONST },
+	[DATA_LATCH_SFI_2]      = { ROUTE_CONST },
+	[DATA_LATCH_RM_1]       = { ROUTE_CONST },
+	[DATA_LATCH_RM_2]       = { ROUTE_CONST },
+	[DATA_LATCH_RM_HML]     = { ROUTE_CONST },
+
+	[DATA_REG_IMM_0_8]      = { ROUTE_REG_IMM, 0, 8 },
+	[DATA_REG_IMM_1_8]      = { ROUTE_REG_IMM, 1, 8 },
+	[DATA_REG_IMM_1_2]      = { ROUTE_REG_IMM, 1, 2 },
+	[DATA_REG_IMM_2_8]      = { ROUTE_REG_INDEX, 2, 0 },
+	[DATA_REG_RM_1_8]       = { ROUTE_REG_RM, 0, 8 },
+	[DATA_REG_RM_1_2]       = { ROUTE_REG_RM, 0, 2 },
+	[DATA_REG_RM_2_8]       = { ROUTE_REG_INDEX, 1, 1 },
+};
 
 static uint32_t
-fetch_data_ (pilot_execute_state *state, data_bus_specifier src)
+execute_const_operand_ (pilot_execute_state *state, data_bus_specifier src)
 {
+	const uint16_t *imm_words = state->decoded_inst->imm_words;
+	uint8_t rm2_offset = state->decoded_inst->rm2_offset;
+	data_size_spec size = ECW_SRC_GET(*state->control, 0, SIZE);
 	switch (src)
 	{
-		case DATA_ZERO:
-			return 0;
 		case DATA_SIZE:
-			{
-				data_size_spec size = state->mucode_decoded_buffer.srcs[0].size;
-				if (size == SIZE_8_BIT) {
-					if (state->mucode_decoded_buffer.srcs[0].location == DATA_REG_SP || state->mucode_decoded_buffer.srcs[1].location == DATA_REG_SP)
-						return 2;
-					else
-						return 1;
-				}
-				else if (size == SIZE_16_BIT)
+			if (size == SIZE_8_BIT) {
+				if (ECW_SRC_GET(*state->control, 0, LOCATION) == DATA_REG_SP || ECW_SRC_GET(*state->control, 1, LOCATION) == DATA_REG_SP)
 					return 2;
 				else
-					return 4;
+					return 1;
 			}
-		case DATA_REG_L0:
-			return state->sys->core.regs[0] & 0xff;
-		case DATA_REG_L1:
-			return state->sys->core.regs[1] & 0xff;
-		case DATA_REG_L2:
-			return state->sys->core.regs[2] & 0xff;
-		case DATA_REG_L3:
-			return state->sys->core.regs[3] & 0xff;
-		case DATA_REG_M0:
-			return (state->sys->core.regs[0] >> 8) & 0xff;
-		case DATA_REG_M1:
-			return (state->sys->core.regs[1] >> 8) & 0xff;
-		case DATA_REG_M2:
-			return (state->sys->core.regs[2] >> 8) & 0xff;
-		case DATA_REG_M3:
-			return (state->sys->core.regs[3] >> 8) & 0xff;
-		case DATA_REG_W0:
-			return state->sys->core.regs[0] & 0xffff;
-		case DATA_REG_W1:
-			return state->sys->core.regs[1] & 0xffff;
-		case DATA_REG_W2:
-			return state->sys->core.regs[2] & 0xffff;
-		case DATA_REG_W3:
-			return state->sys->core.regs[3] & 0xffff;
-		case DATA_REG_W4:
-			return state->sys->core.regs[4] & 0xffff;
-		case DATA_REG_W5:
-			return state->sys->core.regs[5] & 0xffff;
-		case DATA_REG_W6:
-			return state->sys->core.regs[6] & 0xffff;
-		case DATA_REG_W7:
-			return state->sys->core.regs[7] & 0xffff;
-		case DATA_REG_P0:
-			return state->sys->core.regs[0];
-		case DATA_REG_P1:
-			return state->sys->core.regs[1];
-		case DATA_REG_P2:
-			return state->sys->core.regs[2];
-		case DATA_REG_P3:
-			return state->sys->core.regs[3];
-		case DATA_REG_P4:
-			return state->sys->core.regs[4];
-		case DATA_REG_P5:
-			return state->sys->core.regs[5];
-		case DATA_REG_P6:
-			return state->sys->core.regs[6];
-		case DATA_REG_SP:
-			return state->sys->core.regs[7];
-		case DATA_REG_PGC:
-			return state->sys->core.pgc;
-		case DATA_REG__F:
-			return state->sys->core.wf & 0xff;
-		case DATA_REG__W:
-			return state->sys->core.wf >> 8;
-		case DATA_REG_WF:
-			return state->sys->core.wf;
-		case DATA_LATCH_REPI:
-			return state->sys->core.repi;
-		case DATA_LATCH_REPR:
-			return state->sys->core.repr;
-		case DATA_LATCH_MEM_ADDR:
-			return state->mem_addr;
-		case DATA_LATCH_MEM_DATA:
-			return state->mem_data;
+			else if (size == SIZE_16_BIT)
+				return 2;
+			else
+				return 4;
 		case DATA_LATCH_IMM_0:
-			return READ_IMM_LATCH_(state, 0, state->mucode_decoded_buffer.srcs[0].size);
+			return READ_IMM_LATCH_(state, 0, size);
 		case DATA_LATCH_IMM_1:
-			return READ_IMM_LATCH_(state, 1, state->mucode_decoded_buffer.srcs[0].size);
+			return READ_IMM_LATCH_(state, 1, size);
 		case DATA_LATCH_IMM_2:
-			return READ_IMM_LATCH_(state, 2, state->mucode_decoded_buffer.srcs[0].size);
+			return READ_IMM_LATCH_(state, 2, size);
 		case DATA_LATCH_IMM_HML:
-			return ((state->decoded_inst.imm_words[0] & 0xff) << 16) | state->decoded_inst.imm_words[1];
+			return ((imm_words[0] & 0xff) << 16) | imm_words[1];
 		case DATA_LATCH_IMM_HML_RM:
-			return ((state->decoded_inst.imm_words[2] & 0xff) << 16) | state->decoded_inst.imm_words[1];
+			return ((imm_words[2] & 0xff) << 16) | imm_words[1];
 		case DATA_LATCH_SFI_1:
-			return (state->decoded_inst.imm_words[0] >> 2) & 0x000f;
+			return (imm_words[0] >> 2) & 0x000f;
 		case DATA_LATCH_SFI_2:
-			return (state->decoded_inst.imm_words[0] >> 8) & 0x000f;
+			return (imm_words[0] >> 8) & 0x000f;
 		case DATA_LATCH_RM_1:
-			return READ_IMM_LATCH_(state, state->decoded_inst.rm2_offset, state->mucode_decoded_buffer.srcs[0].size);
+			return READ_IMM_LATCH_(state, rm2_offset, size);
 		case DATA_LATCH_RM_2:
-			return READ_IMM_LATCH_(state, state->decoded_inst.rm2_offset + 1, state->mucode_decoded_buffer.srcs[0].size);
+			return READ_IMM_LATCH_(state, rm2_offset + 1, size);
 		case DATA_LATCH_RM_HML:
-			return ((state->decoded_inst.imm_words[state->decoded_inst.rm2_offset + 1] & 0xff) << 16) | state->decoded_inst.imm_words[state->decoded_inst.rm2_offset];
-		case DATA_REG_IMM_0_8:
-			return ACCESS_REG_BITS_(state, (state->decoded_inst.imm_words[0] >> 8) & 0x7, state->mucode_decoded_buffer.srcs[0].size);
-		case DATA_REG_IMM_1_8:
-			return ACCESS_REG_BITS_(state, (state->decoded_inst.imm_words[1] >> 8) & 0x7, state->mucode_decoded_buffer.srcs[0].size);
-		case DATA_REG_IMM_1_2:
-			return ACCESS_REG_BITS_(state, (state->decoded_inst.imm_words[1] >> 2) & 0x7, state->mucode_decoded_buffer.srcs[0].size);
-		case DATA_REG_IMM_2_8:
-		{
-			if (state->decoded_inst.imm_words[2] >= 0xc000) 
-			{
-				decode_invalid_opcode_(state->sys);
-				return 0;
-			}
-			state->mucode_decoded_buffer.srcs[1].sign_extend = ((state->decoded_inst.imm_words[2] & 0x0800) != 0);
-			return ACCESS_REG_BITS_(state, (state->decoded_inst.imm_words[2] >> 8) & 0x7, state->decoded_inst.imm_words[2] >> 14);
-		}
-		case DATA_REG_RM_1_8:
-			return ACCESS_REG_BITS_(state, (state->decoded_inst.imm_words[state->decoded_inst.rm2_offset] >> 8) & 0x7, state->mucode_decoded_buffer.srcs[0].size);
-		case DATA_REG_RM_1_2:
-			return ACCESS_REG_BITS_(state, (state->decoded_inst.imm_words[state->decoded_inst.rm2_offset] >> 2) & 0x7, state->mucode_decoded_buffer.srcs[0].size);
-		case DATA_REG_RM_2_8:
-		{
-			if (state->decoded_inst.imm_words[state->decoded_inst.rm2_offset + 1] >= 0xc000) 
-			{
-				decode_invalid_opcode_(state->sys);
-				return 0;
-			}
-			state->mucode_decoded_buffer.srcs[1].sign_extend = ((state->decoded_inst.imm_words[state->decoded_inst.rm2_offset + 1] & 0x0800) != 0);
-			return ACCESS_REG_BITS_(state, (state->decoded_inst.imm_words[state->decoded_inst.rm2_offset + 1] >> 8) & 0x7, state->decoded_inst.imm_words[state->decoded_inst.rm2_offset + 1] >> 14);
-		}
+			return ((imm_words[rm2_offset + 1] & 0xff) << 16) | imm_words[rm2_offset];
 		default:
 			execute_unreachable_();
+			return 0;
+	}
+}
+
+// Points an operand at register r; 8-bit operations use DATA_REG_L0 + r (L0-L3, then M0-M3 for r = 4-7), 16-bit
+// writes Wr, and everything else Pr.
+static inline void
+execute_route_reg_ (pilot_execute_state *state, exec_bus_operand *op, uint8_t r, data_size_spec size, bool is_dest)
+{
+	op->reg = &state->sys->core.regs[r];
+	op->shift = 0;
+	if (size == SIZE_8_BIT)
+	{
+		// M(r - 4) is bits 8-15 of register r - 4
+		op->reg = &state->sys->core.regs[r & 3];
+		op->shift = (r & 4) ? 8 : 0;
+		op->mask = 0xff;
+	}
+	else if (size == SIZE_16_BIT && is_dest)
+	{
+		op->mask = 0xffff;
+	}
+	else
+	{
+		op->mask = 0xffffff;
 	}
 }
 
 static void
-write_data_ (pilot_execute_state *state, data_bus_specifier dest, uint32_t *src)
+execute_resolve_operand_ (pilot_execute_state *state, int slot, data_bus_specifier spec)
 {
-	switch (dest)
+	exec_bus_operand *op = &state->bus[slot];
+	const data_bus_route *route = &data_bus_routes_[spec];
+	const uint16_t *imm_words = state->decoded_inst->imm_words;
+	data_size_spec size = ECW_SRC_GET(*state->control, 0, SIZE);
+	bool is_dest = (slot == BUS_DEST);
+	uint16_t word;
+
+	state->bus_touches_flags[slot] = FALSE;
+	switch (route->type)
 	{
-		case DATA_ZERO:
-		case DATA_SIZE:
-			return;
-		case DATA_REG_L0:
-			state->sys->core.regs[0] &= 0xffff00;
-			state->sys->core.regs[0] |= *src & 0xff;
-			return;
-		case DATA_REG_L1:
-			state->sys->core.regs[1] &= 0xffff00;
-			state->sys->core.regs[1] |= *src & 0xff;
-			return;
-		case DATA_REG_L2:
-			state->sys->core.regs[2] &= 0xffff00;
-			state->sys->core.regs[2] |= *src & 0xff;
-			return;
-		case DATA_REG_L3:
-			state->sys->core.regs[3] &= 0xffff00;
-			state->sys->core.regs[3] |= *src & 0xff;
-			return;
-		case DATA_REG_M0:
-			state->sys->core.regs[0] &= 0xff00ff;
-			state->sys->core.regs[0] |= ((*src & 0xff) << 8);
-			return;
-		case DATA_REG_M1:
-			state->sys->core.regs[1] &= 0xff00ff;
-			state->sys->core.regs[1] |= ((*src & 0xff) << 8);
-			return;
-		case DATA_REG_M2:
-			state->sys->core.regs[2] &= 0xff00ff;
-			state->sys->core.regs[2] |= ((*src & 0xff) << 8);
-			return;
-		case DATA_REG_M3:
-			state->sys->core.regs[3] &= 0xff00ff;
-			state->sys->core.regs[3] |= ((*src & 0xff) << 8);
-			return;
-		case DATA_REG_W0:
-			state->sys->core.regs[0] &= 0xff0000;
-			state->sys->core.regs[0] |= *src & 0xffff;
-			return;
-		case DATA_REG_W1:
-			state->sys->core.regs[1] &= 0xff0000;
-			state->sys->core.regs[1] |= *src & 0xffff;
-			return;
-		case DATA_REG_W2:
-			state->sys->core.regs[2] &= 0xff0000;
-			state->sys->core.regs[2] |= *src & 0xffff;
-			return;
-		case DATA_REG_W3:
-			state->sys->core.regs[3] &= 0xff0000;
-			state->sys->core.regs[3] |= *src & 0xffff;
-			return;
-		case DATA_REG_W4:
-			state->sys->core.regs[4] &= 0xff0000;
-			state->sys->core.regs[4] |= *src & 0xffff;
-			return;
-		case DATA_REG_W5:
-			state->sys->core.regs[5] &= 0xff0000;
-			state->sys->core.regs[5] |= *src & 0xffff;
-			return;
-		case DATA_REG_W6:
-			state->sys->core.regs[6] &= 0xff0000;
-			state->sys->core.regs[6] |= *src & 0xffff;
-			return;
-		case DATA_REG_W7:
-			state->sys->core.regs[7] &= 0xff0000;
-			state->sys->core.regs[7] |= *src & 0xffff;
-			return;
-		case DATA_REG_P0:
-			state->sys->core.regs[0] = *src & 0xffffff;
-			return;
-		case DATA_REG_P1:
-			state->sys->core.regs[1] = *src & 0xffffff;
-			return;
-		case DATA_REG_P2:
-			state->sys->core.regs[2] = *src & 0xffffff;
+		case ROUTE_CORE:
+			op->reg = &state->sys->core.file[route->index];
+			op->shift = route->shift;
+			op->mask = route->mask;
+			state->bus_touches_flags[slot] = (route->index == REGFILE_WF && ((route->mask << route->shift) & 0xff));
 			return;
-		case DATA_REG_P3:
-			state->sys->core.regs[3] = *src & 0xffffff;
+		case ROUTE_LATCH:
+			op->reg = &state->bus_latches[route->index];
+			op->shift = route->shift;
+			op->mask = route->mask;
 			return;
-		case DATA_REG_P4:
-			state->sys->core.regs[4] = *src & 0xffffff;
-			return;
-		case DATA_REG_P5:
-			state->sys->core.regs[5] = *src & 0xffffff;
-			return;
-		case DATA_REG_P6:
-			state->sys->core.regs[6] = *src & 0xffffff;
-			return;
-		case DATA_REG_SP:
-			state->sys->core.regs[7] = *src & 0xffffff;
-			return;
-		case DATA_REG__F:
-			state->sys->core.wf &= 0xff00;
-			state->sys->core.wf |= *src & 0xff;
-			return;
-		case DATA_REG__W:
-			state->sys->core.wf &= 0x00ff;
-			state->sys->core.wf |= ((*src & 0xff) << 8);
-			return;
-		case DATA_REG_WF:
-			state->sys->core.wf = *src & 0xffff;
-			return;
-		case DATA_REG_PGC:
-			state->sys->core.pgc = *src & 0xfffffe;
-			return;
-		case DATA_LATCH_MEM_ADDR:
-			state->mem_addr = *src;
+		case ROUTE_CONST:
+			op->shift = 0;
+			if (is_dest)
+			{
+				// writes to constants go nowhere
+				op->reg = &state->bus_zero;
+				op->mask = 0;
+				return;
+			}
+			state->bus_consts[slot] = execute_const_operand_(state, spec);
+			op->reg = &state->bus_consts[slot];
+			op->mask = 0xffffffff;
 			return;
-		case DATA_LATCH_MEM_DATA:
-			state->mem_data = *src;
+		case ROUTE_REG_IMM:
+		case ROUTE_REG_RM:
+			word = imm_words[route->index + (route->type == ROUTE_REG_RM ? state->decoded_inst->rm2_offset : 0)];
+			execute_route_reg_(state, op, (word >> route->shift) & 0x7, size, is_dest);
 			return;
-		case DATA_REG_IMM_0_8:
-			state->sys->core.regs[(state->decoded_inst.imm_words[0] >> 8) & 0x7] = *src;
-		case DATA_REG_IMM_1_8:
-			state->sys->core.regs[(state->decoded_inst.imm_words[1] >> 8) & 0x7] = *src;
-		case DATA_REG_IMM_1_2:
-			state->sys->core.regs[(state->decoded_inst.imm_words[1] >> 2) & 0x7] = *src;
-		case DATA_REG_RM_1_8:
-			state->sys->core.regs[(state->decoded_inst.imm_words[state->decoded_inst.rm2_offset] >> 8) & 0x7] = *src;
-		case DATA_REG_RM_1_2:
-			 state->sys->core.regs[(state->decoded_inst.imm_words[state->decoded_inst.rm2_offset] >> 2) & 0x7] = *src;
-		case DATA_REG_IMM_2_8:
-		case DATA_REG_RM_2_8:
-		case DATA_LATCH_IMM_0:
-		case DATA_LATCH_IMM_1:
-		case DATA_LATCH_IMM_2:
-		case DATA_LATCH_IMM_HML:
-		case DATA_LATCH_IMM_HML_RM:
-		case DATA_LATCH_SFI_1:
-		case DATA_LATCH_SFI_2:
-		case DATA_LATCH_RM_1:
-		case DATA_LATCH_RM_2:
-		case DATA_LATCH_RM_HML:
+		case ROUTE_REG_INDEX:
+			// The index register's size and sign extension come from the extension word itself
+			word = imm_words[route->index + (route->shift ? state->decoded_inst->rm2_offset : 0)];
+			op->reg = &state->bus_zero;
+			op->shift = 0;
+			op->mask = 0;
+			if (is_dest)
+			{
+				return;
+			}
+			if (word >= 0xc000)
+			{
+				decode_invalid_opcode_(state->sys);
+				return;
+			}
+			state->alu_input_sign_extend[slot] = ((word & 0x0800) != 0);
+			execute_route_reg_(state, op, (word >> 8) & 0x7, word >> 14, FALSE);
 			return;
 		default:
 			execute_unreachable_();
 	}
 }
 
+// Resolves the bus operands of a newly latched control word
+static void
+execute_resolve_bus_ (pilot_execute_state *state)
+{
+	state->alu_input_sign_extend[0] = ECW_SRC_GET(*state->control, 0, SIGN_EXTEND);
+	state->alu_input_sign_extend[1] = ECW_SRC_GET(*state->control, 1, SIGN_EXTEND);
+	execute_resolve_operand_(state, 0, ECW_SRC_GET(*state->control, 0, LOCATION));
+	execute_resolve_operand_(state, 1, ECW_SRC_GET(*state->control, 1, LOCATION));
+	execute_resolve_operand_(state, BUS_DEST, ECW_GET(*state->control, DEST));
+}
+
 static void
 execute_half1_mem_wait_ (pilot_execute_state *state)
 {
@@ -359,9 +279,9 @@ execute_half1_mem_wait_ (pilot_execute_state *state)
 				state->mem_data = Pilot_mem_get_data(state->sys);
 			}
 		}
-		else if (state->control->srcs[0].location == DATA_LATCH_MEM_DATA
-			|| state->control->srcs[1].location == DATA_LATCH_MEM_DATA
-			|| state->control->dest == DATA_LATCH_MEM_DATA)
+		else if (ECW_SRC_GET(*state->control, 0, LOCATION) == DATA_LATCH_MEM_DATA
+			|| ECW_SRC_GET(*state->control, 1, LOCATION) == DATA_LATCH_MEM_DATA
+			|| ECW_GET(*state->control, DEST) == DATA_LATCH_MEM_DATA)
 		{
 			return;
 		}
@@ -369,14 +289,25 @@ execute_half1_mem_wait_ (pilot_execute_state *state)
 	state->execution_phase = EXEC_HALF1_OPERAND_LATCH;
 }
 
+static inline void
+execute_half1_operand_latch_ (pilot_execute_state *state)
+{
+	if (state->bus_touches_flags[0] || state->bus_touches_flags[1])
+	{
+		pilot_execute_materialize_flags(&state->sys->core);
+	}
+	state->alu_input_latches[0] = BUS_READ_(&state->bus[0]);
+	state->alu_input_latches[1] = BUS_READ_(&state->bus[1]);
+}
+
 static void
 execute_half1_mem_prepare_ (pilot_execute_state *state)
 {
-	if (state->control->mem_latch_ctl == MEM_LATCH_HALF1)
+	if (ECW_GET(*state->control, MEM_LATCH_CTL) == MEM_LATCH_HALF1)
 	{
-		if (state->control->mem_write_ctl != MEM_READ)
+		if (ECW_GET(*state->control, MEM_WRITE_CTL) != MEM_READ)
 		{
-			switch (state->control->mem_write_ctl)
+			switch (ECW_GET(*state->control, MEM_WRITE_CTL))
 			{
 				case MEM_WRITE_FROM_SRC1:
 					state->mem_data = state->alu_input_latches[1];
@@ -399,11 +330,12 @@ execute_half1_mem_prepare_ (pilot_execute_state *state)
 static void
 execute_half1_mem_assert_ (pilot_execute_state *state)
 {
-	if (state->control->mem_latch_ctl == MEM_LATCH_HALF1 && !state->control->mem_access_suppress)
+	if (ECW_GET(*state->control, MEM_LATCH_CTL) == MEM_LATCH_HALF1 && !ECW_GET(*state->control, MEM_ACCESS_SUPPRESS))
 	{
-		if (state->control->mem_write_ctl == MEM_READ)
+		if (ECW_GET(*state->control, MEM_WRITE_CTL) == MEM_READ)
 		{
-			if (!Pilot_mem_addr_read_assert(state->sys, state->mem_addr))
+			// The address is only taken if the memory controller was ready
+			if (Pilot_mem_addr_read_assert(state->sys, state->mem_addr) != MCTL_READY)
 			{
 				return;
 			}
@@ -411,10 +343,11 @@ execute_half1_mem_assert_ (pilot_execute_state *state)
 		}
 		else
 		{
-			if (!Pilot_mem_addr_write_assert(state->sys, state->mem_addr, state->mem_data))
+			if (Pilot_mem_addr_write_assert(state->sys, state->mem_addr, state->mem_data) != MCTL_READY)
 			{
 				return;
 			}
+			state->mem_access_was_read = FALSE;
 		}
 		state->mem_access_waiting = TRUE;
 	}
@@ -436,8 +369,7 @@ pilot_execute_half1 (pilot_execute_state *state)
 	
 	if (state->execution_phase == EXEC_HALF1_OPERAND_LATCH)
 	{
-		state->alu_input_latches[0] = fetch_data_(state, state->control->srcs[0].location);
-		state->alu_input_latches[1] = fetch_data_(state, state->control->srcs[1].location);
+		execute_half1_operand_latch_(state);
 		state->execution_phase = EXEC_HALF1_MEM_PREPARE;
 	}
 	
@@ -452,28 +384,46 @@ pilot_execute_half1 (pilot_execute_state *state)
 	}
 }
 
+/*
+ * ALU kernels
+ *
+ * The result latch is written once, as alu_result_latch_, and instantiated for every combination of operation,
+ * source sizes and shifter mode, which are then all constants for the compiler to fold. The decode stage picks the
+ * kernel for each control word up front (pilot_execute_select_alu_kernel) and stores its index in ALU_KERNEL, so
+ * running a control word costs one indirect call instead of a string of size and mode tests.
+ */
+static inline uint32_t
+alu_size_mask_ (data_size_spec size)
+{
+	return (size == SIZE_8_BIT) ? 0xff : (size == SIZE_16_BIT) ? 0xffff : 0xffffff;
+}
+
+static inline uint32_t
+alu_input_ (uint32_t value, data_size_spec size, bool sign_extend)
+{
+	value &= alu_size_mask_(size);
+	if (size == SIZE_8_BIT && sign_extend && (value & 0x80))
+	{
+		value |= 0xffffff00;
+	}
+	else if (size == SIZE_16_BIT && sign_extend && (value & 0x8000))
+	{
+		value |= 0xffff0000;
+	}
+	return value;
+}
+
 static inline uint16_t
-alu_operate_shifter_ (pilot_execute_state *state, uint16_t operand)
+alu_operate_shifter_ (pilot_execute_state *state, uint16_t operand, data_size_spec size, shifter_mode_spec mode)
 {
 	bool inject_bit;
 	bool msb_bit;
 	bool lsb_bit = operand & 1;
-	bool carry_flag = (fetch_data_(state, DATA_REG__F) & F_CARRY) != 0;
+	uint8_t msb_shift = (size == SIZE_8_BIT) ? 7 : (size == SIZE_16_BIT) ? 15 : 23;
 	
-	if (state->control->srcs[1].size == SIZE_8_BIT)
-	{
-		msb_bit = (operand & 0x80) != 0;
-	}
-	else if (state->control->srcs[1].size == SIZE_16_BIT)
-	{
-		msb_bit = (operand & 0x8000) != 0;
-	}
-	else
-	{
-		msb_bit = (operand & 0x800000) != 0;
-	}
+	msb_bit = ((uint32_t)operand >> msb_shift) & 1;
 	
-	switch (state->control->shifter_mode)
+	switch (mode)
 	{
 		case SHIFTER_NONE:
 		case SHIFTER_LEFT:
@@ -482,7 +432,8 @@ alu_operate_shifter_ (pilot_execute_state *state, uint16_t operand)
 			break;
 		case SHIFTER_LEFT_CARRY:
 		case SHIFTER_RIGHT_CARRY:
-			inject_bit = carry_flag;
+			pilot_execute_materialize_flags(&state->sys->core);
+			inject_bit = (state->sys->core.wf & F_CARRY) != 0;
 			break;
 		case SHIFTER_LEFT_BARREL:
 		case SHIFTER_RIGHT_ARITH:
@@ -493,16 +444,17 @@ alu_operate_shifter_ (pilot_execute_state *state, uint16_t operand)
 			break;
 		default:
 			execute_unreachable_();
+			return operand;
 	}
 	
-	switch (state->control->shifter_mode)
+	switch (mode)
 	{
 		case SHIFTER_NONE:
 			break;
 		case SHIFTER_LEFT:
 		case SHIFTER_LEFT_CARRY:
 		case SHIFTER_LEFT_BARREL:
-			state->alu_shifter_carry_bit = msb_bit ^ state->control->invert_carries;
+			state->alu_shifter_carry_bit = msb_bit ^ ECW_GET(*state->control, INVERT_CARRIES);
 			operand <<= 1;
 			operand |= inject_bit;
 			break;
@@ -510,20 +462,9 @@ alu_operate_shifter_ (pilot_execute_state *state, uint16_t operand)
 		case SHIFTER_RIGHT_ARITH:
 		case SHIFTER_RIGHT_CARRY:
 		case SHIFTER_RIGHT_BARREL:
-			state->alu_shifter_carry_bit = lsb_bit ^ state->control->invert_carries;
+			state->alu_shifter_carry_bit = lsb_bit ^ ECW_GET(*state->control, INVERT_CARRIES);
 			operand >>= 1;
-			if (state->control->srcs[1].size == SIZE_8_BIT)
-			{
-				operand |= inject_bit << 7;
-			}
-			else if (state->control->srcs[1].size == SIZE_16_BIT)
-			{
-				operand |= inject_bit << 15;
-			}
-			else
-			{
-				operand |= inject_bit << 23;
-			}
+			operand |= (uint32_t)inject_bit << msb_shift;
 			break;
 		default:
 			execute_unreachable_();
@@ -533,27 +474,30 @@ alu_operate_shifter_ (pilot_execute_state *state, uint16_t operand)
 }
 
 static inline uint8_t
-alu_modify_flags_ (pilot_execute_state *state, uint8_t flags, uint32_t operands[2], uint32_t result, uint32_t carries)
+alu_modify_flags_ (const Pilot_lazy_flags *lazy, uint8_t flags, data_size_spec size)
 {
 	bool alu_carry;
 	bool alu_overflow;
 	bool alu_zero;
 	bool alu_neg;
 	uint8_t flag_source_word = 0;
+	const uint32_t *operands = lazy->operands;
+	uint32_t result = lazy->result;
+	uint32_t carries = lazy->carries;
 	
 	uint32_t alu_parity = result;
 	alu_parity = alu_parity ^ alu_parity >> 4;
 	alu_parity = alu_parity ^ alu_parity >> 2;
 	alu_parity = alu_parity ^ alu_parity >> 1;
 	
-	if (state->control->srcs[0].size == SIZE_8_BIT)
+	if (size == SIZE_8_BIT)
 	{
 		alu_carry = (carries & 0x80) != 0;
 		alu_neg = (result & 0x80) != 0;
 		alu_overflow = ((operands[1] ^ result) & (operands[0] ^ result) & 0x80) != 0;
 		alu_zero = (result & 0xff) == 0;
 	}
-	else if (state->control->srcs[0].size == SIZE_16_BIT)
+	else if (size == SIZE_16_BIT)
 	{
 		alu_carry = (carries & 0x8000) != 0;
 		alu_neg = (result & 0x8000) != 0;
@@ -569,17 +513,17 @@ alu_modify_flags_ (pilot_execute_state *state, uint8_t flags, uint32_t operands[
 		alu_zero = (result) == 0;
 		alu_parity ^= (alu_parity >> 8) ^ (alu_parity >> 16);
 	}
-	alu_carry ^= state->control->invert_carries;
+	alu_carry ^= ECW_GET(lazy->control, INVERT_CARRIES);
 	
 	// S - Sign/negative flag
 	flag_source_word |= alu_neg << 7;
 	// Z - Zero flag
 	flag_source_word |= alu_zero << 6;
 	// V - Overflow/parity flag
-	switch (state->control->flag_v_mode)
+	switch (ECW_GET(lazy->control, FLAG_V_MODE))
 	{
 		case FLAG_V_NORMAL:
-			if (state->control->operation == ALU_ADD)
+			if (ECW_GET(lazy->control, OPERATION) == ALU_ADD)
 			{
 				// overflow
 				flag_source_word |= alu_overflow << 2;
@@ -591,7 +535,7 @@ alu_modify_flags_ (pilot_execute_state *state, uint8_t flags, uint32_t operands[
 			}
 			break;
 		case FLAG_V_SHIFTER_CARRY:
-			flag_source_word |= (state->alu_shifter_carry_bit != 0) << 2;
+			flag_source_word |= (lazy->shifter_carry != 0) << 2;
 			break;
 		case FLAG_V_CLEAR:
 			break;
@@ -603,80 +547,160 @@ alu_modify_flags_ (pilot_execute_state *state, uint8_t flags, uint32_t operands[
 	flag_source_word |= alu_carry << 1;
 	flag_source_word |= alu_carry;
 	
-	flags &= ~state->control->flag_write_mask;
-	flags |= (flag_source_word & state->control->flag_write_mask);
+	flags &= ~ECW_GET(lazy->control, FLAG_WRITE_MASK);
+	flags |= (flag_source_word & ECW_GET(lazy->control, FLAG_WRITE_MASK));
 	
 	return flags;
 }
 
-static void
-execute_half2_result_latch_ (pilot_execute_state *state)
+#define ALU_FLAGS_KERNEL_(size) \
+	static uint8_t \
+	alu_flags_##size##_ (const Pilot_lazy_flags *lazy, uint8_t flags) \
+	{ \
+		return alu_modify_flags_(lazy, flags, size); \
+	}
+
+ALU_FLAGS_KERNEL_(SIZE_8_BIT)
+ALU_FLAGS_KERNEL_(SIZE_16_BIT)
+ALU_FLAGS_KERNEL_(SIZE_24_BIT)
+
+// Indexed by the size of the first ALU source; the unused fourth size works as 24 bits
+static uint8_t (*const alu_flags_kernels_[])(const Pilot_lazy_flags *, uint8_t) =
 {
-	int i;
-	uint32_t operands[2];
-	uint32_t carries;
+	alu_flags_SIZE_8_BIT_, alu_flags_SIZE_16_BIT_, alu_flags_SIZE_24_BIT_, alu_flags_SIZE_24_BIT_
+};
+
+// Brings F up to date with the last flag-setting ALU operation
+void
+pilot_execute_materialize_flags (Pilot_cpu_regs *core)
+{
+	if (!core->lazy_flags.pending)
+	{
+		return;
+	}
+	core->wf = (core->wf & ~0xff)
+		| alu_flags_kernels_[ECW_SRC_GET(core->lazy_flags.control, 0, SIZE)](&core->lazy_flags, core->wf & 0xff);
+	core->lazy_flags.pending = FALSE;
+}
+
+// Records the inputs of a flag-setting ALU operation in place of computing its flags
+static inline void
+alu_record_flags_ (pilot_execute_state *state, uint32_t operands[2], uint32_t carries)
+{
+	Pilot_cpu_regs *core = &state->sys->core;
+	uint8_t write_mask = ECW_GET(*state->control, FLAG_WRITE_MASK);
 	
-	alu_src_control *src2 = &state->control->srcs[1];
-	uint8_t flags = fetch_data_(state, DATA_REG__F);
-	bool carry_flag_status = (flags & F_CARRY) != 0;
-	for (i = 0; i < 2; i++)
+	if (!write_mask)
 	{
-		alu_src_control *src = &state->control->srcs[i];
-		operands[i] = state->alu_input_latches[i];
-		if (src->size == SIZE_8_BIT)
-		{
-			operands[i] &= 0xff;
-			if (src->sign_extend && (operands[i] & 0x80))
-			{
-				operands[i] |= 0xffffff00;
-			}
-		}
-		else if (src->size == SIZE_16_BIT)
-		{
-			operands[i] &= 0xffff;
-			if (src->sign_extend && (operands[i] & 0x8000))
-			{
-				operands[i] |= 0xffff0000;
-			}
-		}
-		else
-		{
-			operands[i] &= 0xffffff;
-		}
+		return;
+	}
+	// A pending operation can only be dropped if this one overwrites every flag it would have set
+	if (core->lazy_flags.pending && (ECW_GET(core->lazy_flags.control, FLAG_WRITE_MASK) & ~write_mask))
+	{
+		pilot_execute_materialize_flags(core);
 	}
+	core->lazy_flags.control = *state->control;
+	core->lazy_flags.operands[0] = operands[0];
+	core->lazy_flags.operands[1] = operands[1];
+	core->lazy_flags.result = state->alu_output_latch;
+	core->lazy_flags.carries = carries;
+	core->lazy_flags.shifter_carry = state->alu_shifter_carry_bit;
+	core->lazy_flags.pending = TRUE;
+#ifdef PILOT_EAGER_FLAGS
+	pilot_execute_materialize_flags(core);
+#endif
+}
+
+bool
+pilot_execute_test_cond (Pilot_cpu_regs *core, branch_cond_spec cond)
+{
+	uint8_t flags;
+	bool n, z, v, c;
 	
-	if (state->control->src2_add1)
+	if (cond == COND_ALWAYS || cond == COND_ALWAYS_CALL)
+	{
+		return TRUE;
+	}
+	pilot_execute_materialize_flags(core);
+	flags = core->wf & 0xff;
+	n = (flags & F_NEG) != 0;
+	z = (flags & F_ZERO) != 0;
+	v = (flags & F_OVERFLOW) != 0;
+	c = (flags & F_CARRY) != 0;
+	
+	switch (cond)
+	{
+		case COND_LE:
+			return z || (n != v);
+		case COND_GT:
+			return !z && (n == v);
+		case COND_LT:
+			return n != v;
+		case COND_GE:
+			return n == v;
+		case COND_U_LE:
+			return c || z;
+		case COND_U_GT:
+			return !c && !z;
+		case COND_C:
+			return c;
+		case COND_NC:
+			return !c;
+		case COND_M:
+			return n;
+		case COND_P:
+			return !n;
+		case COND_V:
+			return v;
+		case COND_NV:
+			return !v;
+		case COND_Z:
+			return z;
+		case COND_NZ:
+			return !z;
+		default:
+			execute_unreachable_();
+			return FALSE;
+	}
+}
+
+static inline void
+alu_result_latch_ (pilot_execute_state *state, alu_operation_spec operation, data_size_spec size0, data_size_spec size1,
+	shifter_mode_spec shifter_mode)
+{
+	uint32_t operands[2];
+	uint32_t carries;
+	Pilot_cpu_regs *core = &state->sys->core;
+	
+	operands[0] = alu_input_(state->alu_input_latches[0], size0, state->alu_input_sign_extend[0]);
+	operands[1] = alu_input_(state->alu_input_latches[1], size1, state->alu_input_sign_extend[1]);
+	
+	if (ECW_GET(*state->control, SRC2_ADD1))
 	{
 		operands[1] += 1;
 	}
-	else if (state->control->src2_add_carry)
+	else if (ECW_GET(*state->control, SRC2_ADD_CARRY))
 	{
-		operands[1] += carry_flag_status;
+		pilot_execute_materialize_flags(core);
+		operands[1] += (core->wf & F_CARRY) != 0;
 	}
 	
-	if (state->control->src2_negate)
+	if (ECW_GET(*state->control, SRC2_NEGATE))
 	{
 		operands[1] = ~operands[1] + 1;
-		if (src2->size == SIZE_8_BIT && !src2->sign_extend)
-		{
-			operands[1] &= 0xff;
-		}
-		else if (src2->size == SIZE_16_BIT && !src2->sign_extend)
+		if (!state->alu_input_sign_extend[1])
 		{
-			operands[1] &= 0xffff;
-		}
-		else if (!src2->sign_extend)
-		{
-			operands[1] &= 0xffffff;
+			operands[1] &= alu_size_mask_(size1);
 		}
 	}
 	
 	state->alu_shifter_carry_bit = FALSE;
-	operands[1] = alu_operate_shifter_(state, operands[1]);
+	operands[1] = alu_operate_shifter_(state, operands[1], size1, shifter_mode);
 
-	switch (state->control->operation)
+	switch (operation)
 	{
 		case ALU_OFF:
+			carries = 0;
 			break;
 		case ALU_ADD:
 			state->alu_output_latch = (operands[0] + operands[1]) & 0xffffff;
@@ -696,34 +720,106 @@ execute_half2_result_latch_ (pilot_execute_state *state)
 			break;
 		default:
 			execute_unreachable_();
+			return;
 	}
 	
-	if ((state->control->srcs[0].size == SIZE_8_BIT) && (flags & F_DECIMAL) && (carries & 0x08))
+	// ALU operations don't normally write D, so it can be read without bringing F up to date
+	if (core->lazy_flags.pending && (ECW_GET(core->lazy_flags.control, FLAG_WRITE_MASK) & F_DECIMAL))
+	{
+		pilot_execute_materialize_flags(core);
+	}
+	if (size0 == SIZE_8_BIT && (core->wf & F_DECIMAL) && (carries & 0x08))
 	{
 		state->alu_output_latch = state->alu_output_latch + 0x10;
 		carries = (carries & 0x0f) | ((operands[0] ^ operands[1] ^ state->alu_output_latch) & 0xf0);
 	}
 	
-	if (state->control->operation != ALU_OFF)
+	if (operation != ALU_OFF)
 	{
-		flags = alu_modify_flags_(state, flags, operands, state->alu_output_latch, carries);
+		alu_record_flags_(state, operands, carries);
+		if (state->bus_touches_flags[BUS_DEST])
+		{
+			pilot_execute_materialize_flags(core);
+		}
+		BUS_WRITE_(&state->bus[BUS_DEST], state->alu_output_latch);
+		state->pgc_written |= (state->bus[BUS_DEST].reg == &core->file[REGFILE_PGC]);
 	}
-	
+}
+
+#define ALU_KERNEL_NAME_(op, size0, size1, shift) alu_kernel_##op##_##size0##_##size1##_##shift##_
+#define ALU_KERNEL_(op, size0, size1, shift) \
+	static void \
+	ALU_KERNEL_NAME_(op, size0, size1, shift) (pilot_execute_state *state) \
+	{ \
+		alu_result_latch_(state, op, size0, size1, shift); \
+	}
+#define ALU_KERNEL_ENTRY_(op, size0, size1, shift) ALU_KERNEL_NAME_(op, size0, size1, shift),
+
+// Expands f for every kernel, in the order of their indices: operation (ALU_OFF to ALU_XOR), then the sizes of
+// sources 0 and 1, then the shifter mode
+#define ALU_FOR_SHIFTERS_(f, op, size0, size1) \
+	f(op, size0, size1, 0) f(op, size0, size1, 1) f(op, size0, size1, 2) f(op, size0, size1, 3) \
+	f(op, size0, size1, 4) f(op, size0, size1, 5) f(op, size0, size1, 6) f(op, size0, size1, 7)
+#define ALU_FOR_SIZE1_(f, op, size0) \
+	ALU_FOR_SHIFTERS_(f, op, size0, 0) ALU_FOR_SHIFTERS_(f, op, size0, 1) ALU_FOR_SHIFTERS_(f, op, size0, 2)
+#define ALU_FOR_SIZE0_(f, op) ALU_FOR_SIZE1_(f, op, 0) ALU_FOR_SIZE1_(f, op, 1) ALU_FOR_SIZE1_(f, op, 2)
+#define ALU_FOR_KERNELS_(f) \
+	ALU_FOR_SIZE0_(f, 0) ALU_FOR_SIZE0_(f, 1) ALU_FOR_SIZE0_(f, 2) ALU_FOR_SIZE0_(f, 3) ALU_FOR_SIZE0_(f, 4)
+
+#define ALU_KERNEL_INVALID_ ((ALU_XOR + 1) * 3 * 3 * 8)
+
+ALU_FOR_KERNELS_(ALU_KERNEL_)
+
+static void
+alu_kernel_invalid_ (pilot_execute_state *state)
+{
+	(void)state;
+	execute_unreachable_();
+}
+
+static void (*const alu_kernels_[ALU_KERNEL_INVALID_ + 1])(pilot_execute_state *) =
+{
+	ALU_FOR_KERNELS_(ALU_KERNEL_ENTRY_)
+	alu_kernel_invalid_
+};
+
+void
+pilot_execute_select_alu_kernel (execute_control_word *control)
+{
+	uint32_t operation = ECW_GET(*control, OPERATION);
+	uint32_t size0 = ECW_SRC_GET(*control, 0, SIZE);
+	uint32_t size1 = ECW_SRC_GET(*control, 1, SIZE);
+	uint32_t kernel = ALU_KERNEL_INVALID_;
+
+	// The unused fourth size works as 24 bits, as it always has
+	size0 = (size0 > SIZE_24_BIT) ? SIZE_24_BIT : size0;
+	size1 = (size1 > SIZE_24_BIT) ? SIZE_24_BIT : size1;
+	if (operation <= ALU_XOR)
+	{
+		kernel = ((operation * 3 + size0) * 3 + size1) * 8 + ECW_GET(*control, SHIFTER_MODE);
+	}
+	ECW_SET(*control, ALU_KERNEL, kernel);
+}
+
+static void
+execute_half2_result_latch_ (pilot_execute_state *state)
+{
+	alu_kernels_[ECW_GET(*state->control, ALU_KERNEL)](state);
 	state->execution_phase = EXEC_HALF2_MEM_PREPARE;
 }
 
 static void
 execute_half2_mem_prepare_ (pilot_execute_state *state)
 {
-	if (state->control->mem_latch_ctl == MEM_LATCH_HALF2)
+	if (ECW_GET(*state->control, MEM_LATCH_CTL) == MEM_LATCH_HALF2)
 	{
 		state->mem_addr = state->alu_output_latch;
 	}
-	if (state->control->mem_latch_ctl >= MEM_LATCH_HALF2)
+	if (ECW_GET(*state->control, MEM_LATCH_CTL) >= MEM_LATCH_HALF2)
 	{
-		if (state->control->mem_write_ctl != MEM_READ)
+		if (ECW_GET(*state->control, MEM_WRITE_CTL) != MEM_READ)
 		{
-			switch (state->control->mem_write_ctl)
+			switch (ECW_GET(*state->control, MEM_WRITE_CTL))
 			{
 				case MEM_WRITE_FROM_SRC1:
 					// MEM_WRITE_FROM_SRC1 should only be used in cycle 1!
@@ -747,12 +843,11 @@ execute_half2_mem_prepare_ (pilot_execute_state *state)
 static void
 execute_half2_mem_assert_ (pilot_execute_state *state)
 {
-	if (state->control->mem_latch_ctl >= MEM_LATCH_HALF2 && !state->control->mem_access_suppress)
+	if (ECW_GET(*state->control, MEM_LATCH_CTL) >= MEM_LATCH_HALF2 && !ECW_GET(*state->control, MEM_ACCESS_SUPPRESS))
 	{
-		if (state->control->mem_write_ctl == MEM_READ)
+		if (ECW_GET(*state->control, MEM_WRITE_CTL) == MEM_READ)
 		{
-			if (!Pilot_mem_addr_read_assert(
-				state->sys, state->mem_addr))
+			if (Pilot_mem_addr_read_assert(state->sys, state->mem_addr) != MCTL_READY)
 			{
 				return;
 			}
@@ -760,10 +855,11 @@ execute_half2_mem_assert_ (pilot_execute_state *state)
 		}
 		else
 		{
-			if (!Pilot_mem_addr_write_assert(state->sys, state->mem_addr, state->mem_data))
+			if (Pilot_mem_addr_write_assert(state->sys, state->mem_addr, state->mem_data) != MCTL_READY)
 			{
 				return;
 			}
+			state->mem_access_was_read = FALSE;
 		}
 		state->mem_access_waiting = TRUE;
 	}
@@ -797,12 +893,11 @@ pilot_execute_half2 (pilot_execute_state *state)
 bool
 pilot_execute_sequencer_mucode_run (pilot_execute_state *state)
 {
-	mucode_entry decoded;
+	const mucode_entry *decoded = pilot_mucode_lookup(state->mucode_control);
 	
-	decoded = decode_mucode_entry(state->mucode_control);
-	state->mucode_control = decoded.next;
-	state->mucode_decoded_buffer = decoded.operation;
-	state->control = &state->mucode_decoded_buffer;
+	state->mucode_control = decoded->next;
+	state->control = &decoded->operation;
+	execute_resolve_bus_(state);
 	
 	// Return TRUE if there's another microcode entry to be run
 	if (state->mucode_control.entry_idx != MU_NONE)
@@ -817,10 +912,10 @@ pilot_execute_sequencer_advance (pilot_execute_state *state)
 {
 	if (state->sequencer_phase == EXEC_SEQ_CORE_OP_EXECUTED)
 	{
-		if (state->decoded_inst.run_after.entry_idx != MU_NONE)
+		if (state->decoded_inst->run_after.entry_idx != MU_NONE)
 		{
 			state->sequencer_phase = EXEC_SEQ_RUN_AFTER;
-			state->mucode_control = state->decoded_inst.run_after;
+			state->mucode_control = state->decoded_inst->run_after;
 		}
 		else
 		{
@@ -837,23 +932,27 @@ pilot_execute_sequencer_advance (pilot_execute_state *state)
 	{
 		if (state->sys->interconnects.decoded_inst_semaph)
 		{
-			state->decoded_inst = *state->sys->interconnects.decoded_inst;
+			pilot_interconnect *interconnects = &state->sys->interconnects;
+			state->decoded_inst = &interconnects->decoded_insts[interconnects->decoded_inst_slot];
 			state->sys->interconnects.decoded_inst_semaph = FALSE;
+			// PGC relative operands are relative to the instruction being run
+			state->sys->core.pgc = state->decoded_inst->inst_pgc;
+			state->insts_taken++;
 			state->sequencer_phase = EXEC_SEQ_EVAL_CONTROL;
 		}
 	}
 	
 	if (state->sequencer_phase == EXEC_SEQ_EVAL_CONTROL)
 	{
-		if (state->decoded_inst.override_op.entry_idx != MU_NONE)
+		if (state->decoded_inst->override_op.entry_idx != MU_NONE)
 		{
 			state->sequencer_phase = EXEC_SEQ_OVERRIDE_OP;
-			state->mucode_control = state->decoded_inst.override_op;
+			state->mucode_control = state->decoded_inst->override_op;
 		}
-		else if (state->decoded_inst.run_before.entry_idx != MU_NONE)
+		else if (state->decoded_inst->run_before.entry_idx != MU_NONE)
 		{
 			state->sequencer_phase = EXEC_SEQ_RUN_BEFORE;
-			state->mucode_control = state->decoded_inst.run_before;
+			state->mucode_control = state->decoded_inst->run_before;
 		}
 		else
 		{
@@ -871,7 +970,12 @@ pilot_execute_sequencer_advance (pilot_execute_state *state)
 	
 	if (state->sequencer_phase == EXEC_SEQ_RUN_BEFORE)
 	{
-		if (!pilot_execute_sequencer_mucode_run(state))
+		// core_op is latched on the advance after the last run_before entry, not in place of it
+		if (state->mucode_control.entry_idx != MU_NONE)
+		{
+			pilot_execute_sequencer_mucode_run(state);
+		}
+		else
 		{
 			state->sequencer_phase = EXEC_SEQ_CORE_OP;
 		}
@@ -879,7 +983,8 @@ pilot_execute_sequencer_advance (pilot_execute_state *state)
 	
 	if (state->sequencer_phase == EXEC_SEQ_CORE_OP)
 	{
-		state->control = &state->decoded_inst.core_op;
+		state->control = &state->decoded_inst->core_op;
+		execute_resolve_bus_(state);
 		state->sequencer_phase = EXEC_SEQ_CORE_OP_EXECUTED;
 	}
 	
@@ -890,5 +995,107 @@ pilot_execute_sequencer_advance (pilot_execute_state *state)
 			state->sequencer_phase = EXEC_SEQ_FINAL_STEPS;
 		}
 	}
+	
+	// Every phase but WAIT_NEXT_INS has latched a new control word to run. Otherwise, the sequencer has to be
+	// advanced again once the decode stage dispatches something.
+	if (state->sequencer_phase == EXEC_SEQ_WAIT_NEXT_INS)
+	{
+		state->execution_phase = EXEC_ADVANCE_SEQUENCER;
+	}
+	else
+	{
+		state->execution_phase = EXEC_HALF1_READY;
+	}
+}
+
+
+/*
+ * Instruction-level execution
+ *
+ * Runs control words one at a time to completion, with the same operand routing and ALU as the pipeline. Memory
+ * accesses are done on the spot rather than through the memory controller, so they're visible to the very next
+ * control word, as they would be once the pipeline had waited for them.
+ *
+ * Each control word takes one cycle, plus the wait states of any memory access it makes.
+ */
+static unsigned
+execute_mem_access_sync_ (pilot_execute_state *state)
+{
+	uint16_t data;
+	unsigned cycles;
+
+	if (ECW_GET(*state->control, MEM_WRITE_CTL) == MEM_READ)
+	{
+		cycles = Pilot_mem_read_sync(state->sys, state->mem_addr, &data);
+		state->mem_data = data;
+	}
+	else
+	{
+		cycles = Pilot_mem_write_sync(state->sys, state->mem_addr, state->mem_data);
+	}
+	return cycles - 1;
+}
+
+void
+pilot_execute_resolve_control (pilot_execute_state *state, const execute_control_word *control)
+{
+	state->control = control;
+	execute_resolve_bus_(state);
 }
 
+unsigned
+pilot_execute_run_control (pilot_execute_state *state, const execute_control_word *control)
+{
+	unsigned cycles = 1;
+	bool mem_access = !ECW_GET(*control, MEM_ACCESS_SUPPRESS);
+
+	state->control = control;
+	execute_resolve_bus_(state);
+
+	execute_half1_operand_latch_(state);
+	execute_half1_mem_prepare_(state);
+	if (mem_access && ECW_GET(*control, MEM_LATCH_CTL) == MEM_LATCH_HALF1)
+	{
+		cycles += execute_mem_access_sync_(state);
+	}
+
+	execute_half2_result_latch_(state);
+	execute_half2_mem_prepare_(state);
+	if (mem_access && ECW_GET(*control, MEM_LATCH_CTL) >= MEM_LATCH_HALF2)
+	{
+		cycles += execute_mem_access_sync_(state);
+	}
+	return cycles;
+}
+
+static unsigned
+execute_run_mucode_sync_ (pilot_execute_state *state, mucode_entry_spec spec)
+{
+	unsigned cycles = 0;
+	while (spec.entry_idx != MU_NONE)
+	{
+		const mucode_entry *entry = pilot_mucode_lookup(spec);
+		cycles += pilot_execute_run_control(state, &entry->operation);
+		spec = entry->next;
+	}
+	return cycles;
+}
+
+// Runs an instruction's control words in the order the sequencer would
+unsigned
+pilot_execute_run_inst (pilot_execute_state *state, const inst_decoded_flags *inst)
+{
+	unsigned cycles;
+
+	state->decoded_inst = inst;
+	state->insts_taken++;
+	state->pgc_written = FALSE;
+	if (inst->override_op.entry_idx != MU_NONE)
+	{
+		return execute_run_mucode_sync_(state, inst->override_op);
+	}
+	cycles = execute_run_mucode_sync_(state, inst->run_before);
+	cycles += pilot_execute_run_control(state, &state->decoded_inst->core_op);
+	cycles += execute_run_mucode_sync_(state, inst->run_after);
+	return cycles;
+}
@@ -1,4 +1,123 @@
 
+#ifndef __CPU_EXECUTE_H__
+#define __CPU_EXECUTE_H__
+
 #include "types.h"
+#include "cpu_regs.h"
+
+// A data bus specifier resolved against the current instruction: a field of a 32-bit register or latch
+typedef struct
+{
+	uint32_t *reg;
+	uint32_t mask;
+	uint8_t shift;
+} exec_bus_operand;
+
+typedef struct {
+	Pilot_system *sys;
+	
+	const inst_decoded_flags *decoded_inst;
+	// Number of instructions taken up so far, by either engine
+	uint64_t insts_taken;
+	// Set when the instruction pilot_execute_run_inst last ran wrote PGC, whatever value it wrote
+	bool pgc_written;
+	mucode_entry_spec mucode_control;
+	const execute_control_word *control;
+	
+	uint32_t alu_input_latches[2];
+	// Sign extension of each ALU input; normally from control, but register indexed sources pick their own
+	bool alu_input_sign_extend[2];
+	uint32_t alu_output_latch;
+	bool alu_shifter_carry_bit;
+	
+	// Latches reachable from the data bus. Writes to bus_zero are always masked out.
+	union
+	{
+		uint32_t bus_latches[6];
+		struct
+		{
+			uint32_t bus_zero;
+			// Memory address and data registers for requesting memory accesses
+			uint32_t mem_addr;
+			uint32_t mem_data;
+			// Values of immediate and otherwise constant operands, one per bus operand slot
+			uint32_t bus_consts[3];
+		};
+	};
+	// Operands of the current control word, resolved by execute_resolve_bus_
+	exec_bus_operand bus[3];
+	// Set for operands overlapping F, which has to be brought up to date before they're read or written
+	bool bus_touches_flags[3];
+	
+	// When reading memory, this flag will be high until the memory access has been completed.
+	// During this time, any reads from mem_data will block until this flag goes low.
+	bool mem_access_waiting;
+	bool mem_access_was_read;
+	
+	enum
+	{
+		EXEC_HALF1_READY,
+		EXEC_HALF1_MEM_WAIT,
+		EXEC_HALF1_OPERAND_LATCH,
+		EXEC_HALF1_MEM_PREPARE,
+		EXEC_HALF1_MEM_ASSERT,
+		
+		EXEC_HALF2_READY,
+		EXEC_HALF2_RESULT_LATCH,
+		EXEC_HALF2_MEM_PREPARE,
+		EXEC_HALF2_MEM_ASSERT,
+		
+		EXEC_ADVANCE_SEQUENCER,
+		EXEC_EXCEPTION
+	} execution_phase;
+	
+	enum
+	{
+		EXEC_SEQ_WAIT_NEXT_INS,
+		EXEC_SEQ_EVAL_CONTROL,
+		EXEC_SEQ_OVERRIDE_OP,
+		EXEC_SEQ_RUN_BEFORE,
+		EXEC_SEQ_CORE_OP,
+		EXEC_SEQ_CORE_OP_EXECUTED,
+		EXEC_SEQ_RUN_AFTER,
+		EXEC_SEQ_FINAL_STEPS,
+		EXEC_SEQ_SIGNAL_BRANCH,
+	} sequencer_phase;
+} pilot_execute_state;
+
+void pilot_execute_half1 (pilot_execute_state *state);
+void pilot_execute_half2 (pilot_execute_state *state);
+void pilot_execute_sequencer_advance (pilot_execute_state *state);
+
+// Instruction-level execution; each returns the number of cycles taken
+unsigned pilot_execute_run_control (pilot_execute_state *state, const execute_control_word *control);
+unsigned pilot_execute_run_inst (pilot_execute_state *state, const inst_decoded_flags *inst);
+
+// Latches a control word and resolves its bus operands against state->decoded_inst, without running it
+void pilot_execute_resolve_control (pilot_execute_state *state, const execute_control_word *control);
+
+// Sets a control word's ALU_KERNEL field from its other fields
+void pilot_execute_select_alu_kernel (execute_control_word *control);
 
 mucode_entry decode_mucode_entry (mucode_entry_spec spec);
+
+// Builds the microcode ROM from decode_mucode_entry, once per process; safe to call from any thread.
+// Pilot_system_reset calls it.
+void pilot_mucode_init_rom (void);
+
+// Looks up the microcode ROM entry for a spec. The entry is never modified, so it can be executed in place.
+const mucode_entry *pilot_mucode_lookup (mucode_entry_spec spec);
+
+// Position of a ROM entry's control word in the ROM, or -1 if it isn't one, and back (NULL if out of range); for
+// storing the sequencer's control word pointer in savestates
+int32_t pilot_mucode_rom_index (const execute_control_word *control);
+const execute_control_word *pilot_mucode_rom_control (uint32_t index);
+
+// Writes the flags of the last flag-setting ALU operation to F, if they're still pending. Anything reading F from
+// outside the execute stage (branches, savestates, debuggers) has to call this first.
+void pilot_execute_materialize_flags (Pilot_cpu_regs *core);
+
+// Evaluates a branch condition against F
+bool pilot_execute_test_cond (Pilot_cpu_regs *core, branch_cond_spec cond);
+
+#endif
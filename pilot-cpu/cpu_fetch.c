@@ -0,0 +1,44 @@
+#include "cpu_decode.h"
+#include "memory.h"
+
+/*
+ * Fetch unit
+ *
+ * There's no prefetch queue yet. Each word the decode stage asks for is read off the bus at the decoder's PGC there
+ * and then: straight from the page's host memory, or through its handler. It doesn't go through the memory
+ * controller, so fetches neither contend with the execute stage's accesses nor sit out wait states, and
+ * execute_memory_backoff goes unread. A handler that isn't ready (e.g. a ROM bank still being paged in) stalls the
+ * decoder until its next try.
+ *
+ * Fetching is free, then: the pipeline's cycle counts are those of the execute stage and its memory accesses alone,
+ * and only stall on fetches when a handler isn't ready. Benchmarks and tests comparing engines rely on that, and will
+ * need their references redone once fetches are timed.
+ *
+ * Words land in the instruction's imm_words in order: the opcode word first, then the words decode_queue_read_word_
+ * queued up for it.
+ */
+bool
+decode_try_read_word_ (pilot_decode_state *state)
+{
+	Pilot_system *sys = state->sys;
+	uint32_t addr = state->pgc & 0xfffffe;
+	const Pilot_mem_page *page = &sys->mem_pages[addr >> PILOT_MEM_PAGE_SHIFT];
+	uint16_t word;
+
+	// Nothing is queued, so there's nothing to throw away on a branch
+	sys->interconnects.fetch_branch = FALSE;
+
+	if (page->read)
+	{
+		const uint8_t *host = page->read + (addr & PILOT_MEM_PAGE_MASK);
+		word = host[0] | (host[1] << 8);
+	}
+	else if (!sys->mem_handlers[page->handler].read(sys, addr, &word))
+	{
+		return FALSE;
+	}
+
+	state->work_regs->imm_words[state->inst_length - state->words_to_read] = word;
+	state->pgc = (state->pgc + 2) & 0xffffff;
+	return TRUE;
+}
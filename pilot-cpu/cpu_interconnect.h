@@ -9,9 +9,12 @@ typedef struct
 	bool fetch_word_semaph;
 	bool fetch_branch;
 	
-	// Decode-execute interface
+	// Decode-execute interface: a two-slot ring. The decode stage fills decoded_insts[decoded_inst_slot] in place and
+	// raises the semaphore; the execute stage runs the instruction straight out of that slot and lowers it, after
+	// which the decode stage moves on to the other slot.
 	bool decoded_inst_semaph;
-	inst_decoded_flags *decoded_inst;
+	uint8_t decoded_inst_slot;
+	inst_decoded_flags decoded_insts[2];
 	
 	// Execute branch feedback
 	bool execute_branch;
@@ -0,0 +1,111 @@
+#include "cpu_interp.h"
+#include "system.h"
+#include "memory.h"
+#include "block_cache.h"
+#include <string.h>
+
+// Decodes the instruction at pgc straight off the bus, for when the block cache is off or can't hold it.
+// Returns its length in words.
+static uint8_t
+interp_decode_ (Pilot_system *sys, uint32_t pgc, inst_decoded_flags *inst)
+{
+	const decode_template *t;
+	uint16_t opcode;
+	int i;
+
+	Pilot_mem_read_sync(sys, pgc, &opcode);
+	t = pilot_decode_template(opcode);
+
+	memset(inst, 0, sizeof(*inst));
+	pilot_decode_latch_template(inst, t);
+	inst->imm_words[0] = opcode;
+	for (i = 1; i <= t->extra_words; i++)
+	{
+		Pilot_mem_read_sync(sys, (pgc + i * 2) & 0xffffff, &inst->imm_words[i]);
+	}
+	inst->inst_pgc = pgc;
+
+	switch (t->status)
+	{
+		case DECODE_OK:
+			break;
+		case DECODE_INVALID:
+			decode_invalid_opcode_(sys);
+			break;
+		case DECODE_NOT_IMPLEMENTED:
+			decode_not_implemented_();
+			break;
+	}
+	return 1 + t->extra_words;
+}
+
+static inline const inst_decoded_flags *
+interp_fetch_ (Pilot_system *sys, uint32_t pgc, inst_decoded_flags *scratch, uint8_t *words)
+{
+	pilot_interp_state *interp = &sys->interp;
+	const pilot_block *block = interp->block;
+
+	if (sys->block_cache)
+	{
+		if (block && interp->block_pos < block->inst_count
+			&& block->insts[interp->block_pos].inst_pgc == pgc && pilot_block_valid(sys, block))
+		{
+			sys->block_cache->stats.hits++;
+		}
+		else
+		{
+			block = pilot_block_lookup(sys, pgc);
+			interp->block = block;
+			interp->block_pos = 0;
+		}
+		if (block)
+		{
+			*words = block->inst_words[interp->block_pos];
+			return &block->insts[interp->block_pos++];
+		}
+	}
+
+	*words = interp_decode_(sys, pgc, scratch);
+	return scratch;
+}
+
+Pilot_run_status
+pilot_interp_run (Pilot_system *sys, uint64_t end)
+{
+	pilot_interp_state *interp = &sys->interp;
+	inst_decoded_flags scratch;
+
+	while (sys->cycles < end)
+	{
+		uint32_t pgc = sys->core.pgc & 0xfffffe;
+		const inst_decoded_flags *inst;
+		uint8_t words;
+
+		if (sys->breakpoint_count && !interp->breakpoint_taken && pilot_breakpoint_hit(sys, pgc))
+		{
+			interp->breakpoint_taken = TRUE;
+			return PILOT_RUN_BREAKPOINT;
+		}
+		interp->breakpoint_taken = FALSE;
+
+		inst = interp_fetch_(sys, pgc, &scratch, &words);
+		sys->core.pgc = pgc;
+		sys->cycles += pilot_execute_run_inst(&sys->execute, inst);
+		// Instructions that write PGC leave it where they put it, even if that's back where they started
+		if (!sys->execute.pgc_written)
+		{
+			sys->core.pgc = (pgc + words * 2) & 0xffffff;
+		}
+
+		if (sys->stop_requested || sys->execute.execution_phase == EXEC_EXCEPTION)
+		{
+			if (sys->execute.execution_phase == EXEC_EXCEPTION)
+			{
+				return PILOT_RUN_EXCEPTION;
+			}
+			sys->stop_requested = FALSE;
+			return PILOT_RUN_STOPPED;
+		}
+	}
+	return PILOT_RUN_DONE;
+}
@@ -0,0 +1,24 @@
+#ifndef __CPU_INTERP_H__
+#define __CPU_INTERP_H__
+
+#include "types.h"
+#include "cpu_regs.h"
+
+/*
+ * Instruction-level engine
+ *
+ * Runs one whole instruction per dispatch, straight from core.pgc, with the same decode templates, microcode and
+ * ALU as the pipeline. Cycle counts come from the number of control words each instruction runs plus memory wait
+ * states, so they line up with the pipeline's as long as it isn't stalled on fetches.
+ */
+typedef struct
+{
+	// Position in the block cache, if enabled
+	const struct pilot_block *block;
+	uint8_t block_pos;
+
+	// Set after stopping at a breakpoint, so resuming runs the instruction there instead of stopping again
+	bool breakpoint_taken;
+} pilot_interp_state;
+
+#endif
@@ -0,0 +1,662 @@
+#include "cpu_jit.h"
+#include "system.h"
+#include "memory.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define JIT_ENTRIES         4096
+#define JIT_DEFAULT_BLOCKS  4096
+#define JIT_ENTRY_SLOT_(jit, pgc) ((((pgc) >> 1) ^ ((pgc) >> 11)) & (jit)->entry_mask)
+
+// Bus operand slot of the destination in pilot_execute_state.bus
+#define JIT_BUS_DEST 2
+
+// The code buffer is never writable and executable at once. It's made writable to translate and link blocks, and
+// executable again before the dispatcher enters it, so a dispatch that changed nothing costs no system calls.
+static bool
+jit_code_writable_ (pilot_jit *jit, bool writable)
+{
+	if (jit->code_writable == writable)
+	{
+		return TRUE;
+	}
+	if (mprotect(jit->code, jit->code_size, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC))
+	{
+		return FALSE;
+	}
+	jit->code_writable = writable;
+	return TRUE;
+}
+
+bool
+Pilot_jit_enable (Pilot_system *sys, size_t code_size)
+{
+	pilot_jit *jit;
+
+	Pilot_jit_disable(sys);
+	if (!sys->block_cache && !Pilot_block_cache_enable(sys, JIT_DEFAULT_BLOCKS))
+	{
+		return FALSE;
+	}
+
+	jit = calloc(1, sizeof(*jit));
+	if (!jit)
+	{
+		return FALSE;
+	}
+	jit->entries = malloc(JIT_ENTRIES * sizeof(*jit->entries));
+	jit->code = mmap(NULL, code_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (!jit->entries || jit->code == MAP_FAILED)
+	{
+		if (jit->code != MAP_FAILED)
+		{
+			munmap(jit->code, code_size);
+		}
+		free(jit->entries);
+		free(jit);
+		return FALSE;
+	}
+	jit->code_size = code_size;
+	jit->code_writable = TRUE;
+	jit->entry_mask = JIT_ENTRIES - 1;
+	if (!pilot_jit_backend_init(jit) || !jit_code_writable_(jit, FALSE))
+	{
+		munmap(jit->code, code_size);
+		free(jit->entries);
+		free(jit);
+		return FALSE;
+	}
+	sys->jit = jit;
+	Pilot_jit_flush(sys);
+	return TRUE;
+}
+
+void
+Pilot_jit_disable (Pilot_system *sys)
+{
+	if (!sys->jit)
+	{
+		return;
+	}
+	munmap(sys->jit->code, sys->jit->code_size);
+	free(sys->jit->entries);
+	free(sys->jit);
+	sys->jit = NULL;
+}
+
+void
+Pilot_jit_flush (Pilot_system *sys)
+{
+	pilot_jit *jit = sys->jit;
+	uint32_t i;
+
+	if (!jit)
+	{
+		return;
+	}
+	for (i = 0; i <= jit->entry_mask; i++)
+	{
+		jit->entries[i].pgc = PILOT_BLOCK_EMPTY;
+	}
+	jit->code_used = jit->code_start;
+	jit->link_site = NULL;
+}
+
+Pilot_jit_stats
+Pilot_jit_get_stats (const Pilot_system *sys)
+{
+	if (!sys->jit)
+	{
+		return (Pilot_jit_stats) { 0 };
+	}
+	return sys->jit->stats;
+}
+
+void
+Pilot_jit_set_lockstep (Pilot_system *sys, bool lockstep)
+{
+	if (!sys->jit || sys->jit->lockstep == lockstep)
+	{
+		return;
+	}
+	// Translations for lockstep mode don't chain, and send every write through pilot_jit_mem_write
+	sys->jit->lockstep = lockstep;
+	Pilot_jit_flush(sys);
+}
+
+uint32_t
+pilot_jit_mem_read (Pilot_system *sys, uint32_t addr)
+{
+	uint16_t data;
+	sys->cycles += Pilot_mem_read_sync(sys, addr, &data) - 1;
+	return data;
+}
+
+bool
+pilot_jit_mem_write (Pilot_system *sys, uint32_t addr, uint32_t data)
+{
+	pilot_jit *jit = sys->jit;
+	const Pilot_mem_page *page = &sys->mem_pages[(addr & 0xfffffe) >> PILOT_MEM_PAGE_SHIFT];
+	bool code = (page->flags & PILOT_PAGE_CODE) != 0;
+
+	// A block makes a handful of writes per instruction at most, so the journal can't fill up
+	if (jit->lockstep && page->write && jit->journal_count < JIT_JOURNAL_MAX)
+	{
+		const uint8_t *host = page->write + (addr & PILOT_MEM_PAGE_MASK & ~1);
+		pilot_jit_write *entry = &jit->journal[jit->journal_count++];
+		entry->addr = addr & 0xfffffe;
+		entry->old_data = host[0] | (host[1] << 8);
+		entry->new_data = data;
+	}
+	sys->cycles += Pilot_mem_write_sync(sys, addr, data) - 1;
+	return code;
+}
+
+
+/*
+ * Translation
+ */
+static void
+jit_resolve_operand_ (Pilot_system *sys, const pilot_execute_state *scratch, int slot, uint32_t pgc, jit_operand *out)
+{
+	const exec_bus_operand *op = &scratch->bus[slot];
+
+	out->index = 0;
+	out->shift = op->shift;
+	out->mask = op->mask;
+	out->value = 0;
+	if (op->reg >= sys->core.file && op->reg < sys->core.file + REGFILE_SIZE)
+	{
+		out->type = JIT_LOC_CORE;
+		out->index = op->reg - sys->core.file;
+		// The instruction-level engines point PGC at the opcode word for the whole instruction
+		if (out->index == REGFILE_PGC && slot != JIT_BUS_DEST)
+		{
+			out->type = JIT_LOC_CONST;
+			out->value = (pgc >> op->shift) & op->mask;
+		}
+	}
+	else if (op->reg == &scratch->mem_addr)
+	{
+		out->type = JIT_LOC_MEM_ADDR;
+	}
+	else if (op->reg == &scratch->mem_data)
+	{
+		out->type = JIT_LOC_MEM_DATA;
+	}
+	else
+	{
+		// bus_zero or one of bus_consts; either way fixed for the instruction
+		out->type = JIT_LOC_CONST;
+		out->value = (*op->reg >> op->shift) & op->mask;
+	}
+}
+
+// Register indexed operands with a bad extension word raise an exception when they're resolved
+static inline bool
+jit_index_word_valid_ (const inst_decoded_flags *inst, data_bus_specifier spec)
+{
+	if (spec == DATA_REG_IMM_2_8)
+	{
+		return inst->imm_words[2] < 0xc000;
+	}
+	if (spec == DATA_REG_RM_2_8)
+	{
+		return inst->imm_words[1 + inst->rm2_offset] < 0xc000;
+	}
+	return TRUE;
+}
+
+static bool
+jit_translate_control_ (Pilot_system *sys, pilot_execute_state *scratch, const execute_control_word *control,
+	jit_op *op)
+{
+	execute_control_word ctl = *control;
+	alu_operation_spec operation = ECW_GET(ctl, OPERATION);
+	mem_latch_spec latch = ECW_GET(ctl, MEM_LATCH_CTL);
+	mem_write_spec write = ECW_GET(ctl, MEM_WRITE_CTL);
+	uint32_t pgc = scratch->decoded_inst->inst_pgc & 0xfffffe;
+	int i;
+
+	if (ECW_GET(ctl, SHIFTER_MODE) != SHIFTER_NONE || (ECW_GET(ctl, FLAG_WRITE_MASK) & F_DECIMAL)
+		|| operation > ALU_XOR)
+	{
+		return FALSE;
+	}
+	// Combinations that use whatever an earlier control word left in the ALU output latch
+	if ((latch == MEM_LATCH_HALF1 && write == MEM_WRITE_FROM_DEST)
+		|| (latch >= MEM_LATCH_HALF2 && write == MEM_WRITE_FROM_SRC1)
+		|| (operation == ALU_OFF && (latch == MEM_LATCH_HALF2 || (latch >= MEM_LATCH_HALF2 && write == MEM_WRITE_FROM_DEST))))
+	{
+		return FALSE;
+	}
+	for (i = 0; i < 2; i++)
+	{
+		if (!jit_index_word_valid_(scratch->decoded_inst, ECW_SRC_GET(ctl, i, LOCATION)))
+		{
+			return FALSE;
+		}
+	}
+
+	pilot_execute_resolve_control(scratch, control);
+	if (scratch->bus_touches_flags[0] || scratch->bus_touches_flags[1])
+	{
+		return FALSE;
+	}
+	op->control = ctl;
+	for (i = 0; i < 2; i++)
+	{
+		jit_resolve_operand_(sys, scratch, i, pgc, &op->src[i]);
+		op->sign_extend[i] = scratch->alu_input_sign_extend[i];
+	}
+	jit_resolve_operand_(sys, scratch, JIT_BUS_DEST, pgc, &op->dest);
+	if (operation != ALU_OFF
+		&& (scratch->bus_touches_flags[JIT_BUS_DEST] || (op->dest.type == JIT_LOC_CORE && op->dest.index == REGFILE_PGC)))
+	{
+		return FALSE;
+	}
+	op->record_flags = (operation != ALU_OFF && ECW_GET(ctl, FLAG_WRITE_MASK) != 0);
+	return TRUE;
+}
+
+static bool
+jit_translate_mucode_ (Pilot_system *sys, pilot_execute_state *scratch, mucode_entry_spec spec, jit_ir_block *ir)
+{
+	while (spec.entry_idx != MU_NONE)
+	{
+		const mucode_entry *entry = pilot_mucode_lookup(spec);
+		if (ir->op_count == JIT_MAX_OPS || !jit_translate_control_(sys, scratch, &entry->operation, &ir->ops[ir->op_count]))
+		{
+			return FALSE;
+		}
+		ir->op_count++;
+		spec = entry->next;
+	}
+	return TRUE;
+}
+
+// Appends an instruction's control words to the block, in the order pilot_execute_run_inst would run them
+static bool
+jit_translate_inst_ (Pilot_system *sys, const inst_decoded_flags *inst, uint8_t words, jit_ir_block *ir)
+{
+	pilot_execute_state scratch;
+	jit_inst *out = &ir->insts[ir->inst_count];
+	bool ok;
+	int i;
+
+	memset(&scratch, 0, sizeof(scratch));
+	scratch.sys = sys;
+	scratch.decoded_inst = inst;
+
+	out->pgc = inst->inst_pgc & 0xfffffe;
+	out->next_pgc = (out->pgc + words * 2) & 0xffffff;
+	out->first_op = ir->op_count;
+	if (inst->override_op.entry_idx != MU_NONE)
+	{
+		ok = jit_translate_mucode_(sys, &scratch, inst->override_op, ir);
+	}
+	else
+	{
+		ok = jit_translate_mucode_(sys, &scratch, inst->run_before, ir)
+			&& ir->op_count < JIT_MAX_OPS
+			&& jit_translate_control_(sys, &scratch, &scratch.decoded_inst->core_op, &ir->ops[ir->op_count++])
+			&& jit_translate_mucode_(sys, &scratch, inst->run_after, ir);
+	}
+	if (!ok)
+	{
+		ir->op_count = out->first_op;
+		return FALSE;
+	}
+	out->op_count = ir->op_count - out->first_op;
+
+	out->writes_memory = FALSE;
+	for (i = out->first_op; i < ir->op_count; i++)
+	{
+		const jit_op *op = &ir->ops[i];
+		execute_control_word ctl = op->control;
+		int j;
+
+		if (ECW_GET(ctl, MEM_LATCH_CTL) != MEM_NO_LATCH && ECW_GET(ctl, MEM_WRITE_CTL) != MEM_READ
+			&& !ECW_GET(ctl, MEM_ACCESS_SUPPRESS))
+		{
+			out->writes_memory = TRUE;
+		}
+		for (j = 0; j < 2; j++)
+		{
+			if (op->src[j].type == JIT_LOC_CORE && op->src[j].index < 8)
+			{
+				ir->regs_read |= 1 << op->src[j].index;
+			}
+		}
+		if (ECW_GET(ctl, OPERATION) != ALU_OFF)
+		{
+			if (op->dest.type == JIT_LOC_CORE && op->dest.index < 8 && op->dest.mask)
+			{
+				ir->regs_written |= 1 << op->dest.index;
+			}
+			if (ECW_SRC_GET(ctl, 0, SIZE) == SIZE_8_BIT)
+			{
+				ir->needs_decimal_clear = TRUE;
+			}
+		}
+	}
+	ir->inst_count++;
+	return TRUE;
+}
+
+static inline bool
+jit_op_reads_carry_ (const jit_op *op)
+{
+	return !ECW_GET(op->control, SRC2_ADD1) && ECW_GET(op->control, SRC2_ADD_CARRY);
+}
+
+/*
+ * A flag record can be dropped when a later one overwrites all of its flags with nothing reading them in between,
+ * just as alu_record_flags_ would drop it at run time. F can't be read by translated code other than through carry
+ * inputs, but blocks can also be left early after an instruction that writes memory, so records never outlive one.
+ */
+static void
+jit_prune_flags_ (jit_ir_block *ir)
+{
+#ifndef PILOT_EAGER_FLAGS
+	int k;
+	for (k = 0; k < ir->inst_count; k++)
+	{
+		int i;
+		for (i = ir->insts[k].first_op; i < ir->insts[k].first_op + ir->insts[k].op_count; i++)
+		{
+			uint8_t mask = ECW_GET(ir->ops[i].control, FLAG_WRITE_MASK);
+			int m = k;
+			int j;
+
+			if (!ir->ops[i].record_flags)
+			{
+				continue;
+			}
+			for (j = i + 1; j < ir->op_count; j++)
+			{
+				const jit_op *later = &ir->ops[j];
+				if (j == ir->insts[m].first_op + ir->insts[m].op_count)
+				{
+					if (ir->insts[m].writes_memory)
+					{
+						break;
+					}
+					m++;
+				}
+				if (jit_op_reads_carry_(later))
+				{
+					break;
+				}
+				if (later->record_flags)
+				{
+					if (!(mask & ~ECW_GET(later->control, FLAG_WRITE_MASK)))
+					{
+						ir->ops[i].record_flags = FALSE;
+					}
+					break;
+				}
+			}
+		}
+	}
+#endif
+}
+
+void
+pilot_jit_build_ir (Pilot_system *sys, const pilot_block *block, jit_ir_block *ir)
+{
+	int i;
+
+	ir->pgc = block->pgc;
+	ir->gen = block->gen;
+	ir->inst_count = 0;
+	ir->op_count = 0;
+	ir->regs_read = 0;
+	ir->regs_written = 0;
+	ir->needs_decimal_clear = FALSE;
+	for (i = 0; i < block->inst_count; i++)
+	{
+		if (!jit_translate_inst_(sys, &block->insts[i], block->inst_words[i], ir))
+		{
+			break;
+		}
+	}
+	jit_prune_flags_(ir);
+}
+
+// Returns the translation for pgc, translating it first if needed, or NULL if the instruction there has to be
+// interpreted
+static const uint8_t *
+jit_lookup_ (Pilot_system *sys, pilot_jit *jit, uint32_t pgc)
+{
+	pilot_jit_entry *entry = &jit->entries[JIT_ENTRY_SLOT_(jit, pgc)];
+	const pilot_block *block;
+	jit_ir_block ir;
+
+	if (entry->pgc == pgc && entry->gen == sys->block_cache->page_gen[pgc >> PILOT_MEM_PAGE_SHIFT])
+	{
+		return entry->body;
+	}
+
+	// Uncacheable pages aren't remembered, as nothing would tell us when they became cacheable
+	block = pilot_block_lookup(sys, pgc);
+	if (!block)
+	{
+		return NULL;
+	}
+
+	pilot_jit_build_ir(sys, block, &ir);
+	entry->pgc = pgc;
+	entry->gen = block->gen;
+	entry->body = NULL;
+	if (!ir.inst_count || !jit_code_writable_(jit, TRUE))
+	{
+		return NULL;
+	}
+	entry->body = pilot_jit_backend_emit(sys, jit, &ir);
+	if (!entry->body)
+	{
+		Pilot_jit_flush(sys);
+		jit->stats.flushes++;
+		entry->pgc = pgc;
+		entry->gen = block->gen;
+		entry->body = pilot_jit_backend_emit(sys, jit, &ir);
+	}
+	if (entry->body)
+	{
+		jit->stats.translations++;
+	}
+	return entry->body;
+}
+
+
+/*
+ * Lockstep mode
+ *
+ * Each block is run translated first, with its memory writes journaled. Its results are set aside, the writes undone
+ * and the machine put back as it was, and the interpreter then runs the same number of instructions. Registers
+ * (with flags brought up to date), MAR, MDR, cycles and the final contents of every address the block wrote have
+ * to agree. The interpreter's results are kept either way.
+ *
+ * Memory handlers see every access twice, so this is meant for code running out of RAM and ROM.
+ */
+static Pilot_run_status
+jit_run_lockstep_ (Pilot_system *sys, pilot_jit *jit, const uint8_t *body)
+{
+	Pilot_cpu_regs core = sys->core;
+	uint32_t mem_addr = sys->execute.mem_addr;
+	uint32_t mem_data = sys->execute.mem_data;
+	uint64_t cycles = sys->cycles;
+	uint64_t insts_taken = sys->execute.insts_taken;
+	Pilot_run_status status = PILOT_RUN_DONE;
+	Pilot_cpu_regs jit_core;
+	uint32_t jit_mem_addr, jit_mem_data;
+	uint64_t jit_cycles, n;
+	bool match;
+	uint32_t i;
+
+	jit->journal_count = 0;
+	jit->enter(sys, body);
+	if (jit->bailed)
+	{
+		return PILOT_RUN_DONE;
+	}
+	jit->stats.lockstep_blocks++;
+
+	jit_core = sys->core;
+	jit_mem_addr = sys->execute.mem_addr;
+	jit_mem_data = sys->execute.mem_data;
+	jit_cycles = sys->cycles;
+	n = sys->execute.insts_taken - insts_taken;
+
+	for (i = jit->journal_count; i-- > 0; )
+	{
+		const pilot_jit_write *entry = &jit->journal[i];
+		uint8_t *host = sys->mem_pages[entry->addr >> PILOT_MEM_PAGE_SHIFT].write;
+		if (host)
+		{
+			host += entry->addr & PILOT_MEM_PAGE_MASK;
+			host[0] = entry->old_data & 0xff;
+			host[1] = entry->old_data >> 8;
+		}
+	}
+	sys->core = core;
+	sys->execute.mem_addr = mem_addr;
+	sys->execute.mem_data = mem_data;
+	sys->cycles = cycles;
+	sys->execute.insts_taken = insts_taken;
+
+	while (n--)
+	{
+		Pilot_run_status interp_status = pilot_interp_run(sys, sys->cycles + 1);
+		if (interp_status != PILOT_RUN_DONE)
+		{
+			status = interp_status;
+		}
+	}
+
+	core = sys->core;
+	pilot_execute_materialize_flags(&core);
+	pilot_execute_materialize_flags(&jit_core);
+	match = !memcmp(core.file, jit_core.file, sizeof(core.file))
+		&& sys->execute.mem_addr == jit_mem_addr && sys->execute.mem_data == jit_mem_data && sys->cycles == jit_cycles;
+
+	// Later writes to the same address are checked last, so each address ends up compared with its final value
+	for (i = 0; match && i < jit->journal_count; i++)
+	{
+		const pilot_jit_write *entry = &jit->journal[i];
+		const uint8_t *host = sys->mem_pages[entry->addr >> PILOT_MEM_PAGE_SHIFT].write;
+		uint32_t j;
+
+		for (j = i + 1; j < jit->journal_count && jit->journal[j].addr != entry->addr; j++)
+			;
+		if (host && j == jit->journal_count)
+		{
+			host += entry->addr & PILOT_MEM_PAGE_MASK;
+			match = (host[0] | (host[1] << 8)) == entry->new_data;
+		}
+	}
+
+	if (!match)
+	{
+		jit->stats.lockstep_mismatches++;
+		return PILOT_RUN_JIT_MISMATCH;
+	}
+	return status;
+}
+
+
+/*
+ * Dispatch
+ *
+ * Translated blocks return here when they reach the end of the run, hit a stop request, leave through an exit that
+ * hasn't been chained yet, or decline to run. Stop requests and the end of the run are only checked between blocks,
+ * so the JIT can overshoot by up to a block.
+ *
+ * Breakpoints are left to the interpreter: the whole run goes through it while any are set.
+ */
+static inline Pilot_run_status
+jit_interpret_one_ (Pilot_system *sys, pilot_jit *jit)
+{
+	jit->stats.fallbacks++;
+	return pilot_interp_run(sys, sys->cycles + 1);
+}
+
+Pilot_run_status
+pilot_jit_run (Pilot_system *sys, uint64_t end)
+{
+	pilot_jit *jit = sys->jit;
+
+	if (!jit || !sys->block_cache || sys->breakpoint_count)
+	{
+		return pilot_interp_run(sys, end);
+	}
+
+	jit->link_site = NULL;
+	while (sys->cycles < end)
+	{
+		uint32_t pgc = sys->core.pgc & 0xfffffe;
+		const uint8_t *body = jit_lookup_(sys, jit, pgc);
+		Pilot_run_status status = PILOT_RUN_DONE;
+
+		// A site that came back unpatched, or led to a block that bailed as stale, now goes to whatever is at pgc;
+		// with nothing there it's unpatched, so it comes back to be linked again
+		if (jit->link_site && jit_code_writable_(jit, TRUE))
+		{
+			pilot_jit_backend_link(jit->link_site, body ? body : jit->exit_keep_link);
+			jit->stats.chains += (body != NULL);
+		}
+		jit->link_site = NULL;
+
+		if (!body || !jit_code_writable_(jit, FALSE))
+		{
+			status = jit_interpret_one_(sys, jit);
+		}
+		else
+		{
+			jit->end = end;
+			jit->bailed = FALSE;
+			jit->stats.entries++;
+			if (jit->lockstep)
+			{
+				status = jit_run_lockstep_(sys, jit, body);
+			}
+			else
+			{
+				jit->enter(sys, body);
+			}
+
+			if (jit->bailed)
+			{
+				const pilot_jit_entry *entry;
+
+				jit->stats.bails++;
+				// Stale translations are redone on the next lookup; the rest bailed on F's decimal flag
+				pgc = sys->core.pgc & 0xfffffe;
+				entry = &jit->entries[JIT_ENTRY_SLOT_(jit, pgc)];
+				if (entry->pgc == pgc && entry->gen == sys->block_cache->page_gen[pgc >> PILOT_MEM_PAGE_SHIFT])
+				{
+					// The site that led here, if any, is still good
+					jit->link_site = NULL;
+					status = jit_interpret_one_(sys, jit);
+				}
+			}
+		}
+		if (status != PILOT_RUN_DONE)
+		{
+			return status;
+		}
+
+		if (sys->stop_requested || sys->execute.execution_phase == EXEC_EXCEPTION)
+		{
+			if (sys->execute.execution_phase == EXEC_EXCEPTION)
+			{
+				return PILOT_RUN_EXCEPTION;
+			}
+			sys->stop_requested = FALSE;
+			return PILOT_RUN_STOPPED;
+		}
+	}
+	return PILOT_RUN_DONE;
+}
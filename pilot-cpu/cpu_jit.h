@@ -0,0 +1,170 @@
+#ifndef __CPU_JIT_H__
+#define __CPU_JIT_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "types.h"
+#include "pilot.h"
+#include "block_cache.h"
+
+/*
+ * Dynamic recompiler
+ *
+ * Translates the block cache's decoded blocks into host code. Each instruction is expanded into the control words
+ * the sequencer would run, and each control word into one jit_op: its operands resolved by the execute stage's own
+ * bus routing, then classified as constants, core registers or MAR/MDR. A pass over the ops drops flag records that
+ * a later op in the block completely overwrites, and the backend (cpu_jit_x64.c) emits the rest.
+ *
+ * Translated code sees the machine exactly as the instruction-level engine leaves it between instructions: flags
+ * are recorded into core.lazy_flags, memory goes through the bus page table, and cycles count one per control word
+ * plus wait states. Anything the backend doesn't handle (shifter modes, operands overlapping F, writes to PGC, ...)
+ * ends the translation, and the instruction is run by the interpreter instead.
+ */
+#define JIT_MAX_OPS (PILOT_BLOCK_MAX_INSTS * 6)
+
+typedef enum
+{
+	JIT_LOC_CONST,
+	// Field of core.file; index is the register file index
+	JIT_LOC_CORE,
+	JIT_LOC_MEM_ADDR,
+	JIT_LOC_MEM_DATA
+} jit_loc_type;
+
+// A bus operand resolved at translation time
+typedef struct
+{
+	uint8_t type;
+	uint8_t index;
+	uint8_t shift;
+	uint32_t mask;
+	// JIT_LOC_CONST only
+	uint32_t value;
+} jit_operand;
+
+typedef struct
+{
+	execute_control_word control;
+	jit_operand src[2];
+	jit_operand dest;
+	bool sign_extend[2];
+	// Cleared when a later op in the block overwrites every flag this one would set
+	bool record_flags;
+} jit_op;
+
+typedef struct
+{
+	uint32_t pgc;
+	uint32_t next_pgc;
+	uint8_t first_op;
+	uint8_t op_count;
+	bool writes_memory;
+} jit_inst;
+
+typedef struct
+{
+	uint32_t pgc;
+	uint32_t gen;
+	uint8_t inst_count;
+	uint8_t op_count;
+	// Bit n is set if guest register n is read or written
+	uint8_t regs_read;
+	uint8_t regs_written;
+	// Some op depends on F's decimal flag, which the translation assumes clear
+	bool needs_decimal_clear;
+	jit_inst insts[PILOT_BLOCK_MAX_INSTS];
+	jit_op ops[JIT_MAX_OPS];
+} jit_ir_block;
+
+typedef struct
+{
+	// Blocks translated, and instructions that had to be run by the interpreter instead
+	uint64_t translations;
+	uint64_t fallbacks;
+	// Times the dispatcher entered translated code, and exits it patched to jump straight to the next block
+	uint64_t entries;
+	uint64_t chains;
+	// Translations that declined to run on entry: stale code, or F's decimal flag set
+	uint64_t bails;
+	// Times the code buffer filled up and was emptied
+	uint64_t flushes;
+	uint64_t lockstep_blocks;
+	uint64_t lockstep_mismatches;
+} Pilot_jit_stats;
+
+typedef struct
+{
+	uint32_t pgc;
+	uint32_t gen;
+	// NULL if the instruction at pgc can't be translated
+	const uint8_t *body;
+} pilot_jit_entry;
+
+// Guest memory writes made by a block in lockstep mode, so they can be undone before the interpreter reruns it
+#define JIT_JOURNAL_MAX 128
+
+typedef struct
+{
+	uint32_t addr;
+	uint16_t old_data;
+	uint16_t new_data;
+} pilot_jit_write;
+
+typedef struct pilot_jit
+{
+	// Mapped either writable or executable, never both: see jit_code_writable_
+	uint8_t *code;
+	size_t code_size;
+	bool code_writable;
+	size_t code_used;
+	// Start of the space for translations, after the entry and exit trampolines
+	size_t code_start;
+	void (*enter) (Pilot_system *sys, const uint8_t *body);
+	// Return to the dispatcher; exit clears link_site on the way, exit_keep_link doesn't
+	const uint8_t *exit;
+	const uint8_t *exit_keep_link;
+
+	// Direct mapped by PGC
+	pilot_jit_entry *entries;
+	uint32_t entry_mask;
+
+	// Shared with translated code
+	uint64_t end;
+	// Set by a chaining exit, patched or not, to the rel32 of its jump: the dispatcher links it to the next block if it
+	// returns unpatched, and relinks it if the block it jumped to bailed as stale
+	uint8_t *link_site;
+	bool bailed;
+
+	bool lockstep;
+	uint32_t journal_count;
+	pilot_jit_write journal[JIT_JOURNAL_MAX];
+
+	Pilot_jit_stats stats;
+} pilot_jit;
+
+// Allocates code_size bytes of memory for translations, and turns the block cache on if it isn't already.
+// Returns FALSE if out of memory, or if there's no backend for the host. Select the engine with Pilot_set_engine.
+bool Pilot_jit_enable (Pilot_system *sys, size_t code_size);
+void Pilot_jit_disable (Pilot_system *sys);
+// Drops every translation
+void Pilot_jit_flush (Pilot_system *sys);
+Pilot_jit_stats Pilot_jit_get_stats (const Pilot_system *sys);
+
+// Runs every translated block a second time through the interpreter and compares the results; see cpu_jit.c
+void Pilot_jit_set_lockstep (Pilot_system *sys, bool lockstep);
+
+// Translates as much of the block as the backends handle, which may be none of it; also used by cpu_aot.c
+void pilot_jit_build_ir (Pilot_system *sys, const pilot_block *block, jit_ir_block *ir);
+
+// Backend; see cpu_jit_x64.c
+bool pilot_jit_backend_init (pilot_jit *jit);
+// Returns the entry point of the translation, or NULL if it doesn't fit in the code buffer
+const uint8_t *pilot_jit_backend_emit (Pilot_system *sys, pilot_jit *jit, const jit_ir_block *ir);
+void pilot_jit_backend_link (uint8_t *site, const uint8_t *target);
+
+// Helpers called from translated code
+uint32_t pilot_jit_mem_read (Pilot_system *sys, uint32_t addr);
+// Returns TRUE if the write landed on a page holding cached code
+bool pilot_jit_mem_write (Pilot_system *sys, uint32_t addr, uint32_t data);
+
+#endif
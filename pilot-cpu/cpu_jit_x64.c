@@ -0,0 +1,1022 @@
+#include "cpu_jit.h"
+#include "cpu_regs.h"
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+
+/*
+ * x86-64 backend (System V ABI)
+ *
+ * Translated code is entered through a shared trampoline that saves the callee-saved registers, points r15 at the
+ * Pilot_system and jumps to the block; blocks leave through a shared exit that undoes it. The 8 bytes the trampoline
+ * reserves to keep the stack aligned hold a flag set when a write lands on a page of cached code.
+ *
+ * Within a block, each guest register the block uses is pinned to a host register: loaded on entry, and stored back
+ * at every exit if the block writes it. The callee-saved registers go first; r8-r10 are saved around helper calls.
+ * Everything else (W, REPI/REPR, MAR, MDR, the lazy flags) is read and written in place. Per control word, the ALU
+ * sources are loaded into eax and edx, the result is computed in ecx and the carries in esi.
+ *
+ * Memory accesses look the page up inline and go straight to host memory if it has a zero-wait pointer (and, for
+ * writes, isn't marked PILOT_PAGE_CODE); anything else calls pilot_jit_mem_read/pilot_jit_mem_write.
+ *
+ * Block exits store PGC, add up the cycles and instructions run, and either return to the dispatcher or, once
+ * chained, jump straight into the next block if the run's cycle budget and stop requests allow. The shared exit clears
+ * jit->link_site; chaining exits and bails leave through exit_keep_link, just after it, so the dispatcher can tell
+ * which site to link.
+ */
+enum
+{
+	RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+	R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+enum
+{
+	CC_B = 0x2,
+	CC_AE = 0x3,
+	CC_E = 0x4,
+	CC_NE = 0x5
+};
+
+// Group 1 opcode extensions, and the matching r/m, reg opcodes
+enum
+{
+	ALU_EXT_ADD = 0,
+	ALU_EXT_OR = 1,
+	ALU_EXT_AND = 4,
+	ALU_EXT_SUB = 5,
+	ALU_EXT_XOR = 6,
+	ALU_EXT_CMP = 7
+};
+
+#define OP_ADD   0x01
+#define OP_OR    0x09
+#define OP_AND   0x21
+#define OP_XOR   0x31
+#define OP_TEST  0x85
+#define OP_MOV   0x89
+#define OP_LOAD  0x8b
+#define OP_CMP_R 0x3b
+
+#define SHIFT_SHL 4
+#define SHIFT_SHR 5
+#define SHIFT_SAR 7
+
+#define SYS_OFF_(member) ((int32_t)offsetof(Pilot_system, member))
+#define CORE_OFF_(index) (SYS_OFF_(core.file) + (int32_t)(index) * 4)
+#define LAZY_OFF_(member) SYS_OFF_(core.lazy_flags.member)
+#define PAGE_OFF_(member) (SYS_OFF_(mem_pages) + (int32_t)offsetof(Pilot_mem_page, member))
+
+// Host registers for guest registers, in order of preference
+static const uint8_t jit_pin_regs_[8] = { RBX, RBP, R12, R13, R14, R8, R9, R10 };
+
+typedef struct
+{
+	uint8_t *p;
+	uint8_t *end;
+	bool overflow;
+} jit_asm;
+
+static inline void
+emit8_ (jit_asm *a, uint8_t b)
+{
+	if (a->p < a->end)
+	{
+		*a->p++ = b;
+	}
+	else
+	{
+		a->overflow = TRUE;
+	}
+}
+
+static void
+emit32_ (jit_asm *a, uint32_t v)
+{
+	int i;
+	for (i = 0; i < 4; i++)
+	{
+		emit8_(a, v >> (i * 8));
+	}
+}
+
+static void
+emit64_ (jit_asm *a, uint64_t v)
+{
+	emit32_(a, v);
+	emit32_(a, v >> 32);
+}
+
+static inline void
+emit_rex_ (jit_asm *a, bool w, int reg, int rm)
+{
+	uint8_t rex = 0x40 | (w << 3) | ((reg & 8) >> 1) | ((rm & 8) >> 3);
+	if (rex != 0x40)
+	{
+		emit8_(a, rex);
+	}
+}
+
+static inline void
+emit_opcode_ (jit_asm *a, uint16_t opcode)
+{
+	if (opcode > 0xff)
+	{
+		emit8_(a, opcode >> 8);
+	}
+	emit8_(a, opcode);
+}
+
+// opcode reg, [base + disp]
+static void
+emit_mem_ (jit_asm *a, bool w, uint16_t opcode, int reg, int base, int32_t disp)
+{
+	bool disp8 = (disp >= -128 && disp < 128);
+
+	emit_rex_(a, w, reg, base);
+	emit_opcode_(a, opcode);
+	emit8_(a, (disp8 ? 0x40 : 0x80) | ((reg & 7) << 3) | (base & 7));
+	if ((base & 7) == RSP)
+	{
+		emit8_(a, 0x24);
+	}
+	if (disp8)
+	{
+		emit8_(a, disp);
+	}
+	else
+	{
+		emit32_(a, disp);
+	}
+}
+
+// opcode reg, rm
+static void
+emit_reg_ (jit_asm *a, bool w, uint16_t opcode, int reg, int rm)
+{
+	emit_rex_(a, w, reg, rm);
+	emit_opcode_(a, opcode);
+	emit8_(a, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+static inline void
+asm_rr_ (jit_asm *a, uint8_t opcode, int dst, int src)
+{
+	emit_reg_(a, FALSE, opcode, src, dst);
+}
+
+static inline void
+asm_rr64_ (jit_asm *a, uint8_t opcode, int dst, int src)
+{
+	emit_reg_(a, TRUE, opcode, src, dst);
+}
+
+static void
+asm_ri_ (jit_asm *a, int ext, int dst, uint32_t imm)
+{
+	if ((int32_t)imm >= -128 && (int32_t)imm < 128)
+	{
+		emit_reg_(a, FALSE, 0x83, ext, dst);
+		emit8_(a, imm);
+	}
+	else
+	{
+		emit_reg_(a, FALSE, 0x81, ext, dst);
+		emit32_(a, imm);
+	}
+}
+
+static void
+asm_mi64_ (jit_asm *a, int ext, int base, int32_t disp, int32_t imm)
+{
+	if (imm >= -128 && imm < 128)
+	{
+		emit_mem_(a, TRUE, 0x83, ext, base, disp);
+		emit8_(a, imm);
+	}
+	else
+	{
+		emit_mem_(a, TRUE, 0x81, ext, base, disp);
+		emit32_(a, imm);
+	}
+}
+
+static inline void
+asm_load_ (jit_asm *a, int dst, int base, int32_t disp)
+{
+	emit_mem_(a, FALSE, OP_LOAD, dst, base, disp);
+}
+
+static inline void
+asm_load64_ (jit_asm *a, int dst, int base, int32_t disp)
+{
+	emit_mem_(a, TRUE, OP_LOAD, dst, base, disp);
+}
+
+static inline void
+asm_store_ (jit_asm *a, int base, int32_t disp, int src)
+{
+	emit_mem_(a, FALSE, OP_MOV, src, base, disp);
+}
+
+static inline void
+asm_store64_ (jit_asm *a, int base, int32_t disp, int src)
+{
+	emit_mem_(a, TRUE, OP_MOV, src, base, disp);
+}
+
+static inline void
+asm_store16_ (jit_asm *a, int base, int32_t disp, int src)
+{
+	emit8_(a, 0x66);
+	emit_mem_(a, FALSE, OP_MOV, src, base, disp);
+}
+
+static inline void
+asm_store_imm_ (jit_asm *a, int base, int32_t disp, uint32_t imm)
+{
+	emit_mem_(a, FALSE, 0xc7, 0, base, disp);
+	emit32_(a, imm);
+}
+
+static inline void
+asm_store8_imm_ (jit_asm *a, int base, int32_t disp, uint8_t imm)
+{
+	emit_mem_(a, FALSE, 0xc6, 0, base, disp);
+	emit8_(a, imm);
+}
+
+static inline void
+asm_cmp8_imm_ (jit_asm *a, int base, int32_t disp, uint8_t imm)
+{
+	emit_mem_(a, FALSE, 0x80, ALU_EXT_CMP, base, disp);
+	emit8_(a, imm);
+}
+
+static inline void
+asm_test8_imm_ (jit_asm *a, int base, int32_t disp, uint8_t imm)
+{
+	emit_mem_(a, FALSE, 0xf6, 0, base, disp);
+	emit8_(a, imm);
+}
+
+static void
+asm_mov_ri_ (jit_asm *a, int dst, uint32_t imm)
+{
+	emit_rex_(a, FALSE, 0, dst);
+	emit8_(a, 0xb8 + (dst & 7));
+	emit32_(a, imm);
+}
+
+static void
+asm_mov_ri64_ (jit_asm *a, int dst, uint64_t imm)
+{
+	emit_rex_(a, TRUE, 0, dst);
+	emit8_(a, 0xb8 + (dst & 7));
+	emit64_(a, imm);
+}
+
+static inline void
+asm_shift_ (jit_asm *a, int ext, int dst, uint8_t n)
+{
+	emit_reg_(a, FALSE, 0xc1, ext, dst);
+	emit8_(a, n);
+}
+
+static inline void
+asm_push_ (jit_asm *a, int r)
+{
+	emit_rex_(a, FALSE, 0, r);
+	emit8_(a, 0x50 + (r & 7));
+}
+
+static inline void
+asm_pop_ (jit_asm *a, int r)
+{
+	emit_rex_(a, FALSE, 0, r);
+	emit8_(a, 0x58 + (r & 7));
+}
+
+static void
+asm_call_ (jit_asm *a, const void *fn)
+{
+	asm_mov_ri64_(a, RAX, (uintptr_t)fn);
+	emit8_(a, 0xff);
+	emit8_(a, 0xd0);
+}
+
+// Jumps with a rel32 to fill in later; each returns the address of the rel32
+static uint8_t *
+asm_jcc_ (jit_asm *a, int cc)
+{
+	emit8_(a, 0x0f);
+	emit8_(a, 0x80 + cc);
+	emit32_(a, 0);
+	return a->p - 4;
+}
+
+static uint8_t *
+asm_jmp_ (jit_asm *a)
+{
+	emit8_(a, 0xe9);
+	emit32_(a, 0);
+	return a->p - 4;
+}
+
+static void
+asm_patch_ (jit_asm *a, uint8_t *site, const uint8_t *target)
+{
+	if (!a->overflow)
+	{
+		pilot_jit_backend_link(site, target);
+	}
+}
+
+static inline void
+asm_jcc_to_ (jit_asm *a, int cc, const uint8_t *target)
+{
+	asm_patch_(a, asm_jcc_(a, cc), target);
+}
+
+static inline void
+asm_jmp_to_ (jit_asm *a, const uint8_t *target)
+{
+	asm_patch_(a, asm_jmp_(a), target);
+}
+
+void
+pilot_jit_backend_link (uint8_t *site, const uint8_t *target)
+{
+	int32_t rel = (int32_t)(target - (site + 4));
+	memcpy(site, &rel, sizeof(rel));
+}
+
+bool
+pilot_jit_backend_init (pilot_jit *jit)
+{
+	static const uint8_t saved[] = { RBX, RBP, R12, R13, R14, R15 };
+	jit_asm a = { jit->code, jit->code + jit->code_size, FALSE };
+	int i;
+
+	// enter (sys, body)
+	jit->enter = (void (*) (Pilot_system *, const uint8_t *))a.p;
+	for (i = 0; i < (int)sizeof(saved); i++)
+	{
+		asm_push_(&a, saved[i]);
+	}
+	emit_reg_(&a, TRUE, 0x83, ALU_EXT_SUB, RSP);
+	emit8_(&a, 8);
+	emit_reg_(&a, TRUE, OP_LOAD, R15, RDI);
+	emit_reg_(&a, FALSE, 0xff, 4, RSI);
+
+	jit->exit = a.p;
+	asm_load64_(&a, RAX, R15, SYS_OFF_(jit));
+	asm_rr_(&a, OP_XOR, RCX, RCX);
+	asm_store64_(&a, RAX, offsetof(pilot_jit, link_site), RCX);
+	jit->exit_keep_link = a.p;
+	emit_reg_(&a, TRUE, 0x83, ALU_EXT_ADD, RSP);
+	emit8_(&a, 8);
+	for (i = sizeof(saved) - 1; i >= 0; i--)
+	{
+		asm_pop_(&a, saved[i]);
+	}
+	emit8_(&a, 0xc3);
+
+	jit->code_start = a.p - jit->code;
+	return !a.overflow;
+}
+
+
+/*
+ * Block translation
+ */
+typedef struct
+{
+	jit_asm a;
+	Pilot_system *sys;
+	pilot_jit *jit;
+	const jit_ir_block *ir;
+	// Host register of each guest register, if the block uses it
+	int8_t host_reg[8];
+	// Whether translated code knows the state of core.lazy_flags at this point, and if so, the write mask of the
+	// pending operation (0 if none)
+	bool lazy_known;
+	uint8_t lazy_mask;
+} jit_emit_ctx;
+
+static inline bool
+jit_caller_saved_ (int r)
+{
+	return r >= R8 && r <= R11;
+}
+
+static void
+jit_emit_call_ (jit_emit_ctx *ctx, const void *fn)
+{
+	int g;
+	for (g = 0; g < 8; g++)
+	{
+		if (ctx->host_reg[g] >= 0 && jit_caller_saved_(ctx->host_reg[g]) && (ctx->ir->regs_written & (1 << g)))
+		{
+			asm_store_(&ctx->a, R15, CORE_OFF_(g), ctx->host_reg[g]);
+		}
+	}
+	asm_call_(&ctx->a, fn);
+	for (g = 0; g < 8; g++)
+	{
+		if (ctx->host_reg[g] >= 0 && jit_caller_saved_(ctx->host_reg[g]))
+		{
+			asm_load_(&ctx->a, ctx->host_reg[g], R15, CORE_OFF_(g));
+		}
+	}
+}
+
+static void
+jit_emit_materialize_ (jit_emit_ctx *ctx)
+{
+	emit_reg_(&ctx->a, TRUE, OP_LOAD, RDI, R15);
+	if (SYS_OFF_(core))
+	{
+		emit_reg_(&ctx->a, TRUE, 0x81, ALU_EXT_ADD, RDI);
+		emit32_(&ctx->a, SYS_OFF_(core));
+	}
+	jit_emit_call_(ctx, (const void *)pilot_execute_materialize_flags);
+	ctx->lazy_known = TRUE;
+	ctx->lazy_mask = 0;
+}
+
+// Brings F up to date before a carry input is read
+static void
+jit_emit_carry_prepare_ (jit_emit_ctx *ctx)
+{
+	uint8_t *skip;
+
+	if (ctx->lazy_known)
+	{
+		if (ctx->lazy_mask)
+		{
+			jit_emit_materialize_(ctx);
+		}
+		return;
+	}
+	asm_cmp8_imm_(&ctx->a, R15, LAZY_OFF_(pending), 0);
+	skip = asm_jcc_(&ctx->a, CC_E);
+	jit_emit_materialize_(ctx);
+	asm_patch_(&ctx->a, skip, ctx->a.p);
+}
+
+// As alu_record_flags_: a pending operation has to be written to F unless this one overwrites all of its flags
+static void
+jit_emit_flags_prepare_ (jit_emit_ctx *ctx, uint8_t write_mask)
+{
+	uint8_t *skip[2];
+
+	if (ctx->lazy_known)
+	{
+		if (ctx->lazy_mask & ~write_mask)
+		{
+			jit_emit_materialize_(ctx);
+		}
+		return;
+	}
+	if (!(0xff & ~write_mask))
+	{
+		return;
+	}
+	asm_cmp8_imm_(&ctx->a, R15, LAZY_OFF_(pending), 0);
+	skip[0] = asm_jcc_(&ctx->a, CC_E);
+	asm_load64_(&ctx->a, R11, R15, LAZY_OFF_(control));
+	emit_reg_(&ctx->a, TRUE, 0xc1, SHIFT_SHR, R11);
+	emit8_(&ctx->a, ECW_FLAG_WRITE_MASK_SHIFT);
+	asm_ri_(&ctx->a, ALU_EXT_AND, R11, 0xff & ~write_mask);
+	skip[1] = asm_jcc_(&ctx->a, CC_E);
+	jit_emit_materialize_(ctx);
+	asm_patch_(&ctx->a, skip[0], ctx->a.p);
+	asm_patch_(&ctx->a, skip[1], ctx->a.p);
+	ctx->lazy_known = FALSE;
+}
+
+static int32_t
+jit_loc_offset_ (const jit_operand *op)
+{
+	switch (op->type)
+	{
+		case JIT_LOC_MEM_ADDR:
+			return SYS_OFF_(execute.mem_addr);
+		case JIT_LOC_MEM_DATA:
+			return SYS_OFF_(execute.mem_data);
+		default:
+			return CORE_OFF_(op->index);
+	}
+}
+
+static inline int
+jit_pinned_ (const jit_emit_ctx *ctx, const jit_operand *op)
+{
+	if (op->type == JIT_LOC_CORE && op->index < 8)
+	{
+		return ctx->host_reg[op->index];
+	}
+	return -1;
+}
+
+static void
+jit_emit_load_operand_ (jit_emit_ctx *ctx, int dst, const jit_operand *op)
+{
+	int host = jit_pinned_(ctx, op);
+
+	if (op->type == JIT_LOC_CONST)
+	{
+		asm_mov_ri_(&ctx->a, dst, op->value);
+		return;
+	}
+	if (host >= 0)
+	{
+		asm_rr_(&ctx->a, OP_MOV, dst, host);
+	}
+	else
+	{
+		asm_load_(&ctx->a, dst, R15, jit_loc_offset_(op));
+	}
+	if (op->shift)
+	{
+		asm_shift_(&ctx->a, SHIFT_SHR, dst, op->shift);
+	}
+	if (op->mask != 0xffffffff)
+	{
+		asm_ri_(&ctx->a, ALU_EXT_AND, dst, op->mask);
+	}
+}
+
+// As BUS_WRITE_; clobbers edi and r11
+static void
+jit_emit_store_operand_ (jit_emit_ctx *ctx, const jit_operand *op, int src)
+{
+	uint32_t field = op->mask << op->shift;
+	int host = jit_pinned_(ctx, op);
+	int target = (host >= 0) ? host : R11;
+
+	if (op->type == JIT_LOC_CONST || !field)
+	{
+		return;
+	}
+	if (host < 0 && field != 0xffffffff)
+	{
+		asm_load_(&ctx->a, R11, R15, jit_loc_offset_(op));
+	}
+	if (field == 0xffffffff)
+	{
+		asm_rr_(&ctx->a, OP_MOV, target, src);
+	}
+	else
+	{
+		asm_rr_(&ctx->a, OP_MOV, RDI, src);
+		asm_ri_(&ctx->a, ALU_EXT_AND, RDI, op->mask);
+		if (op->shift)
+		{
+			asm_shift_(&ctx->a, SHIFT_SHL, RDI, op->shift);
+		}
+		asm_ri_(&ctx->a, ALU_EXT_AND, target, ~field);
+		asm_rr_(&ctx->a, OP_OR, target, RDI);
+	}
+	if (host < 0)
+	{
+		asm_store_(&ctx->a, R15, jit_loc_offset_(op), R11);
+	}
+}
+
+static void
+jit_emit_size_ (jit_emit_ctx *ctx, int r, data_size_spec size, bool sign_extend)
+{
+	if (size == SIZE_8_BIT || size == SIZE_16_BIT)
+	{
+		uint8_t bits = (size == SIZE_8_BIT) ? 24 : 16;
+		if (sign_extend)
+		{
+			asm_shift_(&ctx->a, SHIFT_SHL, r, bits);
+			asm_shift_(&ctx->a, SHIFT_SAR, r, bits);
+		}
+		else
+		{
+			asm_ri_(&ctx->a, ALU_EXT_AND, r, 0xffffffff >> bits);
+		}
+	}
+	else
+	{
+		asm_ri_(&ctx->a, ALU_EXT_AND, r, 0xffffff);
+	}
+}
+
+// Leaves the host pointer to the page's memory in rdx and the offset into it in rcx, or jumps to the returned slow
+// path site if the page has to go through the bus
+static void
+jit_emit_page_lookup_ (jit_emit_ctx *ctx, bool write, uint8_t *slow[3])
+{
+	jit_asm *a = &ctx->a;
+
+	asm_load_(a, RCX, R15, SYS_OFF_(execute.mem_addr));
+	asm_ri_(a, ALU_EXT_AND, RCX, 0xfffffe);
+	asm_rr_(a, OP_MOV, RSI, RCX);
+	asm_shift_(a, SHIFT_SHR, RSI, PILOT_MEM_PAGE_SHIFT);
+	emit_reg_(a, FALSE, 0x69, RSI, RSI);
+	emit32_(a, sizeof(Pilot_mem_page));
+	asm_rr64_(a, OP_ADD, RSI, R15);
+
+	asm_load64_(a, RDX, RSI, write ? PAGE_OFF_(write) : PAGE_OFF_(read));
+	asm_rr64_(a, OP_TEST, RDX, RDX);
+	slow[0] = asm_jcc_(a, CC_E);
+	asm_cmp8_imm_(a, RSI, PAGE_OFF_(wait_states), 0);
+	slow[1] = asm_jcc_(a, CC_NE);
+	slow[2] = NULL;
+	if (write)
+	{
+		asm_cmp8_imm_(a, RSI, PAGE_OFF_(flags), 0);
+		slow[2] = asm_jcc_(a, CC_NE);
+	}
+	asm_ri_(a, ALU_EXT_AND, RCX, PILOT_MEM_PAGE_MASK);
+	asm_rr64_(a, OP_ADD, RDX, RCX);
+}
+
+static void
+jit_emit_mem_access_ (jit_emit_ctx *ctx, bool write)
+{
+	jit_asm *a = &ctx->a;
+	uint8_t *slow[3] = { NULL, NULL, NULL };
+	uint8_t *done = NULL;
+	int i;
+
+	if (!write)
+	{
+		jit_emit_page_lookup_(ctx, FALSE, slow);
+		emit_mem_(a, FALSE, 0x0fb7, RAX, RDX, 0);
+		done = asm_jmp_(a);
+		for (i = 0; i < 3; i++)
+		{
+			if (slow[i])
+			{
+				asm_patch_(a, slow[i], a->p);
+			}
+		}
+		emit_reg_(a, TRUE, OP_LOAD, RDI, R15);
+		asm_load_(a, RSI, R15, SYS_OFF_(execute.mem_addr));
+		jit_emit_call_(ctx, (const void *)pilot_jit_mem_read);
+		asm_patch_(a, done, a->p);
+		asm_store_(a, R15, SYS_OFF_(execute.mem_data), RAX);
+		return;
+	}
+
+	// Lockstep mode has every write journaled
+	if (!ctx->jit->lockstep)
+	{
+		jit_emit_page_lookup_(ctx, TRUE, slow);
+		asm_load_(a, RAX, R15, SYS_OFF_(execute.mem_data));
+		asm_store16_(a, RDX, 0, RAX);
+		done = asm_jmp_(a);
+		for (i = 0; i < 3; i++)
+		{
+			if (slow[i])
+			{
+				asm_patch_(a, slow[i], a->p);
+			}
+		}
+	}
+	emit_reg_(a, TRUE, OP_LOAD, RDI, R15);
+	asm_load_(a, RSI, R15, SYS_OFF_(execute.mem_addr));
+	asm_load_(a, RDX, R15, SYS_OFF_(execute.mem_data));
+	jit_emit_call_(ctx, (const void *)pilot_jit_mem_write);
+	// test al, al
+	emit8_(a, 0x84);
+	emit8_(a, 0xc0);
+	{
+		uint8_t *skip = asm_jcc_(a, CC_E);
+		asm_store8_imm_(a, RSP, 0, 1);
+		asm_patch_(a, skip, a->p);
+	}
+	if (done)
+	{
+		asm_patch_(a, done, a->p);
+	}
+}
+
+// Mirrors pilot_execute_run_control for one control word
+static void
+jit_emit_op_ (jit_emit_ctx *ctx, const jit_op *op)
+{
+	jit_asm *a = &ctx->a;
+	execute_control_word ctl = op->control;
+	alu_operation_spec operation = ECW_GET(ctl, OPERATION);
+	mem_latch_spec latch = ECW_GET(ctl, MEM_LATCH_CTL);
+	mem_write_spec write = ECW_GET(ctl, MEM_WRITE_CTL);
+	bool mem_access = !ECW_GET(ctl, MEM_ACCESS_SUPPRESS);
+	uint8_t write_mask = ECW_GET(ctl, FLAG_WRITE_MASK);
+	bool add_carry = !ECW_GET(ctl, SRC2_ADD1) && ECW_GET(ctl, SRC2_ADD_CARRY);
+
+	// Flags are only touched through calls made up front, while no values are live in scratch registers
+	if (add_carry)
+	{
+		jit_emit_carry_prepare_(ctx);
+	}
+	if (op->record_flags)
+	{
+		jit_emit_flags_prepare_(ctx, write_mask);
+	}
+
+	// Operand latch
+	jit_emit_load_operand_(ctx, RAX, &op->src[0]);
+	jit_emit_load_operand_(ctx, RDX, &op->src[1]);
+
+	// First half memory access
+	if (latch == MEM_LATCH_HALF1)
+	{
+		if (write == MEM_WRITE_FROM_SRC1)
+		{
+			asm_store_(a, R15, SYS_OFF_(execute.mem_data), RDX);
+		}
+		if (mem_access)
+		{
+			asm_store_(a, R15, SYS_OFF_(execute.alu_input_latches[0]), RAX);
+			asm_store_(a, R15, SYS_OFF_(execute.alu_input_latches[1]), RDX);
+			jit_emit_mem_access_(ctx, write != MEM_READ);
+			asm_load_(a, RAX, R15, SYS_OFF_(execute.alu_input_latches[0]));
+			asm_load_(a, RDX, R15, SYS_OFF_(execute.alu_input_latches[1]));
+		}
+	}
+
+	// Result latch
+	if (operation != ALU_OFF)
+	{
+		data_size_spec src2_size = ECW_SRC_GET(ctl, 1, SIZE);
+
+		jit_emit_size_(ctx, RAX, ECW_SRC_GET(ctl, 0, SIZE), op->sign_extend[0]);
+		jit_emit_size_(ctx, RDX, src2_size, op->sign_extend[1]);
+		if (ECW_GET(ctl, SRC2_ADD1))
+		{
+			asm_ri_(a, ALU_EXT_ADD, RDX, 1);
+		}
+		else if (add_carry)
+		{
+			asm_load_(a, RDI, R15, CORE_OFF_(REGFILE_WF));
+			asm_shift_(a, SHIFT_SHR, RDI, 3);
+			asm_ri_(a, ALU_EXT_AND, RDI, 1);
+			asm_rr_(a, OP_ADD, RDX, RDI);
+		}
+		if (ECW_GET(ctl, SRC2_NEGATE))
+		{
+			emit_reg_(a, FALSE, 0xf7, 3, RDX);
+			if (!op->sign_extend[1])
+			{
+				asm_ri_(a, ALU_EXT_AND, RDX, src2_size == SIZE_8_BIT ? 0xff : src2_size == SIZE_16_BIT ? 0xffff : 0xffffff);
+			}
+		}
+		// The second source passes through the shifter, which is 16 bits wide
+		asm_ri_(a, ALU_EXT_AND, RDX, 0xffff);
+
+		asm_rr_(a, OP_MOV, RCX, RAX);
+		switch (operation)
+		{
+			case ALU_ADD:
+				asm_rr_(a, OP_ADD, RCX, RDX);
+				asm_ri_(a, ALU_EXT_AND, RCX, 0xffffff);
+				asm_rr_(a, OP_MOV, RSI, RAX);
+				asm_rr_(a, OP_XOR, RSI, RDX);
+				asm_rr_(a, OP_XOR, RSI, RCX);
+				break;
+			case ALU_AND:
+				asm_rr_(a, OP_AND, RCX, RDX);
+				break;
+			case ALU_OR:
+				asm_rr_(a, OP_OR, RCX, RDX);
+				break;
+			default:
+				asm_rr_(a, OP_XOR, RCX, RDX);
+				break;
+		}
+
+		// F's decimal flag is known to be clear (see needs_decimal_clear), so there's no decimal adjust
+		if (op->record_flags)
+		{
+			asm_mov_ri64_(a, R11, ctl);
+			asm_store64_(a, R15, LAZY_OFF_(control), R11);
+			asm_store_(a, R15, LAZY_OFF_(operands[0]), RAX);
+			asm_store_(a, R15, LAZY_OFF_(operands[1]), RDX);
+			asm_store_(a, R15, LAZY_OFF_(result), RCX);
+			if (operation == ALU_ADD)
+			{
+				asm_store_(a, R15, LAZY_OFF_(carries), RSI);
+			}
+			else
+			{
+				asm_store_imm_(a, R15, LAZY_OFF_(carries), 0);
+			}
+			asm_store8_imm_(a, R15, LAZY_OFF_(shifter_carry), FALSE);
+			asm_store8_imm_(a, R15, LAZY_OFF_(pending), TRUE);
+			ctx->lazy_known = TRUE;
+			ctx->lazy_mask = write_mask;
+		}
+		jit_emit_store_operand_(ctx, &op->dest, RCX);
+	}
+
+	// Second half memory access
+	if (latch >= MEM_LATCH_HALF2)
+	{
+		if (latch == MEM_LATCH_HALF2)
+		{
+			asm_store_(a, R15, SYS_OFF_(execute.mem_addr), RCX);
+		}
+		if (write == MEM_WRITE_FROM_DEST)
+		{
+			asm_store_(a, R15, SYS_OFF_(execute.mem_data), RCX);
+		}
+		if (mem_access)
+		{
+			jit_emit_mem_access_(ctx, write != MEM_READ);
+		}
+	}
+
+#ifdef PILOT_EAGER_FLAGS
+	if (op->record_flags)
+	{
+		jit_emit_materialize_(ctx);
+	}
+#endif
+}
+
+// Leaves the block after its first n instructions
+static void
+jit_emit_exit_ (jit_emit_ctx *ctx, int n, bool chain)
+{
+	jit_asm *a = &ctx->a;
+	const jit_inst *last = &ctx->ir->insts[n - 1];
+	uint8_t *site_imm;
+	uint8_t *site;
+	int g;
+
+	for (g = 0; g < 8; g++)
+	{
+		if (ctx->ir->regs_written & (1 << g))
+		{
+			asm_store_(a, R15, CORE_OFF_(g), ctx->host_reg[g]);
+		}
+	}
+	asm_store_imm_(a, R15, CORE_OFF_(REGFILE_PGC), last->next_pgc);
+	asm_mi64_(a, ALU_EXT_ADD, R15, SYS_OFF_(cycles), last->first_op + last->op_count);
+	asm_mi64_(a, ALU_EXT_ADD, R15, SYS_OFF_(execute.insts_taken), n);
+
+	if (!chain)
+	{
+		asm_jmp_to_(a, ctx->jit->exit);
+		return;
+	}
+	asm_load64_(a, RAX, R15, SYS_OFF_(jit));
+	asm_load64_(a, RCX, R15, SYS_OFF_(cycles));
+	emit_mem_(a, TRUE, OP_CMP_R, RCX, RAX, offsetof(pilot_jit, end));
+	asm_jcc_to_(a, CC_AE, ctx->jit->exit);
+	asm_cmp8_imm_(a, R15, SYS_OFF_(stop_requested), 0);
+	asm_jcc_to_(a, CC_NE, ctx->jit->exit);
+
+	// Patched by the dispatcher to jump to the next block, once it's been translated. The site is recorded on the way
+	// through even once it is, so that if the block there bails as stale, the dispatcher can relink it to the
+	// retranslation.
+	asm_mov_ri64_(a, RCX, 0);
+	site_imm = a->p - 8;
+	asm_store64_(a, RAX, offsetof(pilot_jit, link_site), RCX);
+	site = asm_jmp_(a);
+	if (!a->overflow)
+	{
+		memcpy(site_imm, &site, sizeof(site));
+	}
+	asm_patch_(a, site, ctx->jit->exit_keep_link);
+}
+
+const uint8_t *
+pilot_jit_backend_emit (Pilot_system *sys, pilot_jit *jit, const jit_ir_block *ir)
+{
+	jit_emit_ctx ctx;
+	jit_asm *a = &ctx.a;
+	const uint8_t *body = jit->code + jit->code_used;
+	uint8_t *bail[3] = { NULL, NULL, NULL };
+	uint8_t *early_exit[PILOT_BLOCK_MAX_INSTS];
+	uint8_t *bail_stub;
+	uint8_t regs_used = ir->regs_read | ir->regs_written;
+	bool writes_memory = FALSE;
+	int host = 0;
+	int g, k, i;
+
+	a->p = jit->code + jit->code_used;
+	a->end = jit->code + jit->code_size;
+	a->overflow = FALSE;
+	ctx.sys = sys;
+	ctx.jit = jit;
+	ctx.ir = ir;
+	ctx.lazy_known = FALSE;
+	ctx.lazy_mask = 0;
+	for (g = 0; g < 8; g++)
+	{
+		ctx.host_reg[g] = (regs_used & (1 << g)) ? jit_pin_regs_[host++] : -1;
+	}
+	for (k = 0; k < ir->inst_count; k++)
+	{
+		writes_memory |= ir->insts[k].writes_memory;
+	}
+
+	// The page's code may have changed since the block was translated
+	asm_load64_(a, RAX, R15, SYS_OFF_(block_cache));
+	emit_mem_(a, FALSE, 0x81, ALU_EXT_CMP, RAX,
+		offsetof(pilot_block_cache, page_gen) + (ir->pgc >> PILOT_MEM_PAGE_SHIFT) * sizeof(uint32_t));
+	emit32_(a, ir->gen);
+	bail[0] = asm_jcc_(a, CC_NE);
+
+	if (ir->needs_decimal_clear)
+	{
+		uint8_t *clear;
+
+		asm_test8_imm_(a, R15, CORE_OFF_(REGFILE_WF), F_DECIMAL);
+		bail[1] = asm_jcc_(a, CC_NE);
+		asm_cmp8_imm_(a, R15, LAZY_OFF_(pending), 0);
+		clear = asm_jcc_(a, CC_E);
+		// bt qword [lazy.control], D's bit of the pending operation's write mask
+		emit_mem_(a, TRUE, 0x0fba, 4, R15, LAZY_OFF_(control));
+		emit8_(a, ECW_FLAG_WRITE_MASK_SHIFT + 1);
+		bail[2] = asm_jcc_(a, CC_B);
+		asm_patch_(a, clear, a->p);
+	}
+
+	if (writes_memory)
+	{
+		asm_store8_imm_(a, RSP, 0, 0);
+	}
+	for (g = 0; g < 8; g++)
+	{
+		if (ctx.host_reg[g] >= 0)
+		{
+			asm_load_(a, ctx.host_reg[g], R15, CORE_OFF_(g));
+		}
+	}
+
+	for (k = 0; k < ir->inst_count; k++)
+	{
+		const jit_inst *inst = &ir->insts[k];
+		for (i = inst->first_op; i < inst->first_op + inst->op_count; i++)
+		{
+			jit_emit_op_(&ctx, &ir->ops[i]);
+		}
+		early_exit[k] = NULL;
+		if (inst->writes_memory && k < ir->inst_count - 1)
+		{
+			asm_cmp8_imm_(a, RSP, 0, 0);
+			early_exit[k] = asm_jcc_(a, CC_NE);
+		}
+	}
+	jit_emit_exit_(&ctx, ir->inst_count, !jit->lockstep);
+
+	for (k = 0; k < ir->inst_count; k++)
+	{
+		if (early_exit[k])
+		{
+			asm_patch_(a, early_exit[k], a->p);
+			jit_emit_exit_(&ctx, k + 1, FALSE);
+		}
+	}
+
+	// Keeps link_site, in case a chained exit led here
+	bail_stub = a->p;
+	asm_load64_(a, RAX, R15, SYS_OFF_(jit));
+	asm_store8_imm_(a, RAX, offsetof(pilot_jit, bailed), TRUE);
+	asm_jmp_to_(a, jit->exit_keep_link);
+	for (i = 0; i < 3; i++)
+	{
+		if (bail[i])
+		{
+			asm_patch_(a, bail[i], bail_stub);
+		}
+	}
+
+	if (a->overflow)
+	{
+		return NULL;
+	}
+	jit->code_used = a->p - jit->code;
+	return body;
+}
+
+#else
+
+bool
+pilot_jit_backend_init (pilot_jit *jit)
+{
+	return FALSE;
+}
+
+const uint8_t *
+pilot_jit_backend_emit (Pilot_system *sys, pilot_jit *jit, const jit_ir_block *ir)
+{
+	return NULL;
+}
+
+void
+pilot_jit_backend_link (uint8_t *site, const uint8_t *target)
+{
+}
+
+#endif
@@ -1,10 +1,14 @@
+#include <string.h>
+#include <pthread.h>
 #include "cpu_regs.h"
 #include "cpu_decode.h"
+#include "cpu_execute.h"
 
 static inline mucode_entry
 base_entry_ (mucode_entry_spec spec)
 {
 	mucode_entry prg;
+	memset(&prg, 0, sizeof(prg));
 	prg.next = (mucode_entry_spec)
 	{
 		MU_NONE,
@@ -12,19 +16,19 @@ base_entry_ (mucode_entry_spec spec)
 		spec.size,
 		spec.is_write
 	};
-	prg.operation.srcs[0].size = SIZE_24_BIT;
-	prg.operation.srcs[0].sign_extend = FALSE;
+	ECW_SRC_SET(prg.operation, 0, SIZE, SIZE_24_BIT);
+	ECW_SRC_SET(prg.operation, 0, SIGN_EXTEND, FALSE);
 
-	prg.operation.srcs[1].size = spec.size;
-	prg.operation.srcs[1].sign_extend = FALSE;
+	ECW_SRC_SET(prg.operation, 1, SIZE, spec.size);
+	ECW_SRC_SET(prg.operation, 1, SIGN_EXTEND, FALSE);
 
-	prg.operation.operation = ALU_OFF;
-	prg.operation.shifter_mode = SHIFTER_NONE;
-	prg.operation.dest = DATA_ZERO;
+	ECW_SET(prg.operation, OPERATION, ALU_OFF);
+	ECW_SET(prg.operation, SHIFTER_MODE, SHIFTER_NONE);
+	ECW_SET(prg.operation, DEST, DATA_ZERO);
 	
-	prg.operation.mem_latch_ctl = MEM_NO_LATCH;
-	prg.operation.mem_size = spec.size;
-	prg.operation.mem_access_suppress = FALSE;
+	ECW_SET(prg.operation, MEM_LATCH_CTL, MEM_NO_LATCH);
+	ECW_SET(prg.operation, MEM_SIZE, spec.size);
+	ECW_SET(prg.operation, MEM_ACCESS_SUPPRESS, FALSE);
 	
 	return prg;
 }
@@ -33,11 +37,11 @@ static mucode_entry
 ind_1cyc_imm_ (mucode_entry_spec spec)
 {
 	mucode_entry prg = base_entry_(spec);
-	prg.operation.srcs[0].location = DATA_LATCH_IMM_1;
-	prg.operation.srcs[0].size = spec.size;
+	ECW_SRC_SET(prg.operation, 0, LOCATION, DATA_LATCH_IMM_1);
+	ECW_SRC_SET(prg.operation, 0, SIZE, spec.size);
 	
-	prg.operation.mem_latch_ctl = MEM_LATCH_HALF1;
-	prg.operation.mem_write_ctl = !(spec.is_write) ? MEM_READ : MEM_WRITE_FROM_MDR;
+	ECW_SET(prg.operation, MEM_LATCH_CTL, MEM_LATCH_HALF1);
+	ECW_SET(prg.operation, MEM_WRITE_CTL, !(spec.is_write) ? MEM_READ : MEM_WRITE_FROM_MDR);
 	return prg;
 }
 
@@ -45,11 +49,11 @@ static mucode_entry
 ind_1cyc_imm_rm_ (mucode_entry_spec spec)
 {
 	mucode_entry prg = base_entry_(spec);
-	prg.operation.srcs[0].location = DATA_LATCH_RM_1;
-	prg.operation.srcs[0].size = spec.size;
+	ECW_SRC_SET(prg.operation, 0, LOCATION, DATA_LATCH_RM_1);
+	ECW_SRC_SET(prg.operation, 0, SIZE, spec.size);
 
-	prg.operation.mem_latch_ctl = MEM_LATCH_HALF1;
-	prg.operation.mem_write_ctl = !(spec.is_write) ? MEM_READ : MEM_WRITE_FROM_MDR;
+	ECW_SET(prg.operation, MEM_LATCH_CTL, MEM_LATCH_HALF1);
+	ECW_SET(prg.operation, MEM_WRITE_CTL, !(spec.is_write) ? MEM_READ : MEM_WRITE_FROM_MDR);
 	return prg;
 }
 
@@ -57,11 +61,11 @@ static mucode_entry
 ind_1cyc_imm0_ (mucode_entry_spec spec)
 {
 	mucode_entry prg = base_entry_(spec);
-	prg.operation.srcs[0].location = DATA_LATCH_IMM_0;
-	prg.operation.srcs[0].size = SIZE_8_BIT;
+	ECW_SRC_SET(prg.operation, 0, LOCATION, DATA_LATCH_IMM_0);
+	ECW_SRC_SET(prg.operation, 0, SIZE, SIZE_8_BIT);
 	
-	prg.operation.mem_latch_ctl = MEM_LATCH_HALF1;
-	prg.operation.mem_write_ctl = !(spec.is_write) ? MEM_READ : MEM_WRITE_FROM_MDR;
+	ECW_SET(prg.operation, MEM_LATCH_CTL, MEM_LATCH_HALF1);
+	ECW_SET(prg.operation, MEM_WRITE_CTL, !(spec.is_write) ? MEM_READ : MEM_WRITE_FROM_MDR);
 	return prg;
 }
 
@@ -69,21 +73,21 @@ static mucode_entry
 ind_1cyc_reg_ (mucode_entry_spec spec)
 {
 	mucode_entry prg = base_entry_(spec);
-	prg.operation.srcs[0].size = spec.size;
+	ECW_SRC_SET(prg.operation, 0, SIZE, spec.size);
 	switch (spec.size)
 	{
 		case SIZE_8_BIT:
-			prg.operation.srcs[0].location = DATA_REG_L0 + (spec.reg_select & 0x7);
+			ECW_SRC_SET(prg.operation, 0, LOCATION, DATA_REG_L0 + (spec.reg_select & 0x7));
 			break;
 		case SIZE_16_BIT:
-			prg.operation.srcs[0].location = DATA_REG_W0 + (spec.reg_select & 0x7);
+			ECW_SRC_SET(prg.operation, 0, LOCATION, DATA_REG_W0 + (spec.reg_select & 0x7));
 			break;
 		case SIZE_24_BIT:
-			prg.operation.srcs[0].location = DATA_REG_P0 + (spec.reg_select & 0x7);
+			ECW_SRC_SET(prg.operation, 0, LOCATION, DATA_REG_P0 + (spec.reg_select & 0x7));
 	}
 	
-	prg.operation.mem_latch_ctl = MEM_LATCH_HALF1;
-	prg.operation.mem_write_ctl = !(spec.is_write) ? MEM_READ : MEM_WRITE_FROM_MDR;
+	ECW_SET(prg.operation, MEM_LATCH_CTL, MEM_LATCH_HALF1);
+	ECW_SET(prg.operation, MEM_WRITE_CTL, !(spec.is_write) ? MEM_READ : MEM_WRITE_FROM_MDR);
 	return prg;
 }
 
@@ -101,16 +105,16 @@ ind_1cyc_reg_auto_ (mucode_entry_spec spec)
 {
 	mucode_entry prg = ind_1cyc_reg_(spec);
 	
-	prg.operation.srcs[1].location = DATA_SIZE;
-	prg.operation.src2_add1 = FALSE;
-	prg.operation.src2_negate = TRUE;
+	ECW_SRC_SET(prg.operation, 1, LOCATION, DATA_SIZE);
+	ECW_SET(prg.operation, SRC2_ADD1, FALSE);
+	ECW_SET(prg.operation, SRC2_NEGATE, TRUE);
 	
-	prg.operation.operation = ALU_ADD;
+	ECW_SET(prg.operation, OPERATION, ALU_ADD);
 	
-	prg.operation.dest = prg.operation.srcs[0].location;
+	ECW_SET(prg.operation, DEST, ECW_SRC_GET(prg.operation, 0, LOCATION));
 	
-	prg.operation.mem_latch_ctl = MEM_LATCH_HALF2;
-	prg.operation.mem_write_ctl = !(spec.is_write) ? MEM_READ : MEM_WRITE_FROM_MDR;
+	ECW_SET(prg.operation, MEM_LATCH_CTL, MEM_LATCH_HALF2);
+	ECW_SET(prg.operation, MEM_WRITE_CTL, !(spec.is_write) ? MEM_READ : MEM_WRITE_FROM_MDR);
 	return prg;
 }
 
@@ -118,18 +122,18 @@ static mucode_entry
 ind_2cyc_withimm_ (mucode_entry_spec spec)
 {
 	mucode_entry prg = ind_1cyc_reg_(spec);
-	prg.operation.srcs[1].location = (!(spec.reg_select & 0x10)) ? DATA_LATCH_IMM_1 : DATA_LATCH_RM_1;
-	prg.operation.srcs[1].size = SIZE_16_BIT;
-	prg.operation.srcs[1].sign_extend = TRUE;
+	ECW_SRC_SET(prg.operation, 1, LOCATION, (!(spec.reg_select & 0x10)) ? DATA_LATCH_IMM_1 : DATA_LATCH_RM_1);
+	ECW_SRC_SET(prg.operation, 1, SIZE, SIZE_16_BIT);
+	ECW_SRC_SET(prg.operation, 1, SIGN_EXTEND, TRUE);
 	
-	prg.operation.src2_add1 = FALSE;
-	prg.operation.src2_negate = FALSE;
+	ECW_SET(prg.operation, SRC2_ADD1, FALSE);
+	ECW_SET(prg.operation, SRC2_NEGATE, FALSE);
 	
-	prg.operation.operation = ALU_ADD;
+	ECW_SET(prg.operation, OPERATION, ALU_ADD);
 	
-	prg.operation.dest = DATA_ZERO;
+	ECW_SET(prg.operation, DEST, DATA_ZERO);
 	
-	prg.operation.mem_latch_ctl = MEM_LATCH_HALF2;
+	ECW_SET(prg.operation, MEM_LATCH_CTL, MEM_LATCH_HALF2);
 	return prg;
 }
 
@@ -137,19 +141,19 @@ static mucode_entry
 ind_2cyc_imm_withbits_ (mucode_entry_spec spec)
 {
 	mucode_entry prg = base_entry_(spec);
-	prg.operation.srcs[0].location = (!(spec.reg_select & 0x10)) ? DATA_LATCH_IMM_HML_RM : DATA_LATCH_RM_HML;
+	ECW_SRC_SET(prg.operation, 0, LOCATION, (!(spec.reg_select & 0x10)) ? DATA_LATCH_IMM_HML_RM : DATA_LATCH_RM_HML);
 	
-	prg.operation.srcs[1].location = (!(spec.reg_select & 0x10)) ? DATA_REG_IMM_2_8 : DATA_REG_RM_2_8;
-	prg.operation.srcs[1].sign_extend = spec.reg_select & 0x8;
+	ECW_SRC_SET(prg.operation, 1, LOCATION, (!(spec.reg_select & 0x10)) ? DATA_REG_IMM_2_8 : DATA_REG_RM_2_8);
+	ECW_SRC_SET(prg.operation, 1, SIGN_EXTEND, (spec.reg_select & 0x8) != 0);
 	
-	prg.operation.src2_add1 = FALSE;
-	prg.operation.src2_negate = FALSE;
+	ECW_SET(prg.operation, SRC2_ADD1, FALSE);
+	ECW_SET(prg.operation, SRC2_NEGATE, FALSE);
 	
-	prg.operation.operation = ALU_ADD;
+	ECW_SET(prg.operation, OPERATION, ALU_ADD);
 	
-	prg.operation.dest = DATA_ZERO;
+	ECW_SET(prg.operation, DEST, DATA_ZERO);
 	
-	prg.operation.mem_latch_ctl = MEM_LATCH_HALF2;
+	ECW_SET(prg.operation, MEM_LATCH_CTL, MEM_LATCH_HALF2);
 	return prg;
 }
 
@@ -157,19 +161,19 @@ static mucode_entry
 ind_2cyc_reg_withbits_ (mucode_entry_spec spec)
 {
 	mucode_entry prg = base_entry_(spec);
-	prg.operation.srcs[0].location = (!(spec.reg_select & 0x10)) ? DATA_REG_IMM_1_2 : DATA_REG_RM_1_2;
+	ECW_SRC_SET(prg.operation, 0, LOCATION, (!(spec.reg_select & 0x10)) ? DATA_REG_IMM_1_2 : DATA_REG_RM_1_2);
 	
-	prg.operation.srcs[1].location = (!(spec.reg_select & 0x10)) ? DATA_REG_IMM_1_8 : DATA_REG_RM_1_8;
-	prg.operation.srcs[1].sign_extend = spec.reg_select & 0x8;
+	ECW_SRC_SET(prg.operation, 1, LOCATION, (!(spec.reg_select & 0x10)) ? DATA_REG_IMM_1_8 : DATA_REG_RM_1_8);
+	ECW_SRC_SET(prg.operation, 1, SIGN_EXTEND, (spec.reg_select & 0x8) != 0);
 	
-	prg.operation.src2_add1 = FALSE;
-	prg.operation.src2_negate = FALSE;
+	ECW_SET(prg.operation, SRC2_ADD1, FALSE);
+	ECW_SET(prg.operation, SRC2_NEGATE, FALSE);
 	
-	prg.operation.operation = ALU_ADD;
+	ECW_SET(prg.operation, OPERATION, ALU_ADD);
 	
-	prg.operation.dest = DATA_ZERO;
+	ECW_SET(prg.operation, DEST, DATA_ZERO);
 	
-	prg.operation.mem_latch_ctl = MEM_LATCH_HALF2;
+	ECW_SET(prg.operation, MEM_LATCH_CTL, MEM_LATCH_HALF2);
 	return prg;
 }
 
@@ -177,20 +181,20 @@ static mucode_entry
 ind_2cyc_pgc_withimm_ (mucode_entry_spec spec)
 {
 	mucode_entry prg = base_entry_(spec);
-	prg.operation.srcs[0].location = DATA_REG_PGC;
+	ECW_SRC_SET(prg.operation, 0, LOCATION, DATA_REG_PGC);
 	
-	prg.operation.srcs[1].location = DATA_LATCH_IMM_0;
-	prg.operation.srcs[1].size = SIZE_8_BIT;
-	prg.operation.srcs[1].sign_extend = TRUE;
+	ECW_SRC_SET(prg.operation, 1, LOCATION, DATA_LATCH_IMM_0);
+	ECW_SRC_SET(prg.operation, 1, SIZE, SIZE_8_BIT);
+	ECW_SRC_SET(prg.operation, 1, SIGN_EXTEND, TRUE);
 	
-	prg.operation.src2_add1 = FALSE;
-	prg.operation.src2_negate = FALSE;
+	ECW_SET(prg.operation, SRC2_ADD1, FALSE);
+	ECW_SET(prg.operation, SRC2_NEGATE, FALSE);
 	
-	prg.operation.operation = ALU_ADD;
+	ECW_SET(prg.operation, OPERATION, ALU_ADD);
 	
-	prg.operation.dest = DATA_ZERO;
+	ECW_SET(prg.operation, DEST, DATA_ZERO);
 	
-	prg.operation.mem_latch_ctl = MEM_LATCH_HALF2;
+	ECW_SET(prg.operation, MEM_LATCH_CTL, MEM_LATCH_HALF2);
 	return prg;
 }
 
@@ -198,20 +202,20 @@ static mucode_entry
 ind_2cyc_pgc_withimm_rm_ (mucode_entry_spec spec)
 {
 	mucode_entry prg = base_entry_(spec);
-	prg.operation.srcs[0].location = DATA_REG_PGC;
+	ECW_SRC_SET(prg.operation, 0, LOCATION, DATA_REG_PGC);
 	
-	prg.operation.srcs[1].location = (!(spec.reg_select & 0x10)) ? DATA_LATCH_IMM_1 : DATA_LATCH_RM_1;
-	prg.operation.srcs[1].size = spec.size;
-	prg.operation.srcs[1].sign_extend = (spec.size == SIZE_16_BIT);
+	ECW_SRC_SET(prg.operation, 1, LOCATION, (!(spec.reg_select & 0x10)) ? DATA_LATCH_IMM_1 : DATA_LATCH_RM_1);
+	ECW_SRC_SET(prg.operation, 1, SIZE, spec.size);
+	ECW_SRC_SET(prg.operation, 1, SIGN_EXTEND, (spec.size == SIZE_16_BIT));
 	
-	prg.operation.src2_add1 = FALSE;
-	prg.operation.src2_negate = FALSE;
+	ECW_SET(prg.operation, SRC2_ADD1, FALSE);
+	ECW_SET(prg.operation, SRC2_NEGATE, FALSE);
 	
-	prg.operation.operation = ALU_ADD;
+	ECW_SET(prg.operation, OPERATION, ALU_ADD);
 	
-	prg.operation.dest = DATA_ZERO;
+	ECW_SET(prg.operation, DEST, DATA_ZERO);
 	
-	prg.operation.mem_latch_ctl = MEM_LATCH_HALF2;
+	ECW_SET(prg.operation, MEM_LATCH_CTL, MEM_LATCH_HALF2);
 	return prg;
 }
 
@@ -219,20 +223,20 @@ static mucode_entry
 ind_2cyc_pgc_withhml_ (mucode_entry_spec spec)
 {
 	mucode_entry prg = base_entry_(spec);
-	prg.operation.srcs[0].location = DATA_REG_PGC;
+	ECW_SRC_SET(prg.operation, 0, LOCATION, DATA_REG_PGC);
 	
-	prg.operation.srcs[1].location = DATA_LATCH_IMM_HML;
-	prg.operation.srcs[1].size = SIZE_24_BIT;
-	prg.operation.srcs[1].sign_extend = FALSE;
+	ECW_SRC_SET(prg.operation, 1, LOCATION, DATA_LATCH_IMM_HML);
+	ECW_SRC_SET(prg.operation, 1, SIZE, SIZE_24_BIT);
+	ECW_SRC_SET(prg.operation, 1, SIGN_EXTEND, FALSE);
 	
-	prg.operation.src2_add1 = FALSE;
-	prg.operation.src2_negate = FALSE;
+	ECW_SET(prg.operation, SRC2_ADD1, FALSE);
+	ECW_SET(prg.operation, SRC2_NEGATE, FALSE);
 	
-	prg.operation.operation = ALU_ADD;
+	ECW_SET(prg.operation, OPERATION, ALU_ADD);
 	
-	prg.operation.dest = DATA_ZERO;
+	ECW_SET(prg.operation, DEST, DATA_ZERO);
 	
-	prg.operation.mem_latch_ctl = MEM_LATCH_HALF2;
+	ECW_SET(prg.operation, MEM_LATCH_CTL, MEM_LATCH_HALF2);
 	return prg;
 }
 
@@ -240,20 +244,20 @@ static mucode_entry
 ind_2cyc_pgc_withhml_rm_ (mucode_entry_spec spec)
 {
 	mucode_entry prg = base_entry_(spec);
-	prg.operation.srcs[0].location = DATA_REG_PGC;
+	ECW_SRC_SET(prg.operation, 0, LOCATION, DATA_REG_PGC);
 	
-	prg.operation.srcs[1].location = (!(spec.reg_select & 0x10)) ? DATA_LATCH_IMM_HML_RM : DATA_LATCH_RM_HML;
-	prg.operation.srcs[1].size = SIZE_24_BIT;
-	prg.operation.srcs[1].sign_extend = FALSE;
+	ECW_SRC_SET(prg.operation, 1, LOCATION, (!(spec.reg_select & 0x10)) ? DATA_LATCH_IMM_HML_RM : DATA_LATCH_RM_HML);
+	ECW_SRC_SET(prg.operation, 1, SIZE, SIZE_24_BIT);
+	ECW_SRC_SET(prg.operation, 1, SIGN_EXTEND, FALSE);
 	
-	prg.operation.src2_add1 = FALSE;
-	prg.operation.src2_negate = FALSE;
+	ECW_SET(prg.operation, SRC2_ADD1, FALSE);
+	ECW_SET(prg.operation, SRC2_NEGATE, FALSE);
 	
-	prg.operation.operation = ALU_ADD;
+	ECW_SET(prg.operation, OPERATION, ALU_ADD);
 	
-	prg.operation.dest = DATA_ZERO;
+	ECW_SET(prg.operation, DEST, DATA_ZERO);
 	
-	prg.operation.mem_latch_ctl = MEM_LATCH_HALF2;
+	ECW_SET(prg.operation, MEM_LATCH_CTL, MEM_LATCH_HALF2);
 	return prg;
 }
 
@@ -261,17 +265,17 @@ static mucode_entry
 after_autoidx_ (mucode_entry_spec spec)
 {
 	mucode_entry prg = ind_1cyc_reg_(spec);
-	prg.operation.srcs[1].location = DATA_SIZE;
-	prg.operation.srcs[1].size = SIZE_24_BIT;
+	ECW_SRC_SET(prg.operation, 1, LOCATION, DATA_SIZE);
+	ECW_SRC_SET(prg.operation, 1, SIZE, SIZE_24_BIT);
 	
-	prg.operation.src2_add1 = FALSE;
-	prg.operation.src2_negate = FALSE;
+	ECW_SET(prg.operation, SRC2_ADD1, FALSE);
+	ECW_SET(prg.operation, SRC2_NEGATE, FALSE);
 	
-	prg.operation.operation = ALU_ADD;
+	ECW_SET(prg.operation, OPERATION, ALU_ADD);
 	
-	prg.operation.dest = prg.operation.srcs[0].location;
+	ECW_SET(prg.operation, DEST, ECW_SRC_GET(prg.operation, 0, LOCATION));
 	
-	prg.operation.mem_latch_ctl = MEM_NO_LATCH;
+	ECW_SET(prg.operation, MEM_LATCH_CTL, MEM_NO_LATCH);
 	return prg;
 }
 
@@ -314,3 +318,73 @@ decode_mucode_entry (mucode_entry_spec spec)
 			return base_entry_(spec);
 	}
 }
+
+/*
+ * Microcode ROM
+ *
+ * Every combination of entry index, register select, size and read/write is expanded once through
+ * decode_mucode_entry. The sequencer then executes entries straight out of the ROM.
+ */
+#define MUCODE_REG_SELECTS 0x20
+#define MUCODE_ROM_INDEX_(entry_idx, reg_select, size, is_write) \
+	(((((entry_idx) * MUCODE_REG_SELECTS + ((reg_select) & (MUCODE_REG_SELECTS - 1))) * 3 + (size)) << 1) | ((is_write) != 0))
+#define MUCODE_ROM_SIZE MUCODE_ROM_INDEX_(MU_POST_AUTOIDX + 1, 0, 0, 0)
+
+static mucode_entry mucode_rom_[MUCODE_ROM_SIZE];
+static pthread_once_t mucode_rom_once_ = PTHREAD_ONCE_INIT;
+
+static void
+mucode_build_rom_ (void)
+{
+	mucode_entry_spec spec;
+	int entry_idx;
+	int reg_select;
+	int size;
+	int is_write;
+
+	for (entry_idx = MU_NONE; entry_idx <= MU_POST_AUTOIDX; entry_idx++)
+	{
+		for (reg_select = 0; reg_select < MUCODE_REG_SELECTS; reg_select++)
+		{
+			for (size = SIZE_8_BIT; size <= SIZE_24_BIT; size++)
+			{
+				for (is_write = FALSE; is_write <= TRUE; is_write++)
+				{
+					spec = (mucode_entry_spec) { entry_idx, reg_select, size, is_write };
+					mucode_entry *entry = &mucode_rom_[MUCODE_ROM_INDEX_(entry_idx, reg_select, size, is_write)];
+					*entry = (entry_idx == MU_NONE) ? base_entry_(spec) : decode_mucode_entry(spec);
+					pilot_execute_select_alu_kernel(&entry->operation);
+				}
+			}
+		}
+	}
+}
+
+void
+pilot_mucode_init_rom (void)
+{
+	pthread_once(&mucode_rom_once_, mucode_build_rom_);
+}
+
+const mucode_entry *
+pilot_mucode_lookup (mucode_entry_spec spec)
+{
+	return &mucode_rom_[MUCODE_ROM_INDEX_(spec.entry_idx, spec.reg_select, spec.size, spec.is_write)];
+}
+
+int32_t
+pilot_mucode_rom_index (const execute_control_word *control)
+{
+	const mucode_entry *entry = (const mucode_entry *)control;
+	if (entry < mucode_rom_ || entry >= mucode_rom_ + MUCODE_ROM_SIZE || &entry->operation != control)
+	{
+		return -1;
+	}
+	return (int32_t)(entry - mucode_rom_);
+}
+
+const execute_control_word *
+pilot_mucode_rom_control (uint32_t index)
+{
+	return (index < MUCODE_ROM_SIZE) ? &mucode_rom_[index].operation : NULL;
+}
@@ -3,19 +3,51 @@
 
 #include "types.h"
 
+// Register file indices of the non-general purpose registers
+enum
+{
+	REGFILE_WF = 8,
+	REGFILE_PGC,
+	REGFILE_REPI,
+	REGFILE_REPR,
+	REGFILE_SIZE
+};
+
+// Inputs of the last flag-setting ALU operation whose flags haven't been written to F yet.
+// F is only brought up to date (pilot_execute_materialize_flags) when something reads or overwrites it.
+typedef struct
+{
+	execute_control_word control;
+	uint32_t operands[2];
+	uint32_t result;
+	uint32_t carries;
+	bool shifter_carry;
+	bool pending;
+} Pilot_lazy_flags;
+
 typedef struct {
-	uint32_t regs[8];
-	uint16_t wf;
+	// Every register is also addressable as a 32-bit word of file[], so the execute stage can route data bus
+	// specifiers to them uniformly
+	union
+	{
+		uint32_t file[REGFILE_SIZE];
+		struct
+		{
+			uint32_t regs[8];
+			uint32_t wf;
 
-	// Program countet
-	uint32_t pgc;
-	
-	// Internal states
-	uint8_t repi;
-	uint8_t repr;
+			// Program countet
+			uint32_t pgc;
+			
+			// Internal states
+			uint32_t repi;
+			uint32_t repr;
+		};
+	};
+	Pilot_lazy_flags lazy_flags;
 } Pilot_cpu_regs;
 
-const enum
+typedef enum
 {
 	// Extend carry/borrow
 	F_EXTEND   = 1 << 0,
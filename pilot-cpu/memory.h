@@ -5,13 +5,78 @@
 #include <stddef.h>
 #include "pilot.h"
 
+#define WRAM_START       0x000000
+#define WRAM_END         0x007fff
+#define VRAM_START       0x008000
+#define VRAM_END         0x00ffff
+#define CART_CS1_START   0x010000
+#define CART_CS1_END     0x0fffff
+#define CART_CS2_START   0x100000
+#define CART_CS2_END     0x1fffff
+#define CART_ROM_START   0x200000
+#define CART_ROM_END     0xffdfff
+#define TMRAM_START      0xffe000
+#define TMRAM_END        0xffefff
+#define OAM_START        0xfff000
+#define OAM_END          0xfff27f
+#define HCIO_START       0xfff300
+#define HCIO_END         0xfff3ff
+#define HRAM_START       0xfff400
+#define HRAM_END         0xffffff
+
+void Pilot_mem_init (Pilot_system *sys);
+
+// Maps [start, end] straight onto host memory. Passing a NULL write pointer makes the range read-only, with writes
+// going to the page's current handler.
+void Pilot_mem_map_direct (Pilot_system *sys, uint32_t start, uint32_t end, uint8_t *read, uint8_t *write, uint8_t wait_states);
+void Pilot_mem_map_handler (Pilot_system *sys, uint32_t start, uint32_t end, Pilot_mem_handler_id handler, uint8_t wait_states);
+void Pilot_mem_set_handler (Pilot_system *sys, Pilot_mem_handler_id handler, Pilot_mem_handler callbacks);
+
+// Runs the memory controller for one cycle. Not called while it's waiting; see Pilot_memctl.waiting.
 void Pilot_memctl_tick (Pilot_system *sys);
+// Completes the access in progress, if any, without waiting out its wait states
+void Pilot_memctl_finish (Pilot_system *sys);
+// Abandons the access in progress
+void pilot_memctl_reset (Pilot_system *sys);
 
 Pilot_memctl_state Pilot_mem_addr_read_assert (Pilot_system *sys, uint32_t addr);
 Pilot_memctl_state Pilot_mem_addr_write_assert (Pilot_system *sys, uint32_t addr, uint16_t data);
 bool Pilot_mem_data_wait (Pilot_system *sys);
 uint16_t Pilot_mem_get_data (Pilot_system *sys);
 
+// Whole accesses, bypassing the memory controller's states; return the number of cycles the access takes
+unsigned Pilot_mem_read_sync (Pilot_system *sys, uint32_t addr, uint16_t *data);
+unsigned Pilot_mem_write_sync (Pilot_system *sys, uint32_t addr, uint16_t data);
+// Same as that many reads and writes of consecutive words, going up from the given addresses, but done in bulk where
+// pages are mapped directly; for repeated block moves and fills
+unsigned Pilot_mem_copy_sync (Pilot_system *sys, uint32_t dest, uint32_t src, uint32_t words);
+unsigned Pilot_mem_fill_sync (Pilot_system *sys, uint32_t dest, uint16_t data, uint32_t words);
+
+/*
+ * Dirty page tracking, for incremental snapshots. A page flagged PILOT_PAGE_DIRTY has its bit in sys->dirty_pages set
+ * by the next write to it through the bus (from any engine, bulk accesses included), which also clears the flag so
+ * further writes go at full speed; remapping a page sets its bit too. Writes the host makes straight into the RAM
+ * arrays aren't seen.
+ */
+// Clears the page's bit and flags it to have it set again
+void pilot_mem_track_writes (Pilot_system *sys, uint32_t page);
+// Unflags the page, leaving its bit as it is
+void pilot_mem_untrack_writes (Pilot_system *sys, uint32_t page);
+// Sets page flags (PILOT_PAGE_*), making sure that a write to the page the memory controller already has under way
+// goes through mem_write too. Anything flagging a page has to go through here.
+void pilot_mem_flag_page (Pilot_system *sys, uint32_t page, uint8_t flags);
+// Reports a write to, or remap of, a page with flags set, as the bus does
+void pilot_mem_page_written (Pilot_system *sys, uint32_t page);
+// Reports the RAM pages of the default map as written, after the host replaced RAM behind the bus' back: blocks
+// cached from it (and their translations) have to go, and tracked pages are dirty
+void pilot_mem_ram_replaced (Pilot_system *sys);
+
+static inline bool
+pilot_mem_page_dirty (const Pilot_system *sys, uint32_t page)
+{
+	return (sys->dirty_pages[page >> 5] >> (page & 31)) & 1;
+}
+
 uint16_t Pilot_memctl_read (Pilot_system *sys);
 void Pilot_memctl_write (Pilot_system *sys, uint16_t data);
 
@@ -1,56 +1,268 @@
 #include "memory.h"
+#include "block_cache.h"
+#include "clone.h"
+#include "replay.h"
+#include "scheduler.h"
 #include <stddef.h>
+#include <string.h>
 
-#define WRAM_END         0x007fff
-#define VRAM_END         0x00ffff
-#define CART_CS1_END     0x0fffff
-#define CART_CS2_END     0x1fffff
-#define CART_ROM_END     0xffdfff
-#define TMRAM_END        0xffefff
-#define OAM_END          0xfff27f
-#define HCIO_START       0xfff300
-#define HCIO_END         0xfff3ff
-#define HRAM_END         0xffffff
+#define PAGE_OF_(addr) ((addr) >> PILOT_MEM_PAGE_SHIFT)
 
-bool
-mem_read (Pilot_system *sys)
+static inline void
+mem_page_set_dirty_ (Pilot_system *sys, uint32_t page)
+{
+	sys->dirty_pages[page >> 5] |= 1u << (page & 31);
+}
+
+void
+pilot_mem_page_written (Pilot_system *sys, uint32_t page)
 {
-	uint32_t addr = sys->memctl.addr_reg;
-	if (addr <= WRAM_END)
+	Pilot_mem_page *p = &sys->mem_pages[page];
+	if (p->flags & PILOT_PAGE_DIRTY)
 	{
-		// try to read WRAM
+		// Once is enough until the page is tracked again
+		p->flags &= ~PILOT_PAGE_DIRTY;
+		mem_page_set_dirty_(sys, page);
 	}
-	else if (addr <= VRAM_END)
+	if (p->flags & PILOT_PAGE_CODE)
 	{
-		// try to read VRAM
+		pilot_block_cache_page_written(sys, page);
 	}
-	else if (addr <= CART_CS2_END)
+	// Last, so the write lands in the system's own copy
+	if (p->flags & PILOT_PAGE_COW)
 	{
-		// call cartridge chip select mapper
+		pilot_cow_page_written(sys, page);
 	}
-	else if (addr <= CART_ROM_END)
+}
+
+// Only RAM pages can have changed; ROM stays as it was
+void
+pilot_mem_ram_replaced (Pilot_system *sys)
+{
+	static const uint32_t ranges[][2] =
 	{
-		// call cartridge mapper
+		{ WRAM_START, VRAM_END },
+		{ TMRAM_START, TMRAM_END },
+		{ OAM_START, HRAM_END },
+	};
+	uint32_t page;
+	size_t i;
+
+	for (i = 0; i < sizeof(ranges) / sizeof(ranges[0]); i++)
+	{
+		for (page = PAGE_OF_(ranges[i][0]); page <= PAGE_OF_(ranges[i][1]); page++)
+		{
+			if (sys->mem_pages[page].flags)
+			{
+				pilot_mem_page_written(sys, page);
+			}
+		}
 	}
-	else if (addr <= TMRAM_END)
+}
+
+void
+pilot_mem_flag_page (Pilot_system *sys, uint32_t page, uint8_t flags)
+{
+	sys->mem_pages[page].flags |= flags;
+	// A write asserted before the page was flagged would skip mem_write
+	if (sys->memctl.state == MCTL_MEM_W_BUSY && PAGE_OF_(sys->memctl.addr_reg & 0xffffff) == page)
 	{
-		// tilemap RAM
+		sys->memctl.direct_ptr = NULL;
 	}
-	else if (addr <= OAM_END)
+}
+
+void
+pilot_mem_track_writes (Pilot_system *sys, uint32_t page)
+{
+	sys->dirty_pages[page >> 5] &= ~(1u << (page & 31));
+	pilot_mem_flag_page(sys, page, PILOT_PAGE_DIRTY);
+}
+
+void
+pilot_mem_untrack_writes (Pilot_system *sys, uint32_t page)
+{
+	sys->mem_pages[page].flags &= ~PILOT_PAGE_DIRTY;
+}
+
+static bool
+open_bus_read_ (Pilot_system *sys, uint32_t addr, uint16_t *data)
+{
+	(void)sys;
+	(void)addr;
+	*data = 0xffff;
+	return TRUE;
+}
+
+static void
+open_bus_write_ (Pilot_system *sys, uint32_t addr, uint16_t data)
+{
+	(void)sys;
+	(void)addr;
+	(void)data;
+}
+
+// OAM and HCIO share the page at 0xfff000, so this page is always dispatched through a handler
+static bool
+oam_hcio_read_ (Pilot_system *sys, uint32_t addr, uint16_t *data)
+{
+	if (addr <= OAM_END)
 	{
-		// sprite attribute RAM
+		addr -= OAM_START;
+		*data = sys->oam[addr] | (sys->oam[addr + 1] << 8);
 	}
-	else if (HCIO_START <= addr && addr <= HCIO_END)
+	else if (addr >= HCIO_START)
 	{
 		// memory mapped I/O
+		addr -= HCIO_START;
+		*data = sys->hcio[addr] | (sys->hcio[addr + 1] << 8);
+		if (sys->replay)
+		{
+			*data = pilot_replay_hcio_read(sys, addr, *data);
+		}
+	}
+	else
+	{
+		*data = 0xffff;
+	}
+	return TRUE;
+}
+
+static void
+oam_hcio_write_ (Pilot_system *sys, uint32_t addr, uint16_t data)
+{
+	if (addr <= OAM_END)
+	{
+		addr -= OAM_START;
+		sys->oam[addr] = data & 0xff;
+		sys->oam[addr + 1] = data >> 8;
+	}
+	else if (addr >= HCIO_START)
+	{
+		addr -= HCIO_START;
+		sys->hcio[addr] = data & 0xff;
+		sys->hcio[addr + 1] = data >> 8;
+	}
+}
+
+void
+Pilot_mem_map_direct (Pilot_system *sys, uint32_t start, uint32_t end, uint8_t *read, uint8_t *write, uint8_t wait_states)
+{
+	uint32_t page;
+	size_t offset = 0;
+	if (sys->cow)
+	{
+		pilot_cow_remapped(sys, start, end, read, write);
+	}
+	for (page = PAGE_OF_(start); page <= PAGE_OF_(end); page++)
+	{
+		Pilot_mem_page *p = &sys->mem_pages[page];
+		if (p->flags)
+		{
+			pilot_mem_page_written(sys, page);
+		}
+		mem_page_set_dirty_(sys, page);
+		p->read = read ? read + offset : NULL;
+		p->write = write ? write + offset : NULL;
+		p->wait_states = wait_states;
+		offset += PILOT_MEM_PAGE_SIZE;
+	}
+}
+
+void
+Pilot_mem_map_handler (Pilot_system *sys, uint32_t start, uint32_t end, Pilot_mem_handler_id handler, uint8_t wait_states)
+{
+	uint32_t page;
+	if (sys->cow)
+	{
+		pilot_cow_remapped(sys, start, end, NULL, NULL);
+	}
+	for (page = PAGE_OF_(start); page <= PAGE_OF_(end); page++)
+	{
+		Pilot_mem_page *p = &sys->mem_pages[page];
+		if (p->flags)
+		{
+			pilot_mem_page_written(sys, page);
+		}
+		mem_page_set_dirty_(sys, page);
+		p->read = NULL;
+		p->write = NULL;
+		p->handler = handler;
+		p->wait_states = wait_states;
+	}
+}
+
+void
+Pilot_mem_set_handler (Pilot_system *sys, Pilot_mem_handler_id handler, Pilot_mem_handler callbacks)
+{
+	sys->mem_handlers[handler] = callbacks;
+}
+
+static void
+memctl_wait_done_ (Pilot_system *sys, Pilot_event_id id)
+{
+	(void)id;
+	sys->memctl.waiting = FALSE;
+}
+
+void
+Pilot_mem_init (Pilot_system *sys)
+{
+	int i;
+	for (i = 0; i < MEM_HANDLERS_MAX; i++)
+	{
+		sys->mem_handlers[i] = (Pilot_mem_handler) { open_bus_read_, open_bus_write_ };
+	}
+	sys->mem_handlers[MEM_HANDLER_OAM_HCIO] = (Pilot_mem_handler) { oam_hcio_read_, oam_hcio_write_ };
+	Pilot_event_set_handler(sys, PILOT_EVENT_MEMCTL, memctl_wait_done_);
+
+	Pilot_mem_map_direct(sys, WRAM_START, WRAM_END, sys->wram, sys->wram, 0);
+	Pilot_mem_map_direct(sys, VRAM_START, VRAM_END, sys->vram, sys->vram, 0);
+	// Cartridges install their own handlers or mappings over these
+	Pilot_mem_map_handler(sys, CART_CS1_START, CART_CS1_END, MEM_HANDLER_CART_CS1, 0);
+	Pilot_mem_map_handler(sys, CART_CS2_START, CART_CS2_END, MEM_HANDLER_CART_CS2, 0);
+	Pilot_mem_map_handler(sys, CART_ROM_START, CART_ROM_END, MEM_HANDLER_CART_ROM, 0);
+	Pilot_mem_map_direct(sys, TMRAM_START, TMRAM_END, sys->tmram, sys->tmram, 0);
+	Pilot_mem_map_handler(sys, OAM_START, HCIO_END, MEM_HANDLER_OAM_HCIO, 0);
+	Pilot_mem_map_direct(sys, HRAM_START, HRAM_END, sys->hram, sys->hram, 0);
+}
+
+/*
+ * The external bus is 16 bits wide, so the lowest address bit is ignored here; byte lanes are picked out by the CPU.
+ */
+bool
+mem_read (Pilot_system *sys)
+{
+	uint32_t addr = sys->memctl.addr_reg & 0xfffffe;
+	const Pilot_mem_page *page = &sys->mem_pages[PAGE_OF_(addr)];
+	if (page->read)
+	{
+		const uint8_t *host = page->read + (addr & PILOT_MEM_PAGE_MASK);
+		sys->memctl.data_reg_in = host[0] | (host[1] << 8);
+		return TRUE;
 	}
-	else if (addr <= HRAM_END)
+
+	return sys->mem_handlers[page->handler].read(sys, addr, &sys->memctl.data_reg_in);
+}
+
+bool
+mem_write (Pilot_system *sys)
+{
+	uint32_t addr = sys->memctl.addr_reg & 0xfffffe;
+	const Pilot_mem_page *page = &sys->mem_pages[PAGE_OF_(addr)];
+	if (page->flags)
+	{
+		pilot_mem_page_written(sys, PAGE_OF_(addr));
+	}
+	if (page->write)
 	{
-		sys->memctl.data_reg_in = sys->hram[addr] | (sys->hram[addr + 1] << 8);
+		uint8_t *host = page->write + (addr & PILOT_MEM_PAGE_MASK);
+		host[0] = sys->memctl.data_reg_out & 0xff;
+		host[1] = sys->memctl.data_reg_out >> 8;
 		return TRUE;
 	}
-	
-	return FALSE;
+
+	sys->mem_handlers[page->handler].write(sys, addr, sys->memctl.data_reg_out);
+	return TRUE;
 }
 
 /*
@@ -64,13 +276,27 @@ mem_read (Pilot_system *sys)
  * Writes:
  * Tick 0: Pilot_mem_addr_write_assert
  * 
+ * n is the wait state count of the page being accessed.
  */
+static inline uint8_t *
+direct_ptr_ (Pilot_system *sys, const Pilot_mem_page *page, uint8_t *host, uint32_t addr)
+{
+	if (!sys->memctl.direct_ram || !host || page->wait_states)
+	{
+		return NULL;
+	}
+	return host + (addr & PILOT_MEM_PAGE_MASK & ~1);
+}
+
 Pilot_memctl_state
 Pilot_mem_addr_read_assert (Pilot_system *sys, uint32_t addr)
 {
 	if (sys->memctl.state == MCTL_READY)
 	{
+		const Pilot_mem_page *page = &sys->mem_pages[PAGE_OF_(addr & 0xffffff)];
 		sys->memctl.addr_reg = addr;
+		sys->memctl.wait_cycles_left = page->wait_states;
+		sys->memctl.direct_ptr = direct_ptr_(sys, page, page->read, addr);
 		sys->memctl.state = MCTL_MEM_R_BUSY;
 		return MCTL_READY;
 	}
@@ -83,8 +309,12 @@ Pilot_mem_addr_write_assert (Pilot_system *sys, uint32_t addr, uint16_t data)
 {
 	if (sys->memctl.state == MCTL_READY)
 	{
+		const Pilot_mem_page *page = &sys->mem_pages[PAGE_OF_(addr & 0xffffff)];
 		sys->memctl.addr_reg = addr;
 		sys->memctl.data_reg_out = data;
+		sys->memctl.wait_cycles_left = page->wait_states;
+		// Writes to flagged pages have to go through mem_write to be reported
+		sys->memctl.direct_ptr = page->flags ? NULL : direct_ptr_(sys, page, page->write, addr);
 		sys->memctl.state = MCTL_MEM_W_BUSY;
 		return MCTL_READY;
 	}
@@ -107,15 +337,207 @@ void
 Pilot_memctl_tick (Pilot_system *sys)
 {
 	sys->memctl.data_valid = FALSE;
-	if (sys->memctl.state == MCTL_MEM_R_BUSY && mem_read(sys))
+	if (sys->memctl.state == MCTL_READY)
+	{
+		return;
+	}
+	// Nothing happens until the wait states are up, so rather than count them down here, the controller sits out
+	// the rest of them on an event and the run loop stops ticking it until then
+	if (sys->memctl.wait_cycles_left > 0)
+	{
+		Pilot_event_schedule(sys, PILOT_EVENT_MEMCTL, sys->cycles + sys->memctl.wait_cycles_left);
+		sys->memctl.wait_cycles_left = 0;
+		sys->memctl.waiting = TRUE;
+		return;
+	}
+	if (sys->memctl.direct_ptr)
+	{
+		// Reads are picked up by Pilot_mem_get_data through the same pointer
+		if (sys->memctl.state == MCTL_MEM_W_BUSY)
+		{
+			sys->memctl.direct_ptr[0] = sys->memctl.data_reg_out & 0xff;
+			sys->memctl.direct_ptr[1] = sys->memctl.data_reg_out >> 8;
+			sys->memctl.direct_ptr = NULL;
+		}
+		sys->memctl.state = MCTL_READY;
+		sys->memctl.data_valid = TRUE;
+		return;
+	}
+	if ((sys->memctl.state == MCTL_MEM_R_BUSY && mem_read(sys))
+		|| (sys->memctl.state == MCTL_MEM_W_BUSY && mem_write(sys)))
 	{
 		sys->memctl.state = MCTL_READY;
 		sys->memctl.data_valid = TRUE;
 	}
 }
 
+void
+Pilot_memctl_finish (Pilot_system *sys)
+{
+	if (sys->memctl.waiting)
+	{
+		Pilot_event_cancel(sys, PILOT_EVENT_MEMCTL);
+		sys->memctl.waiting = FALSE;
+	}
+	while (sys->memctl.state != MCTL_READY)
+	{
+		Pilot_memctl_tick(sys);
+	}
+}
+
+void
+pilot_memctl_reset (Pilot_system *sys)
+{
+	Pilot_event_cancel(sys, PILOT_EVENT_MEMCTL);
+	sys->memctl.state = MCTL_READY;
+	sys->memctl.data_valid = FALSE;
+	sys->memctl.waiting = FALSE;
+	sys->memctl.direct_ptr = NULL;
+}
+
+/*
+ * Accesses for the instruction-level engine, which does a whole access at once instead of going through the memory
+ * controller's states. The cycle count includes the access cycle itself and any wait states.
+ */
+unsigned
+Pilot_mem_read_sync (Pilot_system *sys, uint32_t addr, uint16_t *data)
+{
+	unsigned cycles = 1 + sys->mem_pages[PAGE_OF_(addr & 0xffffff)].wait_states;
+	sys->memctl.addr_reg = addr;
+	while (!mem_read(sys))
+	{
+		cycles++;
+	}
+	*data = sys->memctl.data_reg_in;
+	return cycles;
+}
+
+unsigned
+Pilot_mem_write_sync (Pilot_system *sys, uint32_t addr, uint16_t data)
+{
+	unsigned cycles = 1 + sys->mem_pages[PAGE_OF_(addr & 0xffffff)].wait_states;
+	sys->memctl.addr_reg = addr;
+	sys->memctl.data_reg_out = data;
+	mem_write(sys);
+	return cycles;
+}
+
+/*
+ * Bulk accesses for repeated block moves and fills. A run is split at page boundaries of both ranges; spans where
+ * every page involved is directly mapped go through host memory in one go, anything else is done a word at a time
+ * through the sync accessors. Either way the cycle count is the same as for the separate accesses.
+ */
+static inline uint32_t
+mem_span_words_ (uint32_t addr, uint32_t words)
+{
+	uint32_t left = (PILOT_MEM_PAGE_SIZE - (addr & PILOT_MEM_PAGE_MASK)) >> 1;
+	return (left < words) ? left : words;
+}
+
+unsigned
+Pilot_mem_copy_sync (Pilot_system *sys, uint32_t dest, uint32_t src, uint32_t words)
+{
+	unsigned cycles = 0;
+	uint32_t i;
+
+	dest &= 0xfffffe;
+	src &= 0xfffffe;
+	// Word-by-word copies forward into an overlapping destination repeat the start of the source, which memmove
+	// wouldn't. The distance wraps the same way addresses do.
+	if (dest != src && ((dest - src) & 0xffffff) < words * 2)
+	{
+		for (i = 0; i < words; i++)
+		{
+			uint16_t data;
+			cycles += Pilot_mem_read_sync(sys, (src + i * 2) & 0xffffff, &data);
+			cycles += Pilot_mem_write_sync(sys, (dest + i * 2) & 0xffffff, data);
+		}
+		return cycles;
+	}
+
+	while (words)
+	{
+		uint32_t span = mem_span_words_(dest, mem_span_words_(src, words));
+		const Pilot_mem_page *from = &sys->mem_pages[PAGE_OF_(src)];
+		const Pilot_mem_page *to = &sys->mem_pages[PAGE_OF_(dest)];
+
+		if (from->read && to->write)
+		{
+			if (to->flags)
+			{
+				pilot_mem_page_written(sys, PAGE_OF_(dest));
+			}
+			memmove(to->write + (dest & PILOT_MEM_PAGE_MASK), from->read + (src & PILOT_MEM_PAGE_MASK), span * 2);
+			cycles += span * (2 + from->wait_states + to->wait_states);
+		}
+		else
+		{
+			for (i = 0; i < span; i++)
+			{
+				uint16_t data;
+				cycles += Pilot_mem_read_sync(sys, src + i * 2, &data);
+				cycles += Pilot_mem_write_sync(sys, dest + i * 2, data);
+			}
+		}
+		src = (src + span * 2) & 0xffffff;
+		dest = (dest + span * 2) & 0xffffff;
+		words -= span;
+	}
+	return cycles;
+}
+
+unsigned
+Pilot_mem_fill_sync (Pilot_system *sys, uint32_t dest, uint16_t data, uint32_t words)
+{
+	unsigned cycles = 0;
+	uint32_t i;
+
+	dest &= 0xfffffe;
+	while (words)
+	{
+		uint32_t span = mem_span_words_(dest, words);
+		const Pilot_mem_page *to = &sys->mem_pages[PAGE_OF_(dest)];
+
+		if (to->write)
+		{
+			uint8_t *host = to->write + (dest & PILOT_MEM_PAGE_MASK);
+			if (to->flags)
+			{
+				pilot_mem_page_written(sys, PAGE_OF_(dest));
+			}
+			if ((data & 0xff) == (data >> 8))
+			{
+				memset(host, data & 0xff, span * 2);
+			}
+			else
+			{
+				for (i = 0; i < span; i++)
+				{
+					host[i * 2] = data & 0xff;
+					host[i * 2 + 1] = data >> 8;
+				}
+			}
+			cycles += span * (1 + to->wait_states);
+		}
+		else
+		{
+			for (i = 0; i < span; i++)
+			{
+				cycles += Pilot_mem_write_sync(sys, dest + i * 2, data);
+			}
+		}
+		dest = (dest + span * 2) & 0xffffff;
+		words -= span;
+	}
+	return cycles;
+}
+
 uint16_t
 Pilot_mem_get_data (Pilot_system *sys)
 {
+	if (sys->memctl.direct_ptr)
+	{
+		return sys->memctl.direct_ptr[0] | (sys->memctl.direct_ptr[1] << 8);
+	}
 	return sys->memctl.data_reg_in;
 }
@@ -5,6 +5,22 @@
 #include <stddef.h>
 #include "cpu_regs.h"
 #include "cpu_interconnect.h"
+#include "cpu_decode.h"
+#include "cpu_execute.h"
+#include "cpu_interp.h"
+
+typedef enum
+{
+	// Half-cycle pipeline; cycle accurate
+	PILOT_ENGINE_PIPELINE = 0,
+	// Whole instructions at a time; see cpu_interp.h
+	PILOT_ENGINE_INTERP,
+	// Translated blocks, with the interpreter for the rest; see cpu_jit.h. Runs as INTERP until the JIT is enabled.
+	PILOT_ENGINE_JIT,
+	// Blocks precompiled from the cartridge ROM, with the interpreter for the rest; see cpu_aot.h. Runs as INTERP
+	// until an object is loaded.
+	PILOT_ENGINE_AOT
+} Pilot_engine;
 
 typedef enum
 {
@@ -19,17 +35,152 @@ typedef struct
 	Pilot_memctl_state state;
 	bool data_valid;
 	size_t wait_cycles_left;
+	// Sitting out its wait states on PILOT_EVENT_MEMCTL; the run loop doesn't tick it until the event fires
+	bool waiting;
 	uint32_t addr_reg;
 	uint16_t data_reg_in;
 	uint16_t data_reg_out;
+
+	// Opt-in: accesses to zero-wait direct pages skip the page dispatch in Pilot_memctl_tick, and move data straight
+	// through the host pointer resolved when the address was asserted. State transitions are unchanged.
+	bool direct_ram;
+	uint8_t *direct_ptr;
 } Pilot_memctl;
 
+/*
+ * The 24-bit address space is split into 1 KiB pages. Each page either points straight at host memory, or defers to
+ * one of the system's memory handlers (MMIO, cartridge mappers, open bus).
+ *
+ * A page with a read pointer but no write pointer is read-only from the bus' point of view; writes to it go to the
+ * page's handler instead (e.g. ROM bank switching registers).
+ */
+#define PILOT_MEM_PAGE_SHIFT 10
+#define PILOT_MEM_PAGE_SIZE  (1 << PILOT_MEM_PAGE_SHIFT)
+#define PILOT_MEM_PAGE_MASK  (PILOT_MEM_PAGE_SIZE - 1)
+#define PILOT_MEM_PAGES      (0x1000000 >> PILOT_MEM_PAGE_SHIFT)
+
+#define PILOT_BREAKPOINTS_MAX 16
+
+typedef enum
+{
+	MEM_HANDLER_OPEN_BUS = 0,
+	MEM_HANDLER_CART_CS1,
+	MEM_HANDLER_CART_CS2,
+	MEM_HANDLER_CART_ROM,
+	MEM_HANDLER_OAM_HCIO,
+
+	MEM_HANDLERS_MAX = 16
+} Pilot_mem_handler_id;
+
 typedef struct
+{
+	// Returns FALSE if the data isn't ready yet; the access will be retried on the next tick
+	bool (*read) (Pilot_system *sys, uint32_t addr, uint16_t *data);
+	void (*write) (Pilot_system *sys, uint32_t addr, uint16_t data);
+} Pilot_mem_handler;
+
+// Page flags that make the bus report writes to the page, even when it's backed by host memory
+enum
+{
+	// The page holds cached decoded instructions
+	PILOT_PAGE_CODE = 1 << 0,
+	// The page's next write sets its bit in sys->dirty_pages; see memory.h
+	PILOT_PAGE_DIRTY = 1 << 1,
+	// The page reads from memory shared with clones, and has to be copied before it's written; see clone.h
+	PILOT_PAGE_COW = 1 << 2
+};
+
+/*
+ * Timed events
+ *
+ * Each source of timed events (the memory controller, and later timers, video, HCIO devices) owns one event id, and
+ * has at most one deadline pending at a time: an absolute value of sys->cycles, at the start of which its handler is
+ * called. The run loop runs uninterrupted up to the earliest deadline, so a component with nothing scheduled costs
+ * nothing. See scheduler.h.
+ */
+typedef enum
+{
+	PILOT_EVENT_MEMCTL = 0,
+
+	PILOT_EVENTS_MAX = 16
+} Pilot_event_id;
+
+typedef void (*Pilot_event_handler) (Pilot_system *sys, Pilot_event_id id);
+
+typedef struct
+{
+	// Earliest pending deadline, or UINT64_MAX if nothing is pending
+	uint64_t next;
+	uint64_t when[PILOT_EVENTS_MAX];
+	Pilot_event_handler handlers[PILOT_EVENTS_MAX];
+	// Binary min-heap of the pending ids by deadline, and each id's index in it (-1 if not pending)
+	uint8_t heap[PILOT_EVENTS_MAX];
+	int8_t heap_pos[PILOT_EVENTS_MAX];
+	uint8_t count;
+} Pilot_scheduler;
+
+typedef struct
+{
+	uint8_t *read;
+	uint8_t *write;
+	uint8_t handler;
+	uint8_t wait_states;
+	uint8_t flags;
+} Pilot_mem_page;
+
+typedef struct
+{
+	// Read-only mapping of the ROM image. Nothing is read up front; the host pages banks in on first access.
+	uint8_t *rom;
+	size_t rom_size;
+	size_t map_size;
+	// Number of systems sharing the mapping, once a system with the cartridge loaded has been cloned
+	uint32_t *users;
+} Pilot_cartridge;
+
+struct Pilot_system
 {
 	Pilot_cpu_regs core;
 	Pilot_memctl memctl;
 	pilot_interconnect interconnects;
+	pilot_decode_state decode;
+	pilot_execute_state execute;
+	pilot_interp_state interp;
+	Pilot_engine engine;
+
+	// Run control; see system.h
+	uint64_t cycles;
+	uint64_t deadline;
+	bool stop_requested;
+	uint8_t breakpoint_count;
+	uint32_t breakpoints[PILOT_BREAKPOINTS_MAX];
+	// Timed events; see scheduler.h
+	Pilot_scheduler events;
+
+	Pilot_mem_page mem_pages[PILOT_MEM_PAGES];
+	// A bit per page, set by remaps and by writes to pages flagged PILOT_PAGE_DIRTY
+	uint32_t dirty_pages[PILOT_MEM_PAGES / 32];
+	Pilot_mem_handler mem_handlers[MEM_HANDLERS_MAX];
+	Pilot_cartridge cart;
+	// Optional; see block_cache.h
+	struct pilot_block_cache *block_cache;
+	// Optional; see cpu_jit.h
+	struct pilot_jit *jit;
+	// Optional; see cpu_aot.h
+	struct pilot_aot *aot;
+	// Optional; see rewind.h
+	struct pilot_rewind *rewind;
+	// Optional; see replay.h
+	struct pilot_replay *replay;
+	// Pages shared with clones; see clone.h
+	struct pilot_cow *cow;
+
+	uint8_t wram[0x8000];
+	uint8_t vram[0x8000];
+	uint8_t tmram[0x1000];
+	uint8_t oam[0x280];
+	uint8_t hcio[0x100];
 	uint8_t hram[0xc00];
-} Pilot_system;
+};
 
 #endif
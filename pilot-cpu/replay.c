@@ -0,0 +1,245 @@
+#include "replay.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const uint8_t replay_magic_[4] = { 'P', 'R', 'P', 'L' };
+
+#define REPLAY_VALUE_CHANGED_ 0x80
+// A tag, a 64-bit varint and a value
+#define REPLAY_RECORD_MAX_ (1 + 10 + 2)
+#define REPLAY_INITIAL_CAPACITY_ 4096
+
+static void
+replay_put_le_ (uint8_t *out, uint64_t value, int bytes)
+{
+	int i;
+	for (i = 0; i < bytes; i++)
+	{
+		out[i] = (value >> (i * 8)) & 0xff;
+	}
+}
+
+static uint64_t
+replay_get_le_ (const uint8_t *in, int bytes)
+{
+	uint64_t value = 0;
+	int i;
+	for (i = 0; i < bytes; i++)
+	{
+		value |= (uint64_t)in[i] << (i * 8);
+	}
+	return value;
+}
+
+static pilot_replay *
+replay_new_ (size_t capacity)
+{
+	pilot_replay *rp = calloc(1, sizeof(*rp));
+	if (!rp)
+	{
+		return NULL;
+	}
+	rp->stream = malloc(capacity);
+	if (!rp->stream)
+	{
+		free(rp);
+		return NULL;
+	}
+	rp->capacity = capacity;
+	return rp;
+}
+
+bool
+Pilot_replay_record (Pilot_system *sys)
+{
+	pilot_replay *rp;
+
+	Pilot_replay_stop(sys);
+	rp = replay_new_(REPLAY_INITIAL_CAPACITY_);
+	if (!rp)
+	{
+		return FALSE;
+	}
+	memcpy(rp->stream, replay_magic_, sizeof(replay_magic_));
+	replay_put_le_(rp->stream + 4, PILOT_REPLAY_VERSION, 2);
+	replay_put_le_(rp->stream + 6, 0, 2);
+	replay_put_le_(rp->stream + 8, sys->cycles, 8);
+	rp->size = PILOT_REPLAY_HEADER_SIZE;
+	rp->cycles = sys->cycles;
+	rp->stats.bytes = rp->size;
+	sys->replay = rp;
+	return TRUE;
+}
+
+bool
+Pilot_replay_play (Pilot_system *sys, const void *stream, size_t size)
+{
+	const uint8_t *in = stream;
+	pilot_replay *rp;
+
+	if (size < PILOT_REPLAY_HEADER_SIZE || memcmp(in, replay_magic_, sizeof(replay_magic_))
+		|| replay_get_le_(in + 4, 2) != PILOT_REPLAY_VERSION)
+	{
+		return FALSE;
+	}
+	rp = replay_new_(size);
+	if (!rp)
+	{
+		return FALSE;
+	}
+	Pilot_replay_stop(sys);
+	memcpy(rp->stream, in, size);
+	rp->playing = TRUE;
+	rp->size = size;
+	rp->pos = PILOT_REPLAY_HEADER_SIZE;
+	rp->cycles = replay_get_le_(in + 8, 8);
+	rp->stats.bytes = size;
+	rp->stats.finished = (size == PILOT_REPLAY_HEADER_SIZE);
+	sys->replay = rp;
+	return TRUE;
+}
+
+void
+Pilot_replay_stop (Pilot_system *sys)
+{
+	if (!sys->replay)
+	{
+		return;
+	}
+	free(sys->replay->stream);
+	free(sys->replay);
+	sys->replay = NULL;
+}
+
+const uint8_t *
+Pilot_replay_stream (const Pilot_system *sys, size_t *size)
+{
+	if (!sys->replay || sys->replay->playing)
+	{
+		*size = 0;
+		return NULL;
+	}
+	*size = sys->replay->size;
+	return sys->replay->stream;
+}
+
+Pilot_replay_stats
+Pilot_replay_get_stats (const Pilot_system *sys)
+{
+	Pilot_replay_stats stats = { 0 };
+	return sys->replay ? sys->replay->stats : stats;
+}
+
+static void
+replay_record_ (Pilot_system *sys, pilot_replay *rp, uint32_t reg, uint16_t data)
+{
+	uint64_t delta = sys->cycles - rp->cycles;
+	uint8_t *out;
+
+	if (rp->stats.truncated)
+	{
+		return;
+	}
+	if (rp->capacity - rp->size < REPLAY_RECORD_MAX_)
+	{
+		uint8_t *stream = realloc(rp->stream, rp->capacity * 2);
+		if (!stream)
+		{
+			rp->stats.truncated = TRUE;
+			return;
+		}
+		rp->stream = stream;
+		rp->capacity *= 2;
+	}
+
+	out = rp->stream + rp->size;
+	*out++ = reg | ((data != rp->regs[reg]) ? REPLAY_VALUE_CHANGED_ : 0);
+	do
+	{
+		*out++ = (delta & 0x7f) | ((delta >= 0x80) ? 0x80 : 0);
+		delta >>= 7;
+	}
+	while (delta);
+	if (data != rp->regs[reg])
+	{
+		replay_put_le_(out, data, 2);
+		out += 2;
+		rp->regs[reg] = data;
+	}
+
+	rp->size = out - rp->stream;
+	rp->cycles = sys->cycles;
+	rp->stats.reads++;
+	rp->stats.bytes = rp->size;
+}
+
+// Feeds the next record to a read of reg. Returns FALSE if the stream is for another register, or malformed.
+static bool
+replay_feed_ (Pilot_system *sys, pilot_replay *rp, uint32_t reg)
+{
+	const uint8_t *in = rp->stream + rp->pos;
+	const uint8_t *end = rp->stream + rp->size;
+	uint64_t delta = 0;
+	int shift = 0;
+	uint8_t tag = *in++;
+
+	if ((tag & ~REPLAY_VALUE_CHANGED_) != reg)
+	{
+		return FALSE;
+	}
+	do
+	{
+		if (in == end || shift > 63)
+		{
+			return FALSE;
+		}
+		delta |= (uint64_t)(*in & 0x7f) << shift;
+		shift += 7;
+	}
+	while (*in++ & 0x80);
+	if (tag & REPLAY_VALUE_CHANGED_)
+	{
+		if (end - in < 2)
+		{
+			return FALSE;
+		}
+		rp->regs[reg] = replay_get_le_(in, 2);
+		in += 2;
+	}
+
+	rp->cycles += delta;
+	if (rp->cycles != sys->cycles)
+	{
+		rp->stats.late_reads++;
+	}
+	rp->pos = in - rp->stream;
+	rp->stats.reads++;
+	rp->stats.finished = (rp->pos == rp->size);
+	return TRUE;
+}
+
+uint16_t
+pilot_replay_hcio_read (Pilot_system *sys, uint32_t offset, uint16_t data)
+{
+	pilot_replay *rp = sys->replay;
+	uint32_t reg = offset >> 1;
+
+	if (!rp->playing)
+	{
+		replay_record_(sys, rp, reg, data);
+		return data;
+	}
+	if (rp->stats.finished || rp->stats.desynced)
+	{
+		return data;
+	}
+	if (!replay_feed_(sys, rp, reg))
+	{
+		rp->stats.desynced = TRUE;
+		return data;
+	}
+	// Left where the recorded session's host had it
+	sys->hcio[offset] = rp->regs[reg] & 0xff;
+	sys->hcio[offset + 1] = rp->regs[reg] >> 8;
+	return rp->regs[reg];
+}
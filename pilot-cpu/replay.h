@@ -0,0 +1,81 @@
+#ifndef __REPLAY_H__
+#define __REPLAY_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "types.h"
+#include "pilot.h"
+
+/*
+ * Input recording and replay
+ *
+ * HCIO registers are where the console sees the outside world, written by the host (buttons, link cable, clock) as
+ * well as the bus. Recording logs the value of every HCIO read along with the cycle it came at; replaying feeds the
+ * same values back, in order, so a session runs again the same way with no frontend, host timing or input devices
+ * behind it, and as fast as the engine can go.
+ *
+ * A replay has to start from the state the recording started from (after the same reset, or a savestate of it), on
+ * the same engine, since that decides which reads happen and at which cycle. Replayed values are stored in sys->hcio
+ * before being read, so each register is left as the recorded session had it at its last read. A read of a different
+ * register than the stream has next means the replay has gone off course: it's flagged, and reads go to sys->hcio
+ * from there on. Reads at another cycle than recorded are only counted.
+ *
+ * The stream is a header (magic, version, the cycle count recording started at), then a record per read: a tag byte
+ * with the register's word index in the low 7 bits and bit 7 set if the value differs from that register's last one,
+ * the cycles since the previous read as a little-endian base 128 varint, then the value as 16 bits little-endian if
+ * it changed. A polling loop comes to two bytes per read. Everything is byte order independent, so streams can be
+ * replayed on other machines.
+ */
+#define PILOT_REPLAY_VERSION 1
+#define PILOT_REPLAY_HEADER_SIZE 16
+#define PILOT_REPLAY_REGS 0x80
+
+typedef struct
+{
+	// HCIO reads recorded, or fed back
+	uint64_t reads;
+	// Size of the stream recorded so far, or of the one being replayed
+	size_t bytes;
+	// Replayed reads that came at a different cycle than they were recorded at
+	uint64_t late_reads;
+	// Replaying: a read went to another register than the stream had next, and wasn't fed from then on
+	bool desynced;
+	// Replaying: every read in the stream has been fed back
+	bool finished;
+	// Recording: ran out of memory, so the stream ends early
+	bool truncated;
+} Pilot_replay_stats;
+
+typedef struct pilot_replay
+{
+	bool playing;
+	uint8_t *stream;
+	size_t size;
+	size_t capacity;
+	// Where the next record is read from, when playing
+	size_t pos;
+	// Cycle of the previous read, as recorded
+	uint64_t cycles;
+	// Last value of each register, as recorded
+	uint16_t regs[PILOT_REPLAY_REGS];
+	Pilot_replay_stats stats;
+} pilot_replay;
+
+// Starts recording HCIO reads from the current state, dropping any recording or replay in progress. Returns FALSE if
+// out of memory.
+bool Pilot_replay_record (Pilot_system *sys);
+// Starts feeding back a recorded stream, which is copied. Returns FALSE, leaving sys alone, if it isn't a stream of
+// this version, or if out of memory.
+bool Pilot_replay_play (Pilot_system *sys, const void *stream, size_t size);
+// Stops recording or replaying, and frees the stream
+void Pilot_replay_stop (Pilot_system *sys);
+
+// The stream recorded so far, valid until the next run or Pilot_replay_stop; NULL if not recording
+const uint8_t *Pilot_replay_stream (const Pilot_system *sys, size_t *size);
+Pilot_replay_stats Pilot_replay_get_stats (const Pilot_system *sys);
+
+// Called by the bus on HCIO reads while sys->replay is set, with the offset of the register and the value read from
+// sys->hcio. Returns the value the read gets.
+uint16_t pilot_replay_hcio_read (Pilot_system *sys, uint32_t offset, uint16_t data);
+
+#endif
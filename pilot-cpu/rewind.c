@@ -0,0 +1,401 @@
+#include "rewind.h"
+#include "memory.h"
+#include "savestate.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * A delta is a list of chunks, each for a span of the savestate: where the span starts and how many bytes of runs
+ * follow, the runs being pairs of 16-bit lengths, unchanged bytes to skip and changed bytes to XOR in, each pair
+ * followed by the changed bytes. Trailing unchanged bytes aren't written out, and spans with no changes at all are
+ * left out.
+ *
+ * The RAM part of the savestate is compared in page sized units. A tracked page marks the units its host memory
+ * covers, so mirrors of the same RAM come down to the same units.
+ */
+#define REWIND_RAM_SIZE_ (sizeof(Pilot_system) - offsetof(Pilot_system, wram))
+#define REWIND_UNITS_ ((REWIND_RAM_SIZE_ + PILOT_MEM_PAGE_SIZE - 1) / PILOT_MEM_PAGE_SIZE)
+// Unchanged bytes inside a run of changed ones are kept in it unless there are enough of them to pay for a new pair
+#define REWIND_MIN_SKIP_ 4
+#define REWIND_RUN_MAX_ 0xffff
+
+typedef struct
+{
+	uint32_t offset;
+	uint32_t runs_size;
+} rewind_chunk;
+
+// Room for the delta of every byte of the savestate changing, with a run pair per REWIND_MIN_SKIP_ + 1 bytes at most
+static size_t
+rewind_scratch_size_ (void)
+{
+	return 2 * Pilot_savestate_size() + (REWIND_UNITS_ + 1) * (sizeof(rewind_chunk) + 4) + 2 * sizeof(uint32_t);
+}
+
+static inline void
+rewind_put16_ (uint8_t *out, uint32_t value)
+{
+	out[0] = value & 0xff;
+	out[1] = value >> 8;
+}
+
+static inline uint32_t
+rewind_get16_ (const uint8_t *in)
+{
+	return in[0] | (in[1] << 8);
+}
+
+// Length of the run of bytes old and cur agree on from the start, up to max
+static size_t
+rewind_same_ (const uint8_t *old, const uint8_t *cur, size_t max)
+{
+	size_t n = 0;
+	while (n + 8 <= max && !memcmp(old + n, cur + n, 8))
+	{
+		n += 8;
+	}
+	while (n < max && old[n] == cur[n])
+	{
+		n++;
+	}
+	return n;
+}
+
+// Appends a chunk for the span of the savestate at offset, taking old (in the savestate) to cur and bringing old up
+// to date. Returns the end of what was written, which is out if the span didn't change.
+static uint8_t *
+rewind_encode_ (uint8_t *out, uint8_t *old, const uint8_t *cur, size_t offset, size_t size)
+{
+	rewind_chunk chunk = { (uint32_t)offset, 0 };
+	uint8_t *p = out + sizeof(chunk);
+	size_t i = 0;
+
+	while (i < size)
+	{
+		size_t skip = rewind_same_(old + i, cur + i, (size - i < REWIND_RUN_MAX_) ? size - i : REWIND_RUN_MAX_);
+		size_t start = i + skip;
+		size_t changed = 0;
+		size_t k;
+
+		if (start == size)
+		{
+			break;
+		}
+		while (start + changed < size && changed < REWIND_RUN_MAX_)
+		{
+			size_t same;
+			if (old[start + changed] != cur[start + changed])
+			{
+				changed++;
+				continue;
+			}
+			same = rewind_same_(old + start + changed, cur + start + changed, REWIND_MIN_SKIP_ < size - start - changed
+				? REWIND_MIN_SKIP_ : size - start - changed);
+			if (same == REWIND_MIN_SKIP_ || start + changed + same == size || changed + same > REWIND_RUN_MAX_)
+			{
+				break;
+			}
+			changed += same;
+		}
+
+		rewind_put16_(p, skip);
+		rewind_put16_(p + 2, changed);
+		p += 4;
+		for (k = 0; k < changed; k++)
+		{
+			p[k] = old[start + k] ^ cur[start + k];
+		}
+		memcpy(old + start, cur + start, changed);
+		p += changed;
+		i = start + changed;
+	}
+
+	if (p == out + sizeof(chunk))
+	{
+		return out;
+	}
+	chunk.runs_size = (uint32_t)(p - out - sizeof(chunk));
+	memcpy(out, &chunk, sizeof(chunk));
+	return p;
+}
+
+// Applies a delta to the savestate
+static void
+rewind_decode_ (uint8_t *state, const uint8_t *in, size_t size)
+{
+	const uint8_t *end = in + size;
+
+	while (in < end)
+	{
+		rewind_chunk chunk;
+		const uint8_t *runs_end;
+		size_t pos;
+
+		memcpy(&chunk, in, sizeof(chunk));
+		in += sizeof(chunk);
+		runs_end = in + chunk.runs_size;
+		pos = chunk.offset;
+		while (in < runs_end)
+		{
+			size_t changed = rewind_get16_(in + 2);
+			size_t k;
+
+			pos += rewind_get16_(in);
+			in += 4;
+			for (k = 0; k < changed; k++)
+			{
+				state[pos + k] ^= in[k];
+			}
+			pos += changed;
+			in += changed;
+		}
+	}
+}
+
+static void
+rewind_ring_write_ (pilot_rewind *rw, size_t pos, const void *data, size_t size)
+{
+	size_t first;
+
+	pos %= rw->ring_size;
+	first = (size < rw->ring_size - pos) ? size : rw->ring_size - pos;
+	memcpy(rw->ring + pos, data, first);
+	memcpy(rw->ring, (const uint8_t *)data + first, size - first);
+}
+
+static void
+rewind_ring_read_ (const pilot_rewind *rw, size_t pos, void *data, size_t size)
+{
+	size_t first;
+
+	pos %= rw->ring_size;
+	first = (size < rw->ring_size - pos) ? size : rw->ring_size - pos;
+	memcpy(data, rw->ring + pos, first);
+	memcpy((uint8_t *)data + first, rw->ring, size - first);
+}
+
+static void
+rewind_drop_oldest_ (pilot_rewind *rw)
+{
+	uint32_t size;
+
+	rewind_ring_read_(rw, rw->ring_start, &size, sizeof(size));
+	size += 2 * sizeof(size);
+	rw->ring_start = (rw->ring_start + size) % rw->ring_size;
+	rw->ring_used -= size;
+	rw->stats.frames--;
+}
+
+// Adds a delta to the newest end, dropping the oldest ones until it fits
+static void
+rewind_ring_push_ (pilot_rewind *rw, const uint8_t *delta, uint32_t size)
+{
+	size_t total = size + 2 * sizeof(size);
+
+	if (total > rw->ring_size)
+	{
+		// The frames before this one can't be reached any more
+		rw->ring_start = 0;
+		rw->ring_used = 0;
+		rw->stats.frames = 1;
+		return;
+	}
+	while (rw->ring_size - rw->ring_used < total)
+	{
+		rewind_drop_oldest_(rw);
+	}
+	rewind_ring_write_(rw, rw->ring_start + rw->ring_used, &size, sizeof(size));
+	rewind_ring_write_(rw, rw->ring_start + rw->ring_used + sizeof(size), delta, size);
+	rewind_ring_write_(rw, rw->ring_start + rw->ring_used + sizeof(size) + size, &size, sizeof(size));
+	rw->ring_used += total;
+	rw->stats.frames++;
+}
+
+// Flags a page to have its next write reported if it's mapped onto the system's RAM, and returns its host memory's
+// offset into it, or -1 if it isn't
+static ptrdiff_t
+rewind_track_page_ (Pilot_system *sys, uint32_t page)
+{
+	uintptr_t host = (uintptr_t)sys->mem_pages[page].write;
+	uintptr_t ram = (uintptr_t)sys->wram;
+
+	if (host < ram || host - ram >= REWIND_RAM_SIZE_)
+	{
+		pilot_mem_untrack_writes(sys, page);
+		sys->dirty_pages[page >> 5] &= ~(1u << (page & 31));
+		return -1;
+	}
+	pilot_mem_track_writes(sys, page);
+	return (ptrdiff_t)(host - ram);
+}
+
+// Tracks the pages written or remapped since the last call again, marking the units they cover if units isn't NULL
+static void
+rewind_collect_dirty_ (Pilot_system *sys, bool *units)
+{
+	uint32_t word;
+
+	for (word = 0; word < PILOT_MEM_PAGES / 32; word++)
+	{
+		uint32_t bits = sys->dirty_pages[word];
+		while (bits)
+		{
+			uint32_t bit = __builtin_ctz(bits);
+			ptrdiff_t offset = rewind_track_page_(sys, word * 32 + bit);
+			bits &= bits - 1;
+			if (offset >= 0 && units)
+			{
+				size_t last = offset + PILOT_MEM_PAGE_SIZE - 1;
+				units[offset / PILOT_MEM_PAGE_SIZE] = TRUE;
+				if (last < REWIND_RAM_SIZE_)
+				{
+					units[last / PILOT_MEM_PAGE_SIZE] = TRUE;
+				}
+			}
+		}
+	}
+}
+
+bool
+Pilot_rewind_enable (Pilot_system *sys, size_t buffer_size)
+{
+	pilot_rewind *rw;
+	uint32_t page;
+
+	Pilot_rewind_disable(sys);
+	if (!buffer_size)
+	{
+		return FALSE;
+	}
+	rw = calloc(1, sizeof(*rw));
+	if (!rw)
+	{
+		return FALSE;
+	}
+	rw->current = malloc(Pilot_savestate_size());
+	rw->ring = malloc(buffer_size);
+	rw->scratch = malloc(rewind_scratch_size_());
+	rw->cpu = malloc(pilot_savestate_cpu_size());
+	if (!rw->current || !rw->ring || !rw->scratch || !rw->cpu)
+	{
+		free(rw->current);
+		free(rw->ring);
+		free(rw->scratch);
+		free(rw->cpu);
+		free(rw);
+		return FALSE;
+	}
+	rw->ring_size = buffer_size;
+	rw->stats.frames = 1;
+	sys->rewind = rw;
+
+	for (page = 0; page < PILOT_MEM_PAGES; page++)
+	{
+		rewind_track_page_(sys, page);
+	}
+	Pilot_savestate_save(sys, rw->current);
+	return TRUE;
+}
+
+void
+Pilot_rewind_disable (Pilot_system *sys)
+{
+	pilot_rewind *rw = sys->rewind;
+	uint32_t page;
+
+	if (!rw)
+	{
+		return;
+	}
+	for (page = 0; page < PILOT_MEM_PAGES; page++)
+	{
+		pilot_mem_untrack_writes(sys, page);
+	}
+	free(rw->current);
+	free(rw->ring);
+	free(rw->scratch);
+	free(rw->cpu);
+	free(rw);
+	sys->rewind = NULL;
+}
+
+void
+Pilot_rewind_push (Pilot_system *sys)
+{
+	pilot_rewind *rw = sys->rewind;
+	size_t cpu_size = pilot_savestate_cpu_size();
+	size_t oam_start = offsetof(Pilot_system, oam) - offsetof(Pilot_system, wram);
+	size_t hcio_end = offsetof(Pilot_system, hcio) + sizeof(sys->hcio) - offsetof(Pilot_system, wram);
+	bool units[REWIND_UNITS_] = { FALSE };
+	uint8_t *out;
+	size_t unit;
+
+	if (!rw)
+	{
+		return;
+	}
+	rewind_collect_dirty_(sys, units);
+	for (unit = oam_start / PILOT_MEM_PAGE_SIZE; unit <= (hcio_end - 1) / PILOT_MEM_PAGE_SIZE; unit++)
+	{
+		units[unit] = TRUE;
+	}
+
+	out = rw->scratch;
+	pilot_savestate_save_cpu(sys, rw->cpu);
+	out = rewind_encode_(out, rw->current, rw->cpu, 0, cpu_size);
+	unit = 0;
+	while (unit < REWIND_UNITS_)
+	{
+		size_t first = unit, start, size;
+		if (!units[unit])
+		{
+			unit++;
+			continue;
+		}
+		while (unit < REWIND_UNITS_ && units[unit])
+		{
+			unit++;
+		}
+		start = first * PILOT_MEM_PAGE_SIZE;
+		size = ((unit * PILOT_MEM_PAGE_SIZE < REWIND_RAM_SIZE_) ? unit * PILOT_MEM_PAGE_SIZE : REWIND_RAM_SIZE_) - start;
+		out = rewind_encode_(out, rw->current + cpu_size + start, sys->wram + start, cpu_size + start, size);
+	}
+
+	rw->stats.last_delta = out - rw->scratch;
+	rewind_ring_push_(rw, rw->scratch, (uint32_t)rw->stats.last_delta);
+}
+
+bool
+Pilot_rewind_step_back (Pilot_system *sys)
+{
+	pilot_rewind *rw = sys->rewind;
+	uint32_t size;
+
+	if (!rw || rw->stats.frames < 2)
+	{
+		return FALSE;
+	}
+	rewind_ring_read_(rw, rw->ring_start + rw->ring_used - sizeof(size), &size, sizeof(size));
+	rewind_ring_read_(rw, rw->ring_start + rw->ring_used - sizeof(size) - size, rw->scratch, size);
+	rw->ring_used -= size + 2 * sizeof(size);
+	rw->stats.frames--;
+
+	rewind_decode_(rw->current, rw->scratch, size);
+	Pilot_savestate_load(sys, rw->current, Pilot_savestate_size());
+	// The system matches the newest frame again, so whatever the load reported as dirty starts over
+	rewind_collect_dirty_(sys, NULL);
+	return TRUE;
+}
+
+Pilot_rewind_stats
+Pilot_rewind_get_stats (const Pilot_system *sys)
+{
+	Pilot_rewind_stats stats = { 0 };
+
+	if (sys->rewind)
+	{
+		stats = sys->rewind->stats;
+		stats.bytes_used = sys->rewind->ring_used;
+	}
+	return stats;
+}
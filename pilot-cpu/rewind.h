@@ -0,0 +1,62 @@
+#ifndef __REWIND_H__
+#define __REWIND_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "types.h"
+#include "pilot.h"
+
+/*
+ * Rewind
+ *
+ * The rewind buffer keeps the newest frame pushed as a full savestate, and for each frame before it a delta that
+ * takes the frame after it back to it: the XOR of the two savestates, as runs of unchanged and changed bytes. Only
+ * the CPU part of the savestate, the OAM and HCIO page (written by devices as well as the bus) and the RAM pages the
+ * bus reported as dirty since the last push are compared, so a frame that touches a few pages costs a few
+ * kilobytes of reads and, typically, a few hundred bytes of buffer.
+ *
+ * Deltas are kept in a byte ring, oldest first; when it fills up, the oldest frames are dropped. Stepping back
+ * undoes the newest delta on the full savestate and loads it, so it costs the same however far back the buffer
+ * goes.
+ *
+ * Tracking flags every page mapped onto the system's RAM with PILOT_PAGE_DIRTY, which sends its first write after
+ * each push through the bus' slow path. RAM the host writes to directly, rather than through the bus, isn't seen.
+ */
+typedef struct
+{
+	// Frames that can be stepped back to, plus the newest one
+	uint32_t frames;
+	size_t bytes_used;
+	// Size of the newest delta
+	size_t last_delta;
+} Pilot_rewind_stats;
+
+typedef struct pilot_rewind
+{
+	// The newest frame, as a savestate
+	uint8_t *current;
+	// Deltas, each framed by its length before and after so the ring can be walked from either end
+	uint8_t *ring;
+	size_t ring_size;
+	size_t ring_start;
+	size_t ring_used;
+	// Where the delta being pushed or undone is built or copied out
+	uint8_t *scratch;
+	// CPU part of the savestate of the frame being pushed
+	uint8_t *cpu;
+	Pilot_rewind_stats stats;
+} pilot_rewind;
+
+// Allocates a buffer of buffer_size bytes for deltas and pushes the current state as its first frame. Returns FALSE
+// if out of memory.
+bool Pilot_rewind_enable (Pilot_system *sys, size_t buffer_size);
+void Pilot_rewind_disable (Pilot_system *sys);
+
+// Pushes the current state as the newest frame; meant to be called between runs, once per frame
+void Pilot_rewind_push (Pilot_system *sys);
+// Drops the newest frame and loads the one before it. Returns FALSE, leaving sys alone, if there's none.
+bool Pilot_rewind_step_back (Pilot_system *sys);
+
+Pilot_rewind_stats Pilot_rewind_get_stats (const Pilot_system *sys);
+
+#endif
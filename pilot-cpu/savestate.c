@@ -0,0 +1,245 @@
+#include "savestate.h"
+#include "system.h"
+#include "memory.h"
+#include "clone.h"
+#include <string.h>
+
+// "PLSS"
+#define SAVESTATE_MAGIC 0x53534c50
+// Marks a control word pointer stored as a microcode ROM index
+#define SAVESTATE_ROM_TAG 0x80000000u
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;
+	// sizeof(Pilot_system) in the build that wrote it
+	uint32_t layout;
+
+	// Offsets from the start of the Pilot_system, plus one; 0 is NULL
+	uint32_t work_regs;
+	uint32_t decoded_inst;
+	// The same, or SAVESTATE_ROM_TAG with the index of a microcode ROM entry
+	uint32_t control;
+	uint32_t bus_regs[3];
+	// Whether the memory controller held a host pointer; it's found again from the access' address
+	uint32_t direct_ptr;
+} savestate_header;
+
+// The system up to the memory map, and the RAM regions at the end of it
+#define SAVESTATE_CPU_SIZE_ offsetof(Pilot_system, mem_pages)
+#define SAVESTATE_RAM_START_ offsetof(Pilot_system, wram)
+#define SAVESTATE_RAM_SIZE_ (sizeof(Pilot_system) - SAVESTATE_RAM_START_)
+
+typedef struct
+{
+	size_t offset;
+	size_t size;
+} savestate_field;
+
+#define SAVESTATE_FIELD_(f) { offsetof(Pilot_system, f), sizeof(((Pilot_system *)0)->f) }
+
+// Fields in the first run that are host pointers, or the host's to set, in order. They're zeroed in savestates and
+// kept as they are on loading.
+static const savestate_field savestate_host_fields_[] =
+{
+	SAVESTATE_FIELD_(memctl.direct_ptr),
+	SAVESTATE_FIELD_(decode.sys),
+	SAVESTATE_FIELD_(decode.work_regs),
+	SAVESTATE_FIELD_(execute.sys),
+	SAVESTATE_FIELD_(execute.decoded_inst),
+	SAVESTATE_FIELD_(execute.control),
+	SAVESTATE_FIELD_(execute.bus[0].reg),
+	SAVESTATE_FIELD_(execute.bus[1].reg),
+	SAVESTATE_FIELD_(execute.bus[2].reg),
+	SAVESTATE_FIELD_(interp.block),
+	SAVESTATE_FIELD_(interp.block_pos),
+	SAVESTATE_FIELD_(deadline),
+	SAVESTATE_FIELD_(breakpoint_count),
+	SAVESTATE_FIELD_(breakpoints),
+	SAVESTATE_FIELD_(events.handlers),
+};
+
+#define SAVESTATE_HOST_FIELDS_ (sizeof(savestate_host_fields_) / sizeof(savestate_host_fields_[0]))
+
+static uint32_t
+savestate_offset_ (const Pilot_system *sys, const void *ptr)
+{
+	uintptr_t offset = (uintptr_t)ptr - (uintptr_t)sys;
+	if (!ptr || offset >= sizeof(*sys))
+	{
+		return 0;
+	}
+	return (uint32_t)offset + 1;
+}
+
+static void *
+savestate_pointer_ (Pilot_system *sys, uint32_t offset)
+{
+	return offset ? (uint8_t *)sys + offset - 1 : NULL;
+}
+
+// Whether an offset stored for a pointer to a type of the given size lands within the system
+static bool
+savestate_offset_valid_ (uint32_t offset, size_t size)
+{
+	return !offset || (offset - 1 <= sizeof(Pilot_system) - size);
+}
+
+size_t
+Pilot_savestate_size (void)
+{
+	return sizeof(savestate_header) + SAVESTATE_CPU_SIZE_ + SAVESTATE_RAM_SIZE_;
+}
+
+size_t
+pilot_savestate_cpu_size (void)
+{
+	return sizeof(savestate_header) + SAVESTATE_CPU_SIZE_;
+}
+
+void
+pilot_savestate_save_cpu (const Pilot_system *sys, void *buf)
+{
+	savestate_header *header = buf;
+	uint8_t *cpu = (uint8_t *)buf + sizeof(*header);
+	int32_t rom_index = pilot_mucode_rom_index(sys->execute.control);
+	size_t i;
+
+	header->magic = SAVESTATE_MAGIC;
+	header->version = PILOT_SAVESTATE_VERSION;
+	header->size = Pilot_savestate_size();
+	header->layout = sizeof(Pilot_system);
+	header->work_regs = savestate_offset_(sys, sys->decode.work_regs);
+	header->decoded_inst = savestate_offset_(sys, sys->execute.decoded_inst);
+	header->control = (rom_index >= 0) ? (SAVESTATE_ROM_TAG | rom_index) : savestate_offset_(sys, sys->execute.control);
+	for (i = 0; i < 3; i++)
+	{
+		header->bus_regs[i] = savestate_offset_(sys, sys->execute.bus[i].reg);
+	}
+	header->direct_ptr = (sys->memctl.direct_ptr != NULL);
+
+	memcpy(cpu, sys, SAVESTATE_CPU_SIZE_);
+	for (i = 0; i < SAVESTATE_HOST_FIELDS_; i++)
+	{
+		memset(cpu + savestate_host_fields_[i].offset, 0, savestate_host_fields_[i].size);
+	}
+}
+
+void
+Pilot_savestate_save (const Pilot_system *sys, void *buf)
+{
+	uint8_t *ram = (uint8_t *)buf + pilot_savestate_cpu_size();
+
+	pilot_savestate_save_cpu(sys, buf);
+	memcpy(ram, sys->wram, SAVESTATE_RAM_SIZE_);
+	if (sys->cow)
+	{
+		pilot_cow_copy_shared(sys, ram);
+	}
+}
+
+static bool
+savestate_header_valid_ (const savestate_header *header, size_t size)
+{
+	int i;
+
+	if (size != Pilot_savestate_size() || header->magic != SAVESTATE_MAGIC
+		|| header->version != PILOT_SAVESTATE_VERSION || header->size != size || header->layout != sizeof(Pilot_system))
+	{
+		return FALSE;
+	}
+	if (!savestate_offset_valid_(header->work_regs, sizeof(inst_decoded_flags))
+		|| !savestate_offset_valid_(header->decoded_inst, sizeof(inst_decoded_flags)))
+	{
+		return FALSE;
+	}
+	if ((header->control & SAVESTATE_ROM_TAG) ? !pilot_mucode_rom_control(header->control & ~SAVESTATE_ROM_TAG)
+		: !savestate_offset_valid_(header->control, sizeof(execute_control_word)))
+	{
+		return FALSE;
+	}
+	for (i = 0; i < 3; i++)
+	{
+		if (!savestate_offset_valid_(header->bus_regs[i], sizeof(uint32_t)))
+		{
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+// Points the memory controller back at the host memory of the access it had in progress, as asserting it did
+static void
+savestate_restore_direct_ptr_ (Pilot_system *sys)
+{
+	uint32_t addr = sys->memctl.addr_reg & 0xffffff;
+	const Pilot_mem_page *page = &sys->mem_pages[addr >> PILOT_MEM_PAGE_SHIFT];
+	// Writes to flagged pages have to go through mem_write to be reported, as when they're asserted
+	uint8_t *host = (sys->memctl.state != MCTL_MEM_W_BUSY) ? page->read : page->flags ? NULL : page->write;
+
+	sys->memctl.direct_ptr = host ? host + (addr & PILOT_MEM_PAGE_MASK & ~1) : NULL;
+}
+
+void
+pilot_savestate_load_cpu (Pilot_system *sys, const void *buf)
+{
+	const savestate_header *header = buf;
+	const uint8_t *cpu = (const uint8_t *)buf + sizeof(*header);
+	size_t from = 0;
+	size_t i;
+
+	// Everything between the host's fields
+	for (i = 0; i < SAVESTATE_HOST_FIELDS_; i++)
+	{
+		const savestate_field *field = &savestate_host_fields_[i];
+		memcpy((uint8_t *)sys + from, cpu + from, field->offset - from);
+		from = field->offset + field->size;
+	}
+	memcpy((uint8_t *)sys + from, cpu + from, SAVESTATE_CPU_SIZE_ - from);
+
+	sys->decode.sys = sys;
+	sys->execute.sys = sys;
+	sys->decode.work_regs = savestate_pointer_(sys, header->work_regs);
+	sys->execute.decoded_inst = savestate_pointer_(sys, header->decoded_inst);
+	if (header->control & SAVESTATE_ROM_TAG)
+	{
+		sys->execute.control = pilot_mucode_rom_control(header->control & ~SAVESTATE_ROM_TAG);
+	}
+	else
+	{
+		sys->execute.control = savestate_pointer_(sys, header->control);
+	}
+	for (i = 0; i < 3; i++)
+	{
+		sys->execute.bus[i].reg = savestate_pointer_(sys, header->bus_regs[i]);
+	}
+	sys->memctl.direct_ptr = NULL;
+	if (header->direct_ptr)
+	{
+		savestate_restore_direct_ptr_(sys);
+	}
+
+	// Block cursors point into the host's cache; they start over with a lookup
+	sys->interp.block = NULL;
+	sys->interp.block_pos = 0;
+}
+
+bool
+Pilot_savestate_load (Pilot_system *sys, const void *buf, size_t size)
+{
+	if (!savestate_header_valid_(buf, size))
+	{
+		return FALSE;
+	}
+	// All of RAM is about to be overwritten, so pages shared with clones can be let go of without copying them
+	if (sys->cow)
+	{
+		pilot_cow_unshare(sys, FALSE);
+	}
+	memcpy(sys->wram, (const uint8_t *)buf + pilot_savestate_cpu_size(), SAVESTATE_RAM_SIZE_);
+	pilot_savestate_load_cpu(sys, buf);
+	pilot_mem_ram_replaced(sys);
+	return TRUE;
+}
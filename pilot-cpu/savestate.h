@@ -0,0 +1,47 @@
+#ifndef __SAVESTATE_H__
+#define __SAVESTATE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "pilot.h"
+
+/*
+ * Savestates
+ *
+ * A savestate is a flat blob: a header, then two runs of the Pilot_system struct copied verbatim. The first covers
+ * the CPU (registers, memory controller, the pipeline's interconnects, decode and execute stages, mid-instruction
+ * phases included), the interpreter, run state and the event scheduler; the second the RAM regions, from wram to
+ * hram. Saving and loading are a couple of memcpys each plus a handful of pointer fixups, so a savestate per frame
+ * costs a few microseconds.
+ *
+ * Pointers within the system (the decode-execute ring slot, the control word being run, the data bus operands, the
+ * memory controller's host pointer) are stored in the header as offsets from the start of the Pilot_system, or as
+ * microcode ROM indices, and zeroed in the copy, so equal states give equal blobs.
+ *
+ * What belongs to the host rather than the console is left out, and stays as it is in the system being loaded into:
+ * the memory map and memory handlers, the cartridge, the block cache, JIT and AOT object, the rewind buffer and dirty
+ * page bits, input recording or replay, event handlers, breakpoints and the run deadline. A savestate has to be
+ * loaded into a system with the same memory map and cartridge as the one it was taken from.
+ *
+ * The layout is that of the build's Pilot_system, so blobs are only for the build that wrote them; the header
+ * records PILOT_SAVESTATE_VERSION and the struct's size, and loading rejects anything else.
+ */
+#define PILOT_SAVESTATE_VERSION 1
+
+// Size of a savestate blob; the same for every system
+size_t Pilot_savestate_size (void);
+
+// Writes the state of sys to buf, which must hold Pilot_savestate_size() bytes
+void Pilot_savestate_save (const Pilot_system *sys, void *buf);
+
+// Returns FALSE, leaving sys alone, if buf isn't a savestate of this version and build
+bool Pilot_savestate_load (Pilot_system *sys, const void *buf, size_t size);
+
+// For incremental snapshots: a savestate is the part pilot_savestate_save_cpu writes, pilot_savestate_cpu_size()
+// bytes of it, followed by a copy of the system from sys->wram to its end
+size_t pilot_savestate_cpu_size (void);
+void pilot_savestate_save_cpu (const Pilot_system *sys, void *buf);
+// Loads the part pilot_savestate_save_cpu wrote, unchecked, leaving RAM alone
+void pilot_savestate_load_cpu (Pilot_system *sys, const void *buf);
+
+#endif
@@ -0,0 +1,153 @@
+#include "scheduler.h"
+
+/*
+ * There are only a handful of event sources, each with at most one deadline pending, so a small binary heap over
+ * the ids does: scheduling and cancelling are O(log n), and the run loop only ever looks at events.next. Events due
+ * on the same cycle fire in id order.
+ */
+static inline bool
+events_before_ (const Pilot_scheduler *events, uint8_t a, uint8_t b)
+{
+	return events->when[a] < events->when[b] || (events->when[a] == events->when[b] && a < b);
+}
+
+static inline void
+events_place_ (Pilot_scheduler *events, int pos, uint8_t id)
+{
+	events->heap[pos] = id;
+	events->heap_pos[id] = pos;
+}
+
+static void
+events_sift_up_ (Pilot_scheduler *events, int pos)
+{
+	uint8_t id = events->heap[pos];
+	while (pos > 0)
+	{
+		int parent = (pos - 1) / 2;
+		if (!events_before_(events, id, events->heap[parent]))
+		{
+			break;
+		}
+		events_place_(events, pos, events->heap[parent]);
+		pos = parent;
+	}
+	events_place_(events, pos, id);
+}
+
+static void
+events_sift_down_ (Pilot_scheduler *events, int pos)
+{
+	uint8_t id = events->heap[pos];
+	for (;;)
+	{
+		int child = pos * 2 + 1;
+		if (child >= events->count)
+		{
+			break;
+		}
+		if (child + 1 < events->count && events_before_(events, events->heap[child + 1], events->heap[child]))
+		{
+			child++;
+		}
+		if (!events_before_(events, events->heap[child], id))
+		{
+			break;
+		}
+		events_place_(events, pos, events->heap[child]);
+		pos = child;
+	}
+	events_place_(events, pos, id);
+}
+
+static inline void
+events_update_next_ (Pilot_scheduler *events)
+{
+	events->next = events->count ? events->when[events->heap[0]] : UINT64_MAX;
+}
+
+void
+pilot_events_init (Pilot_system *sys)
+{
+	Pilot_scheduler *events = &sys->events;
+	int i;
+
+	for (i = 0; i < PILOT_EVENTS_MAX; i++)
+	{
+		events->heap_pos[i] = -1;
+		events->handlers[i] = NULL;
+	}
+	events->count = 0;
+	events->next = UINT64_MAX;
+}
+
+void
+Pilot_event_set_handler (Pilot_system *sys, Pilot_event_id id, Pilot_event_handler handler)
+{
+	sys->events.handlers[id] = handler;
+}
+
+void
+Pilot_event_schedule (Pilot_system *sys, Pilot_event_id id, uint64_t when)
+{
+	Pilot_scheduler *events = &sys->events;
+	int pos = events->heap_pos[id];
+
+	if (pos < 0)
+	{
+		pos = events->count++;
+		events->when[id] = when;
+		events_place_(events, pos, id);
+		events_sift_up_(events, pos);
+	}
+	else if (when < events->when[id])
+	{
+		events->when[id] = when;
+		events_sift_up_(events, pos);
+	}
+	else
+	{
+		events->when[id] = when;
+		events_sift_down_(events, pos);
+	}
+	events_update_next_(events);
+}
+
+void
+Pilot_event_cancel (Pilot_system *sys, Pilot_event_id id)
+{
+	Pilot_scheduler *events = &sys->events;
+	int pos = events->heap_pos[id];
+	uint8_t last;
+
+	if (pos < 0)
+	{
+		return;
+	}
+	events->heap_pos[id] = -1;
+	last = events->heap[--events->count];
+	if (pos < events->count)
+	{
+		events_place_(events, pos, last);
+		events_sift_up_(events, pos);
+		events_sift_down_(events, events->heap_pos[last]);
+	}
+	events_update_next_(events);
+}
+
+void
+pilot_events_dispatch (Pilot_system *sys)
+{
+	Pilot_scheduler *events = &sys->events;
+
+	// Handlers may schedule themselves again, even for the current cycle
+	while (events->next <= sys->cycles)
+	{
+		Pilot_event_id id = events->heap[0];
+		Pilot_event_cancel(sys, id);
+		if (events->handlers[id])
+		{
+			events->handlers[id](sys, id);
+		}
+	}
+}
@@ -0,0 +1,25 @@
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#include <stdint.h>
+#include "types.h"
+#include "pilot.h"
+
+void pilot_events_init (Pilot_system *sys);
+
+void Pilot_event_set_handler (Pilot_system *sys, Pilot_event_id id, Pilot_event_handler handler);
+// Sets the event's deadline, replacing any pending one. A deadline that has already passed fires before the next
+// cycle runs.
+void Pilot_event_schedule (Pilot_system *sys, Pilot_event_id id, uint64_t when);
+void Pilot_event_cancel (Pilot_system *sys, Pilot_event_id id);
+
+static inline bool
+Pilot_event_pending (const Pilot_system *sys, Pilot_event_id id)
+{
+	return sys->events.heap_pos[id] >= 0;
+}
+
+// Calls the handler of every event due by sys->cycles, earliest first; called by the run loop
+void pilot_events_dispatch (Pilot_system *sys);
+
+#endif
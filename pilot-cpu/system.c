@@ -0,0 +1,340 @@
+#include "system.h"
+#include "memory.h"
+#include "cartridge.h"
+#include "block_cache.h"
+#include "cpu_jit.h"
+#include "cpu_aot.h"
+#include "rewind.h"
+#include "replay.h"
+#include "clone.h"
+#include "scheduler.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Everything belonging to one console lives in its Pilot_system. The only state shared between instances is the
+ * opcode template table and the microcode ROM, which are built once and never written to afterwards, so any number
+ * of instances can run at once on different threads.
+ */
+Pilot_system *
+Pilot_system_create (void)
+{
+	Pilot_system *sys = calloc(1, sizeof(*sys));
+	if (!sys)
+	{
+		return NULL;
+	}
+	pilot_events_init(sys);
+	Pilot_mem_init(sys);
+	Pilot_system_reset(sys);
+	return sys;
+}
+
+void
+Pilot_system_destroy (Pilot_system *sys)
+{
+	if (!sys)
+	{
+		return;
+	}
+	Pilot_cart_unload(sys);
+	Pilot_rewind_disable(sys);
+	Pilot_replay_stop(sys);
+	pilot_cow_release(sys);
+	Pilot_jit_disable(sys);
+	Pilot_block_cache_disable(sys);
+	free(sys);
+}
+
+static void
+system_flush_pipeline_ (Pilot_system *sys)
+{
+	memset(&sys->interconnects, 0, sizeof(sys->interconnects));
+	memset(&sys->decode, 0, sizeof(sys->decode));
+	memset(&sys->execute, 0, sizeof(sys->execute));
+
+	sys->decode.sys = sys;
+	sys->decode.decoding_phase = DECODER_HALF1_DISPATCH_WAIT;
+	sys->decode.work_regs = &sys->interconnects.decoded_insts[0];
+
+	// Nothing to run until the decode stage dispatches the first instruction
+	sys->execute.sys = sys;
+	sys->execute.sequencer_phase = EXEC_SEQ_WAIT_NEXT_INS;
+	sys->execute.execution_phase = EXEC_ADVANCE_SEQUENCER;
+
+	pilot_memctl_reset(sys);
+}
+
+void
+Pilot_system_reset (Pilot_system *sys)
+{
+	pilot_decode_init_templates();
+	pilot_mucode_init_rom();
+
+	system_flush_pipeline_(sys);
+	memset(&sys->interp, 0, sizeof(sys->interp));
+
+	// sys->cycles keeps counting: components keep their schedules, and replay streams and rewind snapshots taken
+	// before the reset stay on the same time line
+	sys->deadline = UINT64_MAX;
+	sys->stop_requested = FALSE;
+}
+
+/*
+ * Each cycle runs the stages in the same order as the hardware clocks them: both first halves, both second halves,
+ * then the execute sequencer, then the memory controller.
+ *
+ * Stages with nothing to do are skipped here rather than inside the stage, so an idle execute unit or memory
+ * controller costs a load and a branch. Everything that can end the run early is folded into the loop bound or a
+ * single check per cycle.
+ */
+static Pilot_run_status
+system_run_pipeline_ (Pilot_system *sys, uint64_t end)
+{
+	pilot_decode_state *decode = &sys->decode;
+	pilot_execute_state *execute = &sys->execute;
+	bool *decoded_inst_semaph = &sys->interconnects.decoded_inst_semaph;
+
+	while (sys->cycles < end)
+	{
+		bool execute_busy = (execute->execution_phase != EXEC_ADVANCE_SEQUENCER);
+		bool breakpoint = FALSE;
+
+		pilot_decode_half1(decode);
+		if (execute_busy)
+		{
+			pilot_execute_half1(execute);
+		}
+		pilot_decode_half2(decode);
+		if (execute_busy)
+		{
+			pilot_execute_half2(execute);
+		}
+
+		if (execute->execution_phase == EXEC_ADVANCE_SEQUENCER)
+		{
+			bool inst_waiting = *decoded_inst_semaph;
+			pilot_execute_sequencer_advance(execute);
+
+			// The sequencer takes up a new instruction by clearing the semaphore. The cycle still has to be finished,
+			// memory controller included, before the run stops.
+			breakpoint = sys->breakpoint_count && inst_waiting && !*decoded_inst_semaph
+				&& pilot_breakpoint_hit(sys, execute->decoded_inst->inst_pgc);
+		}
+
+		// The memory controller (and the handlers it calls) is the only thing in here that schedules events
+		if (sys->memctl.state != MCTL_READY && !sys->memctl.waiting)
+		{
+			Pilot_memctl_tick(sys);
+			if (sys->events.next < end)
+			{
+				end = sys->events.next;
+			}
+		}
+		sys->cycles++;
+
+		if (breakpoint)
+		{
+			return PILOT_RUN_BREAKPOINT;
+		}
+		if (sys->stop_requested || execute->execution_phase == EXEC_EXCEPTION)
+		{
+			if (execute->execution_phase == EXEC_EXCEPTION)
+			{
+				return PILOT_RUN_EXCEPTION;
+			}
+			sys->stop_requested = FALSE;
+			return PILOT_RUN_STOPPED;
+		}
+	}
+
+	return PILOT_RUN_DONE;
+}
+
+/*
+ * The run is split at every event deadline: the engine runs uninterrupted up to the earliest one, then the events due
+ * are handled. The instruction-level engines don't check for events scheduled while they run (e.g. from a memory
+ * handler), so those fire at the end of the stretch, or up to an instruction late if they fall within it.
+ */
+Pilot_run_status
+Pilot_run_cycles (Pilot_system *sys, uint64_t n)
+{
+	Pilot_run_status status = PILOT_RUN_DONE;
+	uint64_t end = sys->cycles + n;
+
+	if (sys->deadline < end)
+	{
+		end = sys->deadline;
+		status = PILOT_RUN_DEADLINE;
+	}
+
+	while (sys->cycles < end)
+	{
+		uint64_t until;
+		Pilot_run_status engine_status;
+
+		if (sys->events.next <= sys->cycles)
+		{
+			pilot_events_dispatch(sys);
+		}
+		until = (sys->events.next < end) ? sys->events.next : end;
+
+		switch (sys->engine)
+		{
+			case PILOT_ENGINE_PIPELINE:
+				engine_status = system_run_pipeline_(sys, until);
+				break;
+			case PILOT_ENGINE_JIT:
+				engine_status = pilot_jit_run(sys, until);
+				break;
+			case PILOT_ENGINE_AOT:
+				engine_status = pilot_aot_run(sys, until);
+				break;
+			default:
+				engine_status = pilot_interp_run(sys, until);
+				break;
+		}
+		if (engine_status != PILOT_RUN_DONE)
+		{
+			return engine_status;
+		}
+	}
+
+	return status;
+}
+
+// Upper bound on the cycles the pipeline gets to finish its current instruction when switching engines
+#define SYSTEM_DRAIN_CYCLES_MAX 1024
+
+// Lets the execute stage finish its current instruction, and works out where the next unstarted one is.
+// Instructions the decode stage had begun on are thrown away, to be fetched again.
+static uint32_t
+system_drain_pipeline_ (Pilot_system *sys)
+{
+	pilot_execute_state *execute = &sys->execute;
+	uint64_t insts_taken = execute->insts_taken;
+	uint64_t deadline = sys->deadline;
+	uint32_t next_pgc;
+	int i;
+
+	sys->deadline = UINT64_MAX;
+
+	// The decode stage can dispatch an instruction and the sequencer take it up within the same cycle, so the
+	// semaphore alone doesn't tell when that happened
+	for (i = 0; i < SYSTEM_DRAIN_CYCLES_MAX; i++)
+	{
+		if (execute->execution_phase == EXEC_ADVANCE_SEQUENCER && execute->sequencer_phase == EXEC_SEQ_WAIT_NEXT_INS)
+		{
+			break;
+		}
+		Pilot_run_cycles(sys, 1);
+		// Once the execute stage takes up the next instruction, that's where to carry on from
+		if (execute->insts_taken != insts_taken)
+		{
+			break;
+		}
+	}
+
+	sys->deadline = deadline;
+
+	if (execute->insts_taken != insts_taken)
+	{
+		next_pgc = execute->decoded_inst->inst_pgc;
+	}
+	else if (sys->interconnects.decoded_inst_semaph)
+	{
+		next_pgc = sys->decode.work_regs->inst_pgc;
+	}
+	else if (sys->decode.decoding_phase != DECODER_HALF1_DISPATCH_WAIT
+		&& sys->decode.decoding_phase != DECODER_HALF1_READY)
+	{
+		next_pgc = sys->decode.inst_addr;
+	}
+	else
+	{
+		next_pgc = sys->decode.pgc;
+	}
+
+	// Let the last memory access land, and pick up read data as the execute stage would have
+	Pilot_memctl_finish(sys);
+	if (execute->mem_access_waiting && execute->mem_access_was_read)
+	{
+		execute->mem_data = Pilot_mem_get_data(sys);
+	}
+	execute->mem_access_waiting = FALSE;
+	return next_pgc;
+}
+
+void
+Pilot_set_engine (Pilot_system *sys, Pilot_engine engine)
+{
+	uint32_t mem_addr;
+	uint32_t mem_data;
+	uint64_t insts_taken;
+
+	if (engine == sys->engine)
+	{
+		return;
+	}
+
+	if (sys->engine == PILOT_ENGINE_PIPELINE)
+	{
+		sys->core.pgc = system_drain_pipeline_(sys);
+	}
+
+	// MAR and MDR outlive instructions (accesses latched in the first half of a cycle reuse MAR as it was left)
+	mem_addr = sys->execute.mem_addr;
+	mem_data = sys->execute.mem_data;
+	insts_taken = sys->execute.insts_taken;
+	system_flush_pipeline_(sys);
+	sys->execute.mem_addr = mem_addr;
+	sys->execute.mem_data = mem_data;
+	sys->execute.insts_taken = insts_taken;
+
+	if (engine != PILOT_ENGINE_PIPELINE)
+	{
+		memset(&sys->interp, 0, sizeof(sys->interp));
+	}
+	else
+	{
+		sys->decode.pgc = sys->core.pgc & 0xfffffe;
+		// The fetch unit's queue holds words from before the switch
+		sys->interconnects.fetch_branch = TRUE;
+	}
+	sys->engine = engine;
+}
+
+void
+Pilot_request_stop (Pilot_system *sys)
+{
+	sys->stop_requested = TRUE;
+}
+
+bool
+Pilot_breakpoint_add (Pilot_system *sys, uint32_t addr)
+{
+	if (pilot_breakpoint_hit(sys, addr))
+	{
+		return TRUE;
+	}
+	if (sys->breakpoint_count == PILOT_BREAKPOINTS_MAX)
+	{
+		return FALSE;
+	}
+	sys->breakpoints[sys->breakpoint_count++] = addr;
+	return TRUE;
+}
+
+void
+Pilot_breakpoint_remove (Pilot_system *sys, uint32_t addr)
+{
+	int i;
+	for (i = 0; i < sys->breakpoint_count; i++)
+	{
+		if (sys->breakpoints[i] == addr)
+		{
+			sys->breakpoints[i] = sys->breakpoints[--sys->breakpoint_count];
+			return;
+		}
+	}
+}
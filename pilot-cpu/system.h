@@ -0,0 +1,68 @@
+#ifndef __SYSTEM_H__
+#define __SYSTEM_H__
+
+#include <stdint.h>
+#include "pilot.h"
+
+typedef enum
+{
+	// Ran for all the requested cycles
+	PILOT_RUN_DONE = 0,
+	// An instruction at a breakpoint address was taken up by the execute stage; it hasn't run any cycles yet
+	PILOT_RUN_BREAKPOINT,
+	// The execute stage entered its exception state
+	PILOT_RUN_EXCEPTION,
+	// sys->cycles reached sys->deadline
+	PILOT_RUN_DEADLINE,
+	// Pilot_request_stop was called, e.g. from a memory handler
+	PILOT_RUN_STOPPED,
+	// The JIT's lockstep mode caught translated code disagreeing with the interpreter; the interpreter's results stand
+	PILOT_RUN_JIT_MISMATCH
+} Pilot_run_status;
+
+// Allocates a system with the default memory map and an empty pipeline. Returns NULL if out of memory.
+Pilot_system *Pilot_system_create (void);
+// Also unloads the cartridge
+void Pilot_system_destroy (Pilot_system *sys);
+
+// Empties the pipeline and clears the run state. Registers and memory are left alone, and so is sys->cycles, which
+// only ever counts up.
+void Pilot_system_reset (Pilot_system *sys);
+
+// Runs up to n whole cycles, returning early on breakpoints, exceptions, the deadline or a stop request.
+// sys->cycles tells how far it got; the instruction-level engine can overshoot by the rest of an instruction.
+Pilot_run_status Pilot_run_cycles (Pilot_system *sys, uint64_t n);
+
+// Makes Pilot_run_cycles return at the end of the current cycle
+void Pilot_request_stop (Pilot_system *sys);
+
+// Switches engines between runs. Leaving the pipeline lets it finish the instruction in the execute stage, and
+// restarts from the first instruction it hadn't begun; entering it flushes it and has the fetch unit refill from PGC.
+void Pilot_set_engine (Pilot_system *sys, Pilot_engine engine);
+
+// Returns FALSE if all PILOT_BREAKPOINTS_MAX breakpoints are in use
+bool Pilot_breakpoint_add (Pilot_system *sys, uint32_t addr);
+void Pilot_breakpoint_remove (Pilot_system *sys, uint32_t addr);
+
+static inline bool
+pilot_breakpoint_hit (const Pilot_system *sys, uint32_t pgc)
+{
+	int i;
+	for (i = 0; i < sys->breakpoint_count; i++)
+	{
+		if (sys->breakpoints[i] == pgc)
+		{
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+// Runs the instruction-level engine until sys->cycles reaches end; see cpu_interp.c
+Pilot_run_status pilot_interp_run (Pilot_system *sys, uint64_t end);
+// Likewise for the JIT; see cpu_jit.c
+Pilot_run_status pilot_jit_run (Pilot_system *sys, uint64_t end);
+// Likewise for precompiled blocks; see cpu_aot.c
+Pilot_run_status pilot_aot_run (Pilot_system *sys, uint64_t end);
+
+#endif
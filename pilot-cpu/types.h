@@ -7,6 +7,9 @@ typedef int_fast8_t bool;
 #define TRUE 1
 #define FALSE 0
 
+// Defined in pilot.h; declared here so the pipeline stage headers can refer to it
+typedef struct Pilot_system Pilot_system;
+
 typedef enum
 {
 	REG8_L0 = 0,
@@ -117,13 +120,16 @@ typedef enum
 	MU_POST_AUTOIDX
 } mucode_entry_idx;
 
+// Stored as bytes to keep decoded instructions small
 typedef struct
 {
-	mucode_entry_idx entry_idx;
+	// mucode_entry_idx
+	uint8_t entry_idx;
 	// bit 3: sign extend
 	// bit 4: RM operand number
 	uint8_t reg_select;
-	data_size_spec size;
+	// data_size_spec
+	uint8_t size;
 	bool is_write;
 } mucode_entry_spec;
 
@@ -199,95 +205,154 @@ typedef enum
 	DATA_REG_RM_2_8
 } data_bus_specifier;
 
-typedef struct {
-	data_bus_specifier location;
-	data_size_spec size;
-	bool sign_extend;
-} alu_src_control;
+typedef enum
+{
+	ALU_OFF,
+	ALU_ADD,
+	ALU_AND,
+	ALU_OR,
+	ALU_XOR
+} alu_operation_spec;
 
-typedef struct
+typedef enum
 {
-	alu_src_control srcs[2];
-	data_bus_specifier dest;
+	SHIFTER_NONE,
+	SHIFTER_LEFT,
+	SHIFTER_LEFT_CARRY,
+	SHIFTER_LEFT_BARREL,
+	SHIFTER_RIGHT_LOGICAL,
+	SHIFTER_RIGHT_ARITH,
+	SHIFTER_RIGHT_CARRY,
+	SHIFTER_RIGHT_BARREL
+} shifter_mode_spec;
 
-	enum
-	{
-		ALU_OFF,
-		ALU_ADD,
-		ALU_AND,
-		ALU_OR,
-		ALU_XOR
-	} operation;
-	
-	// Source transformations (in order)
-	bool src2_add_carry;
-	bool src2_negate;
-	bool src2_add1;
-	
-	// Shifter control
-	enum
-	{
-		SHIFTER_NONE,
-		SHIFTER_LEFT,
-		SHIFTER_LEFT_CARRY,
-		SHIFTER_LEFT_BARREL,
-		SHIFTER_RIGHT_LOGICAL,
-		SHIFTER_RIGHT_ARITH,
-		SHIFTER_RIGHT_CARRY,
-		SHIFTER_RIGHT_BARREL
-	} shifter_mode;
-	
-	// Flag control
-	uint8_t flag_write_mask;
-	bool invert_carries;
-	enum
-	{
-		FLAG_C_ALU_CARRY,
-		FLAG_C_SHIFTER_CARRY,
-	} flag_c_mode;
-	
-	bool flag_d;
-	
-	enum
-	{
-		FLAG_V_NORMAL,
-		FLAG_V_SHIFTER_CARRY,
-		FLAG_V_CLEAR,
-	} flag_v_mode;
-	
-	// Memory control
-	/* Latching an address follows the cycle below:
-	 * 1. If memory unit is not ready, execution is blocked with address to be latched being held
-	 * 2. Address is latched, data is read or written, takes 1+ cycles
-	 * 3. While data is being read or written, 
-	 */
-	enum
-	{
-		// Don't latch address
-		MEM_NO_LATCH = 0,
-		// Latches at first half of cycle, address from ALU src0
-		MEM_LATCH_HALF1,
-		// Latches at second half of cycle, address from ALU dest
-		MEM_LATCH_HALF2,
-		// Latches at second half of cycle, address is whatever was left in MAR (used for destination writeback)
-		MEM_LATCH_HALF2_MAR,
-	} mem_latch_ctl;
-	// If set, suppresses memory access assertion if memory is latched in this cycle
-	bool mem_access_suppress;
-	enum
-	{
-		MEM_READ = 0,
-		// Data is latched from ALU src1
-		MEM_WRITE_FROM_SRC1,
-		// Data is latched from ALU dest
-		MEM_WRITE_FROM_DEST,
-		// Data is not latched; whatever was left in MDR is what's written back
-		MEM_WRITE_FROM_MDR,
-	} mem_write_ctl;
-
-	// The Pilot has a 24-bit internal data bus, but this is reduced by glue logic to 16 bits for any accesses outside the CPU.
-	bool mem_size;
-} execute_control_word;
+typedef enum
+{
+	FLAG_C_ALU_CARRY,
+	FLAG_C_SHIFTER_CARRY,
+} flag_c_mode_spec;
+
+typedef enum
+{
+	FLAG_V_NORMAL,
+	FLAG_V_SHIFTER_CARRY,
+	FLAG_V_CLEAR,
+} flag_v_mode_spec;
+
+// Memory control
+/* Latching an address follows the cycle below:
+ * 1. If memory unit is not ready, execution is blocked with address to be latched being held
+ * 2. Address is latched, data is read or written, takes 1+ cycles
+ * 3. While data is being read or written, 
+ */
+typedef enum
+{
+	// Don't latch address
+	MEM_NO_LATCH = 0,
+	// Latches at first half of cycle, address from ALU src0
+	MEM_LATCH_HALF1,
+	// Latches at second half of cycle, address from ALU dest
+	MEM_LATCH_HALF2,
+	// Latches at second half of cycle, address is whatever was left in MAR (used for destination writeback)
+	MEM_LATCH_HALF2_MAR,
+} mem_latch_spec;
+
+typedef enum
+{
+	MEM_READ = 0,
+	// Data is latched from ALU src1
+	MEM_WRITE_FROM_SRC1,
+	// Data is latched from ALU dest
+	MEM_WRITE_FROM_DEST,
+	// Data is not latched; whatever was left in MDR is what's written back
+	MEM_WRITE_FROM_MDR,
+} mem_write_spec;
+
+/*
+ * Execute control word
+ *
+ * Packed into 64 bits so that decoded instructions and microcode entries stay small. Fields are read and written with
+ * the ECW_* accessors below; ALU source fields with ECW_SRC_*, passing the source number (0 or 1).
+ *
+ * Per ALU source:
+ * - LOCATION: data_bus_specifier
+ * - SIZE: data_size_spec
+ * - SIGN_EXTEND
+ *
+ * DEST: data_bus_specifier
+ * OPERATION: alu_operation_spec
+ *
+ * Source transformations (in order): SRC2_ADD_CARRY, SRC2_NEGATE, SRC2_ADD1
+ *
+ * SHIFTER_MODE: shifter_mode_spec
+ *
+ * Flag control: FLAG_WRITE_MASK, INVERT_CARRIES, FLAG_C_MODE (flag_c_mode_spec), FLAG_D, FLAG_V_MODE
+ * (flag_v_mode_spec)
+ *
+ * Memory control:
+ * - MEM_LATCH_CTL: mem_latch_spec
+ * - MEM_ACCESS_SUPPRESS: if set, suppresses memory access assertion if memory is latched in this cycle
+ * - MEM_WRITE_CTL: mem_write_spec
+ * - MEM_SIZE: data_size_spec. The Pilot has a 24-bit internal data bus, but this is reduced by glue logic to 16 bits
+ *   for any accesses outside the CPU.
+ *
+ * ALU_KERNEL: the execute stage's ALU kernel for OPERATION, the source sizes and SHIFTER_MODE. It's derived from
+ * those, so whatever builds a control word sets it last, with pilot_execute_select_alu_kernel.
+ */
+typedef uint64_t execute_control_word;
+
+#define ECW_SRC_LOCATION_SHIFT     0
+#define ECW_SRC_LOCATION_BITS      6
+#define ECW_SRC_SIZE_SHIFT         6
+#define ECW_SRC_SIZE_BITS          2
+#define ECW_SRC_SIGN_EXTEND_SHIFT  8
+#define ECW_SRC_SIGN_EXTEND_BITS   1
+#define ECW_SRC_STRIDE             9
+
+#define ECW_DEST_SHIFT                18
+#define ECW_DEST_BITS                 6
+#define ECW_OPERATION_SHIFT           24
+#define ECW_OPERATION_BITS            3
+#define ECW_SRC2_ADD_CARRY_SHIFT      27
+#define ECW_SRC2_ADD_CARRY_BITS       1
+#define ECW_SRC2_NEGATE_SHIFT         28
+#define ECW_SRC2_NEGATE_BITS          1
+#define ECW_SRC2_ADD1_SHIFT           29
+#define ECW_SRC2_ADD1_BITS            1
+#define ECW_SHIFTER_MODE_SHIFT        30
+#define ECW_SHIFTER_MODE_BITS         3
+#define ECW_FLAG_WRITE_MASK_SHIFT     33
+#define ECW_FLAG_WRITE_MASK_BITS      8
+#define ECW_INVERT_CARRIES_SHIFT      41
+#define ECW_INVERT_CARRIES_BITS       1
+#define ECW_FLAG_C_MODE_SHIFT         42
+#define ECW_FLAG_C_MODE_BITS          1
+#define ECW_FLAG_D_SHIFT              43
+#define ECW_FLAG_D_BITS               1
+#define ECW_FLAG_V_MODE_SHIFT         44
+#define ECW_FLAG_V_MODE_BITS          2
+#define ECW_MEM_LATCH_CTL_SHIFT       46
+#define ECW_MEM_LATCH_CTL_BITS        2
+#define ECW_MEM_ACCESS_SUPPRESS_SHIFT 48
+#define ECW_MEM_ACCESS_SUPPRESS_BITS  1
+#define ECW_MEM_WRITE_CTL_SHIFT       49
+#define ECW_MEM_WRITE_CTL_BITS        2
+#define ECW_MEM_SIZE_SHIFT            51
+#define ECW_MEM_SIZE_BITS             2
+#define ECW_ALU_KERNEL_SHIFT          53
+#define ECW_ALU_KERNEL_BITS           9
+
+#define ECW_MASK_(bits) ((UINT64_C(1) << (bits)) - 1)
+#define ECW_EXTRACT_(w, shift, bits) ((uint32_t)(((w) >> (shift)) & ECW_MASK_(bits)))
+#define ECW_INSERT_(w, shift, bits, v) \
+	((w) = ((w) & ~(ECW_MASK_(bits) << (shift))) | (((uint64_t)(v) & ECW_MASK_(bits)) << (shift)))
+
+#define ECW_GET(w, field) ECW_EXTRACT_(w, ECW_##field##_SHIFT, ECW_##field##_BITS)
+#define ECW_SET(w, field, v) ECW_INSERT_(w, ECW_##field##_SHIFT, ECW_##field##_BITS, v)
+#define ECW_SRC_GET(w, src, field) \
+	ECW_EXTRACT_(w, ECW_SRC_##field##_SHIFT + (src) * ECW_SRC_STRIDE, ECW_SRC_##field##_BITS)
+#define ECW_SRC_SET(w, src, field, v) \
+	ECW_INSERT_(w, ECW_SRC_##field##_SHIFT + (src) * ECW_SRC_STRIDE, ECW_SRC_##field##_BITS, v)
 
 typedef struct
 {
@@ -295,12 +360,32 @@ typedef struct
 	mucode_entry_spec next;
 } mucode_entry;
 
+typedef enum
+{
+	COND_LE = 0,     // less than or equal
+	COND_GT,         // greater than
+	COND_LT,         // less than
+	COND_GE,         // greater than or equal
+	COND_U_LE,       // unsigned less than or equal
+	COND_U_GT,       // unsigned greater than
+	COND_C,          // carry set; unsigned less than
+	COND_NC,         // carry clear; unsigned greater than or equal
+	COND_M,          // minus; sign set
+	COND_P,          // plus; sign clear
+	COND_V,          // overflow; parity even
+	COND_NV,         // not overflow; parity odd
+	COND_Z,          // equal; zero
+	COND_NZ,         // not equal; nonzero
+	COND_ALWAYS,     // always
+	COND_ALWAYS_CALL // always, but used for calls
+} branch_cond_spec;
+
 typedef struct
 {
 	// Immediate data sources
 	uint16_t imm_words[5];
 	
-	// PGC for this instruction
+	// PGC for this instruction; the address of its opcode word
 	uint32_t inst_pgc;
 	
 	// Sequencer control
@@ -318,25 +403,7 @@ typedef struct
 	
 	// Branch flags
 	bool branch;
-	enum
-	{
-		COND_LE = 0,     // less than or equal
-		COND_GT,         // greater than
-		COND_LT,         // less than
-		COND_GE,         // greater than or equal
-		COND_U_LE,       // unsigned less than or equal
-		COND_U_GT,       // unsigned greater than
-		COND_C,          // carry set; unsigned less than
-		COND_NC,         // carry clear; unsigned greater than or equal
-		COND_M,          // minus; sign set
-		COND_P,          // plus; sign clear
-		COND_V,          // overflow; parity even
-		COND_NV,         // not overflow; parity odd
-		COND_Z,          // equal; zero
-		COND_NZ,         // not equal; nonzero
-		COND_ALWAYS,     // always
-		COND_ALWAYS_CALL // always, but used for calls
-	} branch_cond;
+	branch_cond_spec branch_cond;
 	
 	enum
 	{
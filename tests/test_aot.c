@@ -0,0 +1,242 @@
+#include <stdlib.h>
+#include "test_common.h"
+#include "cartridge.h"
+#include "cpu_aot.h"
+#include "cpu_decode.h"
+
+/*
+ * Static recompilation, end to end
+ *
+ *     test_aot pilot-aot cc include-dir work-dir
+ *
+ * Writes a synthetic ROM, translates it with pilot-aot, builds the output with cc -shared as cpu_aot.h describes and
+ * loads it. Run with the bank it was compiled for mapped, the object has to give the interpreter's registers, memory
+ * and cycle count. The ROM holds the same code twice, so with the other copy mapped at the same address every block
+ * has to turn itself down and leave the run to the interpreter, with the same results. An object for another ROM
+ * mustn't load at all.
+ *
+ * Exits with TEST_SKIPPED if there's no compiler to build the object with (an empty cc means CMake found no dlopen).
+ */
+
+#define TEST_SKIPPED 77
+
+#define CP_8_R0_R0 0x28c0
+// LD.16 (r1+), (r0+)
+#define LD_16_POSTINC 0x5920
+// ADD.16 r2, r3
+#define ADD_16_R2_R3 0x620c
+// XOR.16 r4, r5
+#define XOR_16_R4_R5 0x6c54
+// ADD.16 r6, short-form immediate 3
+#define ADD_16_R6_SFI_3 0x660f
+#define PATTERN_WORDS 5
+#define PATTERNS 160
+
+// Two banks of whole pages, each with a copy of the program
+#define BANK_SIZE 0x1000
+#define ROM_SIZE (BANK_SIZE * 2)
+
+#define COPY_SRC (WRAM_START + 0x100)
+#define COPY_DEST (WRAM_START + 0x800)
+
+// One word each, so the pattern doesn't depend on how many extension words the decoder fetches
+static const uint16_t pattern[PATTERN_WORDS] =
+{
+	LD_16_POSTINC, ADD_16_R2_R3, XOR_16_R4_R5, ADD_16_R6_SFI_3, CP_8_R0_R0
+};
+
+typedef struct
+{
+	uint64_t cycles;
+	uint32_t pgc;
+	uint32_t regs[8];
+	uint8_t wram[0x8000];
+} run_result;
+
+static char cmd[4096];
+static char rom_path[1024], other_rom_path[1024], source_path[1024], object_path[1024];
+
+static bool
+write_rom_ (const char *path, const uint8_t *rom)
+{
+	FILE *out = fopen(path, "wb");
+	bool ok = out && fwrite(rom, 1, ROM_SIZE, out) == ROM_SIZE;
+
+	if (out && fclose(out) != 0)
+	{
+		ok = FALSE;
+	}
+	return ok;
+}
+
+static uint32_t
+build_rom_ (uint8_t *rom)
+{
+	uint32_t bank, i;
+
+	memset(rom, 0, ROM_SIZE);
+	for (bank = 0; bank < ROM_SIZE; bank += BANK_SIZE)
+	{
+		for (i = 0; i < PATTERNS * PATTERN_WORDS; i++)
+		{
+			rom[bank + i * 2] = pattern[i % PATTERN_WORDS] & 0xff;
+			rom[bank + i * 2 + 1] = pattern[i % PATTERN_WORDS] >> 8;
+		}
+	}
+	// The zero word after each copy doesn't decode, which ends the last block there
+	return CART_ROM_START + PATTERNS * PATTERN_WORDS * 2;
+}
+
+// A system with the ROM loaded, bank 1 mapped if asked, and the program's registers and data; NULL if the ROM or
+// object won't load
+static Pilot_system *
+create_ (bool other_bank, const char *object)
+{
+	static const uint32_t regs[8] = { COPY_SRC, COPY_DEST, 0x000102, 0x000304, 0x000506, 0x000708, 0x000090 };
+	Pilot_system *sys = Pilot_system_create();
+	int i;
+
+	if (!sys || !Pilot_cart_load(sys, rom_path) || (object && !Pilot_aot_load(sys, object)))
+	{
+		Pilot_system_destroy(sys);
+		return NULL;
+	}
+	if (other_bank)
+	{
+		Pilot_cart_map_bank(sys, CART_ROM_START, CART_ROM_END, BANK_SIZE);
+	}
+	for (i = 0; i < 0x800; i++)
+	{
+		sys->wram[COPY_SRC - WRAM_START + i] = (uint8_t)(i * 13 + 5);
+	}
+	Pilot_set_engine(sys, object ? PILOT_ENGINE_AOT : PILOT_ENGINE_INTERP);
+	sys->core.pgc = CART_ROM_START;
+	for (i = 0; i < 8; i++)
+	{
+		sys->core.regs[i] = regs[i];
+	}
+	sys->core.wf = 0;
+	return sys;
+}
+
+static void
+save_ (const Pilot_system *sys, uint64_t start, run_result *result)
+{
+	result->cycles = sys->cycles - start;
+	result->pgc = sys->core.pgc;
+	memcpy(result->regs, sys->core.regs, sizeof(result->regs));
+	memcpy(result->wram, sys->wram, sizeof(result->wram));
+}
+
+static void
+compare_ (const char *name, const run_result *a, const run_result *ref)
+{
+	TEST_CHECK(a->cycles == ref->cycles && a->pgc == ref->pgc, "%s: ran %llu cycles to %06x, not %llu to %06x", name,
+		(unsigned long long)a->cycles, a->pgc, (unsigned long long)ref->cycles, ref->pgc);
+	TEST_CHECK(!memcmp(a->regs, ref->regs, sizeof(ref->regs)), "%s: registers differ", name);
+	TEST_CHECK(!memcmp(a->wram, ref->wram, sizeof(ref->wram)), "%s: WRAM differs", name);
+}
+
+// Runs the program on the object, for as many cycles as the interpreter took
+static void
+run_aot_ (const char *name, bool other_bank, const run_result *ref)
+{
+	static run_result result;
+	Pilot_system *sys = create_(other_bank, object_path);
+	Pilot_aot_stats stats;
+	uint64_t start;
+
+	TEST_CHECK(sys, "%s: the object didn't load", name);
+	if (!sys)
+	{
+		return;
+	}
+	start = sys->cycles;
+	TEST_CHECK(Pilot_run_cycles(sys, ref->cycles) == PILOT_RUN_DONE, "%s: run didn't finish", name);
+	save_(sys, start, &result);
+	compare_(name, &result, ref);
+
+	stats = Pilot_aot_get_stats(sys);
+	if (other_bank)
+	{
+		TEST_CHECK(stats.blocks_run == 0 && stats.bails > 0, "%s: %llu blocks ran, %llu bailed", name,
+			(unsigned long long)stats.blocks_run, (unsigned long long)stats.bails);
+	}
+	else
+	{
+		TEST_CHECK(stats.blocks_run > 0 && stats.bails == 0 && stats.fallbacks == 0,
+			"%s: %llu blocks ran, %llu bailed, %llu instructions interpreted", name, (unsigned long long)stats.blocks_run,
+			(unsigned long long)stats.bails, (unsigned long long)stats.fallbacks);
+	}
+	Pilot_system_destroy(sys);
+}
+
+int
+main (int argc, char **argv)
+{
+	static uint8_t rom[ROM_SIZE];
+	static run_result ref;
+	Pilot_system *sys;
+	uint64_t start;
+	uint32_t end;
+	int i;
+
+	if (argc != 5)
+	{
+		fprintf(stderr, "usage: %s pilot-aot cc include-dir work-dir\n", argv[0]);
+		return 2;
+	}
+	snprintf(cmd, sizeof(cmd), "'%s' --version > /dev/null 2>&1", argv[2]);
+	if (!argv[2][0] || system(cmd) != 0)
+	{
+		printf("aot: skipped, no compiler\n");
+		return TEST_SKIPPED;
+	}
+	snprintf(rom_path, sizeof(rom_path), "%s/test_aot_rom.bin", argv[4]);
+	snprintf(other_rom_path, sizeof(other_rom_path), "%s/test_aot_other_rom.bin", argv[4]);
+	snprintf(source_path, sizeof(source_path), "%s/test_aot_rom.c", argv[4]);
+	snprintf(object_path, sizeof(object_path), "%s/test_aot_rom.so", argv[4]);
+
+	pilot_decode_init_templates();
+	for (i = 0; i < PATTERN_WORDS; i++)
+	{
+		const decode_template *t = pilot_decode_template(pattern[i]);
+		TEST_CHECK(t->status == DECODE_OK && t->extra_words == 0, "%04x doesn't decode as one word", pattern[i]);
+	}
+	end = build_rom_(rom);
+	TEST_CHECK(write_rom_(rom_path, rom), "can't write %s", rom_path);
+	rom[ROM_SIZE - 1] ^= 1;
+	TEST_CHECK(write_rom_(other_rom_path, rom), "can't write %s", other_rom_path);
+
+	snprintf(cmd, sizeof(cmd), "'%s' '%s' '%s'", argv[1], rom_path, source_path);
+	TEST_CHECK(system(cmd) == 0, "pilot-aot failed");
+	snprintf(cmd, sizeof(cmd), "'%s' -O2 -shared -fPIC -I '%s' '%s' -o '%s'", argv[2], argv[3], source_path, object_path);
+	TEST_CHECK(system(cmd) == 0, "the object didn't build");
+	if (test_failures)
+	{
+		return test_report("aot");
+	}
+
+	// The interpreter's run is the reference, and says how many cycles the program takes
+	sys = create_(FALSE, NULL);
+	TEST_CHECK(sys, "%s didn't load", rom_path);
+	if (!sys)
+	{
+		return test_report("aot");
+	}
+	start = sys->cycles;
+	TEST_CHECK(test_run_to(sys, end), "the interpreter didn't reach the end");
+	save_(sys, start, &ref);
+	Pilot_system_destroy(sys);
+
+	run_aot_("compiled bank", FALSE, &ref);
+	run_aot_("other bank", TRUE, &ref);
+
+	// Same size, one byte different
+	sys = Pilot_system_create();
+	TEST_CHECK(sys && Pilot_cart_load(sys, other_rom_path), "%s didn't load", other_rom_path);
+	TEST_CHECK(!Pilot_aot_load(sys, object_path), "the object loaded for another ROM");
+	Pilot_system_destroy(sys);
+
+	return test_report("aot");
+}
@@ -0,0 +1,126 @@
+#include "test_common.h"
+
+/*
+ * Breakpoints and timing
+ *
+ * Stopping at a breakpoint mustn't change how long a program takes: a run that stops at every instruction and is
+ * resumed each time has to end on the same cycle, with the same state, as one that runs straight through. The
+ * program is a copy of word moves between post-incremented pointers, so every instruction has memory accesses in
+ * flight across the cycle the breakpoint is taken on, and runs at each of 0-3 wait states.
+ */
+
+#define LD_16_POSTINC 0x5920
+#define CP_8_R0_R0 0x28c0
+#define LD_COUNT 12
+// Enough for the pipeline to keep fetching past the copy while it finishes
+#define PAD_COUNT 256
+#define TAIL_CYCLES 64
+#define WAIT_STATES_MAX 3
+
+#define COPY_SRC (WRAM_START + 0x100)
+#define COPY_DEST (WRAM_START + 0x800)
+
+typedef struct
+{
+	uint64_t hit_cycles;
+	uint64_t cycles;
+	int hits;
+	uint32_t regs[8];
+	uint8_t wram[0x1000];
+} run_result;
+
+static void
+run_ (const test_engine *e, uint8_t wait_states, bool every_inst, run_result *result)
+{
+	static const uint32_t regs[8] = { COPY_SRC, COPY_DEST };
+	uint16_t prog[LD_COUNT + PAD_COUNT];
+	Pilot_system *sys = test_create(e);
+	uint32_t end;
+	int i;
+
+	memset(result, 0, sizeof(*result));
+	if (!sys)
+	{
+		return;
+	}
+	for (i = 0; i < LD_COUNT; i++)
+	{
+		prog[i] = LD_16_POSTINC;
+	}
+	for (i = 0; i < PAD_COUNT; i++)
+	{
+		prog[LD_COUNT + i] = CP_8_R0_R0;
+	}
+	for (i = 0; i < 0x100; i++)
+	{
+		sys->wram[COPY_SRC - WRAM_START + i] = (uint8_t)(i * 13 + 5);
+	}
+	Pilot_mem_map_direct(sys, WRAM_START, WRAM_END, sys->wram, sys->wram, wait_states);
+	test_load(sys, e, prog, LD_COUNT + PAD_COUNT, regs);
+	end = TEST_CODE_START + LD_COUNT * 2;
+
+	Pilot_breakpoint_add(sys, end);
+	if (every_inst)
+	{
+		for (i = 0; i < LD_COUNT; i++)
+		{
+			Pilot_breakpoint_add(sys, TEST_CODE_START + i * 2);
+		}
+	}
+	// Each breakpoint is taken once, the one at the end last
+	while (result->hits < (every_inst ? LD_COUNT + 1 : 1)
+		&& Pilot_run_cycles(sys, TEST_CYCLES_MAX) == PILOT_RUN_BREAKPOINT)
+	{
+		result->hits++;
+	}
+	result->hit_cycles = sys->cycles;
+
+	Pilot_breakpoint_remove(sys, end);
+	for (i = 0; i < LD_COUNT; i++)
+	{
+		Pilot_breakpoint_remove(sys, TEST_CODE_START + i * 2);
+	}
+	Pilot_run_cycles(sys, TAIL_CYCLES);
+	result->cycles = sys->cycles;
+	memcpy(result->regs, sys->core.regs, sizeof(result->regs));
+	memcpy(result->wram, sys->wram, sizeof(result->wram));
+	Pilot_system_destroy(sys);
+}
+
+int
+main (void)
+{
+	size_t e;
+	uint8_t wait_states;
+
+	for (e = 0; e < TEST_ENGINES; e++)
+	{
+		const char *name = test_engines[e].name;
+
+		for (wait_states = 0; wait_states <= WAIT_STATES_MAX; wait_states++)
+		{
+			static run_result through, stepped;
+
+			run_(&test_engines[e], wait_states, FALSE, &through);
+			run_(&test_engines[e], wait_states, TRUE, &stepped);
+			if (!through.hits && !stepped.hits)
+			{
+				printf("%s: skipped\n", name);
+				break;
+			}
+			TEST_CHECK(through.hits == 1, "%s, %d wait states: didn't reach the end", name, wait_states);
+			TEST_CHECK(stepped.hits == LD_COUNT + 1, "%s, %d wait states: %d breakpoints taken, not %d", name,
+				wait_states, stepped.hits, LD_COUNT + 1);
+			TEST_CHECK(stepped.hit_cycles == through.hit_cycles,
+				"%s, %d wait states: reached the end on cycle %llu stopping at every instruction, %llu without", name,
+				wait_states, (unsigned long long)stepped.hit_cycles, (unsigned long long)through.hit_cycles);
+			TEST_CHECK(stepped.cycles == through.cycles, "%s, %d wait states: ran to cycle %llu, not %llu", name,
+				wait_states, (unsigned long long)stepped.cycles, (unsigned long long)through.cycles);
+			TEST_CHECK(!memcmp(stepped.regs, through.regs, sizeof(through.regs)), "%s, %d wait states: registers differ",
+				name, wait_states);
+			TEST_CHECK(!memcmp(stepped.wram, through.wram, sizeof(through.wram)), "%s, %d wait states: memory differs",
+				name, wait_states);
+		}
+	}
+	return test_report("breakpoint_cycles");
+}
@@ -0,0 +1,119 @@
+#ifndef __TEST_COMMON_H__
+#define __TEST_COMMON_H__
+
+#include <stdio.h>
+#include <string.h>
+#include "system.h"
+#include "memory.h"
+#include "block_cache.h"
+#include "cpu_jit.h"
+
+/*
+ * Helpers shared by the tests. Each test is its own executable, run by ctest; it prints what failed and returns
+ * nonzero if anything did.
+ */
+
+// Programs are loaded at the bottom of VRAM, as in pilot-workload
+#define TEST_CODE_START VRAM_START
+#define TEST_CYCLES_MAX 1000000
+
+typedef struct
+{
+	const char *name;
+	Pilot_engine engine;
+	bool cache;
+} test_engine;
+
+static const test_engine test_engines[] =
+{
+	{ "pipeline", PILOT_ENGINE_PIPELINE, FALSE },
+	{ "interp", PILOT_ENGINE_INTERP, FALSE },
+	{ "interp_cached", PILOT_ENGINE_INTERP, TRUE },
+	{ "jit", PILOT_ENGINE_JIT, FALSE },
+};
+
+#define TEST_ENGINES (sizeof(test_engines) / sizeof(test_engines[0]))
+
+static int test_failures;
+
+#define TEST_CHECK(cond, ...) \
+	do \
+	{ \
+		if (!(cond)) \
+		{ \
+			printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+			printf(__VA_ARGS__); \
+			printf("\n"); \
+			test_failures++; \
+		} \
+	} \
+	while (0)
+
+// A system on the given engine, with the block cache or JIT enabled as it needs; NULL if that isn't possible here
+static inline Pilot_system *
+test_create (const test_engine *e)
+{
+	Pilot_system *sys = Pilot_system_create();
+	if (!sys)
+	{
+		return NULL;
+	}
+	if ((e->engine == PILOT_ENGINE_JIT && !Pilot_jit_enable(sys, 1 << 20))
+		|| (e->cache && !Pilot_block_cache_enable(sys, 1024)))
+	{
+		Pilot_system_destroy(sys);
+		return NULL;
+	}
+	return sys;
+}
+
+// Loads words at TEST_CODE_START and points the engine at them, with the given registers. Returns the address just
+// past the program.
+static inline uint32_t
+test_load (Pilot_system *sys, const test_engine *e, const uint16_t *words, uint32_t count, const uint32_t regs[8])
+{
+	uint32_t i;
+
+	// Written over the bus so that blocks and translations of the last program loaded there are thrown out
+	for (i = 0; i < count; i++)
+	{
+		Pilot_mem_write_sync(sys, TEST_CODE_START + i * 2, words[i]);
+	}
+	// Passing through the interpreter is the way to repoint the pipeline's fetch
+	Pilot_set_engine(sys, PILOT_ENGINE_INTERP);
+	Pilot_system_reset(sys);
+	sys->core.pgc = TEST_CODE_START;
+	for (i = 0; i < 8; i++)
+	{
+		sys->core.regs[i] = regs[i];
+	}
+	sys->core.wf = 0;
+	Pilot_set_engine(sys, e->engine);
+	return TEST_CODE_START + count * 2;
+}
+
+// Runs a loaded program up to a breakpoint at end; returns FALSE if it didn't get there
+static inline bool
+test_run_to (Pilot_system *sys, uint32_t end)
+{
+	Pilot_run_status status;
+
+	Pilot_breakpoint_add(sys, end);
+	status = Pilot_run_cycles(sys, TEST_CYCLES_MAX);
+	Pilot_breakpoint_remove(sys, end);
+	return status == PILOT_RUN_BREAKPOINT && sys->core.pgc == end;
+}
+
+static inline int
+test_report (const char *name)
+{
+	if (test_failures)
+	{
+		printf("%s: %d failed\n", name, test_failures);
+		return 1;
+	}
+	printf("%s: ok\n", name);
+	return 0;
+}
+
+#endif
@@ -0,0 +1,84 @@
+#include "test_common.h"
+
+/*
+ * Writes already under way when a page is flagged
+ *
+ * With direct_ram, a write to a page that had no flags when it was asserted holds a host pointer and would skip
+ * mem_write. Flagging the page before the write lands has to send the write through mem_write after all: decoding a
+ * block from the page has to see the block it overwrites go stale, and freezing the page for a clone has to see the
+ * write go to the system's own copy, not the RAM the clone shares.
+ */
+
+#include "clone.h"
+
+#define CP_8_R0_R0 0x28c0
+
+static void
+code_page_ (void)
+{
+	Pilot_system *sys = Pilot_system_create();
+	const pilot_block *block;
+	uint16_t data;
+
+	if (!Pilot_block_cache_enable(sys, 1024))
+	{
+		printf("direct_write: code page skipped\n");
+		Pilot_system_destroy(sys);
+		return;
+	}
+	Pilot_system_reset(sys);
+	sys->memctl.direct_ram = TRUE;
+	Pilot_mem_write_sync(sys, TEST_CODE_START, CP_8_R0_R0);
+	Pilot_mem_write_sync(sys, TEST_CODE_START + 2, CP_8_R0_R0);
+
+	Pilot_mem_addr_write_assert(sys, TEST_CODE_START + 2, 0);
+	TEST_CHECK(sys->memctl.direct_ptr != NULL, "write to an unflagged page didn't go direct");
+	block = pilot_block_lookup(sys, TEST_CODE_START);
+	TEST_CHECK(block && block->inst_count == 2, "block wasn't decoded");
+	Pilot_memctl_finish(sys);
+
+	Pilot_mem_read_sync(sys, TEST_CODE_START + 2, &data);
+	TEST_CHECK(data == 0, "write didn't land");
+	TEST_CHECK(block && !pilot_block_valid(sys, block), "block survived a write to its code");
+
+	Pilot_system_destroy(sys);
+}
+
+static void
+cow_page_ (void)
+{
+	Pilot_system *sys = Pilot_system_create();
+	Pilot_system *clone;
+	uint16_t data;
+
+	Pilot_system_reset(sys);
+	sys->memctl.direct_ram = TRUE;
+	Pilot_mem_write_sync(sys, WRAM_START, 0x1111);
+
+	Pilot_mem_addr_write_assert(sys, WRAM_START, 0x2222);
+	TEST_CHECK(sys->memctl.direct_ptr != NULL, "write to an unflagged page didn't go direct");
+	clone = Pilot_system_clone(sys);
+	TEST_CHECK(clone != NULL, "clone failed");
+	Pilot_memctl_finish(sys);
+
+	Pilot_mem_read_sync(sys, WRAM_START, &data);
+	TEST_CHECK(data == 0x2222, "write read back as %04x", data);
+	if (clone)
+	{
+		Pilot_memctl_finish(clone);
+		Pilot_mem_read_sync(clone, WRAM_START, &data);
+		// The clone took the access over with the rest of the CPU state, so it lands there as well, in its own copy
+		TEST_CHECK(data == 0x2222, "clone's write read back as %04x", data);
+		Pilot_system_destroy(clone);
+	}
+
+	Pilot_system_destroy(sys);
+}
+
+int
+main (void)
+{
+	code_page_();
+	cow_page_();
+	return test_report("direct_write");
+}
@@ -0,0 +1,67 @@
+#include "test_common.h"
+
+/*
+ * JIT block chaining
+ *
+ * Two blocks of CP.8 r0, r0, one cycle each: A ends at a page boundary and B starts the next page, so A's exit gets
+ * chained to B. Writing to B's page makes B's translation stale but leaves A's alone; A's chained exit then leads to
+ * a translation that bails, and has to be relinked to B's new one, or every run after that would bail again.
+ */
+
+#define CP_8_R0_R0 0x28c0
+#define BLOCK_START (TEST_CODE_START + PILOT_MEM_PAGE_SIZE - PILOT_BLOCK_MAX_INSTS * 2)
+#define PROGRAM_WORDS (PILOT_BLOCK_MAX_INSTS * 2)
+
+static void
+run_ (Pilot_system *sys)
+{
+	sys->core.pgc = BLOCK_START;
+	TEST_CHECK(Pilot_run_cycles(sys, PROGRAM_WORDS) == PILOT_RUN_DONE, "run didn't finish");
+	TEST_CHECK(sys->core.pgc == BLOCK_START + PROGRAM_WORDS * 2, "run ended at %06x", sys->core.pgc);
+}
+
+int
+main (void)
+{
+	static const uint32_t regs[8];
+	const test_engine *e = &test_engines[TEST_ENGINES - 1];
+	Pilot_system *sys = test_create(e);
+	uint16_t code[PROGRAM_WORDS];
+	Pilot_jit_stats stats;
+	int i;
+
+	if (!sys)
+	{
+		printf("jit_chain: skipped\n");
+		return 0;
+	}
+	for (i = 0; i < PROGRAM_WORDS; i++)
+	{
+		code[i] = CP_8_R0_R0;
+	}
+	// Just to set the system up; the code goes elsewhere
+	test_load(sys, e, code, 0, regs);
+	for (i = 0; i < PROGRAM_WORDS; i++)
+	{
+		Pilot_mem_write_sync(sys, BLOCK_START + i * 2, code[i]);
+	}
+
+	run_(sys);
+	run_(sys);
+	stats = Pilot_jit_get_stats(sys);
+	TEST_CHECK(stats.translations == 2 && stats.bails == 0, "%llu translations, %llu bails before the write",
+		(unsigned long long)stats.translations, (unsigned long long)stats.bails);
+	TEST_CHECK(stats.chains >= 1, "A wasn't chained to B");
+
+	// Same word back, but B's page changed as far as the block cache knows
+	Pilot_mem_write_sync(sys, BLOCK_START + PROGRAM_WORDS * 2 - 2, CP_8_R0_R0);
+	run_(sys);
+	run_(sys);
+	run_(sys);
+	stats = Pilot_jit_get_stats(sys);
+	TEST_CHECK(stats.translations == 3, "%llu translations after the write", (unsigned long long)stats.translations);
+	TEST_CHECK(stats.bails == 1, "%llu bails after the write; A wasn't relinked", (unsigned long long)stats.bails);
+
+	Pilot_system_destroy(sys);
+	return test_report("jit_chain");
+}
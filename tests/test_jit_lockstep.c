@@ -0,0 +1,274 @@
+#include "test_common.h"
+#include "cpu_decode.h"
+
+/*
+ * JIT lockstep mode
+ *
+ * pilot-workload's programs, run translated with lockstep on and no breakpoints, so that every block is checked
+ * against the interpreter as it goes: ALU operations at every size, LD through every addressing mode, and a block copy.
+ * None of them may disagree, and the end state has to match a plain interpreter run.
+ *
+ * Every program writes memory, so blocks go through the write journal: lockstep undoes a block's writes before the
+ * interpreter reruns it, and an undo that left anything different would give the interpreter's reads other data and
+ * show up as a mismatch.
+ */
+
+#define CODE_WORDS_MAX 0x400
+#define PASSES 2
+
+// Data the LD program reads; its registers point in here
+#define LD_DATA (WRAM_START + 0x4000)
+#define LD_DATA_SIZE 0x1000
+#define COPY_SRC (WRAM_START + 0x1000)
+#define COPY_DEST (WRAM_START + 0x2000)
+#define COPY_WORDS 0x100
+
+enum
+{
+	SIZE_8 = 0,
+	SIZE_16,
+	SIZE_24
+};
+
+// Operations of decode_inst_arithlogic_
+enum
+{
+	OP_ADD = 0,
+	OP_XOR = 5,
+	OP_CP = 7,
+	OP_IMM = 15
+};
+
+// RM specifiers; see decode_rm_specifier
+#define RM_REG(r)     ((r) << 2)
+#define RM_SFI(n)     (0x03 | ((n) << 2))
+#define RM_IND(r)     (0x02 | ((r) << 2))
+#define RM_POSTINC(r) (0x20 | ((r) << 2))
+#define RM_PREDEC(r)  (0x22 | ((r) << 2))
+#define RM_REL(r)     (0x01 | ((r) << 2))
+#define RM_ABS16      0x29
+#define RM_ABS24      0x2d
+#define RM_IMM16      0x21
+#define RM_IMM24      0x25
+#define RM_PGC16      0x31
+#define RM_PGC24      0x35
+#define RM_INDEXED    0x39
+#define RM_ABS_INDEXED 0x3d
+#define INDEX_WORD(base, index, size) (((size) << 14) | ((index) << 8) | ((base) << 2))
+
+typedef struct
+{
+	uint16_t words[CODE_WORDS_MAX];
+	uint32_t count;
+	bool bad;
+} program;
+
+// Emits as many extension words as the decoder fetches, which may be fewer than written; see pilot-workload
+static void
+emit_ (program *p, uint16_t op, uint16_t w1, uint16_t w2)
+{
+	const decode_template *t = pilot_decode_template(op);
+
+	if (t->status != DECODE_OK || t->extra_words > 2 || p->count + 1 + t->extra_words > CODE_WORDS_MAX)
+	{
+		p->bad = TRUE;
+		return;
+	}
+	p->words[p->count++] = op;
+	if (t->extra_words > 0)
+	{
+		p->words[p->count++] = w1;
+	}
+	if (t->extra_words > 1)
+	{
+		p->words[p->count++] = w2;
+	}
+}
+
+static void
+alu_ (program *p, int size, int operation, int reg, int rm)
+{
+	emit_(p, (size << 14) | 0x2000 | ((operation >> 2) << 11) | ((operation & 3) << 6) | (reg << 8) | rm, 0, 0);
+}
+
+// rm = rm op imm
+static void
+alu_imm_ (program *p, int size, int operation, int rm, uint16_t imm)
+{
+	emit_(p, (size << 14) | 0x2000 | ((OP_IMM >> 2) << 11) | ((OP_IMM & 3) << 6) | (operation << 8) | rm, imm, 0);
+}
+
+static void
+ld_ (program *p, int size, int dest, int src, uint16_t w1, uint16_t w2)
+{
+	emit_(p, (size << 14) | 0x1000 | (dest << 6) | src, w1, w2);
+}
+
+static void
+build_alu_ (program *p)
+{
+	int pass, size, operation;
+
+	for (pass = 0; pass < PASSES; pass++)
+	{
+		for (size = SIZE_8; size <= SIZE_24; size++)
+		{
+			for (operation = OP_ADD; operation <= OP_CP; operation++)
+			{
+				int reg = (p->count + operation) & 7;
+
+				alu_(p, size, operation, reg, RM_REG((reg + 3) & 7));
+				alu_(p, size, operation, (reg + 1) & 7, RM_SFI((operation * 5 + size) & 0xf));
+				alu_imm_(p, size, operation, RM_REG((reg + 2) & 7), 0x1234 + operation * 0x0f0f);
+			}
+			// Memory destinations
+			alu_imm_(p, size, OP_ADD, RM_IND(size), 0x0101 * (pass + 3));
+			alu_imm_(p, size, OP_XOR, RM_IND(size + 3), 0x5a5a);
+		}
+	}
+}
+
+// Memory destinations are written wherever the access before them went, and PGC relative operands go to the code, so
+// those come first, with reads of the data area after them; see pilot-workload
+static void
+build_ld_rm_ (program *p)
+{
+	int pass, size;
+
+	for (pass = 0; pass < PASSES; pass++)
+	{
+		for (size = SIZE_8; size <= SIZE_24; size++)
+		{
+			int data = 5 + size;
+
+			ld_(p, size, RM_REG(data), RM_PGC16, 0x0400, 0);
+			ld_(p, size, RM_REG(data), RM_PGC24, 0x0400, 0);
+			ld_(p, size, RM_PGC16, RM_REG(data), 0x0400, 0);
+
+			ld_(p, size, RM_REG(data), RM_REG(5 + (size + 1) % 3), 0, 0);
+			ld_(p, size, RM_REG(data), RM_SFI(size + 1), 0, 0);
+			ld_(p, size, RM_REG(data), RM_IND(0), 0, 0);
+			ld_(p, size, RM_REG(data), RM_POSTINC(1), 0, 0);
+			ld_(p, size, RM_REG(data), RM_PREDEC(1), 0, 0);
+			ld_(p, size, RM_REG(data), RM_REL(2), 0, 0);
+			ld_(p, size, RM_REG(data), RM_INDEXED, INDEX_WORD(3, 4, SIZE_8), 0);
+			ld_(p, size, RM_REG(data), RM_ABS_INDEXED, (LD_DATA + 0x400) & 0xffff,
+				INDEX_WORD(0, 4, SIZE_16) | ((LD_DATA + 0x400) >> 16));
+			ld_(p, size, RM_REG(data), RM_ABS16, 0, 0);
+			ld_(p, size, RM_REG(data), RM_ABS24, 0, 0);
+			ld_(p, size, RM_REG(data), RM_IMM16, 0, 0);
+			ld_(p, size, RM_REG(data), RM_IMM24, 0, 0);
+
+			ld_(p, size, RM_IND(0), RM_REG(data), 0, 0);
+			ld_(p, size, RM_POSTINC(1), RM_REG(data), 0, 0);
+			ld_(p, size, RM_PREDEC(1), RM_REG(data), 0, 0);
+			ld_(p, size, RM_INDEXED, RM_REG(data), INDEX_WORD(3, 4, SIZE_8), 0);
+
+			ld_(p, size, RM_IND(0), RM_POSTINC(1), 0, 0);
+			ld_(p, size, RM_PREDEC(1), RM_IND(2), 0, 0);
+		}
+	}
+}
+
+static void
+build_copy_ (program *p)
+{
+	int i;
+
+	for (i = 0; i < COPY_WORDS; i++)
+	{
+		ld_(p, SIZE_16, RM_POSTINC(1), RM_POSTINC(0), 0, 0);
+	}
+}
+
+typedef struct
+{
+	const char *name;
+	void (*build) (program *p);
+	uint32_t regs[8];
+	// Memory destinations write MDR to MAR as the access before them left them, which mostly puts back what was just
+	// read; only the ALU program's first one, with MDR as the reset left it, changes anything
+	bool changes_memory;
+} test_program;
+
+static const test_program programs_[] =
+{
+	{ "alu", build_alu_, { 0x000003, 0x000014, 0x000025, 0x000036, 0x000047, 0x000058, 0x123456, 0xfedcba }, TRUE },
+	{ "ld_rm", build_ld_rm_, { LD_DATA + 0x0800, LD_DATA + 0x0900, LD_DATA + 0x0a00, LD_DATA + 0x0b00, 0x20 }, FALSE },
+	{ "copy", build_copy_, { COPY_SRC, COPY_DEST }, FALSE },
+};
+
+#define PROGRAMS (sizeof(programs_) / sizeof(programs_[0]))
+
+// Data for every program to read, the same each run; after test_load, as the reset clears memory
+static void
+fill_wram_ (Pilot_system *sys)
+{
+	uint32_t i;
+
+	for (i = 0; i < sizeof(sys->wram); i++)
+	{
+		sys->wram[i] = (uint8_t)(i * 13 + 5);
+	}
+}
+
+int
+main (void)
+{
+	const test_engine *interp = &test_engines[1];
+	const test_engine *jit = &test_engines[TEST_ENGINES - 1];
+	size_t i;
+
+	for (i = 0; i < PROGRAMS; i++)
+	{
+		const test_program *t = &programs_[i];
+		static program p;
+		static uint8_t wram[0x8000];
+		Pilot_system *ref = test_create(interp);
+		Pilot_system *sys = test_create(jit);
+		Pilot_jit_stats stats;
+		Pilot_run_status status;
+		uint64_t start, cycles;
+		uint32_t end;
+
+		if (!sys)
+		{
+			printf("jit_lockstep: skipped\n");
+			Pilot_system_destroy(ref);
+			return 0;
+		}
+		memset(&p, 0, sizeof(p));
+		t->build(&p);
+		TEST_CHECK(!p.bad, "%s: program doesn't assemble", t->name);
+
+		// The interpreter's run says how many cycles the program takes
+		end = test_load(ref, interp, p.words, p.count, t->regs);
+		fill_wram_(ref);
+		memcpy(wram, ref->wram, sizeof(wram));
+		start = ref->cycles;
+		TEST_CHECK(test_run_to(ref, end), "%s: the interpreter didn't reach the end", t->name);
+		cycles = ref->cycles - start;
+		TEST_CHECK(!t->changes_memory || memcmp(ref->wram, wram, sizeof(wram)), "%s: memory didn't change", t->name);
+
+		test_load(sys, jit, p.words, p.count, t->regs);
+		fill_wram_(sys);
+		Pilot_jit_set_lockstep(sys, TRUE);
+		start = sys->cycles;
+		status = Pilot_run_cycles(sys, cycles);
+		stats = Pilot_jit_get_stats(sys);
+
+		TEST_CHECK(status == PILOT_RUN_DONE, "%s: run ended with status %d", t->name, status);
+		TEST_CHECK(stats.lockstep_blocks > 0, "%s: no blocks ran in lockstep", t->name);
+		TEST_CHECK(stats.lockstep_mismatches == 0, "%s: %llu blocks disagreed with the interpreter", t->name,
+			(unsigned long long)stats.lockstep_mismatches);
+		TEST_CHECK(sys->cycles - start == cycles && sys->core.pgc == end, "%s: ran %llu cycles to %06x, not %llu to %06x",
+			t->name, (unsigned long long)(sys->cycles - start), sys->core.pgc, (unsigned long long)cycles, end);
+		TEST_CHECK(!memcmp(sys->core.regs, ref->core.regs, sizeof(ref->core.regs)), "%s: registers differ", t->name);
+		TEST_CHECK(!memcmp(sys->wram, ref->wram, sizeof(ref->wram)), "%s: WRAM differs", t->name);
+		TEST_CHECK(!memcmp(sys->vram, ref->vram, sizeof(ref->vram)), "%s: VRAM differs", t->name);
+
+		Pilot_system_destroy(sys);
+		Pilot_system_destroy(ref);
+	}
+	return test_report("jit_lockstep");
+}
@@ -0,0 +1,232 @@
+#include "test_common.h"
+#include "clone.h"
+
+/*
+ * Bulk copies and fills
+ *
+ * Pilot_mem_copy_sync and Pilot_mem_fill_sync have to leave the system exactly as the same reads and writes done a
+ * word at a time would. Each case runs both ways on two systems set up alike, and compares the cycles taken, memory as
+ * the bus sees it, page flags, dirty page bits, code page generations, and for copy-on-write, the pages copied back
+ * and what the clone still sees. The cases cover the memmove and memset fast paths, the word loop for overlapping
+ * copies and handler-backed pages, wait states, and wrapping past the top of memory.
+ */
+
+typedef enum
+{
+	FLAGS_NONE,
+	FLAGS_DIRTY,
+	FLAGS_CODE,
+	FLAGS_COW,
+	FLAGS_MODES
+} flags_mode;
+
+static const char *const flags_names_[FLAGS_MODES] = { "no flags", "dirty", "code", "cow" };
+
+typedef struct
+{
+	const char *name;
+	bool fill;
+	uint32_t dest;
+	uint32_t src;
+	uint16_t data;
+	uint32_t words;
+} bulk_case;
+
+// The upper half of VRAM gets wait states
+#define SLOW_VRAM_START (VRAM_START + 0x4000)
+#define SLOW_VRAM_WAIT  3
+
+static const bulk_case cases_[] =
+{
+	{ "copy across pages", FALSE, WRAM_START + 0x3f6, WRAM_START + 0x1232, 0, 700 },
+	{ "copy to an overlapping range above", FALSE, WRAM_START + 0x2010, WRAM_START + 0x2000, 0, 600 },
+	{ "copy to an overlapping range below", FALSE, WRAM_START + 0x2000, WRAM_START + 0x2010, 0, 600 },
+	{ "copy into wait states", FALSE, SLOW_VRAM_START - 0x100, WRAM_START + 0x0802, 0, 900 },
+	{ "copy from open bus into OAM", FALSE, OAM_START + 0x10, CART_CS1_START, 0, 100 },
+	{ "copy wrapping past the top of memory", FALSE, WRAM_START + 0x100, HRAM_END + 1 - 0x100, 0, 300 },
+	{ "fill with equal bytes", TRUE, WRAM_START + 0x7f0, 0, 0x5a5a, 1500 },
+	{ "fill with different bytes", TRUE, VRAM_START + 0x3ff0, 0, 0x1234, 1500 },
+	{ "fill OAM", TRUE, OAM_START, 0, 0xa55a, 0x140 },
+};
+
+#define CASES (sizeof(cases_) / sizeof(cases_[0]))
+
+// RAM as the bus sees it; everything but HCIO, which has side effects
+static const uint32_t ram_ranges_[][2] =
+{
+	{ WRAM_START, VRAM_END },
+	{ TMRAM_START, TMRAM_END },
+	{ OAM_START, OAM_END },
+	{ HRAM_START, HRAM_END },
+};
+
+#define RAM_RANGES (sizeof(ram_ranges_) / sizeof(ram_ranges_[0]))
+
+static void
+pattern_ (uint8_t *mem, size_t size, uint8_t seed)
+{
+	size_t i;
+	for (i = 0; i < size; i++)
+	{
+		mem[i] = (uint8_t)(i * 7 + (i >> 8) * 13 + seed);
+	}
+}
+
+static Pilot_system *
+setup_ (const bulk_case *c, flags_mode mode, Pilot_system **clone)
+{
+	Pilot_system *sys = Pilot_system_create();
+	uint32_t page;
+	uint32_t first = c->dest >> PILOT_MEM_PAGE_SHIFT;
+	uint32_t last = ((c->dest + c->words * 2 - 1) & 0xffffff) >> PILOT_MEM_PAGE_SHIFT;
+
+	Pilot_block_cache_enable(sys, 1024);
+	Pilot_system_reset(sys);
+	pattern_(sys->wram, sizeof(sys->wram), 1);
+	pattern_(sys->vram, sizeof(sys->vram), 2);
+	pattern_(sys->tmram, sizeof(sys->tmram), 3);
+	pattern_(sys->oam, sizeof(sys->oam), 4);
+	pattern_(sys->hram, sizeof(sys->hram), 5);
+	Pilot_mem_map_direct(sys, SLOW_VRAM_START, VRAM_END, sys->vram + (SLOW_VRAM_START - VRAM_START),
+		sys->vram + (SLOW_VRAM_START - VRAM_START), SLOW_VRAM_WAIT);
+
+	*clone = NULL;
+	switch (mode)
+	{
+		case FLAGS_DIRTY:
+			for (page = 0; page < PILOT_MEM_PAGES; page++)
+			{
+				pilot_mem_track_writes(sys, page);
+			}
+			break;
+		case FLAGS_CODE:
+			// Every other destination page, so spans with and without the flag meet
+			for (page = first; ; page = (page + 1) & (PILOT_MEM_PAGES - 1))
+			{
+				if (!(page & 1) && sys->mem_pages[page].read)
+				{
+					pilot_mem_flag_page(sys, page, PILOT_PAGE_CODE);
+				}
+				if (page == last)
+				{
+					break;
+				}
+			}
+			break;
+		case FLAGS_COW:
+			*clone = Pilot_system_clone(sys);
+			break;
+		default:
+			break;
+	}
+	return sys;
+}
+
+static bool
+same_ram_ (Pilot_system *a, Pilot_system *b)
+{
+	size_t r;
+	uint32_t addr;
+
+	for (r = 0; r < RAM_RANGES; r++)
+	{
+		for (addr = ram_ranges_[r][0]; addr < ram_ranges_[r][1]; addr += 2)
+		{
+			uint16_t x, y;
+			Pilot_mem_read_sync(a, addr, &x);
+			Pilot_mem_read_sync(b, addr, &y);
+			if (x != y)
+			{
+				printf("  %06x: %04x, not %04x\n", addr, y, x);
+				return FALSE;
+			}
+		}
+	}
+	return TRUE;
+}
+
+static bool
+same_flags_ (const Pilot_system *a, const Pilot_system *b)
+{
+	uint32_t page;
+
+	for (page = 0; page < PILOT_MEM_PAGES; page++)
+	{
+		if (a->mem_pages[page].flags != b->mem_pages[page].flags)
+		{
+			printf("  page %u: flags %x, not %x\n", page, b->mem_pages[page].flags, a->mem_pages[page].flags);
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+int
+main (void)
+{
+	size_t i;
+	int mode;
+
+	for (i = 0; i < CASES; i++)
+	{
+		const bulk_case *c = &cases_[i];
+
+		for (mode = 0; mode < FLAGS_MODES; mode++)
+		{
+			Pilot_system *ref_clone, *bulk_clone;
+			Pilot_system *ref = setup_(c, mode, &ref_clone);
+			Pilot_system *bulk = setup_(c, mode, &bulk_clone);
+			unsigned ref_cycles = 0, bulk_cycles;
+			uint32_t w;
+
+			for (w = 0; w < c->words; w++)
+			{
+				uint16_t data = c->data;
+				if (!c->fill)
+				{
+					ref_cycles += Pilot_mem_read_sync(ref, (c->src + w * 2) & 0xffffff, &data);
+				}
+				ref_cycles += Pilot_mem_write_sync(ref, (c->dest + w * 2) & 0xffffff, data);
+			}
+			bulk_cycles = c->fill ? Pilot_mem_fill_sync(bulk, c->dest, c->data, c->words)
+				: Pilot_mem_copy_sync(bulk, c->dest, c->src, c->words);
+
+			TEST_CHECK(bulk_cycles == ref_cycles, "%s, %s: %u cycles, not %u", c->name, flags_names_[mode], bulk_cycles,
+				ref_cycles);
+			TEST_CHECK(same_ram_(ref, bulk), "%s, %s: memory differs", c->name, flags_names_[mode]);
+			TEST_CHECK(same_flags_(ref, bulk), "%s, %s: page flags differ", c->name, flags_names_[mode]);
+			TEST_CHECK(!memcmp(ref->dirty_pages, bulk->dirty_pages, sizeof(ref->dirty_pages)),
+				"%s, %s: dirty pages differ", c->name, flags_names_[mode]);
+			TEST_CHECK(!memcmp(ref->block_cache->page_gen, bulk->block_cache->page_gen,
+				sizeof(ref->block_cache->page_gen)), "%s, %s: code page generations differ", c->name, flags_names_[mode]);
+			if (mode == FLAGS_COW)
+			{
+				TEST_CHECK(ref_clone && bulk_clone, "%s: clone failed", c->name);
+				TEST_CHECK(ref->cow->pages_copied == bulk->cow->pages_copied, "%s, cow: %llu pages copied, not %llu",
+					c->name, (unsigned long long)bulk->cow->pages_copied, (unsigned long long)ref->cow->pages_copied);
+				if (ref_clone && bulk_clone)
+				{
+					Pilot_system *dummy;
+					Pilot_system *untouched = setup_(c, FLAGS_NONE, &dummy);
+
+					TEST_CHECK(same_ram_(untouched, ref_clone), "%s, cow: writes showed through to a clone", c->name);
+					TEST_CHECK(same_ram_(untouched, bulk_clone), "%s, cow: bulk writes showed through to a clone",
+						c->name);
+					Pilot_system_destroy(untouched);
+				}
+			}
+
+			if (ref_clone)
+			{
+				Pilot_system_destroy(ref_clone);
+			}
+			if (bulk_clone)
+			{
+				Pilot_system_destroy(bulk_clone);
+			}
+			Pilot_system_destroy(ref);
+			Pilot_system_destroy(bulk);
+		}
+	}
+	return test_report("mem_bulk");
+}
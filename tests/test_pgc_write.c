@@ -0,0 +1,48 @@
+#include "test_common.h"
+#include "cpu_decode.h"
+#include "cpu_execute.h"
+
+/*
+ * PGC writes
+ *
+ * The instruction-level engines only step PGC past an instruction that didn't write it, so an instruction that writes
+ * PGC back to its own address (a branch to self) has to be told apart from one that leaves PGC alone. Nothing the
+ * decoder produces writes PGC yet, so the instruction here is put together by hand: PGC = 0 | PGC.
+ */
+
+#define CP_8_R0_R0 0x28c0
+
+int
+main (void)
+{
+	Pilot_system *sys = Pilot_system_create();
+	inst_decoded_flags inst;
+	execute_control_word *op = &inst.core_op;
+
+	Pilot_system_reset(sys);
+	sys->core.pgc = TEST_CODE_START;
+
+	memset(&inst, 0, sizeof(inst));
+	pilot_decode_latch_template(&inst, pilot_decode_template(CP_8_R0_R0));
+	inst.imm_words[0] = CP_8_R0_R0;
+	inst.inst_pgc = TEST_CODE_START;
+	pilot_execute_run_inst(&sys->execute, &inst);
+	TEST_CHECK(!sys->execute.pgc_written, "CP wrote PGC");
+
+	ECW_SRC_SET(*op, 0, LOCATION, DATA_ZERO);
+	ECW_SRC_SET(*op, 1, LOCATION, DATA_REG_PGC);
+	ECW_SRC_SET(*op, 0, SIZE, SIZE_24_BIT);
+	ECW_SRC_SET(*op, 1, SIZE, SIZE_24_BIT);
+	ECW_SET(*op, OPERATION, ALU_OR);
+	ECW_SET(*op, SRC2_NEGATE, FALSE);
+	ECW_SET(*op, SRC2_ADD_CARRY, FALSE);
+	ECW_SET(*op, FLAG_WRITE_MASK, 0);
+	ECW_SET(*op, DEST, DATA_REG_PGC);
+	pilot_execute_select_alu_kernel(op);
+	pilot_execute_run_inst(&sys->execute, &inst);
+	TEST_CHECK(sys->execute.pgc_written, "PGC = PGC didn't count as writing PGC");
+	TEST_CHECK(sys->core.pgc == TEST_CODE_START, "PGC = PGC moved PGC to %06x", sys->core.pgc);
+
+	Pilot_system_destroy(sys);
+	return test_report("pgc_write");
+}
@@ -0,0 +1,60 @@
+#include "test_common.h"
+#include "scheduler.h"
+
+/*
+ * The cycle count across a reset
+ *
+ * Pilot_system_reset leaves sys->cycles alone, so it only ever counts up: event deadlines, replay records and rewind
+ * snapshots are all absolute cycle counts, and stay meaningful across a reset. A deadline set before the reset has to
+ * come due at the same cycle after it.
+ */
+
+#define CP_8_R0_R0 0x28c0
+#define PROGRAM_WORDS 512
+#define TEST_EVENT ((Pilot_event_id)(PILOT_EVENTS_MAX - 1))
+
+static uint64_t fired_at;
+
+static void
+event_ (Pilot_system *sys, Pilot_event_id id)
+{
+	(void)id;
+	fired_at = sys->cycles;
+}
+
+int
+main (void)
+{
+	static const uint32_t regs[8];
+	const test_engine *e = &test_engines[1];
+	Pilot_system *sys = test_create(e);
+	uint16_t code[PROGRAM_WORDS];
+	uint64_t before, when;
+	int i;
+
+	for (i = 0; i < PROGRAM_WORDS; i++)
+	{
+		code[i] = CP_8_R0_R0;
+	}
+	test_load(sys, e, code, PROGRAM_WORDS, regs);
+	Pilot_event_set_handler(sys, TEST_EVENT, event_);
+
+	Pilot_run_cycles(sys, 40);
+	before = sys->cycles;
+	TEST_CHECK(before == 40, "ran %llu cycles, not 40", (unsigned long long)before);
+	when = before + 100;
+	Pilot_event_schedule(sys, TEST_EVENT, when);
+
+	Pilot_system_reset(sys);
+	TEST_CHECK(sys->cycles == before, "reset moved the cycle count from %llu to %llu", (unsigned long long)before,
+		(unsigned long long)sys->cycles);
+
+	sys->core.pgc = TEST_CODE_START;
+	Pilot_run_cycles(sys, 200);
+	TEST_CHECK(sys->cycles == before + 200, "ran to cycle %llu", (unsigned long long)sys->cycles);
+	TEST_CHECK(fired_at == when, "event due at %llu came at %llu", (unsigned long long)when,
+		(unsigned long long)fired_at);
+
+	Pilot_system_destroy(sys);
+	return test_report("reset_cycles");
+}
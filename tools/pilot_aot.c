@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "system.h"
+#include "cartridge.h"
+#include "cpu_aot.h"
+
+/*
+ * Static recompiler front end
+ *
+ *     pilot_aot rom.bin rom_aot.c [entry ...]
+ *
+ * Entry points are bus addresses, CART_ROM_START if none are given. See cpu_aot.h for building and loading the
+ * output.
+ */
+int
+main (int argc, char **argv)
+{
+	Pilot_system *sys;
+	uint32_t *entries;
+	FILE *out;
+	int count;
+	int i;
+
+	if (argc < 3)
+	{
+		fprintf(stderr, "usage: %s rom.bin out.c [entry ...]\n", argv[0]);
+		return 2;
+	}
+
+	sys = Pilot_system_create();
+	entries = calloc(argc, sizeof(*entries));
+	if (!sys || !entries)
+	{
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	if (!Pilot_cart_load(sys, argv[1]))
+	{
+		fprintf(stderr, "%s: can't load\n", argv[1]);
+		return 1;
+	}
+	for (i = 3; i < argc; i++)
+	{
+		entries[i - 3] = strtoul(argv[i], NULL, 0);
+	}
+
+	out = fopen(argv[2], "w");
+	if (!out)
+	{
+		fprintf(stderr, "%s: can't open\n", argv[2]);
+		return 1;
+	}
+	count = Pilot_aot_compile(sys, out, entries, argc - 3);
+	if (fclose(out) != 0 || count < 0)
+	{
+		fprintf(stderr, "%s: can't write\n", argv[2]);
+		return 1;
+	}
+	printf("%d blocks\n", count);
+
+	free(entries);
+	Pilot_system_destroy(sys);
+	return 0;
+}
@@ -0,0 +1,449 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "system.h"
+#include "memory.h"
+#include "block_cache.h"
+#include "cpu_decode.h"
+#include "cpu_execute.h"
+#include "cpu_jit.h"
+
+/*
+ * Micro-benchmarks for the CPU core
+ *
+ *     pilot-bench [-r reps] [-j out.json] [prefix ...]
+ *
+ * Each benchmark times a fixed batch of operations on a fresh system: one batch to warm up, then reps more (11 by
+ * default). The median and fastest batches are printed in ns per operation and, with -j, written out as JSON for
+ * diffing between builds. Only benchmarks whose names start with one of the prefixes are run, if any are given.
+ */
+
+#define BENCH_REPS_DEFAULT 11
+#define BENCH_DECODE_PASSES 16
+#define BENCH_MUCODE_PASSES 256
+#define BENCH_ALU_BATCH 200000
+#define BENCH_MEM_BATCH 200000
+// The program fills WRAM and VRAM, and no instruction takes less than a cycle per word, so runs of this many cycles
+// never leave it
+#define BENCH_CORE_CYCLES 16384
+#define BENCH_CORE_BATCH 8
+
+typedef struct bench bench;
+struct bench
+{
+	const char *name;
+	// What one operation is
+	const char *unit;
+	// Prepares a fresh system; returns FALSE to skip the benchmark
+	bool (*setup) (Pilot_system *sys, const bench *b);
+	// Runs one batch, returning the number of operations done
+	uint64_t (*run) (Pilot_system *sys, const bench *b);
+	uint32_t arg[2];
+};
+
+typedef struct
+{
+	const bench *b;
+	uint64_t ops;
+	double median;
+	double fastest;
+} bench_result;
+
+// Keeps results the compiler would otherwise see as unused
+static volatile uint32_t bench_sink_;
+
+static uint64_t
+bench_now_ns_ (void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static int
+bench_compare_ (const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+// Decoding: template lookup and latching, the decode stage's per-instruction work, over every opcode word
+static uint64_t
+bench_decode_run_ (Pilot_system *sys, const bench *b)
+{
+	inst_decoded_flags inst;
+	uint32_t sink = 0;
+	int pass;
+	uint32_t op;
+
+	(void)sys;
+	(void)b;
+	memset(&inst, 0, sizeof(inst));
+	for (pass = 0; pass < BENCH_DECODE_PASSES; pass++)
+	{
+		for (op = 0; op < 0x10000; op++)
+		{
+			const decode_template *t = pilot_decode_template(op);
+			pilot_decode_latch_template(&inst, t);
+			sink += (uint32_t)inst.core_op + t->extra_words;
+		}
+	}
+	bench_sink_ = sink;
+	return BENCH_DECODE_PASSES * 0x10000;
+}
+
+// Building microcode entries, over every spec the microcode ROM holds
+static uint64_t
+bench_mucode_run_ (Pilot_system *sys, const bench *b)
+{
+	uint32_t sink = 0;
+	uint64_t ops = 0;
+	int pass;
+	int entry_idx;
+	int reg_select;
+	int size;
+	int is_write;
+
+	(void)sys;
+	(void)b;
+	for (pass = 0; pass < BENCH_MUCODE_PASSES; pass++)
+	{
+		for (entry_idx = MU_NONE + 1; entry_idx <= MU_POST_AUTOIDX; entry_idx++)
+		{
+			for (reg_select = 0; reg_select < 0x20; reg_select++)
+			{
+				for (size = SIZE_8_BIT; size <= SIZE_24_BIT; size++)
+				{
+					for (is_write = FALSE; is_write <= TRUE; is_write++)
+					{
+						mucode_entry_spec spec = { entry_idx, reg_select, size, is_write };
+						mucode_entry entry = decode_mucode_entry(spec);
+						sink += (uint32_t)entry.operation + entry.next.entry_idx;
+						ops++;
+					}
+				}
+			}
+		}
+	}
+	bench_sink_ = sink;
+	return ops;
+}
+
+// One flag-setting ALU control word between registers; arg[0] is the operation, arg[1] the size
+static inst_decoded_flags bench_alu_inst_;
+
+static bool
+bench_alu_setup_ (Pilot_system *sys, const bench *b)
+{
+	int i;
+
+	(void)b;
+	for (i = 0; i < 8; i++)
+	{
+		sys->core.regs[i] = 0x123456 * (i + 1);
+	}
+	sys->execute.decoded_inst = &bench_alu_inst_;
+	return TRUE;
+}
+
+static uint64_t
+bench_alu_run_ (Pilot_system *sys, const bench *b)
+{
+	execute_control_word ctl = 0;
+	uint32_t i;
+
+	ECW_SRC_SET(ctl, 0, LOCATION, DATA_REG_P0);
+	ECW_SRC_SET(ctl, 0, SIZE, b->arg[1]);
+	ECW_SRC_SET(ctl, 1, LOCATION, DATA_REG_P1);
+	ECW_SRC_SET(ctl, 1, SIZE, b->arg[1]);
+	ECW_SET(ctl, DEST, DATA_REG_P0);
+	ECW_SET(ctl, OPERATION, b->arg[0]);
+	ECW_SET(ctl, FLAG_WRITE_MASK, F_NEG | F_ZERO | F_OVERFLOW | F_CARRY | F_EXTEND);
+	ECW_SET(ctl, MEM_ACCESS_SUPPRESS, TRUE);
+	pilot_execute_select_alu_kernel(&ctl);
+
+	for (i = 0; i < BENCH_ALU_BATCH; i++)
+	{
+		pilot_execute_run_control(&sys->execute, &ctl);
+	}
+	pilot_execute_materialize_flags(&sys->core);
+	bench_sink_ = sys->core.regs[0] + sys->core.wf;
+	return BENCH_ALU_BATCH;
+}
+
+// Word reads through the memory map; arg[0] is the start of the region, arg[1] its size
+static uint64_t
+bench_mem_run_ (Pilot_system *sys, const bench *b)
+{
+	uint32_t sink = 0;
+	uint32_t i;
+
+	for (i = 0; i < BENCH_MEM_BATCH; i++)
+	{
+		uint16_t data;
+		Pilot_mem_read_sync(sys, b->arg[0] + ((i * 2) % b->arg[1]), &data);
+		sink += data;
+	}
+	bench_sink_ = sink;
+	return BENCH_MEM_BATCH;
+}
+
+/*
+ * Whole-core runs over a synthetic instruction stream: a 64-instruction body of register-only, one-word ALU and LD
+ * instructions, picked evenly from the opcode space and repeated through WRAM and VRAM. There are no branches to
+ * loop with, so each run starts over from the top. arg[0] is the engine; arg[1] enables the block cache.
+ */
+#define BENCH_BODY_INSTS 64
+
+static bool
+bench_core_qualifies_ (uint16_t op)
+{
+	const decode_template *t = pilot_decode_template(op);
+	return t->status == DECODE_OK && t->extra_words == 0 && op < 0xe000
+		&& t->override_op.entry_idx == MU_NONE && t->run_before.entry_idx == MU_NONE
+		&& t->run_after.entry_idx == MU_NONE && ECW_GET(t->core_op, MEM_LATCH_CTL) == MEM_NO_LATCH
+		&& ECW_GET(t->core_op, DEST) != DATA_REG_PGC;
+}
+
+static bool
+bench_core_setup_ (Pilot_system *sys, const bench *b)
+{
+	uint16_t body[BENCH_BODY_INSTS];
+	uint32_t op = 0;
+	int count = 0;
+	uint32_t addr;
+
+	while (count < BENCH_BODY_INSTS && op < 0x10000)
+	{
+		if (bench_core_qualifies_(op))
+		{
+			body[count++] = op;
+			op += 0xe000 / BENCH_BODY_INSTS;
+		}
+		else
+		{
+			op++;
+		}
+	}
+	if (!count)
+	{
+		return FALSE;
+	}
+	for (addr = WRAM_START; addr <= VRAM_END; addr += 2)
+	{
+		uint16_t word = body[(addr / 2) % count];
+		uint8_t *host = (addr <= WRAM_END) ? &sys->wram[addr - WRAM_START] : &sys->vram[addr - VRAM_START];
+		host[0] = word & 0xff;
+		host[1] = word >> 8;
+	}
+
+	if (b->arg[0] == PILOT_ENGINE_JIT)
+	{
+		if (!Pilot_jit_enable(sys, 1 << 22))
+		{
+			return FALSE;
+		}
+	}
+	else if (b->arg[1] && !Pilot_block_cache_enable(sys, 4096))
+	{
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static uint64_t
+bench_core_run_ (Pilot_system *sys, const bench *b)
+{
+	uint64_t start = sys->cycles;
+	int i;
+
+	for (i = 0; i < BENCH_CORE_BATCH; i++)
+	{
+		// Passing through the interpreter is the way to repoint the pipeline's fetch
+		Pilot_set_engine(sys, PILOT_ENGINE_INTERP);
+		Pilot_system_reset(sys);
+		sys->core.pgc = WRAM_START;
+		Pilot_set_engine(sys, b->arg[0]);
+		Pilot_run_cycles(sys, BENCH_CORE_CYCLES);
+	}
+	return sys->cycles - start;
+}
+
+static const bench benches_[] =
+{
+	{ "decode/template", "opcode", NULL, bench_decode_run_, { 0, 0 } },
+	{ "decode/mucode_entry", "entry", NULL, bench_mucode_run_, { 0, 0 } },
+
+	{ "alu/add/8", "op", bench_alu_setup_, bench_alu_run_, { ALU_ADD, SIZE_8_BIT } },
+	{ "alu/add/16", "op", bench_alu_setup_, bench_alu_run_, { ALU_ADD, SIZE_16_BIT } },
+	{ "alu/add/24", "op", bench_alu_setup_, bench_alu_run_, { ALU_ADD, SIZE_24_BIT } },
+	{ "alu/and/8", "op", bench_alu_setup_, bench_alu_run_, { ALU_AND, SIZE_8_BIT } },
+	{ "alu/and/16", "op", bench_alu_setup_, bench_alu_run_, { ALU_AND, SIZE_16_BIT } },
+	{ "alu/and/24", "op", bench_alu_setup_, bench_alu_run_, { ALU_AND, SIZE_24_BIT } },
+	{ "alu/or/8", "op", bench_alu_setup_, bench_alu_run_, { ALU_OR, SIZE_8_BIT } },
+	{ "alu/or/16", "op", bench_alu_setup_, bench_alu_run_, { ALU_OR, SIZE_16_BIT } },
+	{ "alu/or/24", "op", bench_alu_setup_, bench_alu_run_, { ALU_OR, SIZE_24_BIT } },
+	{ "alu/xor/8", "op", bench_alu_setup_, bench_alu_run_, { ALU_XOR, SIZE_8_BIT } },
+	{ "alu/xor/16", "op", bench_alu_setup_, bench_alu_run_, { ALU_XOR, SIZE_16_BIT } },
+	{ "alu/xor/24", "op", bench_alu_setup_, bench_alu_run_, { ALU_XOR, SIZE_24_BIT } },
+
+	{ "mem_read/wram", "access", NULL, bench_mem_run_, { WRAM_START, 0x8000 } },
+	{ "mem_read/vram", "access", NULL, bench_mem_run_, { VRAM_START, 0x8000 } },
+	{ "mem_read/cart_rom", "access", NULL, bench_mem_run_, { CART_ROM_START, 0x8000 } },
+	{ "mem_read/tmram", "access", NULL, bench_mem_run_, { TMRAM_START, 0x1000 } },
+	{ "mem_read/oam_hcio", "access", NULL, bench_mem_run_, { OAM_START, 0x400 } },
+	{ "mem_read/hram", "access", NULL, bench_mem_run_, { HRAM_START, 0xc00 } },
+
+	{ "core/pipeline", "cycle", bench_core_setup_, bench_core_run_, { PILOT_ENGINE_PIPELINE, FALSE } },
+	{ "core/interp", "cycle", bench_core_setup_, bench_core_run_, { PILOT_ENGINE_INTERP, FALSE } },
+	{ "core/interp_cached", "cycle", bench_core_setup_, bench_core_run_, { PILOT_ENGINE_INTERP, TRUE } },
+	{ "core/jit", "cycle", bench_core_setup_, bench_core_run_, { PILOT_ENGINE_JIT, TRUE } },
+};
+
+#define BENCH_COUNT (sizeof(benches_) / sizeof(benches_[0]))
+
+// Returns FALSE if the benchmark was skipped
+static bool
+bench_run_ (const bench *b, int reps, double *times, bench_result *result)
+{
+	Pilot_system *sys = Pilot_system_create();
+	int i;
+
+	if (!sys)
+	{
+		return FALSE;
+	}
+	Pilot_system_reset(sys);
+	if (b->setup && !b->setup(sys, b))
+	{
+		Pilot_system_destroy(sys);
+		return FALSE;
+	}
+
+	b->run(sys, b);
+	for (i = 0; i < reps; i++)
+	{
+		uint64_t start = bench_now_ns_();
+		uint64_t ops = b->run(sys, b);
+		times[i] = (double)(bench_now_ns_() - start) / (ops ? ops : 1);
+		result->ops = ops;
+	}
+	qsort(times, reps, sizeof(*times), bench_compare_);
+	result->b = b;
+	result->median = times[reps / 2];
+	result->fastest = times[0];
+
+	Pilot_system_destroy(sys);
+	return TRUE;
+}
+
+static bool
+bench_selected_ (const bench *b, int argc, char **argv, int first)
+{
+	int i;
+	if (first >= argc)
+	{
+		return TRUE;
+	}
+	for (i = first; i < argc; i++)
+	{
+		if (!strncmp(b->name, argv[i], strlen(argv[i])))
+		{
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+static void
+bench_write_json_ (FILE *out, const bench_result *results, int count, int reps)
+{
+	int i;
+	fprintf(out, "{\n\t\"reps\": %d,\n\t\"benchmarks\": [\n", reps);
+	for (i = 0; i < count; i++)
+	{
+		const bench_result *r = &results[i];
+		fprintf(out, "\t\t{ \"name\": \"%s\", \"unit\": \"%s\", \"ops\": %llu, \"ns_per_op\": %.3f, "
+			"\"fastest_ns_per_op\": %.3f }%s\n", r->b->name, r->b->unit, (unsigned long long)r->ops, r->median,
+			r->fastest, (i + 1 < count) ? "," : "");
+	}
+	fprintf(out, "\t]\n}\n");
+}
+
+int
+main (int argc, char **argv)
+{
+	bench_result results[BENCH_COUNT];
+	const char *json_path = NULL;
+	int reps = BENCH_REPS_DEFAULT;
+	double *times;
+	int count = 0;
+	int first = 1;
+	size_t i;
+
+	while (first < argc && argv[first][0] == '-')
+	{
+		if (!strcmp(argv[first], "-r") && first + 1 < argc)
+		{
+			reps = atoi(argv[first + 1]);
+		}
+		else if (!strcmp(argv[first], "-j") && first + 1 < argc)
+		{
+			json_path = argv[first + 1];
+		}
+		else
+		{
+			fprintf(stderr, "usage: %s [-r reps] [-j out.json] [prefix ...]\n", argv[0]);
+			return 2;
+		}
+		first += 2;
+	}
+	if (reps < 1)
+	{
+		reps = 1;
+	}
+	times = calloc(reps, sizeof(*times));
+	if (!times)
+	{
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	printf("%-24s %14s %14s\n", "benchmark", "ns/op", "fastest");
+	for (i = 0; i < BENCH_COUNT; i++)
+	{
+		const bench *b = &benches_[i];
+		if (!bench_selected_(b, argc, argv, first))
+		{
+			continue;
+		}
+		if (!bench_run_(b, reps, times, &results[count]))
+		{
+			printf("%-24s %14s\n", b->name, "skipped");
+			continue;
+		}
+		printf("%-24s %14.3f %14.3f  (per %s)\n", b->name, results[count].median, results[count].fastest, b->unit);
+		count++;
+	}
+
+	if (json_path)
+	{
+		FILE *out = fopen(json_path, "w");
+		if (!out)
+		{
+			fprintf(stderr, "%s: can't open\n", json_path);
+			return 1;
+		}
+		bench_write_json_(out, results, count, reps);
+		if (fclose(out) != 0)
+		{
+			fprintf(stderr, "%s: can't write\n", json_path);
+			return 1;
+		}
+	}
+
+	free(times);
+	return 0;
+}
@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "system.h"
+#include "cartridge.h"
+#include "savestate.h"
+#include "replay.h"
+#include "block_cache.h"
+#include "cpu_jit.h"
+
+/*
+ * Headless replay of a recorded input stream
+ *
+ *     pilot_replay [-c] [-n cycles] [-o out.state] rom.bin start.state stream.bin
+ *
+ * Loads the cartridge and the savestate the recording started from, and runs with the stream fed back (see
+ * replay.h) until it has all been read, or for the given number of cycles. The engine is the one in the savestate;
+ * -c turns on the block cache. Prints the emulated cycles, host time and emulated MHz, and with -o writes the final
+ * savestate, for comparing runs between builds and machines.
+ * The exit status is 1 if the replay went off course, or stopped short of the end of the stream.
+ */
+
+#define REPLAY_SLICE_CYCLES (1 << 20)
+#define REPLAY_JIT_CACHE_SIZE (1 << 22)
+
+static uint8_t *
+replay_read_file_ (const char *path, size_t *size)
+{
+	FILE *in = fopen(path, "rb");
+	uint8_t *data = NULL;
+	long length;
+
+	if (!in)
+	{
+		return NULL;
+	}
+	if (fseek(in, 0, SEEK_END) == 0 && (length = ftell(in)) >= 0 && fseek(in, 0, SEEK_SET) == 0)
+	{
+		data = malloc(length ? length : 1);
+		if (data && fread(data, 1, length, in) != (size_t)length)
+		{
+			free(data);
+			data = NULL;
+		}
+		*size = length;
+	}
+	fclose(in);
+	return data;
+}
+
+static double
+replay_now_ (void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int
+main (int argc, char **argv)
+{
+	Pilot_system *sys;
+	const char *out_path = NULL;
+	bool cache = FALSE;
+	uint64_t cycles = 0;
+	uint8_t *state;
+	uint8_t *stream;
+	size_t state_size, stream_size;
+	Pilot_run_status status = PILOT_RUN_DONE;
+	Pilot_replay_stats stats;
+	uint64_t start_cycles, ran;
+	double start, elapsed;
+	int first = 1;
+
+	while (first < argc && argv[first][0] == '-')
+	{
+		if (!strcmp(argv[first], "-c"))
+		{
+			cache = TRUE;
+		}
+		else if (!strcmp(argv[first], "-n") && first + 1 < argc)
+		{
+			cycles = strtoull(argv[++first], NULL, 0);
+		}
+		else if (!strcmp(argv[first], "-o") && first + 1 < argc)
+		{
+			out_path = argv[++first];
+		}
+		else
+		{
+			break;
+		}
+		first++;
+	}
+	if (argc - first != 3)
+	{
+		fprintf(stderr, "usage: %s [-c] [-n cycles] [-o out.state] rom.bin start.state stream.bin\n", argv[0]);
+		return 2;
+	}
+
+	sys = Pilot_system_create();
+	if (!sys)
+	{
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	if (!Pilot_cart_load(sys, argv[first]))
+	{
+		fprintf(stderr, "%s: can't load\n", argv[first]);
+		return 1;
+	}
+	state = replay_read_file_(argv[first + 1], &state_size);
+	if (!state || !Pilot_savestate_load(sys, state, state_size))
+	{
+		fprintf(stderr, "%s: not a savestate of this build\n", argv[first + 1]);
+		return 1;
+	}
+	stream = replay_read_file_(argv[first + 2], &stream_size);
+	if (!stream || !Pilot_replay_play(sys, stream, stream_size))
+	{
+		fprintf(stderr, "%s: not a replay stream\n", argv[first + 2]);
+		return 1;
+	}
+	if (sys->engine == PILOT_ENGINE_JIT && !Pilot_jit_enable(sys, REPLAY_JIT_CACHE_SIZE))
+	{
+		fprintf(stderr, "can't enable the JIT\n");
+		return 1;
+	}
+	if (cache && !sys->block_cache && !Pilot_block_cache_enable(sys, 4096))
+	{
+		fprintf(stderr, "can't enable the block cache\n");
+		return 1;
+	}
+
+	start_cycles = sys->cycles;
+	start = replay_now_();
+	if (cycles)
+	{
+		status = Pilot_run_cycles(sys, cycles);
+	}
+	else
+	{
+		stats = Pilot_replay_get_stats(sys);
+		while (status == PILOT_RUN_DONE && !stats.finished && !stats.desynced)
+		{
+			status = Pilot_run_cycles(sys, REPLAY_SLICE_CYCLES);
+			stats = Pilot_replay_get_stats(sys);
+		}
+	}
+	elapsed = replay_now_() - start;
+	ran = sys->cycles - start_cycles;
+	stats = Pilot_replay_get_stats(sys);
+
+	printf("%llu cycles in %.3f s, %.2f MHz\n", (unsigned long long)ran, elapsed,
+		elapsed > 0 ? ran / elapsed / 1e6 : 0.0);
+	printf("%llu reads replayed, %llu late%s%s\n", (unsigned long long)stats.reads,
+		(unsigned long long)stats.late_reads, stats.desynced ? ", desynced" : "",
+		stats.finished ? "" : ", stream not finished");
+	if (status != PILOT_RUN_DONE)
+	{
+		printf("run stopped early (status %d) at pgc %06x\n", status, sys->core.pgc);
+	}
+
+	if (out_path)
+	{
+		FILE *out = fopen(out_path, "wb");
+		size_t size = Pilot_savestate_size();
+		uint8_t *buf = malloc(size);
+		bool ok = out && buf;
+
+		if (ok)
+		{
+			Pilot_savestate_save(sys, buf);
+			ok = fwrite(buf, 1, size, out) == size;
+		}
+		if (out && fclose(out) != 0)
+		{
+			ok = FALSE;
+		}
+		free(buf);
+		if (!ok)
+		{
+			fprintf(stderr, "%s: can't write\n", out_path);
+			return 1;
+		}
+	}
+
+	free(state);
+	free(stream);
+	Pilot_system_destroy(sys);
+	return (stats.desynced || !stats.finished) ? 1 : 0;
+}
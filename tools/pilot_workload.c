@@ -0,0 +1,792 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "system.h"
+#include "memory.h"
+#include "block_cache.h"
+#include "cpu_decode.h"
+#include "cpu_execute.h"
+#include "cpu_jit.h"
+
+/*
+ * Workload benchmarks: hand-assembled Pilot programs run headless on each engine
+ *
+ *     pilot-workload [-r reps] [-j out.json] [-b baseline.json] [-t percent] [prefix ...]
+ *
+ * Each program is straight-line code at the bottom of VRAM; there are no branches to loop with yet, so every run
+ * starts over from the top on a reset pipeline. The pipeline is run to a breakpoint at the end of the program once, to
+ * find how many cycles it takes, and from then on every engine runs exactly that many cycles with no breakpoints set:
+ * the JIT leaves any run with breakpoints to the interpreter. A batch is WL_BATCH runs. After a warm-up
+ * batch, reps more (5 by default) are timed, and the median is reported as emulated MHz, host ns per emulated cycle
+ * and emulated instructions per second.
+ *
+ * Before timing, every engine's memory and registers after one run are checked against the pipeline's, which is the
+ * reference. With -b, each result is compared against the same benchmark in an earlier -j file, and the exit status
+ * is 1 if ns per cycle went up by more than the threshold (10% by default).
+ */
+
+#define WL_REPS_DEFAULT 5
+#define WL_THRESHOLD_DEFAULT 10.0
+#define WL_BATCH 64
+// Far more than any program takes; the measuring run didn't reach its breakpoint if it gets here
+#define WL_CYCLES_MAX 10000000
+// Stray writes from addressing modes the decoder doesn't finish yet land low in WRAM, so code lives in VRAM
+#define WL_CODE_START VRAM_START
+#define WL_CODE_WORDS 0x3000
+// Bodies repeat until they fill the code area; no pass through one takes more words than this
+#define WL_PASS_WORDS_MAX 256
+
+// Data for the LD chains; every address they form lands in here
+#define WL_LD_DATA 0x004000
+#define WL_LD_DATA_SIZE 0x4000
+// The copy goes from the bottom half of WRAM to the top half
+#define WL_COPY_SRC (WRAM_START + 0x1000)
+#define WL_COPY_DEST (WRAM_START + 0x4000)
+#define WL_COPY_WORDS 0x1800
+
+typedef struct
+{
+	uint16_t words[WL_CODE_WORDS];
+	uint32_t count;
+	bool overflow;
+	bool bad_encoding;
+} wl_program;
+
+typedef struct workload workload;
+struct workload
+{
+	const char *name;
+	// Assembles the program, and sets up memory it reads
+	void (*build) (wl_program *p, Pilot_system *sys);
+	// Registers at the start of each run. LD.P and LDQ don't load their immediates yet, so programs can't set them up
+	// themselves.
+	uint32_t regs[8];
+	// Opt-in memory controller fast path
+	bool direct_ram;
+};
+
+typedef struct
+{
+	const char *name;
+	Pilot_engine engine;
+	bool cache;
+} wl_engine;
+
+// What the other engines are checked against, from the pipeline's runs
+typedef struct
+{
+	// Cycles the pipeline takes over the program; see wl_run_
+	uint64_t cycles;
+	uint64_t hash;
+} wl_reference;
+
+typedef struct
+{
+	const workload *w;
+	const wl_engine *e;
+	uint64_t cycles;
+	uint64_t insts;
+	double ns_per_cycle;
+} wl_result;
+
+static uint64_t
+wl_now_ns_ (void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static int
+wl_compare_ (const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+/*
+ * Assembler
+ *
+ * Encodings follow cpu_decode.c. Every instruction is checked against its decode template, so a program that
+ * doesn't decode the way it was written fails setup instead of timing something else.
+ */
+
+enum
+{
+	WL_SIZE_8 = 0,
+	WL_SIZE_16,
+	WL_SIZE_24
+};
+
+// Operations of decode_inst_arithlogic_
+enum
+{
+	WL_ADD = 0,
+	WL_ADX,
+	WL_SUB,
+	WL_SBX,
+	WL_AND,
+	WL_XOR,
+	WL_OR,
+	WL_CP,
+	WL_IMM = 15
+};
+
+// RM specifiers; see decode_rm_specifier
+#define WL_RM_REG(r)     ((r) << 2)
+#define WL_RM_SFI(n)     (0x03 | ((n) << 2))
+#define WL_RM_IND(r)     (0x02 | ((r) << 2))
+#define WL_RM_POSTINC(r) (0x20 | ((r) << 2))
+#define WL_RM_PREDEC(r)  (0x22 | ((r) << 2))
+#define WL_RM_REL(r)     (0x01 | ((r) << 2))
+#define WL_RM_ABS16      0x29
+#define WL_RM_ABS24      0x2d
+#define WL_RM_IMM16      0x21
+#define WL_RM_IMM24      0x25
+#define WL_RM_PGC16      0x31
+#define WL_RM_PGC24      0x35
+#define WL_RM_INDEXED    0x39
+#define WL_RM_ABS_INDEXED 0x3d
+
+// Extension word of a register indexed operand: base + index register, the index taken at a size
+#define WL_INDEX_WORD(base, index, size) (((size) << 14) | ((index) << 8) | ((base) << 2))
+
+static uint32_t
+wl_addr_ (const wl_program *p)
+{
+	return WL_CODE_START + p->count * 2;
+}
+
+static void
+wl_emit_ (wl_program *p, uint16_t op, int extra, uint16_t w1, uint16_t w2)
+{
+	const decode_template *t = pilot_decode_template(op);
+	if (t->status != DECODE_OK || t->extra_words > 2)
+	{
+		p->bad_encoding = TRUE;
+		return;
+	}
+	// The decoder fetches fewer words than written for modes it doesn't finish yet (absolute, register relative); the
+	// stream follows the decoder, so the next instruction starts where it'll be looked for
+	if (extra < t->extra_words)
+	{
+		p->bad_encoding = TRUE;
+		return;
+	}
+	if (p->count + 1 + t->extra_words > WL_CODE_WORDS)
+	{
+		p->overflow = TRUE;
+		return;
+	}
+	p->words[p->count++] = op;
+	if (t->extra_words > 0)
+	{
+		p->words[p->count++] = w1;
+	}
+	if (t->extra_words > 1)
+	{
+		p->words[p->count++] = w2;
+	}
+}
+
+// Arithmetic/logic: r = r op rm
+static void
+wl_alu_ (wl_program *p, int size, int operation, int reg, int rm, int extra, uint16_t w1, uint16_t w2)
+{
+	uint16_t op = (size << 14) | 0x2000 | ((operation >> 2) << 11) | ((operation & 3) << 6) | (reg << 8) | rm;
+	wl_emit_(p, op, extra, w1, w2);
+}
+
+// Arithmetic/logic with an immediate word: rm = rm op imm
+static void
+wl_alu_imm_ (wl_program *p, int size, int operation, int rm, uint16_t imm)
+{
+	uint16_t op = (size << 14) | 0x2000 | ((WL_IMM >> 2) << 11) | ((WL_IMM & 3) << 6) | (operation << 8) | rm;
+	wl_emit_(p, op, 1, imm, 0);
+}
+
+// LD: dest rm = src rm. Extension words of both operands follow, source first.
+static void
+wl_ld_ (wl_program *p, int size, int dest, int src, int extra, uint16_t w1, uint16_t w2)
+{
+	wl_emit_(p, (size << 14) | 0x1000 | (dest << 6) | src, extra, w1, w2);
+}
+
+// Displacement from the instruction being assembled to addr, for the PGC relative modes
+static uint32_t
+wl_pgc_disp_ (const wl_program *p, uint32_t addr)
+{
+	return (addr - wl_addr_(p)) & 0xffffff;
+}
+
+/*
+ * Programs
+ */
+
+// ALU-heavy: every operation at every size, against registers, short-form immediates and immediate words
+static void
+wl_build_alu_ (wl_program *p, Pilot_system *sys)
+{
+	int reg;
+	int size;
+	int operation;
+
+	(void)sys;
+	while (!p->overflow && !p->bad_encoding && p->count < WL_CODE_WORDS - WL_PASS_WORDS_MAX)
+	{
+		for (size = WL_SIZE_8; size <= WL_SIZE_24; size++)
+		{
+			for (operation = WL_ADD; operation <= WL_CP; operation++)
+			{
+				reg = (p->count + operation) & 7;
+				wl_alu_(p, size, operation, reg, WL_RM_REG((reg + 3) & 7), 0, 0, 0);
+				wl_alu_(p, size, operation, (reg + 1) & 7, WL_RM_SFI((operation * 5 + size) & 0xf), 0, 0, 0);
+				wl_alu_imm_(p, size, operation, WL_RM_REG((reg + 2) & 7), 0x1234 + operation * 0x0f0f);
+			}
+		}
+	}
+}
+
+// LD chains through every addressing mode of decode_rm_specifier, as a source and, where it can be, as a destination.
+// r0-r3 point into the data area and only move in matched pairs; r4 is the index register; r5-r7 carry data.
+// Register relative isn't used as a destination: its displacement word isn't fetched yet, so it writes wherever the
+// code around it happens to point, the program included.
+static void
+wl_build_ld_rm_ (wl_program *p, Pilot_system *sys)
+{
+	uint32_t i;
+	int size;
+
+	for (i = 0; i < WL_LD_DATA_SIZE; i++)
+	{
+		sys->wram[WL_LD_DATA - WRAM_START + i] = (uint8_t)(i * 7 + 1);
+	}
+
+	while (!p->overflow && !p->bad_encoding && p->count < WL_CODE_WORDS - WL_PASS_WORDS_MAX)
+	{
+		for (size = WL_SIZE_8; size <= WL_SIZE_24; size++)
+		{
+			uint32_t target = WL_LD_DATA + 0x400 + (p->count & 0x3fe);
+			uint32_t disp;
+			int data = 5 + size;
+
+			// Memory destinations are written wherever the access before them went, and PGC relative operands go to
+			// the code, so those all come first, with reads of the data area between them and any destination;
+			// otherwise destinations would write to code pages and throw out the blocks cached from them
+			disp = wl_pgc_disp_(p, target);
+			wl_ld_(p, size, WL_RM_REG(data), WL_RM_PGC16, 1, disp & 0xffff, 0);
+			disp = wl_pgc_disp_(p, target);
+			wl_ld_(p, size, WL_RM_REG(data), WL_RM_PGC24, 2, disp & 0xffff, disp >> 16);
+			disp = wl_pgc_disp_(p, target);
+			wl_ld_(p, size, WL_RM_PGC16, WL_RM_REG(data), 1, disp & 0xffff, 0);
+
+			// Sources
+			wl_ld_(p, size, WL_RM_REG(data), WL_RM_REG(5 + (size + 1) % 3), 0, 0, 0);
+			wl_ld_(p, size, WL_RM_REG(data), WL_RM_SFI(size + 1), 0, 0, 0);
+			wl_ld_(p, size, WL_RM_REG(data), WL_RM_IND(0), 0, 0, 0);
+			wl_ld_(p, size, WL_RM_REG(data), WL_RM_POSTINC(1), 0, 0, 0);
+			wl_ld_(p, size, WL_RM_REG(data), WL_RM_PREDEC(1), 0, 0, 0);
+			wl_ld_(p, size, WL_RM_REG(data), WL_RM_REL(2), 0, 0, 0);
+			wl_ld_(p, size, WL_RM_REG(data), WL_RM_INDEXED, 1, WL_INDEX_WORD(3, 4, WL_SIZE_8), 0);
+			wl_ld_(p, size, WL_RM_REG(data), WL_RM_ABS_INDEXED, 2, target & 0xffff,
+				WL_INDEX_WORD(0, 4, WL_SIZE_16) | (target >> 16));
+			wl_ld_(p, size, WL_RM_REG(data), WL_RM_ABS16, 0, 0, 0);
+			wl_ld_(p, size, WL_RM_REG(data), WL_RM_ABS24, 0, 0, 0);
+			wl_ld_(p, size, WL_RM_REG(data), WL_RM_IMM16, 0, 0, 0);
+			wl_ld_(p, size, WL_RM_REG(data), WL_RM_IMM24, 0, 0, 0);
+
+			// Destinations
+			wl_ld_(p, size, WL_RM_IND(0), WL_RM_REG(data), 0, 0, 0);
+			wl_ld_(p, size, WL_RM_POSTINC(1), WL_RM_REG(data), 0, 0, 0);
+			wl_ld_(p, size, WL_RM_PREDEC(1), WL_RM_REG(data), 0, 0, 0);
+			wl_ld_(p, size, WL_RM_INDEXED, WL_RM_REG(data), 1, WL_INDEX_WORD(3, 4, WL_SIZE_8), 0);
+
+			// Memory to memory
+			wl_ld_(p, size, WL_RM_IND(0), WL_RM_POSTINC(1), 0, 0, 0);
+			wl_ld_(p, size, WL_RM_PREDEC(1), WL_RM_IND(2), 0, 0, 0);
+		}
+	}
+}
+
+// Memory-bound: a block copy of word moves between post-incremented pointers, every access going through the
+// memory controller
+static void
+wl_build_copy_ (wl_program *p, Pilot_system *sys)
+{
+	uint32_t i;
+	uint16_t op = (WL_SIZE_16 << 14) | 0x1000 | (WL_RM_POSTINC(1) << 6) | WL_RM_POSTINC(0);
+
+	for (i = 0; i < WL_COPY_WORDS * 2; i++)
+	{
+		sys->wram[WL_COPY_SRC - WRAM_START + i] = (uint8_t)(i * 13 + 5);
+	}
+	for (i = 0; i < WL_COPY_WORDS; i++)
+	{
+		wl_emit_(p, op, 0, 0, 0);
+	}
+}
+
+static const workload workloads_[] =
+{
+	{ "alu", wl_build_alu_, { 0x000003, 0x000014, 0x000025, 0x000036, 0x000047, 0x000058, 0x123456, 0xfedcba }, FALSE },
+	{ "ld_rm", wl_build_ld_rm_,
+		{ WL_LD_DATA + 0x0800, WL_LD_DATA + 0x1800, WL_LD_DATA + 0x2800, WL_LD_DATA + 0x3800, 0x20 }, FALSE },
+	{ "copy", wl_build_copy_, { WL_COPY_SRC, WL_COPY_DEST }, FALSE },
+	{ "copy_direct", wl_build_copy_, { WL_COPY_SRC, WL_COPY_DEST }, TRUE },
+};
+
+// The pipeline comes first, as the reference the others are checked against
+static const wl_engine engines_[] =
+{
+	{ "pipeline", PILOT_ENGINE_PIPELINE, FALSE },
+	{ "interp", PILOT_ENGINE_INTERP, FALSE },
+	{ "interp_cached", PILOT_ENGINE_INTERP, TRUE },
+	{ "jit", PILOT_ENGINE_JIT, TRUE },
+};
+
+#define WL_WORKLOADS (sizeof(workloads_) / sizeof(workloads_[0]))
+#define WL_ENGINES (sizeof(engines_) / sizeof(engines_[0]))
+
+/*
+ * Running
+ */
+
+static bool
+wl_setup_ (Pilot_system *sys, const workload *w, const wl_engine *e, uint32_t *end)
+{
+	static wl_program p;
+	uint32_t i;
+
+	memset(&p, 0, sizeof(p));
+	Pilot_system_reset(sys);
+	w->build(&p, sys);
+	if (p.overflow || p.bad_encoding)
+	{
+		fprintf(stderr, "%s: program doesn't assemble\n", w->name);
+		return FALSE;
+	}
+	for (i = 0; i < p.count; i++)
+	{
+		sys->vram[WL_CODE_START - VRAM_START + i * 2] = p.words[i] & 0xff;
+		sys->vram[WL_CODE_START - VRAM_START + i * 2 + 1] = p.words[i] >> 8;
+	}
+	*end = wl_addr_(&p);
+	sys->memctl.direct_ram = w->direct_ram;
+
+	if (e->engine == PILOT_ENGINE_JIT)
+	{
+		if (!Pilot_jit_enable(sys, 1 << 22))
+		{
+			return FALSE;
+		}
+	}
+	else if (e->cache && !Pilot_block_cache_enable(sys, 4096))
+	{
+		return FALSE;
+	}
+	return TRUE;
+}
+
+// Puts the program back at the top, on the given engine
+static void
+wl_restart_ (Pilot_system *sys, const workload *w, Pilot_engine engine)
+{
+	int i;
+
+	// Passing through the interpreter is the way to repoint the pipeline's fetch
+	Pilot_set_engine(sys, PILOT_ENGINE_INTERP);
+	Pilot_system_reset(sys);
+	sys->core.pgc = WL_CODE_START;
+	for (i = 0; i < 8; i++)
+	{
+		sys->core.regs[i] = w->regs[i];
+	}
+	sys->core.wf = 0;
+	Pilot_set_engine(sys, engine);
+}
+
+// Runs the pipeline to a breakpoint at the end of the program, on a system of its own, for the number of cycles it
+// takes over the program. Returns FALSE if it didn't get there.
+static bool
+wl_measure_ (const workload *w, uint64_t *pipeline_cycles)
+{
+	Pilot_system *sys = Pilot_system_create();
+	Pilot_run_status status;
+	uint64_t start;
+	uint32_t end;
+	bool reached;
+
+	if (!sys)
+	{
+		return FALSE;
+	}
+	if (!wl_setup_(sys, w, &engines_[0], &end) || !Pilot_breakpoint_add(sys, end))
+	{
+		Pilot_system_destroy(sys);
+		return FALSE;
+	}
+	wl_restart_(sys, w, PILOT_ENGINE_PIPELINE);
+	start = sys->cycles;
+	status = Pilot_run_cycles(sys, WL_CYCLES_MAX);
+	reached = (status == PILOT_RUN_BREAKPOINT && sys->core.pgc == end);
+	*pipeline_cycles = sys->cycles - start;
+	Pilot_system_destroy(sys);
+	return reached;
+}
+
+/*
+ * Runs the program once from the top, for as many cycles as it takes; returns FALSE if it didn't end up at the end.
+ *
+ * The pipeline finishes an instruction's last memory access on the cycle its sequencer takes up the next one, which
+ * the instruction-level engines don't have, so they take one cycle less. Nothing past the end of the program decodes,
+ * so the JIT's last block ends there, and it can't overshoot.
+ */
+static bool
+wl_run_ (Pilot_system *sys, const workload *w, const wl_engine *e, uint32_t end, uint64_t pipeline_cycles,
+	uint64_t *cycles, uint64_t *insts)
+{
+	bool pipeline = (e->engine == PILOT_ENGINE_PIPELINE);
+	uint64_t n = pipeline ? pipeline_cycles : pipeline_cycles - 1;
+	uint64_t start, insts_taken;
+	Pilot_run_status status;
+
+	wl_restart_(sys, w, e->engine);
+	start = sys->cycles;
+	insts_taken = sys->execute.insts_taken;
+	status = Pilot_run_cycles(sys, n);
+	*cycles += sys->cycles - start;
+	*insts += sys->execute.insts_taken - insts_taken;
+	// The pipeline's PGC is that of the last instruction it took up
+	return status == PILOT_RUN_DONE && sys->cycles - start == n && (pipeline || sys->core.pgc == end);
+}
+
+// FNV-1a over what a program can change
+static uint64_t
+wl_hash_ (uint64_t hash, const void *data, size_t size)
+{
+	const uint8_t *bytes = data;
+	size_t i;
+	for (i = 0; i < size; i++)
+	{
+		hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+	}
+	return hash;
+}
+
+static uint64_t
+wl_state_hash_ (Pilot_system *sys)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+	pilot_execute_materialize_flags(&sys->core);
+	hash = wl_hash_(hash, sys->core.regs, sizeof(sys->core.regs));
+	hash = wl_hash_(hash, &sys->core.wf, sizeof(sys->core.wf));
+	hash = wl_hash_(hash, sys->wram, sizeof(sys->wram));
+	hash = wl_hash_(hash, sys->vram, sizeof(sys->vram));
+	return hash;
+}
+
+// Returns -1 if the engine can't run here, 0 if the run failed or disagreed with the reference, 1 if it's timed
+static int
+wl_bench_ (const workload *w, const wl_engine *e, int reps, double *times, wl_reference *reference, wl_result *result)
+{
+	Pilot_system *sys = Pilot_system_create();
+	uint64_t cycles = 0;
+	uint64_t insts = 0;
+	static uint8_t code[WL_CODE_WORDS * 2];
+	uint64_t hash;
+	uint32_t end;
+	int i;
+	int j;
+
+	if (!sys)
+	{
+		return -1;
+	}
+	if (!wl_setup_(sys, w, e, &end))
+	{
+		Pilot_system_destroy(sys);
+		return -1;
+	}
+	memcpy(code, &sys->vram[WL_CODE_START - VRAM_START], end - WL_CODE_START);
+	if (e == &engines_[0] && !wl_measure_(w, &reference->cycles))
+	{
+		fprintf(stderr, "%s: didn't reach the end of the program\n", w->name);
+		Pilot_system_destroy(sys);
+		return 0;
+	}
+
+	// Checked on the first run, while memory is as the program found it
+	if (!wl_run_(sys, w, e, end, reference->cycles, &cycles, &insts))
+	{
+		fprintf(stderr, "%s/%s: didn't reach the end of the program\n", w->name, e->name);
+		Pilot_system_destroy(sys);
+		return 0;
+	}
+	// The engines needn't agree on code that changes under them
+	if (memcmp(code, &sys->vram[WL_CODE_START - VRAM_START], end - WL_CODE_START))
+	{
+		fprintf(stderr, "%s/%s: program overwrote itself\n", w->name, e->name);
+		Pilot_system_destroy(sys);
+		return 0;
+	}
+	hash = wl_state_hash_(sys);
+	if (e == &engines_[0])
+	{
+		reference->hash = hash;
+	}
+	else if (hash != reference->hash)
+	{
+		fprintf(stderr, "%s/%s: state differs from the pipeline's\n", w->name, e->name);
+		Pilot_system_destroy(sys);
+		return 0;
+	}
+	// Anything the JIT can't translate it runs through the interpreter, which would be timed in its place
+	if (e->engine == PILOT_ENGINE_JIT && !Pilot_jit_get_stats(sys).entries)
+	{
+		fprintf(stderr, "%s/%s: nothing ran translated\n", w->name, e->name);
+		Pilot_system_destroy(sys);
+		return 0;
+	}
+
+	for (i = 0; i < WL_BATCH; i++)
+	{
+		wl_run_(sys, w, e, end, reference->cycles, &cycles, &insts);
+	}
+	for (j = 0; j < reps; j++)
+	{
+		uint64_t start;
+		cycles = 0;
+		insts = 0;
+		start = wl_now_ns_();
+		for (i = 0; i < WL_BATCH; i++)
+		{
+			wl_run_(sys, w, e, end, reference->cycles, &cycles, &insts);
+		}
+		times[j] = (double)(wl_now_ns_() - start) / (cycles ? cycles : 1);
+	}
+	qsort(times, reps, sizeof(*times), wl_compare_);
+	result->w = w;
+	result->e = e;
+	result->cycles = cycles;
+	result->insts = insts;
+	result->ns_per_cycle = times[reps / 2];
+
+	Pilot_system_destroy(sys);
+	return 1;
+}
+
+static bool
+wl_selected_ (const char *name, int argc, char **argv, int first)
+{
+	int i;
+	if (first >= argc)
+	{
+		return TRUE;
+	}
+	for (i = first; i < argc; i++)
+	{
+		if (!strncmp(name, argv[i], strlen(argv[i])))
+		{
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+static double
+wl_mhz_ (const wl_result *r)
+{
+	return 1000.0 / r->ns_per_cycle;
+}
+
+static double
+wl_insts_per_sec_ (const wl_result *r)
+{
+	return r->cycles ? 1e9 * r->insts / (r->ns_per_cycle * r->cycles) : 0.0;
+}
+
+static void
+wl_write_json_ (FILE *out, const wl_result *results, int count, int reps)
+{
+	int i;
+	fprintf(out, "{\n\t\"reps\": %d,\n\t\"workloads\": [\n", reps);
+	for (i = 0; i < count; i++)
+	{
+		const wl_result *r = &results[i];
+		fprintf(out, "\t\t{ \"name\": \"%s/%s\", \"cycles\": %llu, \"insts\": %llu, \"ns_per_cycle\": %.3f, "
+			"\"mhz\": %.3f, \"insts_per_sec\": %.0f }%s\n", r->w->name, r->e->name, (unsigned long long)r->cycles,
+			(unsigned long long)r->insts, r->ns_per_cycle, wl_mhz_(r), wl_insts_per_sec_(r),
+			(i + 1 < count) ? "," : "");
+	}
+	fprintf(out, "\t]\n}\n");
+}
+
+// Looks a result up in a file written by wl_write_json_, which has one workload per line. Returns a negative number
+// if it isn't there.
+static double
+wl_baseline_ (FILE *baseline, const char *name)
+{
+	char line[512];
+	char key[128];
+	double ns_per_cycle;
+	const char *field;
+
+	rewind(baseline);
+	while (fgets(line, sizeof(line), baseline))
+	{
+		field = strstr(line, "\"name\": \"");
+		if (!field || sscanf(field, "\"name\": \"%127[^\"]\"", key) != 1 || strcmp(key, name))
+		{
+			continue;
+		}
+		field = strstr(line, "\"ns_per_cycle\": ");
+		if (field && sscanf(field, "\"ns_per_cycle\": %lf", &ns_per_cycle) == 1)
+		{
+			return ns_per_cycle;
+		}
+	}
+	return -1.0;
+}
+
+int
+main (int argc, char **argv)
+{
+	wl_result results[WL_WORKLOADS * WL_ENGINES];
+	wl_reference reference = { 0, 0 };
+	const char *json_path = NULL;
+	const char *baseline_path = NULL;
+	FILE *baseline = NULL;
+	double threshold = WL_THRESHOLD_DEFAULT;
+	int reps = WL_REPS_DEFAULT;
+	double *times;
+	int count = 0;
+	int failed = 0;
+	int first = 1;
+	size_t i;
+	size_t j;
+
+	while (first < argc && argv[first][0] == '-')
+	{
+		if (!strcmp(argv[first], "-r") && first + 1 < argc)
+		{
+			reps = atoi(argv[first + 1]);
+		}
+		else if (!strcmp(argv[first], "-j") && first + 1 < argc)
+		{
+			json_path = argv[first + 1];
+		}
+		else if (!strcmp(argv[first], "-b") && first + 1 < argc)
+		{
+			baseline_path = argv[first + 1];
+		}
+		else if (!strcmp(argv[first], "-t") && first + 1 < argc)
+		{
+			threshold = atof(argv[first + 1]);
+		}
+		else
+		{
+			fprintf(stderr, "usage: %s [-r reps] [-j out.json] [-b baseline.json] [-t percent] [prefix ...]\n",
+				argv[0]);
+			return 2;
+		}
+		first += 2;
+	}
+	if (reps < 1)
+	{
+		reps = 1;
+	}
+	if (baseline_path)
+	{
+		baseline = fopen(baseline_path, "r");
+		if (!baseline)
+		{
+			fprintf(stderr, "%s: can't open\n", baseline_path);
+			return 1;
+		}
+	}
+	times = calloc(reps, sizeof(*times));
+	if (!times)
+	{
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	printf("%-26s %10s %12s %14s %10s\n", "workload", "MHz", "ns/cycle", "insts/s", "baseline");
+	for (i = 0; i < WL_WORKLOADS; i++)
+	{
+		const workload *w = &workloads_[i];
+		for (j = 0; j < WL_ENGINES; j++)
+		{
+			const wl_engine *e = &engines_[j];
+			char name[128];
+			wl_result *r = &results[count];
+			double base;
+			int status;
+
+			snprintf(name, sizeof(name), "%s/%s", w->name, e->name);
+			// The pipeline always runs, to check the others against
+			if (j && !wl_selected_(name, argc, argv, first))
+			{
+				continue;
+			}
+			status = wl_bench_(w, e, reps, times, &reference, r);
+			if (status < 0)
+			{
+				printf("%-26s %10s\n", name, "skipped");
+				continue;
+			}
+			if (status == 0)
+			{
+				failed = 1;
+				if (!j)
+				{
+					break;
+				}
+				continue;
+			}
+			if (!wl_selected_(name, argc, argv, first))
+			{
+				continue;
+			}
+			printf("%-26s %10.3f %12.3f %14.0f", name, wl_mhz_(r), r->ns_per_cycle, wl_insts_per_sec_(r));
+			base = baseline ? wl_baseline_(baseline, name) : -1.0;
+			if (base > 0.0)
+			{
+				double change = 100.0 * (r->ns_per_cycle - base) / base;
+				printf(" %+9.1f%%", change);
+				if (change > threshold)
+				{
+					printf("  regressed");
+					failed = 1;
+				}
+			}
+			printf("\n");
+			count++;
+		}
+	}
+	if (baseline)
+	{
+		fclose(baseline);
+	}
+
+	if (json_path)
+	{
+		FILE *out = fopen(json_path, "w");
+		if (!out)
+		{
+			fprintf(stderr, "%s: can't open\n", json_path);
+			return 1;
+		}
+		wl_write_json_(out, results, count, reps);
+		if (fclose(out) != 0)
+		{
+			fprintf(stderr, "%s: can't write\n", json_path);
+			return 1;
+		}
+	}
+
+	free(times);
+	return failed;
+}